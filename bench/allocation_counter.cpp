@@ -0,0 +1,34 @@
+#include "bench.hpp"
+#include <cstdlib>
+#include <new>
+
+/* Replaces the global operator new to count every allocation in the process, OpenAL's included.
+ * The default operator delete frees what these allocate.
+ */
+
+namespace {
+
+std::atomic<std::uint64_t> allocation_count = 0;
+
+void* allocate(std::size_t size, std::size_t alignment) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    size = std::max<std::size_t>(size, 1);
+    void* memory = alignment <= alignof(std::max_align_t) ? std::malloc(size) : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (memory == nullptr)
+        throw std::bad_alloc();
+    return memory;
+}
+
+} // namespace
+
+std::uint64_t kee_bench::get_allocation_count() {
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) {
+    return allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
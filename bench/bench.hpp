@@ -0,0 +1,151 @@
+#pragma once
+#include "test_support.hpp"
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <sstream>
+
+/* Benchmarks run the engine offline (loopback render) wherever they can, so they measure the engine and not
+ * the sound card. Each case returns one JSON object, kee_audio_bench prints them all as one JSON document.
+ */
+
+namespace kee_bench {
+
+class json_object {
+public:
+    json_object& add(const std::string& key, double value) {
+        std::ostringstream text;
+        text.precision(9);
+        text << (std::isfinite(value) ? value : 0.0);
+        return add_raw(key, text.str());
+    }
+
+    json_object& add(const std::string& key, std::uint64_t value) { return add_raw(key, std::to_string(value)); }
+    json_object& add(const std::string& key, int value) { return add_raw(key, std::to_string(value)); }
+    json_object& add(const std::string& key, bool value) { return add_raw(key, value ? "true" : "false"); }
+    json_object& add(const std::string& key, const char* value) {
+        std::string text = "\"";
+        for (const char* c = value; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\')
+                text += '\\';
+            text += static_cast<unsigned char>(*c) < 0x20 ? ' ' : *c;
+        }
+        return add_raw(key, text + "\"");
+    }
+
+    json_object& add(const std::string& key, const std::string& value) { return add(key, value.c_str()); }
+    json_object& add(const std::string& key, const json_object& value) { return add_raw(key, value.str()); }
+
+    json_object& add(const std::string& key, const std::vector<json_object>& values) {
+        std::string text = "[";
+        for (std::size_t i = 0; i < values.size(); i++)
+            text += (i == 0 ? "" : ",") + values[i].str();
+        return add_raw(key, text + "]");
+    }
+
+    std::string str() const { return "{" + fields + "}"; }
+
+private:
+    json_object& add_raw(const std::string& key, const std::string& value) {
+        fields += (fields.empty() ? "\"" : ",\"") + key + "\":" + value;
+        return *this;
+    }
+
+    std::string fields;
+};
+
+class options {
+public:
+    bool is_quick = false;
+    // smaller sizes, fewer iterations, for a smoke run under ctest
+
+    template <typename T>
+    T pick(T full, T quick) const { return is_quick ? quick : full; }
+};
+
+using clock = std::chrono::steady_clock;
+
+inline double elapsed_ns(clock::time_point start, clock::time_point end = clock::now()) {
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+inline json_object summarize(std::vector<double> values) {
+    // nearest rank percentiles
+    json_object summary;
+    summary.add("count", static_cast<std::uint64_t>(values.size()));
+    if (values.empty())
+        return summary;
+
+    std::sort(values.begin(), values.end());
+    const auto percentile = [&values](double fraction) -> double {
+        std::size_t rank = static_cast<std::size_t>(std::ceil(fraction * values.size()));
+        return values[std::clamp<std::size_t>(rank, 1, values.size()) - 1];
+    };
+    double total = 0.0;
+    for (double value : values)
+        total += value;
+    return summary.add("mean", total / values.size())
+        .add("p50", percentile(0.5))
+        .add("p99", percentile(0.99))
+        .add("max", values.back());
+}
+
+inline json_object summarize(const audio::engine::latency_histogram& histogram) {
+    // percentiles are the upper bound of the bucket they fall in
+    json_object summary;
+    summary.add("count", histogram.count);
+    if (histogram.count == 0)
+        return summary;
+
+    const auto percentile = [&histogram](double fraction) -> double {
+        std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(fraction * histogram.count));
+        std::uint64_t seen = 0;
+        for (std::size_t bucket = 0; bucket < histogram.buckets.size(); bucket++) {
+            seen += histogram.buckets[bucket];
+            if (seen >= rank)
+                return bucket + 1 == histogram.buckets.size() ? static_cast<double>(histogram.max_ns) : std::min(std::ldexp(1.0, 10 + static_cast<int>(bucket)), static_cast<double>(histogram.max_ns));
+        }
+        return static_cast<double>(histogram.max_ns);
+    };
+    return summary.add("mean_ns", static_cast<double>(histogram.total_ns) / histogram.count)
+        .add("p50_ns_bound", percentile(0.5))
+        .add("p99_ns_bound", percentile(0.99))
+        .add("max_ns", histogram.max_ns);
+}
+
+inline audio::engine::metrics_snapshot read_metrics(const audio::engine& engine) {
+    audio::engine::metrics_snapshot snapshot;
+    engine.get_metrics(snapshot);
+    return snapshot;
+}
+
+inline const char* mixer_name(bool use_software_mixer) {
+    return use_software_mixer ? "software" : "source";
+}
+
+inline double get_process_cpu_seconds() {
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+std::uint64_t get_allocation_count();
+// every operator new in the process so far
+
+class bench_case {
+public:
+    const char* name;
+    std::function<json_object(const options&)> run;
+};
+
+inline std::vector<bench_case>& get_cases() {
+    static std::vector<bench_case> cases;
+    return cases;
+}
+
+class register_case {
+public:
+    register_case(const char* name, std::function<json_object(const options&)> run) {
+        get_cases().push_back({ name, std::move(run) });
+    }
+};
+
+} // namespace kee_bench
@@ -0,0 +1,353 @@
+#include "bench.hpp"
+#include <thread>
+
+/* The engine-wide cases: sfx trigger latency and throughput, music refill and effect cost, startup against asset count,
+ * contention between game threads and underruns while the disk stalls.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+constexpr std::size_t CLICK_FRAMES = 256;
+
+std::vector<std::int16_t> make_click() {
+    // a flat click starts on its first sample, so its onset is the first non-zero output sample
+    return std::vector<std::int16_t>(CLICK_FRAMES, 12000);
+}
+
+std::size_t find_onset(const std::vector<std::int16_t>& samples) {
+    for (std::size_t i = 0; i < samples.size(); i++)
+        if (samples[i] != 0)
+            return i / 2;
+    return samples.size() / 2;
+}
+
+kee_bench::json_object bench_play_sfx_latency(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_latency");
+    assets.add_sfx("click.wav", make_click());
+
+    // rendered in small steps after each trigger, the onset is found to within a step
+    constexpr std::size_t STEP_FRAMES = 16;
+    constexpr std::size_t GAP_FRAMES = 2048;
+    std::size_t trigger_count = options.pick<std::size_t>(1000, 50);
+    kee_bench::json_object result;
+    for (bool use_software_mixer : { false, true }) {
+        audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+        config.use_software_mixer = use_software_mixer;
+        audio::engine engine(config);
+        audio::engine::sfx_id click = engine.lookup_sfx("click.wav");
+
+        std::vector<std::int16_t> samples(GAP_FRAMES * 2);
+        std::vector<double> call_ns;
+        std::vector<double> start_ms;
+        for (std::size_t trigger = 0; trigger < trigger_count; trigger++) {
+            engine.render(samples.data(), GAP_FRAMES);
+            kee_bench::clock::time_point call_start = kee_bench::clock::now();
+            engine.play_sfx(click);
+            call_ns.push_back(kee_bench::elapsed_ns(call_start));
+
+            std::size_t frames = 0;
+            std::vector<std::int16_t> step(STEP_FRAMES * 2);
+            while (frames < GAP_FRAMES) {
+                engine.render(step.data(), STEP_FRAMES);
+                std::size_t onset = find_onset(step);
+                frames += onset;
+                if (onset < STEP_FRAMES)
+                    break;
+            }
+            start_ms.push_back(frames * 1000.0 / SAMPLE_RATE);
+        }
+        result.add(kee_bench::mixer_name(use_software_mixer), kee_bench::json_object()
+            .add("call_ns", kee_bench::summarize(call_ns))
+            .add("trigger_to_start_ms", kee_bench::summarize(start_ms)));
+    }
+    return result;
+}
+kee_bench::register_case play_sfx_latency("play_sfx_latency", bench_play_sfx_latency);
+
+kee_bench::json_object bench_max_triggers(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_triggers");
+    assets.add_sfx("click.wav", make_click());
+
+    /* Each rate triggers evenly over rendered audio. The engine keeps up with a rate while rendering it
+     * takes less cpu time than the audio lasts, the way it would have to on its own thread in real time.
+     */
+    constexpr std::size_t BLOCK_FRAMES = 256;
+    double audio_seconds = options.pick(0.5, 0.1);
+    double max_rate = options.pick(512000.0, 4000.0);
+    kee_bench::json_object result;
+    for (bool use_software_mixer : { false, true }) {
+        audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+        config.use_software_mixer = use_software_mixer;
+        audio::engine engine(config);
+        audio::engine::sfx_id click = engine.lookup_sfx("click.wav");
+
+        std::vector<std::int16_t> samples(BLOCK_FRAMES * 2);
+        std::vector<kee_bench::json_object> rates;
+        double max_sustained_rate = 0.0;
+        for (double rate = 250.0; rate <= max_rate; rate *= 2.0) {
+            std::size_t blocks = static_cast<std::size_t>(audio_seconds * SAMPLE_RATE / BLOCK_FRAMES);
+            double triggers_per_block = rate * BLOCK_FRAMES / SAMPLE_RATE;
+            double pending_triggers = 0.0;
+            audio::engine::sfx_pool_stats stats_before = engine.get_sfx_pool_stats();
+            kee_bench::clock::time_point start = kee_bench::clock::now();
+            for (std::size_t block = 0; block < blocks; block++) {
+                for (pending_triggers += triggers_per_block; pending_triggers >= 1.0; pending_triggers -= 1.0)
+                    engine.play_sfx(click);
+                engine.render(samples.data(), BLOCK_FRAMES);
+            }
+            double real_time_factor = kee_bench::elapsed_ns(start) / 1e9 / (blocks * BLOCK_FRAMES / static_cast<double>(SAMPLE_RATE));
+            audio::engine::sfx_pool_stats stats = engine.get_sfx_pool_stats();
+            bool is_sustained = real_time_factor < 1.0;
+            if (is_sustained)
+                max_sustained_rate = rate;
+            rates.push_back(kee_bench::json_object()
+                .add("triggers_per_second", rate)
+                .add("real_time_factor", real_time_factor)
+                .add("steals", static_cast<std::uint64_t>(stats.steals - stats_before.steals))
+                .add("refusals", static_cast<std::uint64_t>(stats.refusals - stats_before.refusals)));
+            if (!is_sustained)
+                break;
+        }
+        result.add(kee_bench::mixer_name(use_software_mixer), kee_bench::json_object()
+            .add("voice_capacity", static_cast<std::uint64_t>(engine.get_sfx_pool_stats().capacity))
+            .add("max_sustained_triggers_per_second", max_sustained_rate)
+            .add("rates", rates));
+    }
+    return result;
+}
+kee_bench::register_case max_triggers("max_triggers", bench_max_triggers);
+
+kee_bench::json_object bench_refill_cost(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_refill");
+    double music_seconds = options.pick(30.0, 3.0);
+    assets.add_music("song.wav", kee_test::make_noise(static_cast<std::size_t>(music_seconds * SAMPLE_RATE), 2, 1));
+
+    // every buffer read and uploaded is timed by the engine's music_buffer_fill_time
+    kee_bench::json_object result;
+    for (std::size_t buffer_size : { std::size_t(16384), std::size_t(65536), std::size_t(262144) }) {
+        audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+        config.music_buffer_size = buffer_size;
+        audio::engine engine(config);
+        engine.set_player_music("song.wav");
+        engine.play_music_player();
+        engine.reset_metrics();
+        engine.render_wav("song_out.wav", music_seconds - 0.5);
+
+        audio::engine::metrics_snapshot snapshot = kee_bench::read_metrics(engine);
+        const audio::engine::latency_histogram& fills = snapshot.music_buffer_fill_time;
+        double bytes_per_second = fills.total_ns == 0 ? 0.0 : snapshot.bytes_streamed[0] / (fills.total_ns / 1e9);
+        result.add(std::to_string(buffer_size), kee_bench::json_object()
+            .add("block_fill", kee_bench::summarize(fills))
+            .add("refill_pass", kee_bench::summarize(snapshot.music_refill_time))
+            .add("bytes_streamed", snapshot.bytes_streamed[0])
+            .add("fill_mb_per_second", bytes_per_second / 1e6));
+    }
+    return result;
+}
+kee_bench::register_case refill_cost("refill_cost", bench_refill_cost);
+
+kee_bench::json_object bench_effect_cost(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_effect_cost");
+    double music_seconds = options.pick(20.0, 3.0);
+    assets.add_music("song.wav", kee_test::make_noise(static_cast<std::size_t>(music_seconds * SAMPLE_RATE), 2, 1));
+    assets.add_sfx("loop.wav", kee_test::make_noise(SAMPLE_RATE * 30, 2, 2), 2);
+
+    /* Each effect alone on a music player (one block is a music buffer) and on a bus of the software mixer
+     * (one block is a mixer block of 512 frames, 16 voices looping on it), timed by the engine's block metrics.
+     * none is the same render without effects, render_real_time_factor is the whole render over the audio's length.
+     */
+    double rendered_seconds = music_seconds - 1.0;
+    using setup_function = void (*)(audio::engine& engine, audio::engine::bus_id bus);
+    const std::vector<std::pair<const char*, setup_function>> music_effects = {
+        { "none", [](audio::engine&, audio::engine::bus_id) {} },
+        { "low_pass", [](audio::engine& engine, audio::engine::bus_id) { engine.set_player_filter(audio::engine::filter_type::low_pass, 800.0f); } },
+        { "reverb", [](audio::engine& engine, audio::engine::bus_id) { engine.set_player_reverb(0.3f); } },
+        { "tempo", [](audio::engine& engine, audio::engine::bus_id) { engine.set_player_tempo(1.25f); } }
+    };
+    const std::vector<std::pair<const char*, setup_function>> bus_effects = {
+        { "none", [](audio::engine&, audio::engine::bus_id) {} },
+        { "low_pass", [](audio::engine& engine, audio::engine::bus_id bus) { engine.set_bus_filter(bus, audio::engine::filter_type::low_pass, 800.0f); } },
+        { "reverb", [](audio::engine& engine, audio::engine::bus_id bus) { engine.set_bus_reverb(bus, 0.3f); } }
+    };
+
+    const auto measure = [&](bool is_bus, setup_function setup) -> kee_bench::json_object {
+        audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+        config.use_software_mixer = is_bus;
+        config.bus_names = { "music", "hits" };
+        audio::engine engine(config);
+        audio::engine::bus_id hits = engine.lookup_bus("hits");
+        if (is_bus) {
+            for (int voice = 0; voice < 16; voice++)
+                engine.play_sfx("loop.wav", 0.05f, 0.0f, hits);
+        }
+        else {
+            engine.set_player_music("song.wav");
+            engine.play_music_player();
+        }
+        setup(engine, hits);
+        std::vector<std::int16_t> samples(SAMPLE_RATE * 2);
+        engine.render(samples.data(), SAMPLE_RATE / 2);
+        engine.reset_metrics();
+
+        kee_bench::clock::time_point start = kee_bench::clock::now();
+        for (double time = 0.0; time < rendered_seconds; time += 1.0)
+            engine.render(samples.data(), SAMPLE_RATE);
+        double render_ns = kee_bench::elapsed_ns(start);
+        audio::engine::metrics_snapshot snapshot = kee_bench::read_metrics(engine);
+        return kee_bench::json_object()
+            .add("filter_block", kee_bench::summarize(snapshot.filter_block_time))
+            .add("reverb_block", kee_bench::summarize(snapshot.reverb_block_time))
+            .add("tempo_block", kee_bench::summarize(snapshot.tempo_block_time))
+            .add("render_real_time_factor", render_ns / 1e9 / rendered_seconds);
+    };
+
+    kee_bench::json_object music_result;
+    for (const auto& [name, setup] : music_effects)
+        music_result.add(name, measure(false, setup));
+    kee_bench::json_object bus_result;
+    for (const auto& [name, setup] : bus_effects)
+        bus_result.add(name, measure(true, setup));
+    return kee_bench::json_object()
+        .add("music_player", music_result)
+        .add("bus", bus_result);
+}
+kee_bench::register_case effect_cost("effect_cost", bench_effect_cost);
+
+kee_bench::json_object bench_startup(const kee_bench::options& options) {
+    std::vector<std::size_t> asset_counts = options.is_quick ? std::vector<std::size_t>{ 16, 128 } : std::vector<std::size_t>{ 16, 128, 1024, 4096 };
+    std::vector<kee_bench::json_object> results;
+    for (std::size_t asset_count : asset_counts) {
+        kee_test::asset_directory assets("bench_startup");
+        std::vector<std::int16_t> sfx = kee_test::make_noise(SAMPLE_RATE / 10, 1, 1);
+        for (std::size_t i = 0; i < asset_count; i++)
+            assets.add_sfx("sfx_" + std::to_string(i) + ".wav", sfx);
+        assets.add_music("song.wav", kee_test::make_noise(SAMPLE_RATE, 2, 2));
+
+        kee_bench::clock::time_point start = kee_bench::clock::now();
+        std::optional<audio::engine> engine(std::in_place, kee_test::loopback_config(SAMPLE_RATE));
+        double construct_ns = kee_bench::elapsed_ns(start);
+        audio::engine::metrics_snapshot snapshot = kee_bench::read_metrics(*engine);
+        engine.reset();
+        results.push_back(kee_bench::json_object()
+            .add("asset_count", static_cast<std::uint64_t>(asset_count + 1))
+            .add("construct_ms", construct_ns / 1e6)
+            .add("startup_ms", snapshot.startup_ns / 1e6)
+            .add("us_per_asset", construct_ns / 1e3 / (asset_count + 1)));
+    }
+    return kee_bench::json_object().add("counts", results);
+}
+kee_bench::register_case startup("startup", bench_startup);
+
+kee_bench::json_object bench_contention(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_contention");
+    assets.add_sfx("click.wav", make_click());
+    assets.add_music("song.wav", kee_test::make_noise(SAMPLE_RATE * 10, 2, 1));
+
+    /* One thread renders the way the engine's own thread would run while game threads call into the engine.
+     * Every game thread loops over a play, a gain change, a voice query and a clock read.
+     */
+    constexpr std::size_t BLOCK_FRAMES = 256;
+    std::chrono::milliseconds duration(options.pick(500, 100));
+    kee_bench::json_object result;
+    for (bool use_software_mixer : { false, true }) {
+        std::vector<kee_bench::json_object> thread_results;
+        for (std::size_t thread_count : { 1, 2, 4, 8 }) {
+            audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+            config.use_software_mixer = use_software_mixer;
+            audio::engine engine(config);
+            audio::engine::sfx_id click = engine.lookup_sfx("click.wav");
+            engine.set_player_music("song.wav");
+            engine.play_music_player();
+            engine.reset_metrics();
+
+            std::atomic_bool should_stop = false;
+            std::atomic<std::uint64_t> rendered_blocks = 0;
+            std::thread render_thread([&]() {
+                std::vector<std::int16_t> samples(BLOCK_FRAMES * 2);
+                while (!should_stop.load(std::memory_order_relaxed)) {
+                    engine.render(samples.data(), BLOCK_FRAMES);
+                    rendered_blocks++;
+                }
+            });
+
+            std::vector<std::vector<double>> call_ns(thread_count);
+            std::vector<std::thread> game_threads;
+            for (std::size_t thread_index = 0; thread_index < thread_count; thread_index++) {
+                game_threads.emplace_back([&, thread_index]() {
+                    std::vector<double>& latencies = call_ns[thread_index];
+                    while (!should_stop.load(std::memory_order_relaxed)) {
+                        kee_bench::clock::time_point start = kee_bench::clock::now();
+                        audio::engine::sfx_handle handle = engine.play_sfx(click);
+                        engine.set_sfx_gain(handle, 0.5f);
+                        engine.is_sfx_playing(handle);
+                        engine.get_playback_time();
+                        latencies.push_back(kee_bench::elapsed_ns(start) / 4.0);
+                    }
+                });
+            }
+            std::this_thread::sleep_for(duration);
+            should_stop = true;
+            for (std::thread& thread : game_threads)
+                thread.join();
+            render_thread.join();
+
+            std::vector<double> all_calls;
+            for (const std::vector<double>& latencies : call_ns)
+                all_calls.insert(all_calls.end(), latencies.begin(), latencies.end());
+            double seconds = std::chrono::duration<double>(duration).count();
+            audio::engine::metrics_snapshot snapshot = kee_bench::read_metrics(engine);
+            thread_results.push_back(kee_bench::json_object()
+                .add("game_threads", static_cast<std::uint64_t>(thread_count))
+                .add("calls_per_second", all_calls.size() * 4 / seconds)
+                .add("call_ns", kee_bench::summarize(all_calls))
+                .add("sfx_lock_wait", kee_bench::summarize(snapshot.sfx_mixer_lock_wait))
+                .add("rendered_seconds_per_second", rendered_blocks.load() * BLOCK_FRAMES / static_cast<double>(SAMPLE_RATE) / seconds));
+        }
+        result.add(kee_bench::mixer_name(use_software_mixer), kee_bench::json_object().add("threads", thread_results));
+    }
+    return result;
+}
+kee_bench::register_case contention("contention", bench_contention);
+
+kee_bench::json_object bench_disk_stalls(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_stalls");
+    double music_seconds = options.pick(40.0, 8.0);
+    assets.add_music("song.wav", kee_test::make_noise(static_cast<std::size_t>(music_seconds * SAMPLE_RATE), 2, 1));
+
+    // every interval the player's reads stop answering for the stall, with the default queue depth
+    std::chrono::milliseconds interval(options.pick(4000, 2000));
+    std::vector<int> stall_ms = options.is_quick ? std::vector<int>{ 100, 1000 } : std::vector<int>{ 25, 100, 250, 500, 1000, 2000 };
+    std::vector<kee_bench::json_object> results;
+    for (int stall : stall_ms) {
+        audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+        engine.set_player_music("song.wav");
+        engine.play_music_player();
+        std::size_t interval_frames = static_cast<std::size_t>(std::chrono::duration<double>(interval).count() * SAMPLE_RATE);
+        std::vector<std::int16_t> samples(interval_frames * 2);
+        // the first stall comes once the queue is full, not during the first fill
+        engine.render(samples.data(), SAMPLE_RATE / 2);
+        std::size_t stall_count = 0;
+        for (double time = 0.5; time + std::chrono::duration<double>(interval).count() < music_seconds - 1.0; time += std::chrono::duration<double>(interval).count()) {
+            audio::test_access::stall_music_reads(engine, 0, std::chrono::milliseconds(stall));
+            engine.render(samples.data(), interval_frames);
+            stall_count++;
+        }
+
+        audio::engine::metrics_snapshot snapshot = kee_bench::read_metrics(engine);
+        results.push_back(kee_bench::json_object()
+            .add("stall_ms", stall)
+            .add("stalls", static_cast<std::uint64_t>(stall_count))
+            .add("underruns", snapshot.starvations[0])
+            .add("near_underruns", snapshot.near_starvations[0])
+            .add("final_buffer_count", snapshot.music_buffer_counts[0]));
+    }
+    audio::engine::config defaults;
+    return kee_bench::json_object()
+        .add("music_buffer_count", static_cast<std::uint64_t>(defaults.music_buffer_count))
+        .add("music_buffer_size", static_cast<std::uint64_t>(defaults.music_buffer_size))
+        .add("stalls", results);
+}
+kee_bench::register_case disk_stalls("disk_stalls", bench_disk_stalls);
+
+} // namespace
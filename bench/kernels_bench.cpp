@@ -0,0 +1,80 @@
+#include "bench.hpp"
+
+/* The mixer's kernels on their own, at every simd level the cpu has, on blocks the size the mixer runs.
+ */
+
+namespace {
+
+using kernels_t = audio::test_access::mix_kernels;
+constexpr std::size_t BLOCK_FRAMES = 512;
+constexpr std::size_t REVERB_MASK = 8191;
+// results the compiler can't drop
+volatile float sink;
+
+const char* simd_level_name(audio::engine::simd_level level) {
+    switch (level) {
+        case audio::engine::simd_level::scalar: return "scalar";
+        case audio::engine::simd_level::sse2: return "sse2";
+        case audio::engine::simd_level::avx2: return "avx2";
+    }
+    return "unknown";
+}
+
+kee_bench::json_object bench_mix_kernels(const kee_bench::options& options) {
+    /* Each kernel runs over the same block repeatedly, timed in batches of 64 calls, and reports ns per frame
+     * (per sample for to_s16, s16_to_f32, accumulate, dot and peak). Inputs are noise, the accumulators are reset between batches so they
+     * stay in range.
+     */
+    constexpr std::size_t BATCH_CALLS = 64;
+    std::size_t batch_count = options.pick<std::size_t>(400, 20);
+    std::vector<std::int16_t> s16 = kee_test::make_noise(BLOCK_FRAMES, 2, 1);
+    std::vector<float> f32(BLOCK_FRAMES * 2);
+    for (std::size_t i = 0; i < f32.size(); i++)
+        f32[i] = static_cast<float>(s16[i]);
+    const float coefficients[5] = { 0.0133f, 0.0266f, 0.0133f, -1.6475f, 0.7008f };
+    const std::size_t delays[audio::test_access::REVERB_LINE_COUNT] = { 1031, 1327, 1523, 1871, 2053, 2311, 2539, 2843 };
+
+    kee_bench::json_object result;
+    for (audio::engine::simd_level level : { audio::engine::simd_level::scalar, audio::engine::simd_level::sse2, audio::engine::simd_level::avx2 }) {
+        const kernels_t kernels = kernels_t::select(level);
+        if (kernels.level != level)
+            continue;
+
+        std::vector<float> accumulator(BLOCK_FRAMES * 2);
+        std::vector<std::int16_t> output(BLOCK_FRAMES * 2);
+        std::vector<float> lines((REVERB_MASK + 1) * audio::test_access::REVERB_LINE_COUNT);
+        std::vector<float> lowpass(audio::test_access::REVERB_LINE_COUNT);
+        std::vector<float> state(4);
+        std::size_t position = 0;
+        const auto time_kernel = [&](std::size_t units, const auto& call) -> kee_bench::json_object {
+            std::vector<double> unit_ns;
+            for (std::size_t batch = 0; batch < batch_count; batch++) {
+                std::copy(f32.begin(), f32.end(), accumulator.begin());
+                kee_bench::clock::time_point start = kee_bench::clock::now();
+                for (std::size_t call_index = 0; call_index < BATCH_CALLS; call_index++)
+                    call();
+                unit_ns.push_back(kee_bench::elapsed_ns(start) / (BATCH_CALLS * units));
+            }
+            return kee_bench::summarize(unit_ns);
+        };
+
+        std::int16_t min = 0;
+        std::int16_t max = 0;
+        result.add(simd_level_name(level), kee_bench::json_object()
+            .add("mix_mono_ns_per_frame", time_kernel(BLOCK_FRAMES, [&]() { kernels.mix_mono(s16.data(), accumulator.data(), BLOCK_FRAMES, 0.01f, 0.01f); }))
+            .add("mix_stereo_ns_per_frame", time_kernel(BLOCK_FRAMES, [&]() { kernels.mix_stereo(s16.data(), accumulator.data(), BLOCK_FRAMES, 0.01f, 0.01f); }))
+            .add("to_s16_ns_per_sample", time_kernel(BLOCK_FRAMES * 2, [&]() { kernels.to_s16(f32.data(), output.data(), BLOCK_FRAMES * 2); }))
+            .add("s16_to_f32_ns_per_sample", time_kernel(BLOCK_FRAMES * 2, [&]() { kernels.s16_to_f32(s16.data(), accumulator.data(), BLOCK_FRAMES * 2); }))
+            .add("accumulate_ns_per_sample", time_kernel(BLOCK_FRAMES * 2, [&]() { kernels.accumulate(f32.data(), accumulator.data(), BLOCK_FRAMES * 2); }))
+            .add("dot_ns_per_sample", time_kernel(BLOCK_FRAMES * 2, [&]() { sink = kernels.dot(f32.data(), accumulator.data(), BLOCK_FRAMES * 2); }))
+            .add("peak_ns_per_sample", time_kernel(BLOCK_FRAMES * 2, [&]() { sink = kernels.peak(s16.data(), BLOCK_FRAMES * 2, min, max); }))
+            .add("biquad_ns_per_frame", time_kernel(BLOCK_FRAMES, [&]() { kernels.biquad(accumulator.data(), BLOCK_FRAMES, 2, coefficients, state.data(), 1.0f); }))
+            .add("reverb_ns_per_frame", time_kernel(BLOCK_FRAMES, [&]() {
+                position = kernels.reverb(accumulator.data(), BLOCK_FRAMES, 2, lines.data(), REVERB_MASK, position, delays, lowpass.data(), 0.8f, 0.3f, 0.3f);
+            })));
+    }
+    return result;
+}
+kee_bench::register_case mix_kernels("mix_kernels", bench_mix_kernels);
+
+} // namespace
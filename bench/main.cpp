@@ -0,0 +1,63 @@
+#include "bench.hpp"
+
+/* kee_audio_bench [--quick] [--output file.json] [case ...]
+ * Runs the named cases (all of them by default) and writes one JSON document to stdout or the output file.
+ * Progress goes to stderr.
+ */
+
+int main(int argc, char** argv) {
+    kee_bench::options options;
+    std::string output_path;
+    std::vector<std::string> selected_cases;
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--quick")
+            options.is_quick = true;
+        else if (argument == "--output" && i + 1 < argc)
+            output_path = argv[++i];
+        else if (argument == "--list") {
+            for (const kee_bench::bench_case& bench_case : kee_bench::get_cases())
+                std::printf("%s\n", bench_case.name);
+            return 0;
+        }
+        else
+            selected_cases.push_back(argument);
+    }
+
+    bool is_failed = false;
+    kee_bench::json_object results;
+    for (const kee_bench::bench_case& bench_case : kee_bench::get_cases()) {
+        if (!selected_cases.empty() && std::find(selected_cases.begin(), selected_cases.end(), bench_case.name) == selected_cases.end())
+            continue;
+
+        std::fprintf(stderr, "%s...\n", bench_case.name);
+        kee_bench::clock::time_point start = kee_bench::clock::now();
+        try {
+            results.add(bench_case.name, bench_case.run(options));
+        }
+        catch (const std::exception& exception) {
+            std::fprintf(stderr, "%s failed: %s\n", bench_case.name, exception.what());
+            results.add(bench_case.name, kee_bench::json_object().add("error", exception.what()));
+            is_failed = true;
+        }
+        std::fprintf(stderr, "%s took %.1f s\n", bench_case.name, kee_bench::elapsed_ns(start) / 1e9);
+    }
+
+#ifdef NDEBUG
+    constexpr bool is_release = true;
+#else
+    constexpr bool is_release = false;
+#endif
+    // debug builds check OpenAL errors after every call, compare runs of the same build type
+    std::string document = kee_bench::json_object()
+        .add("engine", "kee_audio_engine")
+        .add("release", is_release)
+        .add("quick", options.is_quick)
+        .add("cases", results)
+        .str();
+    if (output_path.empty())
+        std::printf("%s\n", document.c_str());
+    else
+        std::ofstream(output_path) << document << "\n";
+    return is_failed ? 1 : 0;
+}
@@ -0,0 +1,209 @@
+#include "bench.hpp"
+
+/* The sfx trigger path: frames with many triggers, lookups against names, and buses full of voices.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+using kee_test::FRAME_FRAMES;
+constexpr std::size_t MIX_FRAMES = 512;
+
+kee_bench::json_object bench_trigger_batch(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_batch");
+    for (int i = 0; i < 8; i++)
+        assets.add_sfx("hit_" + std::to_string(i) + ".wav", kee_test::make_noise(SAMPLE_RATE / 10, 1, i));
+
+    /* 200 play_sfx in one game frame, one by one and between begin_sfx_batch and end_sfx_batch. The frame's
+     * time covers the calls and the render that starts them, al_checks counts OpenAL error checks per frame.
+     */
+    constexpr std::size_t TRIGGER_COUNT = 200;
+    std::size_t frame_count = options.pick<std::size_t>(200, 20);
+    kee_bench::json_object result;
+    for (bool use_software_mixer : { false, true }) {
+        audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+        config.use_software_mixer = use_software_mixer;
+        audio::engine engine(config);
+        std::vector<audio::engine::sfx_id> hits;
+        for (int i = 0; i < 8; i++)
+            hits.push_back(engine.lookup_sfx("hit_" + std::to_string(i) + ".wav"));
+
+        kee_bench::json_object mixer_result;
+        for (bool is_batched : { false, true }) {
+            std::vector<std::int16_t> samples(FRAME_FRAMES * 2);
+            std::vector<double> call_us;
+            std::vector<double> frame_us;
+            std::uint64_t al_checks = 0;
+            engine.reset_metrics();
+            for (std::size_t frame = 0; frame < frame_count; frame++) {
+                std::uint64_t checks_before = kee_bench::read_metrics(engine).al_error_check_time.count;
+                kee_bench::clock::time_point start = kee_bench::clock::now();
+                if (is_batched)
+                    engine.begin_sfx_batch();
+                for (std::size_t trigger = 0; trigger < TRIGGER_COUNT; trigger++)
+                    engine.play_sfx(hits[trigger % hits.size()], 0.5f, (trigger % 9) / 4.0f - 1.0f);
+                if (is_batched)
+                    engine.end_sfx_batch();
+                call_us.push_back(kee_bench::elapsed_ns(start) / 1e3);
+                engine.render(samples.data(), FRAME_FRAMES);
+                frame_us.push_back(kee_bench::elapsed_ns(start) / 1e3);
+                al_checks += kee_bench::read_metrics(engine).al_error_check_time.count - checks_before;
+
+                // the hits ring out before the next burst
+                for (int gap = 0; gap < 8; gap++)
+                    engine.render(samples.data(), FRAME_FRAMES);
+            }
+            audio::engine::metrics_snapshot snapshot = kee_bench::read_metrics(engine);
+            mixer_result.add(is_batched ? "batched" : "unbatched", kee_bench::json_object()
+                .add("calls_us", kee_bench::summarize(call_us))
+                .add("frame_us", kee_bench::summarize(frame_us))
+                .add("al_checks_per_frame", static_cast<double>(al_checks) / frame_count)
+                .add("sfx_start", kee_bench::summarize(snapshot.sfx_start_latency)));
+        }
+        result.add(kee_bench::mixer_name(use_software_mixer), mixer_result);
+    }
+    return result;
+}
+kee_bench::register_case trigger_batch("trigger_batch", bench_trigger_batch);
+
+kee_bench::json_object bench_normalization(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_normalization");
+    constexpr int ASSET_SAMPLE_RATE = 44100;
+    for (int i = 0; i < 16; i++)
+        assets.add_sfx("hit_" + std::to_string(i) + ".wav", kee_test::make_noise(ASSET_SAMPLE_RATE / 2, 1, i), 1, ASSET_SAMPLE_RATE);
+    assets.add_music("song.wav", kee_test::make_noise(ASSET_SAMPLE_RATE * 30, 2, 1), 2, ASSET_SAMPLE_RATE);
+
+    /* 44.1 kHz assets on a 48 kHz device, normalized at load and loaded as they are, so OpenAL resamples every
+     * voice and the music on every mix. 32 sfx start every 100 ms over the music, the render's cpu is the mixer's.
+     */
+    double seconds = options.pick(10.0, 1.0);
+    kee_bench::json_object result;
+    for (bool use_software_mixer : { false, true }) {
+        kee_bench::json_object mixer_result;
+        for (bool is_normalized : { true, false }) {
+            audio::test_access::set_resampling_disabled(!is_normalized);
+            audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+            config.use_software_mixer = use_software_mixer;
+            audio::engine engine(config);
+            std::vector<audio::engine::sfx_id> hits;
+            for (int i = 0; i < 16; i++)
+                hits.push_back(engine.lookup_sfx("hit_" + std::to_string(i) + ".wav"));
+            engine.set_player_music("song.wav");
+            engine.play_music_player();
+
+            // a tenth of a second of audio per burst
+            std::vector<std::int16_t> samples(SAMPLE_RATE / 10 * 2);
+            double render_seconds = 0.0;
+            double cpu_before = kee_bench::get_process_cpu_seconds();
+            for (double time = 0.0; time < seconds; time += 0.1) {
+                for (std::size_t trigger = 0; trigger < 32; trigger++)
+                    engine.play_sfx(hits[trigger % hits.size()], 0.25f);
+                kee_bench::clock::time_point start = kee_bench::clock::now();
+                engine.render(samples.data(), SAMPLE_RATE / 10);
+                render_seconds += kee_bench::elapsed_ns(start) / 1e9;
+            }
+            double cpu_seconds = kee_bench::get_process_cpu_seconds() - cpu_before;
+            mixer_result.add(is_normalized ? "normalized" : "resampled_by_openal", kee_bench::json_object()
+                .add("render_real_time_factor", render_seconds / seconds)
+                .add("process_cpu_percent", cpu_seconds / seconds * 100.0));
+        }
+        result.add(kee_bench::mixer_name(use_software_mixer), mixer_result);
+    }
+    audio::test_access::set_resampling_disabled(false);
+    return result;
+}
+kee_bench::register_case normalization("normalization", bench_normalization);
+
+kee_bench::json_object bench_trigger_lookup(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_lookup");
+    for (int i = 0; i < 256; i++)
+        assets.add_sfx("ui_button_hover_variant_" + std::to_string(i) + ".wav", kee_test::make_noise(480, 1, i));
+    assets.add_music("song.wav", kee_test::make_noise(SAMPLE_RATE, 2, 1));
+
+    /* The trigger path by id against by name, names long enough to spill out of the small string buffer.
+     * Calls go in rounds of 64, each round rendered so the voices it started are freed.
+     */
+    constexpr std::size_t ROUND_CALLS = 64;
+    std::size_t round_count = options.pick<std::size_t>(2000, 50);
+    audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+    config.use_software_mixer = true;
+    audio::engine engine(config);
+    std::vector<std::string> names;
+    std::vector<audio::engine::sfx_id> ids;
+    for (int i = 0; i < 256; i++) {
+        names.push_back("ui_button_hover_variant_" + std::to_string(i) + ".wav");
+        ids.push_back(engine.lookup_sfx(names.back()));
+    }
+    audio::engine::music_id song = engine.lookup_music("song.wav");
+
+    std::vector<std::int16_t> samples(MIX_FRAMES * 2);
+    const auto time_calls = [&](const auto& call) -> kee_bench::json_object {
+        std::vector<double> call_ns;
+        for (std::size_t round = 0; round < round_count; round++) {
+            kee_bench::clock::time_point start = kee_bench::clock::now();
+            for (std::size_t i = 0; i < ROUND_CALLS; i++)
+                call((round * ROUND_CALLS + i) % names.size());
+            call_ns.push_back(kee_bench::elapsed_ns(start) / ROUND_CALLS);
+            engine.render(samples.data(), MIX_FRAMES);
+        }
+        return kee_bench::summarize(call_ns);
+    };
+
+    return kee_bench::json_object()
+        .add("play_sfx_id_ns", time_calls([&](std::size_t i) { engine.play_sfx(ids[i]); }))
+        .add("play_sfx_name_ns", time_calls([&](std::size_t i) { engine.play_sfx(names[i]); }))
+        .add("lookup_sfx_name_ns", time_calls([&](std::size_t i) { engine.lookup_sfx(names[i]); }))
+        .add("lookup_sfx_key_ns", time_calls([&](std::size_t i) { engine.lookup_sfx(audio::engine::asset_key(names[i])); }))
+        .add("get_music_duration_id_ns", time_calls([&](std::size_t) { engine.get_music_duration(song); }))
+        .add("get_music_duration_name_ns", time_calls([&](std::size_t) { engine.get_music_duration("song.wav"); }));
+}
+kee_bench::register_case trigger_lookup("trigger_lookup", bench_trigger_lookup);
+
+kee_bench::json_object bench_bus_pause(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_bus_pause");
+    assets.add_sfx("loop.wav", kee_test::make_noise(SAMPLE_RATE * 30, 1, 1));
+
+    /* 300 voices on one bus, as many as the pool holds with OpenAL sources. Each pause, unpause and gain
+     * change is timed on its own, a render between them lets the engine apply it.
+     */
+    constexpr std::size_t VOICE_COUNT = 300;
+    std::size_t repeat_count = options.pick<std::size_t>(500, 20);
+    kee_bench::json_object result;
+    for (bool use_software_mixer : { false, true }) {
+        audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+        config.use_software_mixer = use_software_mixer;
+        config.bus_names = { "music", "hits" };
+        audio::engine engine(config);
+        audio::engine::bus_id hits = engine.lookup_bus("hits");
+        audio::engine::sfx_id loop = engine.lookup_sfx("loop.wav");
+        std::size_t voice_count = std::min(VOICE_COUNT, engine.get_sfx_pool_stats().capacity);
+        for (std::size_t voice = 0; voice < voice_count; voice++)
+            engine.play_sfx(loop, 0.01f, 0.0f, hits);
+
+        std::vector<std::int16_t> samples(MIX_FRAMES * 2);
+        engine.render(samples.data(), MIX_FRAMES);
+        std::vector<double> pause_us;
+        std::vector<double> unpause_us;
+        std::vector<double> gain_us;
+        const auto time_call = [&](std::vector<double>& latencies, const auto& call) {
+            kee_bench::clock::time_point start = kee_bench::clock::now();
+            call();
+            latencies.push_back(kee_bench::elapsed_ns(start) / 1e3);
+            engine.render(samples.data(), MIX_FRAMES);
+        };
+        for (std::size_t repeat = 0; repeat < repeat_count; repeat++) {
+            time_call(pause_us, [&]() { engine.pause_bus(hits); });
+            time_call(unpause_us, [&]() { engine.unpause_bus(hits); });
+            time_call(gain_us, [&]() { engine.set_bus_gain(hits, repeat % 2 == 0 ? 0.5f : 1.0f); });
+        }
+        result.add(kee_bench::mixer_name(use_software_mixer), kee_bench::json_object()
+            .add("voices", static_cast<std::uint64_t>(engine.get_sfx_pool_stats().active))
+            .add("pause_bus_us", kee_bench::summarize(pause_us))
+            .add("unpause_bus_us", kee_bench::summarize(unpause_us))
+            .add("set_bus_gain_us", kee_bench::summarize(gain_us)));
+    }
+    return result;
+}
+kee_bench::register_case bus_pause("bus_pause", bench_bus_pause);
+
+} // namespace
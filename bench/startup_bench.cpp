@@ -0,0 +1,113 @@
+#include "bench.hpp"
+#include <thread>
+
+/* Engine startup over generated asset corpora: parsing every header against reading the header index,
+ * loose files against an archive.
+ * Every construction is a loopback engine, so only loading the assets differs between runs.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+constexpr const char* ASSET_INDEX_PATH = "assets/asset_index.kee";
+
+void add_sfx_corpus(const kee_test::asset_directory& assets, std::size_t sfx_count) {
+    // short sfx of a few lengths, the way a game's hitsounds and ui sounds look
+    for (std::size_t i = 0; i < sfx_count; i++)
+        assets.add_sfx("sfx_" + std::to_string(i) + ".wav", kee_test::make_noise(SAMPLE_RATE / 20 * (1 + i % 4), 1 + i % 2, static_cast<std::uint32_t>(i)), 1 + i % 2);
+}
+
+double time_construction_ms() {
+    kee_bench::clock::time_point start = kee_bench::clock::now();
+    audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+    return kee_bench::elapsed_ns(start) / 1e6;
+}
+
+kee_bench::json_object bench_startup_index(const kee_bench::options& options) {
+    /* Cold runs find no asset index and parse every header, warm runs read the index the cold run saved.
+     * The files stay in the page cache for both, so cold here is the parsing alone, not the disk.
+     */
+    std::vector<std::size_t> sfx_counts = options.is_quick ? std::vector<std::size_t>{ 200 } : std::vector<std::size_t>{ 1000, 4000 };
+    std::size_t runs = options.pick<std::size_t>(5, 2);
+    std::vector<kee_bench::json_object> results;
+    for (std::size_t sfx_count : sfx_counts) {
+        kee_test::asset_directory assets("bench_startup_index");
+        add_sfx_corpus(assets, sfx_count);
+        assets.add_music("song.wav", kee_test::make_noise(SAMPLE_RATE * 10, 2, 1));
+
+        std::vector<double> cold_ms;
+        std::vector<double> warm_ms;
+        for (std::size_t run = 0; run < runs; run++) {
+            std::filesystem::remove(ASSET_INDEX_PATH);
+            cold_ms.push_back(time_construction_ms());
+            warm_ms.push_back(time_construction_ms());
+        }
+        results.push_back(kee_bench::json_object()
+            .add("asset_count", static_cast<std::uint64_t>(sfx_count + 1))
+            .add("cold_ms", kee_bench::summarize(cold_ms))
+            .add("warm_ms", kee_bench::summarize(warm_ms))
+            .add("index_bytes", static_cast<std::uint64_t>(std::filesystem::file_size(ASSET_INDEX_PATH))));
+    }
+    return kee_bench::json_object()
+        .add("hardware_threads", static_cast<std::uint64_t>(std::thread::hardware_concurrency()))
+        .add("corpora", results);
+}
+kee_bench::register_case startup_index("startup_index", bench_startup_index);
+
+std::int64_t count_open_files() {
+    // -1 where the process's descriptors can't be listed
+    std::error_code error;
+    std::filesystem::directory_iterator descriptors("/proc/self/fd", error);
+    if (error)
+        return -1;
+    return std::distance(descriptors, std::filesystem::directory_iterator());
+}
+
+kee_bench::json_object measure_layout(std::size_t runs) {
+    std::vector<double> construct_ms;
+    for (std::size_t run = 0; run < runs; run++)
+        construct_ms.push_back(time_construction_ms());
+
+    // descriptors the engine holds with a song streaming on every player, over those open before it
+    std::int64_t files_before = count_open_files();
+    audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+    for (std::size_t index = 0; index < engine.get_music_player_count(); index++) {
+        engine.set_player_music("song_" + std::to_string(index) + ".wav", index);
+        engine.play_music_player(index);
+    }
+    std::vector<std::int16_t> samples(SAMPLE_RATE / 2 * 2);
+    engine.render(samples.data(), SAMPLE_RATE / 2);
+    std::int64_t files_streaming = count_open_files();
+    return kee_bench::json_object()
+        .add("construct_ms", kee_bench::summarize(construct_ms))
+        .add("open_files_streaming", static_cast<double>(files_before < 0 ? -1 : files_streaming - files_before));
+}
+
+kee_bench::json_object bench_archive_startup(const kee_bench::options& options) {
+    /* The same corpus loose, with its header index warm, and packed into assets/assets.keea. Startup is timed over
+     * several constructions, open files are counted while four songs stream.
+     */
+    std::size_t sfx_count = options.pick<std::size_t>(2000, 100);
+    std::size_t runs = options.pick<std::size_t>(5, 2);
+    kee_test::asset_directory assets("bench_archive");
+    add_sfx_corpus(assets, sfx_count);
+    for (std::size_t index = 0; index < 4; index++)
+        assets.add_music("song_" + std::to_string(index) + ".wav", kee_test::make_noise(SAMPLE_RATE * 10, 2, static_cast<std::uint32_t>(index)));
+
+    time_construction_ms();
+    kee_bench::json_object loose = measure_layout(runs);
+    // mapped music closes its file once mapped, ifstream streaming keeps one open per player
+    audio::test_access::set_music_mapping_disabled(true);
+    kee_bench::json_object loose_ifstream = measure_layout(runs);
+    audio::test_access::set_music_mapping_disabled(false);
+    audio::engine::pack_assets("assets/assets.keea", SAMPLE_RATE);
+    kee_bench::json_object archive = measure_layout(runs);
+    return kee_bench::json_object()
+        .add("asset_count", static_cast<std::uint64_t>(sfx_count + 4))
+        .add("loose", loose)
+        .add("loose_ifstream", loose_ifstream)
+        .add("archive", archive.add("archive_bytes", static_cast<std::uint64_t>(std::filesystem::file_size("assets/assets.keea"))));
+}
+kee_bench::register_case archive_startup("archive_startup", bench_archive_startup);
+
+} // namespace
@@ -0,0 +1,255 @@
+#include "bench.hpp"
+#include <cstdlib>
+#include <map>
+#include <thread>
+
+/* The engine's thread and music streaming in real time: how often the thread wakes and what it costs.
+ * These cases open the output device (ALSOFT_DRIVERS=null for OpenAL Soft's null backend), not a loopback one.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+
+kee_bench::json_object bench_polling_wakeups(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_wakeups");
+    assets.add_sfx("click.wav", kee_test::make_noise(2400, 1, 1));
+    assets.add_music("song.wav", kee_test::make_noise(SAMPLE_RATE * 20, 2, 2));
+
+    /* Wakeups are passes of the engine's thread (polling_loop_time), cpu is the whole process, the device's
+     * mixer included. legacy_5ms_loop is the loop the engine replaced, next to an idle engine: every 5 ms
+     * it takes two locks and asks every sfx source and music player for its state.
+     */
+    std::chrono::milliseconds duration(options.pick(2000, 300));
+    double seconds = std::chrono::duration<double>(duration).count();
+    audio::engine engine;
+    audio::engine::sfx_id click = engine.lookup_sfx("click.wav");
+
+    const auto measure = [&](const std::function<void()>& during) -> kee_bench::json_object {
+        std::uint64_t passes_before = kee_bench::read_metrics(engine).polling_loop_time.count;
+        double cpu_before = kee_bench::get_process_cpu_seconds();
+        during();
+        double cpu_seconds = kee_bench::get_process_cpu_seconds() - cpu_before;
+        std::uint64_t passes = kee_bench::read_metrics(engine).polling_loop_time.count - passes_before;
+        return kee_bench::json_object()
+            .add("wakeups_per_second", passes / seconds)
+            .add("process_cpu_percent", cpu_seconds / seconds * 100.0);
+    };
+
+    kee_bench::json_object result;
+    result.add("idle", measure([&]() {
+        std::this_thread::sleep_for(duration);
+    }));
+
+    engine.set_player_music("song.wav");
+    engine.play_music_player();
+    result.add("music", measure([&]() {
+        std::this_thread::sleep_for(duration);
+    }));
+
+    result.add("music_and_sfx_20_per_second", measure([&]() {
+        for (kee_bench::clock::time_point end = kee_bench::clock::now() + duration; kee_bench::clock::now() < end;) {
+            engine.play_sfx(click);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }));
+    engine.unset_player_music();
+
+    std::vector<ALuint> legacy_sources(engine.get_sfx_pool_stats().capacity + engine.get_music_player_count());
+    alGenSources(static_cast<ALsizei>(legacy_sources.size()), legacy_sources.data());
+    std::uint64_t legacy_wakeups = 0;
+    kee_bench::json_object legacy = measure([&]() {
+        std::mutex sfx_lock;
+        std::mutex music_lock;
+        for (kee_bench::clock::time_point end = kee_bench::clock::now() + duration; kee_bench::clock::now() < end;) {
+            {
+                std::scoped_lock locks(sfx_lock, music_lock);
+                for (ALuint source : legacy_sources) {
+                    ALint state;
+                    alGetSourcei(source, AL_SOURCE_STATE, &state);
+                }
+            }
+            legacy_wakeups++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    });
+    alDeleteSources(static_cast<ALsizei>(legacy_sources.size()), legacy_sources.data());
+    result.add("legacy_5ms_loop", legacy.add("legacy_wakeups_per_second", legacy_wakeups / seconds));
+    return result;
+}
+kee_bench::register_case polling_wakeups("polling_wakeups", bench_polling_wakeups);
+
+kee_bench::json_object bench_stream_backends(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_backends");
+    double music_seconds = options.pick(60.0, 4.0);
+    assets.add_music("song.wav", kee_test::make_noise(static_cast<std::size_t>(music_seconds * SAMPLE_RATE), 2, 1));
+
+    /* The same song streamed from a mapping and through ifstream, rendered offline. Allocations count the whole
+     * process over the render, OpenAL's buffer uploads included, per second of audio and per buffer filled.
+     */
+    double rendered_seconds = music_seconds - 1.0;
+    kee_bench::json_object result;
+    for (bool is_mapped : { true, false }) {
+        audio::test_access::set_music_mapping_disabled(!is_mapped);
+        audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+        engine.set_player_music("song.wav");
+        engine.play_music_player();
+        std::vector<std::int16_t> samples(SAMPLE_RATE * 2);
+        engine.render(samples.data(), SAMPLE_RATE / 2);
+        engine.reset_metrics();
+
+        std::uint64_t allocations_before = kee_bench::get_allocation_count();
+        kee_bench::clock::time_point start = kee_bench::clock::now();
+        for (double time = 0.0; time < rendered_seconds; time += 1.0)
+            engine.render(samples.data(), SAMPLE_RATE);
+        double render_ns = kee_bench::elapsed_ns(start);
+        std::uint64_t allocations = kee_bench::get_allocation_count() - allocations_before;
+
+        audio::engine::metrics_snapshot snapshot = kee_bench::read_metrics(engine);
+        std::uint64_t blocks = snapshot.music_buffer_fill_time.count;
+        result.add(is_mapped ? "mmap" : "ifstream", kee_bench::json_object()
+            .add("block_fill", kee_bench::summarize(snapshot.music_buffer_fill_time))
+            .add("refill_pass", kee_bench::summarize(snapshot.music_refill_time))
+            .add("allocations_per_second", allocations / rendered_seconds)
+            .add("allocations_per_block", blocks == 0 ? 0.0 : static_cast<double>(allocations) / blocks)
+            .add("render_real_time_factor", render_ns / 1e9 / rendered_seconds));
+    }
+    audio::test_access::set_music_mapping_disabled(false);
+    return result;
+}
+kee_bench::register_case stream_backends("stream_backends", bench_stream_backends);
+
+kee_bench::json_object bench_compressed_streams(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_compressed");
+    double music_seconds = options.pick(60.0, 4.0);
+    std::vector<std::int16_t> song = kee_test::make_noise(static_cast<std::size_t>(music_seconds * SAMPLE_RATE), 2, 1);
+    assets.add_music("song.wav", song);
+    assets.add_music("song.flac", song);
+    // there's no Vorbis encoder here, KEE_AUDIO_BENCH_OGG names an .ogg file to measure next to them
+    const char* ogg_path = std::getenv("KEE_AUDIO_BENCH_OGG");
+    if (ogg_path != nullptr)
+        std::filesystem::copy_file(ogg_path, assets.root / "assets" / "music" / "song.ogg");
+
+    /* Each codec on its own engine. decode renders the song offline, and the process cpu over it (the decode
+     * threads included) gives the audio seconds decoded per cpu second. On the output device every player then
+     * streams the song: cpu_percent_per_stream is the process's cpu over an idle engine's, split per stream,
+     * and seek_ns times set_playback_time_async to random positions until its future is ready.
+     */
+    std::chrono::milliseconds duration(options.pick(3000, 300));
+    double seconds = std::chrono::duration<double>(duration).count();
+    std::size_t seek_count = options.pick<std::size_t>(60, 6);
+    kee_bench::json_object result;
+    for (const char* music_name : { "song.wav", "song.flac", "song.ogg" }) {
+        std::string codec = std::filesystem::path(music_name).extension().string().substr(1);
+        if (!audio::test_access::is_codec_supported(music_name) || !std::filesystem::exists(assets.root / "assets" / "music" / music_name)) {
+            result.add(codec, kee_bench::json_object().add("skipped", true));
+            continue;
+        }
+
+        kee_bench::json_object codec_result;
+        {
+            audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+            engine.set_player_music(music_name);
+            engine.play_music_player();
+            std::vector<std::int16_t> samples(SAMPLE_RATE * 2);
+            double rendered_seconds = std::floor(music_seconds - 1.0);
+            double cpu_before = kee_bench::get_process_cpu_seconds();
+            kee_bench::clock::time_point start = kee_bench::clock::now();
+            for (double time = 0.0; time < rendered_seconds; time += 1.0)
+                engine.render(samples.data(), SAMPLE_RATE);
+            double render_ns = kee_bench::elapsed_ns(start);
+            double cpu_seconds = kee_bench::get_process_cpu_seconds() - cpu_before;
+            audio::engine::metrics_snapshot snapshot = kee_bench::read_metrics(engine);
+            codec_result.add("decode", kee_bench::json_object()
+                .add("audio_seconds_per_cpu_second", rendered_seconds / cpu_seconds)
+                .add("render_real_time_factor", render_ns / 1e9 / rendered_seconds)
+                .add("block_fill", kee_bench::summarize(snapshot.music_buffer_fill_time)));
+        }
+
+        audio::engine engine;
+        std::size_t player_count = engine.get_music_player_count();
+        double idle_cpu_before = kee_bench::get_process_cpu_seconds();
+        std::this_thread::sleep_for(duration);
+        double idle_cpu_seconds = kee_bench::get_process_cpu_seconds() - idle_cpu_before;
+
+        for (std::size_t index = 0; index < player_count; index++) {
+            engine.set_player_music(music_name, index);
+            engine.play_music_player(index);
+        }
+        double cpu_before = kee_bench::get_process_cpu_seconds();
+        std::this_thread::sleep_for(duration);
+        double stream_cpu_seconds = kee_bench::get_process_cpu_seconds() - cpu_before - idle_cpu_seconds;
+
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> seek_time(0.0f, static_cast<float>(music_seconds - 1.0));
+        std::vector<double> seek_ns;
+        for (std::size_t seek = 0; seek < seek_count; seek++) {
+            kee_bench::clock::time_point start = kee_bench::clock::now();
+            engine.set_playback_time_async(seek_time(random), seek % player_count).wait();
+            seek_ns.push_back(kee_bench::elapsed_ns(start));
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        result.add(codec, codec_result
+            .add("streams", static_cast<std::uint64_t>(player_count))
+            .add("cpu_percent_per_stream", std::max(stream_cpu_seconds, 0.0) / seconds * 100.0 / player_count)
+            .add("seek_ns", kee_bench::summarize(seek_ns)));
+    }
+    return result;
+}
+kee_bench::register_case compressed_streams("compressed_streams", bench_compressed_streams);
+
+kee_bench::json_object bench_call_latency(const kee_bench::options& options) {
+    kee_test::asset_directory assets("bench_call_latency");
+    assets.add_music("song.wav", kee_test::make_noise(SAMPLE_RATE * 30, 2, 1));
+
+    /* Every player streams with small buffers and a tempo change, so the engine's thread is busy refilling,
+     * stretching, and every second one player's reads stall for 200 ms. A game thread meanwhile posts commands
+     * and reads state the way a frame would, each call timed on its own.
+     */
+    std::chrono::milliseconds duration(options.pick(3000, 500));
+    audio::engine::config config;
+    config.music_buffer_size = 8192;
+    audio::engine engine(config);
+    for (std::size_t index = 0; index < engine.get_music_player_count(); index++) {
+        engine.set_player_music("song.wav", index);
+        engine.set_player_tempo(1.25f, index);
+        engine.play_music_player(index);
+    }
+
+    std::map<std::string, std::vector<double>> call_ns;
+    const auto time_call = [&call_ns](const char* name, const auto& call) {
+        kee_bench::clock::time_point start = kee_bench::clock::now();
+        call();
+        call_ns[name].push_back(kee_bench::elapsed_ns(start));
+    };
+    kee_bench::clock::time_point next_stall = kee_bench::clock::now();
+    std::size_t frame = 0;
+    for (kee_bench::clock::time_point end = kee_bench::clock::now() + duration; kee_bench::clock::now() < end; frame++) {
+        if (kee_bench::clock::now() >= next_stall) {
+            audio::test_access::stall_music_reads(engine, frame % engine.get_music_player_count(), std::chrono::milliseconds(200));
+            next_stall += std::chrono::seconds(1);
+        }
+        std::size_t index = frame % engine.get_music_player_count();
+        time_call("get_playback_time", [&]() { engine.get_playback_time(index); });
+        time_call("get_audio_clock", [&]() { engine.get_audio_clock(index); });
+        time_call("is_music_playing", [&]() { engine.is_music_playing(index); });
+        time_call("play_music_player", [&]() { engine.play_music_player(index); });
+        time_call("set_bus_gain", [&]() { engine.set_bus_gain({ 0 }, 0.9f); });
+        if (frame % 30 == 0)
+            time_call("set_playback_time", [&]() { engine.set_playback_time(5.0f, index); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    kee_bench::json_object result;
+    std::vector<double> all_calls;
+    for (const auto& [name, latencies] : call_ns) {
+        result.add(name, kee_bench::summarize(latencies));
+        all_calls.insert(all_calls.end(), latencies.begin(), latencies.end());
+    }
+    audio::engine::metrics_snapshot snapshot = kee_bench::read_metrics(engine);
+    return result.add("all_calls_ns", kee_bench::summarize(all_calls))
+        .add("engine_pass", kee_bench::summarize(snapshot.polling_loop_time));
+}
+kee_bench::register_case call_latency("call_latency", bench_call_latency);
+
+} // namespace
@@ -1,5 +1,36 @@
-#include "audio.hpp"
+#include "kee_audio_engine.hpp"
 #include <bit>
+#include <limits>
+#include <cstring>
+#include <cmath>
+#include <numbers>
+#include <algorithm>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(KEE_AUDIO_NO_MMAP)
+    #define KEE_AUDIO_USE_MMAP
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+    #define KEE_AUDIO_HAS_SSE2
+    #include <emmintrin.h>
+    #if defined(__GNUC__) || defined(__clang__)
+        #define KEE_AUDIO_HAS_AVX2
+        #include <immintrin.h>
+    #endif
+#endif
+
+#ifdef KEE_AUDIO_ENABLE_VORBIS
+    #include "stb_vorbis.c"
+#endif
+
+#ifdef KEE_AUDIO_ENABLE_FLAC
+    #define DR_FLAC_IMPLEMENTATION
+    #include "dr_flac.h"
+#endif
 
 #define CHECK_AL_ERRORS()\
     fetch_al_errors(__FILE__, __LINE__)
@@ -7,16 +38,117 @@
 #define CHECK_ALC_ERRORS(device)\
     fetch_alc_errors(device, __FILE__, __LINE__)
 
+#ifdef NDEBUG
+    #define CHECK_AL_ERRORS_DEBUG()
+#else
+    #define CHECK_AL_ERRORS_DEBUG()\
+        CHECK_AL_ERRORS()
+#endif
+// release builds check once per call or batch instead of after every AL call
+
+#ifdef KEE_AUDIO_ENABLE_METRICS
+    #define KEE_AUDIO_METRIC(...) __VA_ARGS__
+#else
+    #define KEE_AUDIO_METRIC(...)
+#endif
+
+#ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+    #define KEE_AUDIO_TEST_HOOK(...) __VA_ARGS__
+#else
+    #define KEE_AUDIO_TEST_HOOK(...)
+#endif
+
 namespace audio {
 
 // ------------------------------------------------------------------- //
 // ENGINE
 
-void engine::init() {
-    singleton();
+std::atomic<engine*> engine::live_engine = nullptr;
+
+engine::engine() :
+    engine(config())
+{ }
+
+engine::config engine::validate_config(const config& engine_config) {
+    if (engine_config.music_player_count == 0 || engine_config.music_player_count > MAX_MUSIC_PLAYERS)
+        throw std::out_of_range("audio::engine::engine: music player count must be between 1 and MAX_MUSIC_PLAYERS");
+    if (engine_config.music_buffer_count < 2)
+        throw std::out_of_range("audio::engine::engine: music players need at least 2 buffers");
+    if (engine_config.music_max_buffer_count < engine_config.music_buffer_count)
+        throw std::out_of_range("audio::engine::engine: music max buffer count must be at least the music buffer count");
+    if (engine_config.music_buffer_size < 4096 || engine_config.music_buffer_size % 8 != 0)
+        throw std::out_of_range("audio::engine::engine: music buffer size must be a multiple of 8 of at least 4096");
+    if (engine_config.use_loopback && engine_config.loopback_sample_rate <= 0)
+        throw std::out_of_range("audio::engine::engine: loopback sample rate must be positive");
+    if (engine_config.bus_names.empty() || engine_config.bus_names.size() > MAX_BUSES)
+        throw std::out_of_range("audio::engine::engine: bus count must be between 1 and MAX_BUSES");
+    for (std::size_t bus_index = 0; bus_index < engine_config.bus_names.size(); bus_index++) {
+        if (std::find(engine_config.bus_names.begin(), engine_config.bus_names.begin() + bus_index, engine_config.bus_names[bus_index]) != engine_config.bus_names.begin() + bus_index)
+            throw std::invalid_argument("audio::engine::engine: bus names must be distinct");
+    }
+    return engine_config;
+}
+
+template <typename F>
+void engine::parallel_for(std::size_t count, const F& function) {
+    std::atomic<std::size_t> next_index = 0;
+    std::exception_ptr worker_exception;
+    std::mutex worker_exception_lock;
+    const auto worker = [&]() {
+        try {
+            for (std::size_t i = next_index++; i < count; i = next_index++)
+                function(i);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(worker_exception_lock);
+            if (!worker_exception)
+                worker_exception = std::current_exception();
+            next_index = count;
+        }
+    };
+    
+    std::size_t worker_count = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < worker_count; i++)
+        workers.emplace_back(worker);
+    worker();
+    for (std::thread& worker_thread : workers)
+        worker_thread.join();
+        
+    if (worker_exception)
+        std::rethrow_exception(worker_exception);
+}
+
+void engine::render(std::int16_t* out, std::size_t frames) {
+    if (!is_loopback)
+        throw std::logic_error("audio::engine::render: engine isn't rendering offline (construct it with config::use_loopback)");
+        
+    // updating every RENDER_UPDATE_FRAMES keeps music and mix queues fed the way the engine's thread would in real time
+    KEE_AUDIO_METRIC(metric_timer render_timer(metrics.render_time));
+    while (frames > 0) {
+        std::size_t update_frames = std::min(frames, RENDER_UPDATE_FRAMES);
+        update_engine();
+        alc_render_samples_soft(alc_device, out, static_cast<ALCsizei>(update_frames)); CHECK_ALC_ERRORS(alc_device);
+        loopback_frames.fetch_add(update_frames, std::memory_order_release);
+        KEE_AUDIO_METRIC(metrics.rendered_frames += update_frames);
+        
+        out += update_frames * 2;
+        frames -= update_frames;
+    }
+}
+
+void engine::render_wav(const std::filesystem::path& wav_path, double duration) {
+    if (duration < 0.0)
+        throw std::out_of_range("audio::engine::render_wav: Duration must be positive");
+        
+    std::size_t frames = static_cast<std::size_t>(duration * mix_sample_rate);
+    std::vector<std::int16_t> samples(frames * 2);
+    render(samples.data(), frames);
+    
+    write_wav(wav_path, samples, 2, mix_sample_rate);
 }
 
-float engine::get_volume() {
+float engine::get_volume() const {
     float volume;
     alGetListenerf(AL_GAIN, &volume); CHECK_AL_ERRORS();
     return volume;
@@ -29,539 +161,4994 @@ void engine::set_volume(float new_volume) {
     alListenerf(AL_GAIN, new_volume); CHECK_AL_ERRORS();
 }
 
-void engine::play_sfx(const std::string& sfx_file_name) {
-    const sfx_t& sfx = singleton().sfx_map.at(sfx_file_name);
+engine::bus_id engine::lookup_bus(std::string_view bus_name) const {
+    for (std::size_t bus_index = 0; bus_index < buses.size(); bus_index++) {
+        if (buses[bus_index].name == bus_name)
+            return { static_cast<std::uint32_t>(bus_index) };
+    }
+    throw std::out_of_range("audio::engine::lookup_bus: bus does not exist");
+}
 
-    ALuint source_id;
-    alGenSources(1, &source_id); CHECK_AL_ERRORS();
-    
-    alSourcef(source_id, AL_PITCH, 1); CHECK_AL_ERRORS();
-    alSourcef(source_id, AL_GAIN, 1.0f); CHECK_AL_ERRORS();
-    alSource3f(source_id, AL_POSITION, 0.0f, 0.0f, 0.0f); CHECK_AL_ERRORS();
-    alSourcei(source_id, AL_LOOPING, AL_FALSE); CHECK_AL_ERRORS();
-    
-    ALuint buffer_id;
-    alGenBuffers(1, &buffer_id); CHECK_AL_ERRORS();
-    alBufferData(buffer_id, sfx.format, sfx.data.data(), static_cast<ALsizei>(sfx.data.size()), sfx.sample_rate); CHECK_AL_ERRORS();
-    alSourcei(source_id, AL_BUFFER, buffer_id); CHECK_AL_ERRORS();
+void engine::set_bus_gain(bus_id bus, float gain) {
+    if (gain < 0.0f)
+        throw std::out_of_range("audio::engine::set_bus_gain: Gain must be positive");
+        
+    buses.at(bus.index).gain.store(gain, std::memory_order_relaxed);
     
-    alSourcePlay(source_id); CHECK_AL_ERRORS();
+    // the software mixer reads the bus's gain every block, sources need theirs set
+    if (!is_software_mixing) {
+        std::unique_lock<std::mutex> lock(sfx_mixer_lock);
+        update_bus_voices(bus.index);
+        lock.unlock();
+        CHECK_AL_ERRORS();
+    }
     
-    singleton().sfx_mixer_lock.lock();
-    singleton().sfx_mixer.emplace_back(source_id, buffer_id);
-    singleton().sfx_mixer_lock.unlock();
+    is_bus_gain_changed.store(true, std::memory_order_release);
+    wake_polling_thread();
 }
 
-void engine::pause_sfx_mixer() {
-    singleton().sfx_mixer_lock.lock();
-    for (const sfx_buffers& sfx : singleton().sfx_mixer)
-        alSourcePause(sfx.get_source_id());
-    singleton().sfx_mixer_lock.unlock();
-    CHECK_AL_ERRORS();
+float engine::get_bus_gain(bus_id bus) const {
+    return buses.at(bus.index).gain.load(std::memory_order_relaxed);
 }
 
-void engine::unpause_sfx_mixer() {
-    singleton().sfx_mixer_lock.lock();
-    for (const sfx_buffers& sfx : singleton().sfx_mixer)
-        alSourcePlay(sfx.get_source_id());
-    singleton().sfx_mixer_lock.unlock();
+void engine::pause_bus(bus_id bus) {
+    std::unique_lock<std::mutex> lock(sfx_mixer_lock);
+    buses.at(bus.index).is_paused.store(true, std::memory_order_relaxed);
+    if (!is_software_mixing) {
+        std::vector<ALuint>& sources = sfx_source_batch;
+        sources.clear();
+        for (std::size_t voice_index = sfx_active_head; voice_index != NO_SFX_VOICE; voice_index = sfx_mixer[voice_index].active_next) {
+            const sfx_voice& voice = sfx_mixer[voice_index];
+            if (voice.bus == bus.index)
+                sources.push_back(voice.source_id);
+        }
+        if (!sources.empty())
+            alSourcePausev(static_cast<ALsizei>(sources.size()), sources.data());
+    }
+    lock.unlock();
     CHECK_AL_ERRORS();
 }
 
-void engine::stop_sfx_mixer() {
-    singleton().sfx_mixer_lock.lock();
-    for (const sfx_buffers& sfx : singleton().sfx_mixer)
-        alSourceStop(sfx.get_source_id());
-    singleton().sfx_mixer_lock.unlock();
+void engine::unpause_bus(bus_id bus) {
+    std::unique_lock<std::mutex> lock(sfx_mixer_lock);
+    buses.at(bus.index).is_paused.store(false, std::memory_order_relaxed);
+    if (!is_software_mixing && !is_sfx_paused) {
+        // also starts the voices played while the bus was paused
+        std::vector<ALuint>& sources = sfx_source_batch;
+        sources.clear();
+        for (std::size_t voice_index = sfx_active_head; voice_index != NO_SFX_VOICE; voice_index = sfx_mixer[voice_index].active_next) {
+            const sfx_voice& voice = sfx_mixer[voice_index];
+            if (voice.bus == bus.index && !voice.is_stop_requested.load(std::memory_order_acquire))
+                sources.push_back(voice.source_id);
+        }
+        if (!sources.empty())
+            alSourcePlayv(static_cast<ALsizei>(sources.size()), sources.data());
+    }
+    lock.unlock();
     CHECK_AL_ERRORS();
+    wake_polling_thread();
 }
 
-void engine::set_player_music(const std::string& music_file_name, std::size_t index) {
-    singleton().music_mixer_lock.lock();
-    music_player& player = singleton().music_mixer.at(index);
-    
-    player.wav_key = music_file_name;
-    player.music_file = std::ifstream("assets/music/" + music_file_name);
-    player.cursor = 0;
-    
-    const music_t& music = singleton().music_map.at(music_file_name);
-    player.update_buffer_queue(music);
-    singleton().music_mixer_lock.unlock();
+bool engine::is_bus_paused(bus_id bus) const {
+    return buses.at(bus.index).is_paused.load(std::memory_order_relaxed);
 }
 
-void engine::unset_player_music(std::size_t index) {
-    music_player& player = singleton().music_mixer.at(index);
-    
-    alSourcei(player.source_id, AL_BUFFER, NULL); CHECK_AL_ERRORS();
-    player.wav_key = "";
-    player.music_file = std::ifstream();
-    player.cursor = 0;
+void engine::set_player_bus(bus_id bus, std::size_t index) {
+    if (index >= music_mixer.size())
+        throw std::out_of_range("audio::engine::set_player_bus: music player index is out of range");
+    if (bus.index >= buses.size())
+        throw std::out_of_range("audio::engine::set_player_bus: bus does not exist");
+        
+    post_music_command({ music_command::type::set_bus, index, nullptr, 0.0f, bus.index, 0.0, nullptr });
 }
 
-void engine::play_music_player(std::size_t index) {
-    singleton().music_mixer_lock.lock();
-    if (singleton().music_mixer.at(index).wav_key.empty())
-        throw std::logic_error("audio::engine::play_music_player: music player has no music set (use audio::engine::set_player_music)");
-    
-    alSourcePlay(singleton().music_mixer.at(index).source_id); CHECK_AL_ERRORS();
-    singleton().music_mixer_lock.unlock();
+void engine::set_bus_filter(bus_id bus, filter_type type, float cutoff, float q) {
+    if (!is_software_mixing)
+        throw std::logic_error("audio::engine::set_bus_filter: Bus effects need the software mixer");
+    if (cutoff <= 0.0f)
+        throw std::out_of_range("audio::engine::set_bus_filter: Cutoff must be positive");
+    if (q <= 0.0f)
+        throw std::out_of_range("audio::engine::set_bus_filter: Q must be positive");
+        
+    buses.at(bus.index).effects.set_filter(type, cutoff, q);
 }
 
-void engine::pause_music_player(std::size_t index) {
-    singleton().music_mixer_lock.lock();
-    if (singleton().music_mixer.at(index).wav_key.empty())
-        throw std::logic_error("audio::engine::play_music_player: music player has no music set (use audio::engine::set_player_music)");
-    
-    alSourcePause(singleton().music_mixer.at(index).source_id); CHECK_AL_ERRORS();
-    singleton().music_mixer_lock.unlock();
+void engine::set_bus_reverb(bus_id bus, float wet, float room_size, float damping) {
+    if (!is_software_mixing)
+        throw std::logic_error("audio::engine::set_bus_reverb: Bus effects need the software mixer");
+    if (wet < 0.0f || wet > 1.0f || room_size < 0.0f || room_size > 1.0f || damping < 0.0f || damping > 1.0f)
+        throw std::out_of_range("audio::engine::set_bus_reverb: Wet, room size and damping must be between 0.0 and 1.0");
+        
+    buses.at(bus.index).effects.set_reverb(wet, room_size, damping);
 }
 
-bool engine::is_music_playing(std::size_t index) {
-    ALint source_state;
-    singleton().music_mixer_lock.lock();
-    alGetSourcei(singleton().music_mixer.at(index).source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
-    singleton().music_mixer_lock.unlock();
-    return source_state == AL_PLAYING;
+engine::sfx_id engine::lookup_sfx(std::string_view sfx_file_name) const {
+    auto sfx_key = sfx_keys.find(asset_key(sfx_file_name).hash);
+    if (sfx_key == sfx_keys.end() || sfx_ids[sfx_key->second]->first != sfx_file_name)
+        throw std::out_of_range("audio::engine::lookup_sfx: sfx file does not exist");
+        
+    return { sfx_key->second };
 }
 
-float engine::get_music_duration(const std::string& music_file_name) {
-    singleton().music_mixer_lock.lock();
-    float res = singleton().music_map.at(music_file_name).duration;
-    singleton().music_mixer_lock.unlock();
-    return res;
+engine::sfx_id engine::lookup_sfx(asset_key key) const {
+    auto sfx_key = sfx_keys.find(key.hash);
+    if (sfx_key == sfx_keys.end())
+        throw std::out_of_range("audio::engine::lookup_sfx: sfx file does not exist");
+        
+    return { sfx_key->second };
 }
 
-void engine::set_playback_time(float time, std::size_t index) {
-    singleton().music_mixer_lock.lock();
-    music_player& player = singleton().music_mixer.at(index);
-    if (player.wav_key.empty())
-        throw std::logic_error("audio::engine::set_playback_time: music player has no music set (use audio::engine::set_player_music)");
+engine::music_id engine::lookup_music(std::string_view music_file_name) const {
+    auto music_key = music_keys.find(asset_key(music_file_name).hash);
+    if (music_key == music_keys.end() || music_ids[music_key->second]->first != music_file_name)
+        throw std::out_of_range("audio::engine::lookup_music: music file does not exist");
         
-    const music_t& music = singleton().music_map.at(player.wav_key);
-    if (time <= 0.0f)
-        player.cursor = 0;
-    else if (time >= music.duration)
-        player.cursor = music.data_size;
-    else {
-        float playback_percent = time / music.duration;
-        player.cursor = playback_percent * music.data_size;
-        if (music.is_duo_byte_sampled)
-            player.cursor -= player.cursor % 2;
-    }
-    
-    player.update_buffer_queue(music);
-    singleton().music_mixer_lock.unlock();
+    return { music_key->second };
 }
 
-//--- ENGINE::MUSIC_PLAYER ---//
-
-engine::music_player::music_player() { }
-
-void engine::music_player::update_buffer_queue(const music_t& music) {
-    alSourceStop(source_id); CHECK_AL_ERRORS();
-    alSourcei(source_id, AL_BUFFER, NULL); CHECK_AL_ERRORS();
-    ALint buffer_count = 0;
-    while (buffer_count < buffer_ids.size()) {
-        ALsizei buffer_size = static_cast<ALsizei>(std::min(MUSIC_BUFFER_SIZE, music.data_size - cursor));
-        buffer_size -= buffer_size % 8;
-        if (buffer_size == 0)
-            break;
+engine::music_id engine::lookup_music(asset_key key) const {
+    auto music_key = music_keys.find(key.hash);
+    if (music_key == music_keys.end())
+        throw std::out_of_range("audio::engine::lookup_music: music file does not exist");
         
-        std::vector<byte> buffer_data(buffer_size);
-        music_file.seekg(music.data_start + cursor);
-        music_file.read(buffer_data.data(), buffer_size);
-        alBufferData(buffer_ids[buffer_count], music.format, buffer_data.data(), buffer_size, music.sample_rate); CHECK_AL_ERRORS();
-        buffer_count++;
-        
-        cursor += buffer_size;
-        if (buffer_size < MUSIC_BUFFER_SIZE) {
-            cursor = music.data_size;
-            break;
-        }
-    }
-    alSourceQueueBuffers(source_id, buffer_count, buffer_ids.data()); CHECK_AL_ERRORS();
+    return { music_key->second };
 }
 
-//----------------------------//
-
-void engine::fetch_al_errors(const std::filesystem::path& file, int line) {
-    bool error_found = false;
-    std::stringstream err_msg_stream;
-    
-    ALenum error_flag = alGetError();
-    while (error_flag != AL_NO_ERROR) {
-        if (!error_found) {
-            error_found = true;
-            err_msg_stream << "OpenAL Flags: ";
-        }
-        
-        switch (error_flag) {
-        case AL_INVALID_NAME:
-            err_msg_stream << "\"AL_INVALID_NAME\" ";
-            break;
-        case AL_INVALID_ENUM:
-            err_msg_stream << "\"AL_INVALID_ENUM\" ";
-            break;
-        case AL_INVALID_VALUE:
-            err_msg_stream << "\"AL_INVALID_VALUE\" ";
-            break;
-        case AL_INVALID_OPERATION:
-            err_msg_stream << "\"AL_INVALID_OPERATION\" ";
-            break;
-        case AL_OUT_OF_MEMORY:
-            err_msg_stream << "\"AL_OUT_OF_MEMORY\" ";
-            break;
-        default:
-            err_msg_stream << "\"Flag not deducable\" ";
-            break;
-        }
-        
-        error_flag = alGetError();
-    }
-    
-    if (error_found) {
-        err_msg_stream << "File " << file << " @ Line " << line;
-        throw std::runtime_error(err_msg_stream.str());
-    }
+engine::sfx_handle engine::play_sfx(std::string_view sfx_file_name, float gain, float pan, bus_id bus) {
+    return play_sfx(lookup_sfx(sfx_file_name), gain, pan, bus);
 }
 
-void engine::fetch_alc_errors(ALCdevice* device, const std::filesystem::path& file, int line) {
-    bool error_found = false;
-    std::stringstream err_msg_stream;
+engine::sfx_handle engine::play_sfx(sfx_id id, float gain, float pan, bus_id bus) {
+    KEE_AUDIO_METRIC(metric_timer play_timer(metrics.play_sfx_latency));
+    KEE_AUDIO_METRIC(std::chrono::steady_clock::time_point trigger_time = std::chrono::steady_clock::now());
+    if (gain < 0.0f)
+        throw std::out_of_range("audio::engine::play_sfx: Gain must be positive");
+    if (pan < -1.0f || pan > 1.0f)
+        throw std::out_of_range("audio::engine::play_sfx: Pan must be between -1.0 and 1.0");
+    if (bus.index >= buses.size())
+        throw std::out_of_range("audio::engine::play_sfx: bus does not exist");
+
+    sfx_t& sfx = sfx_ids.at(id.index)->second;
+    load_sfx(sfx, true);
     
-    ALCenum error_flag = alcGetError(device);
-    while (error_flag != ALC_NO_ERROR) {
-        if (!error_found) {
-            error_found = true;
-            err_msg_stream << "OpenAL Flags: ";
-        }
-        
-        switch (error_flag) {
-        case ALC_INVALID_DEVICE:
-            err_msg_stream << "\"ALC_INVALID_DEVICE\" ";
-            break;
-        case ALC_INVALID_CONTEXT:
-            err_msg_stream << "\"ALC_INVALID_CONTEXT\" ";
-            break;
-        case ALC_INVALID_ENUM:
-            err_msg_stream << "\"ALC_INVALID_ENUM\" ";
-            break;
-        case ALC_INVALID_VALUE:
-            err_msg_stream << "\"ALC_INVALID_VALUE\" ";
-            break;
-        case ALC_OUT_OF_MEMORY:
-            err_msg_stream << "\"ALC_OUT_OF_MEMORY\" ";
-            break;
-        default:
-            err_msg_stream << "\"Flag not deducable\" ";
-            break;
+    KEE_AUDIO_METRIC(metric_timer lock_wait_timer(metrics.sfx_mixer_lock_wait));
+    std::unique_lock<std::mutex> lock(sfx_mixer_lock);
+    KEE_AUDIO_METRIC(lock_wait_timer.stop());
+    std::optional<std::size_t> voice_index = acquire_sfx_voice(sfx, gain, pan, bus.index);
+    if (!voice_index.has_value())
+        return sfx_handle();
+    KEE_AUDIO_METRIC(sfx_mixer[voice_index.value()].trigger_time = trigger_time);
+    
+    bool is_batched = is_sfx_batching;
+    if (is_batched)
+        sfx_batch.push_back(voice_index.value());
+    else {
+        const sfx_voice& voice = sfx_mixer[voice_index.value()];
+        if (!is_software_mixing && !is_sfx_bus_paused(voice)) {
+            alSourcePlay(voice.source_id); CHECK_AL_ERRORS_DEBUG();
         }
-        
-        error_flag = alcGetError(device);
+        push_sfx_active(voice_index.value());
     }
+    sfx_handle res = get_sfx_handle(voice_index.value());
+    lock.unlock();
+    CHECK_AL_ERRORS();
     
-    if (error_found) {
-        err_msg_stream << "File " << file << " @ Line " << line;
-        throw std::runtime_error(err_msg_stream.str());
-    }
+    if (!is_batched)
+        wake_polling_thread();
+    return res;
 }
 
-engine& engine::singleton() {
-    static engine singleton = engine();
-    return singleton;
+engine::sfx_handle engine::schedule_sfx(std::string_view sfx_file_name, double audio_time, std::size_t player_index, float gain, float pan, bus_id bus) {
+    return schedule_sfx(lookup_sfx(sfx_file_name), audio_time, player_index, gain, pan, bus);
 }
 
-engine::engine() {
-    alc_device = alcOpenDevice(nullptr); CHECK_ALC_ERRORS(alc_device);
-    if (alc_device == nullptr)
-        throw std::ios_base::failure("alcOpenDevice: Unable to create OpenAL device");
-        
-    alc_context = alcCreateContext(alc_device, nullptr); CHECK_ALC_ERRORS(alc_device);
-    if (alc_context == nullptr)
-        throw std::ios_base::failure("alcCreateContext: Unable to create OpenAL context");
+engine::sfx_handle engine::schedule_sfx(sfx_id id, double audio_time, std::size_t player_index, float gain, float pan, bus_id bus) {
+    if (gain < 0.0f)
+        throw std::out_of_range("audio::engine::schedule_sfx: Gain must be positive");
+    if (pan < -1.0f || pan > 1.0f)
+        throw std::out_of_range("audio::engine::schedule_sfx: Pan must be between -1.0 and 1.0");
+    if (player_index >= music_mixer.size())
+        throw std::out_of_range("audio::engine::schedule_sfx: music player index is out of range");
+    if (bus.index >= buses.size())
+        throw std::out_of_range("audio::engine::schedule_sfx: bus does not exist");
         
-    if (!alcMakeContextCurrent(alc_context))
-        throw std::ios_base::failure("alcMakeCurrentContext: Could not set OpenAL context to current context");
-    CHECK_ALC_ERRORS(alc_device);
-    
-    alListenerf(AL_GAIN, 0.25f); CHECK_AL_ERRORS();
-    alListener3f(AL_POSITION, 0.0f, 0.0f, 0.0f); CHECK_AL_ERRORS();
+    sfx_t& sfx = sfx_ids.at(id.index)->second;
+    load_sfx(sfx, true);
     
-    static const auto open_wav = [](const std::string& file_name, const std::string& full_path) -> std::ifstream {
-        if (file_name.substr(file_name.size() - 4) != ".wav")
-            throw std::logic_error("audio::engine::open_wav: attempted opening a non .wav file");
+    std::unique_lock<std::mutex> lock(sfx_mixer_lock);
+    std::optional<std::size_t> voice_index = acquire_sfx_voice(sfx, gain, pan, bus.index);
+    if (!voice_index.has_value())
+        return sfx_handle();
     
-        std::ifstream wav_file(full_path, std::ios::binary);
-        if (!wav_file.is_open())
-            throw std::filesystem::filesystem_error("audio::engine::open_wav: Could not open wav file at" + full_path, std::error_code());
-            
-        return wav_file;
-    };
+    sfx_schedule.push_back({ voice_index.value(), player_index, audio_time, 0.0 });
+    sfx_handle res = get_sfx_handle(voice_index.value());
+    lock.unlock();
     
-    static const auto load_wav = [](std::ifstream& wav_file) -> wav {
-        static const auto buffer_to_number = [](byte* buffer, std::size_t len) -> std::int32_t {
-            if (len > 4)
-                throw std::logic_error("audio::engine::buffer_to_number: Buffer can only contain up at 4 bytes");
-            
-            if constexpr (std::endian::native == std::endian::big)
-                std::reverse(buffer, buffer + len);
-            
-            std::int32_t res = 0;
-            std::memcpy(&res, buffer, len);
-            return res;
-        };
-            
-        std::array<char, 4> wav_header_buffer;
+    wake_polling_thread();
+    return res;
+}
+
+void engine::set_sfx_gain(sfx_handle handle, float gain) {
+    if (gain < 0.0f)
+        throw std::out_of_range("audio::engine::set_sfx_gain: Gain must be positive");
         
-        if (!wav_file.read(wav_header_buffer.data(), 4))
-            throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read RIFF", std::error_code());
-        if (std::strncmp(wav_header_buffer.data(), "RIFF", 4) != 0)
-            throw std::filesystem::filesystem_error("audio::engine::load_wav: wav header does not contain RIFF", std::error_code());
-            
-        if (!wav_file.read(wav_header_buffer.data(), 4))
-            throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read size of wav file", std::error_code());
-            
-        if (!wav_file.read(wav_header_buffer.data(), 4))
-            throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read WAVE", std::error_code());
-        if (std::strncmp(wav_header_buffer.data(), "WAVE", 4) != 0)
-            throw std::filesystem::filesystem_error("audio::engine::load_wav: wav header does not contain WAVE", std::error_code());
+    std::unique_lock<std::mutex> voice_lock;
+    sfx_voice* voice = lock_sfx_voice(handle, voice_lock);
+    if (voice == nullptr)
+        return;
         
-        int num_channels = 0;
-        int sample_rate = 0;
-        int bits_per_sample = 0;
-        ALenum format = AL_NONE;
-        std::vector<byte> wav_data;
+    voice->gain = gain;
+    update_sfx_voice_mix(*voice);
+}
+
+void engine::set_sfx_pan(sfx_handle handle, float pan) {
+    if (pan < -1.0f || pan > 1.0f)
+        throw std::out_of_range("audio::engine::set_sfx_pan: Pan must be between -1.0 and 1.0");
         
-        while (wav_file.good() && wav_file.peek() != EOF) {
-            if (!wav_file.read(wav_header_buffer.data(), 4))
-                throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read chunk ID", std::error_code());
-            
-            if (std::strncmp(wav_header_buffer.data(), "fmt ", 4) == 0) {
-                if (!wav_file.read(wav_header_buffer.data(), 4))
-                    throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read chunk size", std::error_code());
-                
-                if (!wav_file.read(wav_header_buffer.data(), 2))
-                    throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read audio format", std::error_code());
-                
-                if (!wav_file.read(wav_header_buffer.data(), 2))
-                    throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read number of channels", std::error_code());
-                num_channels = buffer_to_number(wav_header_buffer.data(), 2);
-                
-                if (!wav_file.read(wav_header_buffer.data(), 4))
-                    throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read sample rate", std::error_code());
-                sample_rate = buffer_to_number(wav_header_buffer.data(), 4);
-                
-                if (!wav_file.read(wav_header_buffer.data(), 4))
-                    throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read byte rate", std::error_code());
-                    
-                if (!wav_file.read(wav_header_buffer.data(), 2))
-                    throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read block align", std::error_code());
-                    
-                if (!wav_file.read(wav_header_buffer.data(), 2))
-                    throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read bits per sample", std::error_code());
-                bits_per_sample = buffer_to_number(wav_header_buffer.data(), 2);
-                
-                if (num_channels == 1 && bits_per_sample == 8)
-                    format = AL_FORMAT_MONO8;
-                else if (num_channels == 1 && bits_per_sample == 16)
-                    format = AL_FORMAT_MONO16;
-                else if (num_channels == 2 && bits_per_sample == 8)
-                    format = AL_FORMAT_STEREO8;
-                else if (num_channels == 2 && bits_per_sample == 16)
-                    format = AL_FORMAT_STEREO16;
-                else
-                    throw std::filesystem::filesystem_error("audio::engine::load_wav: Invalid filesystem format", std::error_code());
-            }
-            else if (std::strncmp(wav_header_buffer.data(), "data", 4) == 0) {
-                if (!wav_file.read(wav_header_buffer.data(), 4))
-                    throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read wav size", std::error_code());
-                    
-                std::size_t data_start = wav_file.tellg();
-                std::size_t data_size = buffer_to_number(wav_header_buffer.data(), 4);
-                
-                float num_samples = data_size / (num_channels * bits_per_sample / 8);
-                float duration = num_samples / sample_rate;
-                return std::make_tuple(sample_rate, format, data_start, data_size, duration);
-            }
-            else {
-                if (!wav_file.read(wav_header_buffer.data(), 4))
-                    throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read LIST chunk size", std::error_code());
-                    
-                ALsizei list_chunk_size = buffer_to_number(wav_header_buffer.data(), 4);
-                wav_file.ignore(list_chunk_size);
-            }
-        }
+    std::unique_lock<std::mutex> voice_lock;
+    sfx_voice* voice = lock_sfx_voice(handle, voice_lock);
+    if (voice == nullptr)
+        return;
         
-        throw std::filesystem::filesystem_error("audio::engine::load_wav: wav file stream went bad or could not find data chunk", std::error_code());
-    };
+    voice->pan = pan;
+    update_sfx_voice_mix(*voice);
+}
 
-    for (const std::filesystem::directory_entry& full_path : std::filesystem::directory_iterator("assets/sfx/")) {
-        std::string file_name = full_path.path().string().substr(directory.string().size());
-        if (file_name[0] == '/')
-            file_name.erase(0, 1);
+void engine::set_sfx_pitch(sfx_handle handle, float pitch) {
+    if (pitch <= 0.0f)
+        throw std::out_of_range("audio::engine::set_sfx_pitch: Pitch must be greater than 0.0");
         
-        if (file_name == ".DS_Store")
-            continue;
-            
-        if (music_map.find(file_name) != music_map.end())
-            throw std::logic_error("audio::engine::load_wav: music file name already exists");
-    
-        std::ifstream music_file = open_wav(file_name, full_path.path().string());
-        const auto [sample_rate, format, data_start, data_size, duration] = load_wav(music_file);
-        music_map.try_emplace(file_name, sample_rate, format, data_start, data_size, duration);
-    }
-    
-    for (const std::filesystem::directory_entry& full_path : std::filesystem::directory_iterator("assets/music/")) {
-        std::string file_name = full_path.path().string().substr(directory.string().size());
-        if (file_name[0] == '/')
-            file_name.erase(0, 1);
+    std::unique_lock<std::mutex> voice_lock;
+    sfx_voice* voice = lock_sfx_voice(handle, voice_lock);
+    if (voice == nullptr)
+        return;
         
-        if (file_name == ".DS_Store")
-            continue;
-            
-        if (music_map.find(file_name) != music_map.end())
-            throw std::logic_error("audio::engine::load_wav: music file name already exists");
-    
-        std::ifstream music_file = open_wav(file_name, full_path.path().string());
-        const auto [sample_rate, format, data_start, data_size, duration] = load_wav(music_file);
-        music_map.try_emplace(file_name, sample_rate, format, data_start, data_size, duration);
-    }
-    
-    for (music_player& player : music_mixer) {
-        alGenSources(1, &player.source_id); CHECK_AL_ERRORS();
-        alSourcef(player.source_id, AL_PITCH, 1); CHECK_AL_ERRORS();
-        alSourcef(player.source_id, AL_GAIN, 1.0f); CHECK_AL_ERRORS();
-        alSource3f(player.source_id, AL_POSITION, 0.0f, 0.0f, 0.0f); CHECK_AL_ERRORS();
-        alSourcei(player.source_id, AL_LOOPING, AL_FALSE); CHECK_AL_ERRORS();
+    voice->pitch.store(pitch, std::memory_order_relaxed);
+    update_sfx_voice_mix(*voice);
+}
+
+void engine::stop_sfx(sfx_handle handle) {
+    std::unique_lock<std::mutex> voice_lock;
+    sfx_voice* voice = lock_sfx_voice(handle, voice_lock);
+    if (voice == nullptr)
+        return;
         
-        alGenBuffers(4, player.buffer_ids.data());
+    // silenced right away, the engine's thread frees the voice (or drops it from the batch or schedule)
+    voice->is_stop_requested.store(true, std::memory_order_release);
+    if (voice->source_id != 0) {
+        alSourceStop(voice->source_id); CHECK_AL_ERRORS_DEBUG();
     }
-    
-    should_thread_close = false;
-    polling_thread = std::thread(&engine::engine_polling_thread, this);
+    voice_lock.unlock();
+    CHECK_AL_ERRORS();
+    wake_polling_thread();
 }
 
-engine::~engine() {
-    sfx_mixer_lock.unlock();
-    music_mixer_lock.unlock();
-    should_thread_close = true;
-    polling_thread.join();
+bool engine::is_sfx_playing(sfx_handle handle) const {
+    if (handle.index >= sfx_mixer.size())
+        return false;
+        
+    const sfx_voice& voice = sfx_mixer[handle.index];
+    return voice.generation.load(std::memory_order_acquire) == handle.generation && !voice.is_stop_requested.load(std::memory_order_acquire);
+}
+
+void engine::begin_sfx_batch() {
+    std::lock_guard<std::mutex> lock(sfx_mixer_lock);
+    is_sfx_batching = true;
+}
+
+void engine::end_sfx_batch() {
+    std::unique_lock<std::mutex> lock(sfx_mixer_lock);
+    is_sfx_batching = false;
+    if (sfx_batch.empty())
+        return;
     
-    for (const sfx_buffers& sfx : sfx_mixer) {
-        alSourceStop(sfx.get_source_id()); CHECK_AL_ERRORS();
-        alDeleteSources(1, sfx.get_source_id_addr()); CHECK_AL_ERRORS();
-        alDeleteBuffers(1, sfx.get_buffer_id_addr()); CHECK_AL_ERRORS();
+    // voices stopped while batched never start
+    std::erase_if(sfx_batch, [this](std::size_t voice_index) -> bool {
+        return free_stopped_sfx_voice(voice_index);
+    });
+    if (!is_software_mixing && !sfx_batch.empty()) {
+        defer_al_updates();
+        sfx_source_batch.clear();
+        for (std::size_t voice_index : sfx_batch) {
+            if (!is_sfx_bus_paused(sfx_mixer[voice_index]))
+                sfx_source_batch.push_back(sfx_mixer[voice_index].source_id);
+        }
+        if (!sfx_source_batch.empty()) {
+            alSourcePlayv(static_cast<ALsizei>(sfx_source_batch.size()), sfx_source_batch.data()); CHECK_AL_ERRORS_DEBUG();
+        }
+        process_al_updates();
     }
     
-    for (music_player& player : music_mixer) {
-        alSourceStop(player.source_id); CHECK_AL_ERRORS();
-        alSourcei(player.source_id, AL_BUFFER, NULL); CHECK_AL_ERRORS();
-        alDeleteSources(1, &player.source_id); CHECK_AL_ERRORS();
-        alDeleteBuffers(4, player.buffer_ids.data()); CHECK_AL_ERRORS();
+    // the software mixer starts every batched voice on the same block
+    for (std::size_t voice_index : sfx_batch)
+        push_sfx_active(voice_index);
+    sfx_batch.clear();
+    lock.unlock();
+    CHECK_AL_ERRORS();
+    wake_polling_thread();
+}
+
+void engine::pause_sfx_mixer() {
+    std::unique_lock<std::mutex> lock(sfx_mixer_lock);
+    is_sfx_paused = true;
+    if (is_software_mixing)
+        alSourcePause(mix_source_id);
+    else {
+        std::vector<ALuint>& sources = sfx_source_batch;
+        sources.clear();
+        for (std::size_t voice_index = sfx_active_head; voice_index != NO_SFX_VOICE; voice_index = sfx_mixer[voice_index].active_next)
+            sources.push_back(sfx_mixer[voice_index].source_id);
+        if (!sources.empty())
+            alSourcePausev(static_cast<ALsizei>(sources.size()), sources.data());
     }
-    
-    alcMakeContextCurrent(nullptr); CHECK_ALC_ERRORS(alc_device);
-    alcDestroyContext(alc_context); CHECK_ALC_ERRORS(alc_device);
-    alcCloseDevice(alc_device); CHECK_ALC_ERRORS(alc_device);
+    lock.unlock();
+    CHECK_AL_ERRORS();
 }
 
-void engine::engine_polling_thread() {
-    while (!should_thread_close) {
-        sfx_mixer_lock.lock();
-        std::erase_if(sfx_mixer, [](const sfx_buffers& sfx) -> bool {
-            ALint source_state = AL_PLAYING;
-            alGetSourcei(sfx.get_source_id(), AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
-            if (source_state != AL_STOPPED)
-                return false;
-                
-            alDeleteSources(1, sfx.get_source_id_addr()); CHECK_AL_ERRORS();
-            alDeleteBuffers(1, sfx.get_buffer_id_addr()); CHECK_AL_ERRORS();
-            return true;
-        });
-        sfx_mixer_lock.unlock();
-        
-        music_mixer_lock.lock();
-        for (music_player& player : music_mixer) {
-            ALint source_state = AL_NONE;
-            alGetSourcei(player.source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
-            
-            if (source_state != AL_PLAYING)
-                continue;
-              
-            ALint buffers_processed;
-            alGetSourcei(player.source_id, AL_BUFFERS_PROCESSED, &buffers_processed); CHECK_AL_ERRORS();
-            while (buffers_processed > 0) {
-                buffers_processed--;
-            
-                ALuint buffer;
-                alSourceUnqueueBuffers(player.source_id, 1, &buffer); CHECK_AL_ERRORS();
-                
-                const music_t& music = singleton().music_map.at(player.wav_key);
-                if (player.cursor >= music.data_size)
-                    continue;
-                    
-                ALsizei buffer_size = static_cast<ALsizei>(std::min(MUSIC_BUFFER_SIZE, music.data_size - player.cursor));
-                buffer_size -= buffer_size % 8;
-                
-                std::vector<byte> buffer_data(buffer_size);
-                player.music_file.seekg(music.data_start + player.cursor);
-                player.music_file.read(buffer_data.data(), buffer_size);
-                
-                alBufferData(buffer, music.format, buffer_data.data(), buffer_size, music.sample_rate); CHECK_AL_ERRORS();
-                alSourceQueueBuffers(player.source_id, 1, &buffer); CHECK_AL_ERRORS();
-                
-                player.cursor += buffer_size;
-                if (buffer_size < MUSIC_BUFFER_SIZE)
-                    player.cursor = music.data_size;
-            }
+void engine::unpause_sfx_mixer() {
+    std::unique_lock<std::mutex> lock(sfx_mixer_lock);
+    is_sfx_paused = false;
+    if (is_software_mixing) {
+        ALint source_state = AL_NONE;
+        alGetSourcei(mix_source_id, AL_SOURCE_STATE, &source_state);
+        if (source_state == AL_PAUSED)
+            alSourcePlay(mix_source_id);
+    }
+    else {
+        // a voice stopped through its handle stays stopped until the engine's thread frees it, one on a paused bus until it's unpaused
+        std::vector<ALuint>& sources = sfx_source_batch;
+        sources.clear();
+        for (std::size_t voice_index = sfx_active_head; voice_index != NO_SFX_VOICE; voice_index = sfx_mixer[voice_index].active_next) {
+            const sfx_voice& voice = sfx_mixer[voice_index];
+            if (!voice.is_stop_requested.load(std::memory_order_acquire) && !is_sfx_bus_paused(voice))
+                sources.push_back(voice.source_id);
         }
-        music_mixer_lock.unlock();
-        
-        static constexpr int UPDATES_PER_SECOND = 200;
-        static constexpr int UPDATE_FRAME_MS = 1000 / UPDATES_PER_SECOND;
-        std::this_thread::sleep_for(std::chrono::milliseconds(UPDATE_FRAME_MS));
+        if (!sources.empty())
+            alSourcePlayv(static_cast<ALsizei>(sources.size()), sources.data());
     }
+    lock.unlock();
+    CHECK_AL_ERRORS();
+    wake_polling_thread();
 }
 
-// ------------------------------------------------------------------- //
-// ENGINE::SFX_T
+void engine::stop_sfx_mixer() {
+    std::unique_lock<std::mutex> lock(sfx_mixer_lock);
+    if (is_software_mixing)
+        alSourceStop(mix_source_id);
+    else {
+        std::vector<ALuint>& sources = sfx_source_batch;
+        sources.clear();
+        for (std::size_t voice_index = sfx_active_head; voice_index != NO_SFX_VOICE; voice_index = sfx_mixer[voice_index].active_next)
+            sources.push_back(sfx_mixer[voice_index].source_id);
+        if (!sources.empty())
+            alSourceStopv(static_cast<ALsizei>(sources.size()), sources.data());
+    }
+    
+    while (sfx_active_head != NO_SFX_VOICE) {
+        std::size_t voice_index = sfx_active_head;
+        unlink_sfx_active(voice_index);
+        free_sfx_voice(voice_index);
+    }
+    
+    // batched and scheduled voices were never started, they only hold their sfx
+    for (std::size_t voice_index : sfx_batch)
+        free_sfx_voice(voice_index);
+    for (const scheduled_sfx& entry : sfx_schedule)
+        free_sfx_voice(entry.voice_index);
+    sfx_batch.clear();
+    sfx_schedule.clear();
+    KEE_AUDIO_METRIC(metrics.record_voices(0));
+    lock.unlock();
+    CHECK_AL_ERRORS();
+    wake_polling_thread();
+}
+
+void engine::set_sfx_pool_policy(sfx_pool_policy policy) {
+    std::lock_guard<std::mutex> lock(sfx_mixer_lock);
+    sfx_policy = policy;
+}
+
+engine::sfx_pool_stats engine::get_sfx_pool_stats() {
+    std::lock_guard<std::mutex> lock(sfx_mixer_lock);
+    return sfx_stats;
+}
+
+void engine::preload_sfx(const std::vector<std::string>& sfx_file_names) {
+    for (const std::string& sfx_file_name : sfx_file_names)
+        load_sfx(sfx_ids[lookup_sfx(sfx_file_name).index]->second, false);
+}
+
+std::future<void> engine::prefetch_sfx(std::vector<std::string> sfx_file_names) {
+    return post_loader_job(std::packaged_task<void()>([this, sfx_file_names = std::move(sfx_file_names)]() {
+        preload_sfx(sfx_file_names);
+    }));
+}
+
+std::future<void> engine::post_loader_job(std::packaged_task<void()> job) {
+    std::future<void> res = job.get_future();
+    {
+        std::lock_guard<std::mutex> lock(loader_lock);
+        loader_jobs.push_back(std::move(job));
+        if (!loader_thread.joinable())
+            loader_thread = std::thread(&engine::engine_loader_thread, this);
+    }
+    loader_cv.notify_one();
+    return res;
+}
+
+void engine::engine_loader_thread() {
+    std::unique_lock<std::mutex> lock(loader_lock);
+    while (true) {
+        loader_cv.wait(lock, [this]() { return should_loader_close || !loader_jobs.empty(); });
+        if (should_loader_close)
+            return;
+            
+        // a job's exception goes to its future
+        std::packaged_task<void()> job = std::move(loader_jobs.front());
+        loader_jobs.pop_front();
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
+
+void engine::set_sfx_memory_budget(std::size_t budget_bytes) {
+    std::lock_guard<std::mutex> lock(sfx_cache_lock);
+    sfx_cache.budget_bytes = budget_bytes;
+    evict_sfx();
+}
+
+engine::sfx_cache_stats engine::get_sfx_cache_stats() {
+    std::lock_guard<std::mutex> lock(sfx_cache_lock);
+    return sfx_cache;
+}
+
+engine::simd_level engine::get_mixer_simd_level() const {
+    return kernels.level;
+}
+
+std::size_t engine::get_music_player_count() const {
+    return music_mixer.size();
+}
+
+void engine::set_player_music(music_id id, std::size_t index) {
+    post_set_player_music(id, index, nullptr);
+}
+
+void engine::set_player_music(std::string_view music_file_name, std::size_t index) {
+    post_set_player_music(lookup_music(music_file_name), index, nullptr);
+}
+
+std::future<void> engine::set_player_music_async(music_id id, std::size_t index) {
+    std::shared_ptr<std::promise<void>> completion = std::make_shared<std::promise<void>>();
+    std::future<void> res = completion->get_future();
+    post_set_player_music(id, index, std::move(completion));
+    return res;
+}
+
+std::future<void> engine::set_player_music_async(std::string_view music_file_name, std::size_t index) {
+    return set_player_music_async(lookup_music(music_file_name), index);
+}
+
+void engine::unset_player_music(std::size_t index) {
+    std::atomic_bool& is_music_set = is_player_music_set.at(index);
+    post_music_command({ music_command::type::unset_music, index, nullptr, 0.0f });
+    is_music_set.store(false, std::memory_order_relaxed);
+}
+
+void engine::queue_player_music(music_id id, std::size_t index) {
+    if (!is_player_music_set.at(index).load(std::memory_order_relaxed))
+        throw std::logic_error("audio::engine::queue_player_music: music player has no music set (use audio::engine::set_player_music)");
+        
+    post_music_command({ music_command::type::queue_music, index, music_ids.at(id.index), 0.0f });
+}
+
+void engine::queue_player_music(std::string_view music_file_name, std::size_t index) {
+    queue_player_music(lookup_music(music_file_name), index);
+}
+
+void engine::play_music_player(std::size_t index) {
+    if (!is_player_music_set.at(index).load(std::memory_order_relaxed))
+        throw std::logic_error("audio::engine::play_music_player: music player has no music set (use audio::engine::set_player_music)");
+    
+    post_music_command({ music_command::type::play, index, nullptr, 0.0f });
+}
+
+void engine::pause_music_player(std::size_t index) {
+    if (!is_player_music_set.at(index).load(std::memory_order_relaxed))
+        throw std::logic_error("audio::engine::pause_music_player: music player has no music set (use audio::engine::set_player_music)");
+    
+    post_music_command({ music_command::type::pause, index, nullptr, 0.0f });
+}
+
+void engine::crossfade_music_players(std::size_t from_index, std::size_t to_index, float fade_duration, double start_time) {
+    if (!is_player_music_set.at(from_index).load(std::memory_order_relaxed) || !is_player_music_set.at(to_index).load(std::memory_order_relaxed))
+        throw std::logic_error("audio::engine::crossfade_music_players: music player has no music set (use audio::engine::set_player_music)");
+    if (from_index == to_index)
+        throw std::logic_error("audio::engine::crossfade_music_players: a music player cannot crossfade into itself");
+    if (fade_duration < 0.0f)
+        throw std::out_of_range("audio::engine::crossfade_music_players: Fade duration must be positive");
+        
+    post_music_command({ music_command::type::crossfade, from_index, nullptr, fade_duration, to_index, start_time });
+}
+
+bool engine::is_music_playing(std::size_t index) const {
+    return music_mixer.at(index).published_is_playing.load(std::memory_order_acquire);
+}
+
+float engine::get_music_duration(music_id id) const {
+    return music_ids.at(id.index)->second.duration;
+}
+
+float engine::get_music_duration(std::string_view music_file_name) const {
+    return get_music_duration(lookup_music(music_file_name));
+}
+
+void engine::preload_waveforms(const std::vector<std::string>& music_file_names) {
+    std::vector<music_id> ids;
+    for (const std::string& music_file_name : music_file_names)
+        ids.push_back(lookup_music(music_file_name));
+    if (music_file_names.empty()) {
+        for (std::size_t music_index = 0; music_index < music_ids.size(); music_index++)
+            ids.push_back({ static_cast<std::uint32_t>(music_index) });
+    }
+    
+    // one music per worker at a time, decoding is what takes long
+    parallel_for(ids.size(), [this, &ids](std::size_t i) {
+        load_waveform(ids[i]);
+    });
+}
+
+std::future<void> engine::prefetch_waveforms(std::vector<std::string> music_file_names) {
+    // the loader thread only schedules it, preload_waveforms spreads the music over parallel_for's workers
+    return post_loader_job(std::packaged_task<void()>([this, music_file_names = std::move(music_file_names)]() {
+        preload_waveforms(music_file_names);
+    }));
+}
+
+void engine::get_waveform(music_id id, double start_time, double end_time, std::span<waveform_peak> peaks) {
+    if (end_time <= start_time)
+        throw std::out_of_range("audio::engine::get_waveform: End time must be after start time");
+        
+    load_waveform(id)->read(start_time, end_time, peaks);
+}
+
+void engine::get_waveform(std::string_view music_file_name, double start_time, double end_time, std::span<waveform_peak> peaks) {
+    get_waveform(lookup_music(music_file_name), start_time, end_time, peaks);
+}
+
+void engine::release_waveforms() {
+    std::lock_guard<std::mutex> lock(waveform_lock);
+    std::fill(waveforms.begin(), waveforms.end(), nullptr);
+}
+
+void engine::set_playback_time(float time, std::size_t index) {
+    post_set_playback_time(time, index, nullptr);
+}
+
+std::future<void> engine::set_playback_time_async(float time, std::size_t index) {
+    std::shared_ptr<std::promise<void>> completion = std::make_shared<std::promise<void>>();
+    std::future<void> res = completion->get_future();
+    post_set_playback_time(time, index, std::move(completion));
+    return res;
+}
+
+double engine::get_playback_time(std::size_t index) const {
+    const music_player& player = music_mixer.at(index);
+    
+    static constexpr int MAX_ATTEMPTS = 3;
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+        std::uint32_t sequence = player.update_sequence.load(std::memory_order_acquire);
+        if (sequence % 2 != 0)
+            continue;
+            
+        const music_t* music = player.published_music.load(std::memory_order_relaxed);
+        if (music == nullptr)
+            return 0.0;
+            
+        std::size_t queue_start = player.published_queue_start.load(std::memory_order_relaxed);
+        std::size_t queue_end = player.published_cursor.load(std::memory_order_relaxed);
+        float tempo = player.published_tempo.load(std::memory_order_relaxed);
+        double time = player.measure_playback_time(*music, queue_start, queue_end, tempo);
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (player.update_sequence.load(std::memory_order_relaxed) == sequence)
+            return time;
+    }
+    
+    // the polling thread kept changing the queue under us, its last published time is close enough
+    return player.clock.get(get_engine_time());
+}
+
+double engine::get_audio_clock(std::size_t index) const {
+    return music_mixer.at(index).clock.get(get_engine_time());
+}
+
+void engine::set_player_filter(filter_type type, float cutoff, float q, std::size_t index) {
+    if (cutoff <= 0.0f)
+        throw std::out_of_range("audio::engine::set_player_filter: Cutoff must be positive");
+    if (q <= 0.0f)
+        throw std::out_of_range("audio::engine::set_player_filter: Q must be positive");
+        
+    music_mixer.at(index).effects.set_filter(type, cutoff, q);
+}
+
+void engine::set_player_reverb(float wet, float room_size, float damping, std::size_t index) {
+    if (wet < 0.0f || wet > 1.0f || room_size < 0.0f || room_size > 1.0f || damping < 0.0f || damping > 1.0f)
+        throw std::out_of_range("audio::engine::set_player_reverb: Wet, room size and damping must be between 0.0 and 1.0");
+        
+    music_mixer.at(index).effects.set_reverb(wet, room_size, damping);
+}
+
+void engine::set_player_tempo(float tempo, std::size_t index) {
+    if (tempo < 0.5f || tempo > 2.0f)
+        throw std::out_of_range("audio::engine::set_player_tempo: Tempo must be between 0.5 and 2.0");
+    if (index >= music_mixer.size())
+        throw std::out_of_range("audio::engine::set_player_tempo: music player index is out of range");
+        
+    post_music_command({ music_command::type::set_tempo, index, nullptr, tempo, 0, 0.0, nullptr });
+}
+
+bool engine::get_metrics(metrics_snapshot& snapshot) const {
+#ifdef KEE_AUDIO_ENABLE_METRICS
+    metrics.play_sfx_latency.read(snapshot.play_sfx_latency);
+    metrics.sfx_start_latency.read(snapshot.sfx_start_latency);
+    metrics.polling_loop_time.read(snapshot.polling_loop_time);
+    metrics.music_refill_time.read(snapshot.music_refill_time);
+    metrics.music_buffer_fill_time.read(snapshot.music_buffer_fill_time);
+    metrics.sfx_mixer_lock_wait.read(snapshot.sfx_mixer_lock_wait);
+    metrics.al_error_check_time.read(snapshot.al_error_check_time);
+    metrics.render_time.read(snapshot.render_time);
+    metrics.filter_block_time.read(snapshot.filter_block_time);
+    metrics.reverb_block_time.read(snapshot.reverb_block_time);
+    metrics.tempo_block_time.read(snapshot.tempo_block_time);
+    snapshot.rendered_frames = metrics.rendered_frames.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < snapshot.bytes_streamed.size(); i++) {
+        snapshot.bytes_streamed[i] = metrics.bytes_streamed[i].load(std::memory_order_relaxed);
+        snapshot.starvations[i] = metrics.starvations[i].load(std::memory_order_relaxed);
+        snapshot.near_starvations[i] = metrics.near_starvations[i].load(std::memory_order_relaxed);
+        snapshot.music_buffer_counts[i] = metrics.music_buffer_counts[i].load(std::memory_order_relaxed);
+    }
+    snapshot.music_command_spills = metrics.music_command_spills.load(std::memory_order_relaxed);
+    snapshot.live_voices = metrics.live_voices.load(std::memory_order_relaxed);
+    snapshot.peak_voices = metrics.peak_voices.load(std::memory_order_relaxed);
+    snapshot.startup_ns = metrics.startup_ns.load(std::memory_order_relaxed);
+    snapshot.asset_count = metrics.asset_count.load(std::memory_order_relaxed);
+    return true;
+#else
+    snapshot = metrics_snapshot();
+    return false;
+#endif
+}
+
+void engine::reset_metrics() {
+#ifdef KEE_AUDIO_ENABLE_METRICS
+    metrics.play_sfx_latency.reset();
+    metrics.sfx_start_latency.reset();
+    metrics.polling_loop_time.reset();
+    metrics.music_refill_time.reset();
+    metrics.music_buffer_fill_time.reset();
+    metrics.sfx_mixer_lock_wait.reset();
+    metrics.al_error_check_time.reset();
+    metrics.render_time.reset();
+    metrics.filter_block_time.reset();
+    metrics.reverb_block_time.reset();
+    metrics.tempo_block_time.reset();
+    metrics.rendered_frames.store(0, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < metrics.bytes_streamed.size(); i++) {
+        metrics.bytes_streamed[i].store(0, std::memory_order_relaxed);
+        metrics.starvations[i].store(0, std::memory_order_relaxed);
+        metrics.near_starvations[i].store(0, std::memory_order_relaxed);
+    }
+    metrics.music_command_spills.store(0, std::memory_order_relaxed);
+    metrics.peak_voices.store(metrics.live_voices.load(std::memory_order_relaxed), std::memory_order_relaxed);
+#endif
+}
+
+std::string engine::metrics_to_json(const metrics_snapshot& snapshot) {
+    std::ostringstream json;
+    const auto write_array = [&json](const auto& values) {
+        json << "[";
+        for (std::size_t i = 0; i < values.size(); i++)
+            json << (i == 0 ? "" : ",") << values[i];
+        json << "]";
+    };
+    const auto write_histogram = [&json, &write_array](const char* name, const latency_histogram& histogram) {
+        json << "\"" << name << "\":{\"count\":" << histogram.count << ",\"total_ns\":" << histogram.total_ns
+             << ",\"max_ns\":" << histogram.max_ns << ",\"buckets\":";
+        write_array(histogram.buckets);
+        json << "},";
+    };
+    
+    json << "{";
+    write_histogram("play_sfx_latency", snapshot.play_sfx_latency);
+    write_histogram("sfx_start_latency", snapshot.sfx_start_latency);
+    write_histogram("polling_loop_time", snapshot.polling_loop_time);
+    write_histogram("music_refill_time", snapshot.music_refill_time);
+    write_histogram("music_buffer_fill_time", snapshot.music_buffer_fill_time);
+    write_histogram("sfx_mixer_lock_wait", snapshot.sfx_mixer_lock_wait);
+    write_histogram("al_error_check_time", snapshot.al_error_check_time);
+    write_histogram("render_time", snapshot.render_time);
+    write_histogram("filter_block_time", snapshot.filter_block_time);
+    write_histogram("reverb_block_time", snapshot.reverb_block_time);
+    write_histogram("tempo_block_time", snapshot.tempo_block_time);
+    json << "\"rendered_frames\":" << snapshot.rendered_frames << ",\"bytes_streamed\":";
+    write_array(snapshot.bytes_streamed);
+    json << ",\"starvations\":";
+    write_array(snapshot.starvations);
+    json << ",\"near_starvations\":";
+    write_array(snapshot.near_starvations);
+    json << ",\"music_buffer_counts\":";
+    write_array(snapshot.music_buffer_counts);
+    json << ",\"music_command_spills\":" << snapshot.music_command_spills << ",\"live_voices\":" << snapshot.live_voices << ",\"peak_voices\":" << snapshot.peak_voices
+         << ",\"startup_ns\":" << snapshot.startup_ns << ",\"asset_count\":" << snapshot.asset_count << "}";
+    return json.str();
+}
+
+//--- ENGINE::SFX_VOICE ---//
+
+engine::sfx_voice::sfx_voice() :
+    source_id(0),
+    sfx(nullptr),
+    bus(0),
+    active_prev(NO_SFX_VOICE),
+    active_next(NO_SFX_VOICE),
+    generation(0),
+    is_stop_requested(false),
+    gain(1.0f),
+    pan(0.0f),
+    pitch(1.0f),
+    frame_position(0),
+    frame_fraction(0.0),
+    start_delay(0),
+    left_gain(1.0f),
+    right_gain(1.0f)
+{ }
+
+//--- ENGINE::MIX_BUS ---//
+
+engine::mix_bus::mix_bus() :
+    gain(1.0f),
+    is_paused(false)
+{ }
+
+//--- ENGINE::REVERB_STATE ---//
+
+engine::reverb_state::reverb_state() :
+    mask(0),
+    position(0),
+    delays(),
+    lowpass(),
+    sample_rate(0)
+{ }
+
+void engine::reverb_state::resize(int _sample_rate) {
+    // mutually prime lengths, about 21 to 60 ms at 48 kHz, so the lines' echoes don't pile up on the same frames
+    static constexpr std::array<std::size_t, REVERB_LINE_COUNT> BASE_DELAYS = { 1031, 1327, 1523, 1801, 2053, 2311, 2593, 2887 };
+    
+    sample_rate = _sample_rate;
+    for (std::size_t i = 0; i < REVERB_LINE_COUNT; i++)
+        delays[i] = std::max<std::size_t>(BASE_DELAYS[i] * static_cast<std::size_t>(sample_rate) / 48000, 1);
+        
+    std::size_t rows = std::bit_ceil(delays.back() + 1);
+    lines.assign(rows * REVERB_LINE_COUNT, 0.0f);
+    mask = rows - 1;
+    position = 0;
+    lowpass.fill(0.0f);
+}
+
+void engine::reverb_state::clear() {
+    std::fill(lines.begin(), lines.end(), 0.0f);
+    lowpass.fill(0.0f);
+}
+
+//--- ENGINE::EFFECT_CHAIN ---//
+
+engine::effect_chain::effect_chain() :
+    filter(filter_type::none),
+    filter_cutoff(1000.0f),
+    filter_q(0.7071f),
+    reverb_wet(0.0f),
+    reverb_room_size(0.5f),
+    reverb_damping(0.5f),
+    current_filter(filter_type::none),
+    filter_mix(0.0f),
+    current_cutoff(1000.0f),
+    current_q(0.7071f),
+    filter_state(),
+    current_wet(0.0f),
+    current_feedback(0.0f),
+    current_damping(0.0f)
+{ }
+
+void engine::effect_chain::set_filter(filter_type type, float cutoff, float q) {
+    filter_cutoff.store(cutoff, std::memory_order_relaxed);
+    filter_q.store(q, std::memory_order_relaxed);
+    filter.store(type, std::memory_order_relaxed);
+}
+
+void engine::effect_chain::set_reverb(float wet, float room_size, float damping) {
+    reverb_room_size.store(room_size, std::memory_order_relaxed);
+    reverb_damping.store(damping, std::memory_order_relaxed);
+    reverb_wet.store(wet, std::memory_order_relaxed);
+}
+
+bool engine::effect_chain::is_active() const {
+    // a chain turned off still runs until it has faded out
+    return current_filter != filter_type::none || filter.load(std::memory_order_relaxed) != filter_type::none
+        || current_wet > 0.0f || reverb_wet.load(std::memory_order_relaxed) > 0.0f;
+}
+
+// robert bristow-johnson's cookbook, normalized by a0
+static std::array<float, 5> get_biquad_coefficients(engine::filter_type type, float cutoff, float q, int sample_rate) {
+    float omega = 2.0f * std::numbers::pi_v<float> * cutoff / static_cast<float>(sample_rate);
+    float cos_omega = std::cos(omega);
+    float alpha = std::sin(omega) / (2.0f * q);
+    float a0 = 1.0f + alpha;
+    
+    std::array<float, 5> coefficients = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    switch (type) {
+    case engine::filter_type::low_pass:
+        coefficients = { (1.0f - cos_omega) / 2.0f, 1.0f - cos_omega, (1.0f - cos_omega) / 2.0f, -2.0f * cos_omega, 1.0f - alpha };
+        break;
+    case engine::filter_type::high_pass:
+        coefficients = { (1.0f + cos_omega) / 2.0f, -(1.0f + cos_omega), (1.0f + cos_omega) / 2.0f, -2.0f * cos_omega, 1.0f - alpha };
+        break;
+    case engine::filter_type::band_pass:
+        coefficients = { alpha, 0.0f, -alpha, -2.0f * cos_omega, 1.0f - alpha };
+        break;
+    case engine::filter_type::none:
+        return coefficients;
+    }
+    
+    for (float& coefficient : coefficients)
+        coefficient /= a0;
+    return coefficients;
+}
+
+void engine::effect_chain::process(float* samples, std::size_t frames, std::size_t channels, int sample_rate, const mix_kernels& kernels, [[maybe_unused]] engine_metrics& metrics) {
+    // one pole glide per block, covering 63% of a change every EFFECT_SMOOTHING_TIME
+    const float glide = 1.0f - std::exp(-static_cast<float>(EFFECT_SMOOTHING_FRAMES) / (EFFECT_SMOOTHING_TIME * static_cast<float>(sample_rate)));
+    const auto glide_to = [glide](float& value, float target) {
+        value += (target - value) * glide;
+        if (std::abs(target - value) > 1e-4f * std::max(std::abs(target), 1.0f))
+            return false;
+        value = target;
+        return true;
+    };
+    
+    filter_type target_filter = filter.load(std::memory_order_relaxed);
+    float target_cutoff = std::min(filter_cutoff.load(std::memory_order_relaxed), 0.45f * static_cast<float>(sample_rate));
+    float target_q = filter_q.load(std::memory_order_relaxed);
+    float target_wet = reverb_wet.load(std::memory_order_relaxed);
+    float target_feedback = 0.6f + 0.3f * reverb_room_size.load(std::memory_order_relaxed);
+    float target_damping = 0.6f * reverb_damping.load(std::memory_order_relaxed);
+    bool was_reverb_on = current_wet > 0.0f;
+    if ((target_wet > 0.0f || was_reverb_on) && reverb.sample_rate != sample_rate)
+        reverb.resize(sample_rate);
+        
+    KEE_AUDIO_METRIC(std::chrono::steady_clock::duration filter_time(0));
+    KEE_AUDIO_METRIC(std::chrono::steady_clock::duration reverb_time(0));
+    std::size_t frame = 0;
+    while (frame < frames) {
+        // a new filter type waits for the old one to fade out, its state means nothing to the new one
+        if (filter_mix == 0.0f && current_filter != target_filter) {
+            current_filter = target_filter;
+            current_cutoff = target_cutoff;
+            current_q = target_q;
+            filter_state.fill(0.0f);
+        }
+        
+        bool is_settled = glide_to(filter_mix, current_filter == target_filter && current_filter != filter_type::none ? 1.0f : 0.0f);
+        is_settled &= glide_to(current_cutoff, target_cutoff);
+        is_settled &= glide_to(current_q, target_q);
+        is_settled &= glide_to(current_wet, target_wet);
+        is_settled &= glide_to(current_feedback, target_feedback);
+        is_settled &= glide_to(current_damping, target_damping);
+        
+        std::size_t block_frames = is_settled ? frames - frame : std::min(EFFECT_SMOOTHING_FRAMES, frames - frame);
+        float* block = samples + frame * channels;
+        if (filter_mix > 0.0f) {
+            KEE_AUDIO_METRIC(std::chrono::steady_clock::time_point filter_start = std::chrono::steady_clock::now());
+            std::array<float, 5> coefficients = get_biquad_coefficients(current_filter, current_cutoff, current_q, sample_rate);
+            kernels.biquad(block, block_frames, channels, coefficients.data(), filter_state.data(), filter_mix);
+            KEE_AUDIO_METRIC(filter_time += std::chrono::steady_clock::now() - filter_start);
+        }
+        if (current_wet > 0.0f) {
+            KEE_AUDIO_METRIC(std::chrono::steady_clock::time_point reverb_start = std::chrono::steady_clock::now());
+            reverb.position = kernels.reverb(block, block_frames, channels, reverb.lines.data(), reverb.mask, reverb.position,
+                                             reverb.delays.data(), reverb.lowpass.data(), current_feedback, current_damping, current_wet);
+            KEE_AUDIO_METRIC(reverb_time += std::chrono::steady_clock::now() - reverb_start);
+        }
+        frame += block_frames;
+    }
+    
+    // a reverb turned back on starts from silence, not from the tail it had
+    if (was_reverb_on && current_wet == 0.0f)
+        reverb.clear();
+        
+    KEE_AUDIO_METRIC(if (filter_time.count() > 0) metrics.filter_block_time.record(filter_time));
+    KEE_AUDIO_METRIC(if (reverb_time.count() > 0) metrics.reverb_block_time.record(reverb_time));
+}
+
+void engine::effect_chain::reset() {
+    filter_state.fill(0.0f);
+    reverb.clear();
+}
+
+//--- ENGINE::MUSIC_PLAYER ---//
+
+engine::music_player::music_player() :
+    owner(nullptr),
+    source_id(0),
+    bus(0),
+    fade_gain(1.0f),
+    tempo(1.0f),
+    buffer_size(0),
+    queued_bytes(0),
+    heard_music(nullptr),
+    stream_music(nullptr),
+    stream_segment(0),
+    cursor(0),
+    update_sequence(0),
+    published_music(nullptr),
+    published_is_playing(false),
+    published_queue_start(0),
+    published_cursor(0),
+    published_tempo(1.0f),
+    is_starved(false),
+    low_spare_buffers(std::numeric_limits<std::size_t>::max()),
+    depth_window_start(),
+    is_seek_pending(false),
+    pending_seek_cursor(0),
+    is_play_deferred(false)
+{ }
+
+void engine::music_player::set_fade_gain(float gain) {
+    fade_gain = gain;
+    alSourcef(source_id, AL_GAIN, fade_gain * owner->buses[bus].gain.load(std::memory_order_relaxed)); CHECK_AL_ERRORS();
+}
+
+void engine::music_player::set_stream(const music_entry* music) {
+    stream_music = music;
+    stream_segment++;
+    cursor = 0;
+    if (music == nullptr)
+        music_file.close();
+    else {
+        music_file.open(music->second.full_path.string(), music->second, buffer_size);
+        stretch.reset(music->second.frame_size / sizeof(std::int16_t), 0);
+    }
+}
+
+bool engine::music_player::advance_stream() {
+    if (upcoming_music.empty())
+        return false;
+        
+    // a source's queue has to share one format, other music waits for the queue to drain
+    const music_t& next_music = upcoming_music.front()->second;
+    if (stream_music != nullptr && (next_music.format != stream_music->second.format || next_music.sample_rate != stream_music->second.sample_rate))
+        return false;
+        
+    set_stream(upcoming_music.front());
+    upcoming_music.pop_front();
+    return true;
+}
+
+void engine::music_player::rewind_upcoming_music() {
+    // every segment after the heard one was taken off upcoming_music, in order
+    std::vector<const music_entry*> streamed_music;
+    std::uint64_t last_segment = get_heard_segment();
+    for (const queued_buffer& buffer : buffer_queue) {
+        if (buffer.segment == last_segment)
+            continue;
+            
+        streamed_music.push_back(buffer.music);
+        last_segment = buffer.segment;
+    }
+    if (stream_segment != last_segment && stream_music != nullptr)
+        streamed_music.push_back(stream_music);
+        
+    upcoming_music.insert(upcoming_music.begin(), streamed_music.begin(), streamed_music.end());
+}
+
+void engine::music_player::update_buffer_queue() {
+    clear_buffer_queue();
+    fill_free_buffers();
+    
+    if (!buffer_queue.empty())
+        heard_music = buffer_queue.front().music;
+}
+
+void engine::music_player::clear_buffer_queue() {
+    // rewinding leaves the source AL_INITIAL, so offsets read 0 until it plays the new queue
+    alSourceRewind(source_id); CHECK_AL_ERRORS();
+    alSourcei(source_id, AL_BUFFER, 0); CHECK_AL_ERRORS();
+    buffer_queue.clear();
+    queued_bytes = 0;
+    free_buffers = buffer_ids;
+    
+    // the queue is refilled from cursor, nothing before it carries over
+    effects.reset();
+    if (stream_music != nullptr)
+        stretch.reset(stream_music->second.frame_size / sizeof(std::int16_t), cursor / stream_music->second.frame_size);
+}
+
+void engine::music_player::fill_free_buffers() {
+    if (music_file.is_stalled(owner->get_engine_time()))
+        return;
+        
+    while (!free_buffers.empty()) {
+        if (queue_buffer(free_buffers.back()) == 0)
+            break;
+        free_buffers.pop_back();
+    }
+}
+
+ALsizei engine::music_player::queue_buffer(ALuint buffer_id) {
+    if (stream_music == nullptr)
+        return 0;
+    if (!has_stream_data() && !advance_stream())
+        return 0;
+    if (is_stretching())
+        return queue_stretched_buffer(buffer_id);
+
+    const music_t& music = stream_music->second;
+    ALsizei queued_size = static_cast<ALsizei>(std::min(buffer_size, music.data_size - cursor));
+    queued_size -= queued_size % 8;
+    if (queued_size == 0) {
+        // a tail too short to queue is skipped, the stream may still advance into upcoming music
+        cursor = music.data_size;
+        return queue_buffer(buffer_id);
+    }
+    
+    KEE_AUDIO_METRIC(metric_timer fill_timer(owner->metrics.music_buffer_fill_time));
+    const byte* buffer_data = music_file.read(cursor, queued_size);
+    if (music.is_duo_byte_sampled)
+        buffer_data = process_effects(buffer_data, queued_size / music.frame_size, cursor / music.frame_size);
+    alBufferData(buffer_id, music.format, buffer_data, queued_size, music.sample_rate); CHECK_AL_ERRORS();
+    alSourceQueueBuffers(source_id, 1, &buffer_id); CHECK_AL_ERRORS();
+    KEE_AUDIO_TEST_HOOK(owner->digest_upload(buffer_data, queued_size));
+    
+    buffer_queue.push_back({ buffer_id, stream_music, stream_segment, cursor, queued_size, static_cast<std::size_t>(queued_size), 1.0f });
+    queued_bytes += queued_size;
+    
+    cursor += queued_size;
+    if (static_cast<std::size_t>(queued_size) < buffer_size)
+        cursor = music.data_size;
+    return queued_size;
+}
+
+ALsizei engine::music_player::queue_stretched_buffer(ALuint buffer_id) {
+    const music_t& music = stream_music->second;
+    std::size_t channels = music.frame_size / sizeof(std::int16_t);
+    std::size_t music_frames = music.data_size / music.frame_size;
+    std::size_t buffer_frames = buffer_size / music.frame_size;
+    
+    KEE_AUDIO_METRIC(metric_timer fill_timer(owner->metrics.music_buffer_fill_time));
+    KEE_AUDIO_METRIC(metric_timer tempo_timer(owner->metrics.tempo_block_time));
+    while (stretch.output.size() / channels < buffer_frames && stretch.nominal < music_frames) {
+        // reads ahead until the next hop's window and search are in, past the end of the music they're silent
+        std::size_t input_end = stretch.input_start + stretch.input.size() / channels;
+        while (input_end < stretch.get_required_input_end()) {
+            std::size_t read_size = std::min(buffer_size, music.data_size - cursor);
+            read_size -= read_size % music.frame_size;
+            if (read_size == 0) {
+                cursor = music.data_size;
+                stretch.push_silence(stretch.get_required_input_end() - input_end);
+                break;
+            }
+            
+            // copied out first, the stream's block may not be aligned for int16
+            std::memcpy(effect_pcm.data(), music_file.read(cursor, read_size), read_size);
+            stretch.push_input(effect_pcm.data(), read_size / music.frame_size, owner->kernels);
+            cursor += read_size;
+            input_end += read_size / music.frame_size;
+        }
+        stretch.stretch(tempo, owner->kernels);
+    }
+    
+    double nominal_start = 0.0;
+    std::size_t frames = stretch.take_output(effect_samples.data(), buffer_frames, tempo, nominal_start);
+    KEE_AUDIO_METRIC(tempo_timer.stop());
+    if (frames == 0)
+        return queue_buffer(buffer_id);
+        
+    if (effects.is_active())
+        effects.process(effect_samples.data(), frames, channels, music.sample_rate, owner->kernels, owner->metrics);
+    apply_ramp(effect_samples.data(), frames, channels, nominal_start, tempo);
+    owner->kernels.to_s16(effect_samples.data(), effect_pcm.data(), frames * channels);
+    ALsizei queued_size = static_cast<ALsizei>(frames * music.frame_size);
+    alBufferData(buffer_id, music.format, effect_pcm.data(), queued_size, music.sample_rate); CHECK_AL_ERRORS();
+    alSourceQueueBuffers(source_id, 1, &buffer_id); CHECK_AL_ERRORS();
+    KEE_AUDIO_TEST_HOOK(owner->digest_upload(effect_pcm.data(), queued_size));
+    
+    // the buffer covers the input its frames stand for at this tempo, not what the stretch read ahead
+    std::size_t offset = std::min(static_cast<std::size_t>(std::llround(nominal_start)), music_frames) * music.frame_size;
+    std::size_t input_end = std::min(static_cast<std::size_t>(std::llround(nominal_start + frames * static_cast<double>(tempo))), music_frames) * music.frame_size;
+    buffer_queue.push_back({ buffer_id, stream_music, stream_segment, offset, queued_size, input_end - offset, tempo });
+    queued_bytes += queued_size;
+    return queued_size;
+}
+
+const engine::byte* engine::music_player::process_effects(const byte* data, std::size_t frames, std::size_t music_frame) {
+    if (!effects.is_active() && !is_ramped(static_cast<double>(music_frame), frames, 1.0f))
+        return data;
+        
+    const music_t& music = stream_music->second;
+    std::size_t channels = music.frame_size / sizeof(std::int16_t);
+    std::size_t samples = frames * channels;
+    std::memcpy(effect_pcm.data(), data, samples * sizeof(std::int16_t));
+    owner->kernels.s16_to_f32(effect_pcm.data(), effect_samples.data(), samples);
+    if (effects.is_active())
+        effects.process(effect_samples.data(), frames, channels, music.sample_rate, owner->kernels, owner->metrics);
+    apply_ramp(effect_samples.data(), frames, channels, music_frame, 1.0f);
+    owner->kernels.to_s16(effect_samples.data(), effect_pcm.data(), samples);
+    return reinterpret_cast<const byte*>(effect_pcm.data());
+}
+
+float engine::music_player::get_ramp_gain(std::uint64_t segment, double music_frame, float frame_tempo) const {
+    if (!ramp.has_value())
+        return 1.0f;
+        
+    double progress = segment > ramp->segment ? 1.0 : 0.0;
+    if (segment == ramp->segment) {
+        // the ramp's length is heard time, a stretched frame covers frame_tempo frames of the music
+        double ramp_frames = (music_frame - ramp->start_frame) / frame_tempo;
+        progress = ramp->frames > 0.0 ? std::clamp(ramp_frames / ramp->frames, 0.0, 1.0) : (ramp_frames >= 0.0 ? 1.0 : 0.0);
+    }
+    
+    // equal power, so the two players together stay as loud as either alone
+    double fade_angle = progress * std::numbers::pi / 2.0;
+    return static_cast<float>(ramp->is_fade_in ? std::sin(fade_angle) : std::cos(fade_angle));
+}
+
+bool engine::music_player::is_ramped(double music_frame, std::size_t frames, float frame_tempo) const {
+    if (frames == 0)
+        return false;
+        
+    // a ramp is flat before and past its length, so its ends tell whether it changes anything in between
+    double last_frame = music_frame + static_cast<double>(frames - 1) * frame_tempo;
+    return get_ramp_gain(stream_segment, music_frame, frame_tempo) != 1.0f || get_ramp_gain(stream_segment, last_frame, frame_tempo) != 1.0f;
+}
+
+void engine::music_player::apply_ramp(float* samples, std::size_t frames, std::size_t channels, double music_frame, float frame_tempo) const {
+    if (!is_ramped(music_frame, frames, frame_tempo))
+        return;
+        
+    for (std::size_t frame = 0; frame < frames; frame++) {
+        float gain = get_ramp_gain(stream_segment, music_frame + static_cast<double>(frame) * frame_tempo, frame_tempo);
+        for (std::size_t channel = 0; channel < channels; channel++)
+            samples[frame * channels + channel] *= gain;
+    }
+}
+
+bool engine::music_player::is_stretching() const {
+    return tempo != 1.0f && stream_music != nullptr && stream_music->second.is_duo_byte_sampled;
+}
+
+bool engine::music_player::has_stream_data() const {
+    if (stream_music == nullptr)
+        return false;
+        
+    // a stretched stream has read ahead of what it output
+    const music_t& music = stream_music->second;
+    return cursor < music.data_size || (is_stretching() && !stretch.is_drained(music.data_size / music.frame_size));
+}
+
+float engine::music_player::get_heard_tempo() const {
+    return buffer_queue.empty() ? 1.0f : buffer_queue.front().tempo;
+}
+
+void engine::music_player::get_heard_queue(std::size_t& queue_start, std::size_t& queue_end) const {
+    // only the heard music's buffers count, the stream may already be queueing the next music behind them
+    queue_start = cursor;
+    queue_end = cursor;
+    if (!buffer_queue.empty()) {
+        queue_start = buffer_queue.front().offset;
+        for (const queued_buffer& buffer : buffer_queue)
+            if (buffer.segment == buffer_queue.front().segment)
+                queue_end = buffer.offset + buffer.input_size;
+    }
+}
+
+ALuint engine::music_player::unqueue_buffer() {
+    ALuint buffer_id;
+    alSourceUnqueueBuffers(source_id, 1, &buffer_id); CHECK_AL_ERRORS();
+    
+    queued_bytes -= buffer_queue.front().size;
+    buffer_queue.pop_front();
+    if (!buffer_queue.empty())
+        heard_music = buffer_queue.front().music;
+    return buffer_id;
+}
+
+bool engine::music_player::update_buffer_depth(std::size_t spare_buffers) {
+    // a queue running out at the end of its music isn't a refill coming late
+    std::chrono::steady_clock::time_point now = owner->get_engine_time();
+    bool is_near_miss = spare_buffers <= 1 && has_stream_data();
+    if (is_near_miss) {
+        grow_buffers();
+        low_spare_buffers = std::numeric_limits<std::size_t>::max();
+        depth_window_start = now;
+        return true;
+    }
+    
+    low_spare_buffers = std::min(low_spare_buffers, spare_buffers);
+    if (now - depth_window_start < MUSIC_BUFFER_SHRINK_INTERVAL)
+        return false;
+        
+    // with a buffer less the queue would still have had two to spare, far from a near miss
+    if (low_spare_buffers >= 3)
+        shrink_buffers();
+    low_spare_buffers = std::numeric_limits<std::size_t>::max();
+    depth_window_start = now;
+    return false;
+}
+
+bool engine::music_player::grow_buffers() {
+    if (buffer_ids.size() >= owner->init_config.music_max_buffer_count)
+        return false;
+        
+    ALuint buffer_id;
+    alGenBuffers(1, &buffer_id); CHECK_AL_ERRORS();
+    buffer_ids.push_back(buffer_id);
+    free_buffers.push_back(buffer_id);
+    return true;
+}
+
+void engine::music_player::shrink_buffers() {
+    // only a free buffer can go, a queued one is still attached to the source
+    if (buffer_ids.size() <= owner->init_config.music_buffer_count || free_buffers.empty())
+        return;
+        
+    ALuint buffer_id = free_buffers.back();
+    free_buffers.pop_back();
+    std::erase(buffer_ids, buffer_id);
+    alDeleteBuffers(1, &buffer_id); CHECK_AL_ERRORS();
+}
+
+std::uint64_t engine::music_player::get_heard_segment() const {
+    return buffer_queue.empty() ? stream_segment : buffer_queue.front().segment;
+}
+
+std::size_t engine::music_player::rewind_to_heard_position() {
+    const music_entry* music = buffer_queue.empty() ? stream_music : buffer_queue.front().music;
+    if (music == nullptr)
+        return cursor;
+        
+    std::size_t queue_start = 0;
+    std::size_t queue_end = 0;
+    get_heard_queue(queue_start, queue_end);
+    double heard_time = measure_playback_time(music->second, queue_start, queue_end, get_heard_tempo());
+    if (get_heard_segment() != stream_segment) {
+        rewind_upcoming_music();
+        set_stream(music);
+    }
+    
+    cursor = std::min(static_cast<std::size_t>(heard_time * music->second.sample_rate) * music->second.frame_size, music->second.data_size);
+    return cursor;
+}
+
+void engine::music_player::finish_seek() {
+    if (pending_seek_completion != nullptr)
+        pending_seek_completion->set_value();
+    pending_seek_completion = nullptr;
+    is_seek_pending = false;
+}
+
+void engine::music_player::begin_update() {
+    update_sequence.store(update_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void engine::music_player::publish_snapshot(bool is_discontinuous) {
+    ALint source_state = AL_NONE;
+    alGetSourcei(source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+    const music_t* music = heard_music == nullptr ? nullptr : &heard_music->second;
+    
+    std::size_t queue_start = 0;
+    std::size_t queue_end = 0;
+    get_heard_queue(queue_start, queue_end);
+    float heard_tempo = get_heard_tempo();
+    
+    published_music.store(music, std::memory_order_relaxed);
+    published_is_playing.store(source_state == AL_PLAYING, std::memory_order_relaxed);
+    published_queue_start.store(queue_start, std::memory_order_relaxed);
+    published_cursor.store(queue_end, std::memory_order_relaxed);
+    published_tempo.store(heard_tempo, std::memory_order_relaxed);
+    update_sequence.store(update_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    
+    double measured_time = music == nullptr ? 0.0 : measure_playback_time(*music, queue_start, queue_end, heard_tempo);
+    clock.update(owner->get_engine_time(), measured_time, heard_tempo, source_state == AL_PLAYING, is_discontinuous);
+}
+
+double engine::music_player::measure_playback_time(const music_t& music, std::size_t queue_start, std::size_t queue_end, float tempo) const {
+    ALint source_state = AL_NONE;
+    alGetSourcei(source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+    
+    double queued_frames = static_cast<double>((queue_end - queue_start) / music.frame_size);
+    double played_frames = 0.0;
+    if (source_state == AL_STOPPED)
+        played_frames = queued_frames;
+    else if (source_state != AL_INITIAL) {
+        if (owner->al_get_source_i64v_soft != nullptr) {
+            // offset is 32.32 fixed point sample frames, latency is in nanoseconds
+            std::array<ALint64SOFT, 2> offset_latency = { 0, 0 };
+            owner->al_get_source_i64v_soft(source_id, AL_SAMPLE_OFFSET_LATENCY_SOFT, offset_latency.data()); CHECK_AL_ERRORS();
+            played_frames = static_cast<double>(offset_latency[0]) / 4294967296.0;
+            if (source_state == AL_PLAYING)
+                played_frames -= static_cast<double>(offset_latency[1]) * music.sample_rate / 1e9;
+        }
+        else {
+            ALint sample_offset = 0;
+            alGetSourcei(source_id, AL_SAMPLE_OFFSET, &sample_offset); CHECK_AL_ERRORS();
+            played_frames = sample_offset;
+        }
+        // the source plays stretched frames, each one tempo frames of the music
+        played_frames = std::clamp(played_frames * tempo, 0.0, queued_frames);
+    }
+    
+    return (static_cast<double>(queue_start / music.frame_size) + played_frames) / music.sample_rate;
+}
+
+std::optional<double> engine::music_player::measure_mix_time(std::int64_t& clock_ns) const {
+    if (buffer_queue.empty())
+        return std::nullopt;
+        
+    ALint source_state = AL_NONE;
+    alGetSourcei(source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+    if (source_state != AL_PLAYING)
+        return std::nullopt;
+        
+    const music_t& music = buffer_queue.front().music->second;
+    double played_frames = owner->measure_source_offset(source_id, clock_ns) * buffer_queue.front().tempo;
+    return (static_cast<double>(buffer_queue.front().offset / music.frame_size) + played_frames) / music.sample_rate;
+}
+
+//--- ENGINE::TIME_STRETCH ---//
+
+engine::time_stretch::time_stretch() :
+    channels(1),
+    window(STRETCH_WINDOW_FRAMES),
+    input_start(0),
+    nominal(0.0),
+    output_nominal(0.0),
+    previous(0),
+    is_first_hop(true)
+{
+    // periodic hann, windows half a window apart sum to 1
+    for (std::size_t i = 0; i < STRETCH_WINDOW_FRAMES; i++)
+        window[i] = 0.5f - 0.5f * std::cos(2.0f * std::numbers::pi_v<float> * static_cast<float>(i) / static_cast<float>(STRETCH_WINDOW_FRAMES));
+}
+
+void engine::time_stretch::reset(std::size_t _channels, std::size_t start_frame) {
+    channels = _channels;
+    input.clear();
+    input_start = start_frame;
+    overlap.assign(STRETCH_WINDOW_FRAMES / 2 * channels, 0.0f);
+    output.clear();
+    nominal = static_cast<double>(start_frame);
+    output_nominal = nominal;
+    previous = start_frame;
+    is_first_hop = true;
+}
+
+std::size_t engine::time_stretch::get_required_input_end() const {
+    // the furthest candidate segment, and the previous segment's natural continuation
+    std::size_t search_end = static_cast<std::size_t>(std::llround(nominal)) + STRETCH_SEARCH_FRAMES + STRETCH_WINDOW_FRAMES;
+    return std::max(search_end, previous + STRETCH_WINDOW_FRAMES);
+}
+
+void engine::time_stretch::push_input(const std::int16_t* in, std::size_t frames, const mix_kernels& kernels) {
+    std::size_t input_size = input.size();
+    input.resize(input_size + frames * channels);
+    kernels.s16_to_f32(in, input.data() + input_size, frames * channels);
+}
+
+void engine::time_stretch::push_silence(std::size_t frames) {
+    input.resize(input.size() + frames * channels, 0.0f);
+}
+
+bool engine::time_stretch::is_drained(std::size_t music_frames) const {
+    return nominal >= static_cast<double>(music_frames) && output.empty();
+}
+
+void engine::time_stretch::stretch(float tempo, const mix_kernels& kernels) {
+    static constexpr std::size_t HOP_FRAMES = STRETCH_WINDOW_FRAMES / 2;
+    static constexpr std::size_t COARSE_STEP = 4;
+    
+    const std::size_t hop_samples = HOP_FRAMES * channels;
+    const auto get_frame = [this](std::size_t frame) { return input.data() + (frame - input_start) * channels; };
+    
+    // the candidate whose first half best matches the previous segment's second half, by normalized cross correlation.
+    // every COARSE_STEP frames first, then the frames around the best of those
+    std::size_t center = static_cast<std::size_t>(std::llround(nominal));
+    std::size_t best = center;
+    if (!is_first_hop) {
+        const float* target = get_frame(previous + HOP_FRAMES);
+        float best_score = -std::numeric_limits<float>::infinity();
+        const auto score_candidate = [&](std::size_t candidate) {
+            const float* segment = get_frame(candidate);
+            float score = kernels.dot(segment, target, hop_samples) / std::sqrt(kernels.dot(segment, segment, hop_samples) + 1.0f);
+            if (score > best_score) {
+                best_score = score;
+                best = candidate;
+            }
+        };
+        
+        std::size_t search_start = std::max(center, input_start + STRETCH_SEARCH_FRAMES) - STRETCH_SEARCH_FRAMES;
+        std::size_t search_end = center + STRETCH_SEARCH_FRAMES;
+        for (std::size_t candidate = search_start; candidate <= search_end; candidate += COARSE_STEP)
+            score_candidate(candidate);
+            
+        std::size_t coarse_best = best;
+        std::size_t refine_end = std::min(coarse_best + COARSE_STEP - 1, search_end);
+        for (std::size_t candidate = std::max(coarse_best, search_start + COARSE_STEP - 1) - (COARSE_STEP - 1); candidate <= refine_end; candidate++)
+            if (candidate != coarse_best)
+                score_candidate(candidate);
+    }
+    
+    // the first half finishes the previous segment's fade out, the second half waits for the next segment
+    const float* segment = get_frame(best);
+    std::size_t output_size = output.size();
+    output.resize(output_size + hop_samples);
+    for (std::size_t i = 0; i < hop_samples; i++) {
+        output[output_size + i] = overlap[i] + segment[i] * window[i / channels];
+        overlap[i] = segment[hop_samples + i] * window[HOP_FRAMES + i / channels];
+    }
+    
+    previous = best;
+    nominal += HOP_FRAMES * static_cast<double>(tempo);
+    is_first_hop = false;
+    
+    // nothing behind the next search or continuation is read again
+    std::size_t next_center = static_cast<std::size_t>(std::llround(nominal));
+    std::size_t keep_start = std::min(std::max(next_center, input_start + STRETCH_SEARCH_FRAMES) - STRETCH_SEARCH_FRAMES, previous + HOP_FRAMES);
+    if (keep_start - input_start >= STRETCH_WINDOW_FRAMES) {
+        input.erase(input.begin(), input.begin() + (keep_start - input_start) * channels);
+        input_start = keep_start;
+    }
+}
+
+std::size_t engine::time_stretch::take_output(float* out, std::size_t frames, float tempo, double& nominal_start) {
+    frames = std::min(frames, output.size() / channels);
+    std::copy(output.begin(), output.begin() + frames * channels, out);
+    output.erase(output.begin(), output.begin() + frames * channels);
+    
+    nominal_start = output_nominal;
+    output_nominal += frames * static_cast<double>(tempo);
+    return frames;
+}
+
+//--- ENGINE::AUDIO_CLOCK ---//
+
+engine::audio_clock::audio_clock() :
+    sequence(0),
+    anchor_time(0.0),
+    anchor_ns(0),
+    rate(0.0)
+{ }
+
+void engine::audio_clock::update(std::chrono::steady_clock::time_point now, double measured_time, double tempo, bool is_running, bool is_discontinuous) {
+    static constexpr double SNAP_THRESHOLD = 0.02;
+    static constexpr double SLEW_PERIOD = 0.1;
+    static constexpr double MAX_SLEW = 0.5;
+
+    std::int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    double predicted_time = get(now_ns);
+    double error = measured_time - predicted_time;
+    
+    double new_time = measured_time;
+    double new_rate = is_running ? tempo : 0.0;
+    if (!is_discontinuous && std::abs(error) < SNAP_THRESHOLD) {
+        // correct the error over the next SLEW_PERIOD instead of jumping
+        if (is_running) {
+            new_time = predicted_time;
+            new_rate = std::clamp(tempo + error / SLEW_PERIOD, tempo * (1.0 - MAX_SLEW), tempo * (1.0 + MAX_SLEW));
+        }
+        else
+            new_time = std::max(predicted_time, measured_time);
+    }
+    
+    std::uint32_t current_sequence = sequence.load(std::memory_order_relaxed);
+    sequence.store(current_sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    anchor_time.store(new_time, std::memory_order_relaxed);
+    anchor_ns.store(now_ns, std::memory_order_relaxed);
+    rate.store(new_rate, std::memory_order_relaxed);
+    sequence.store(current_sequence + 2, std::memory_order_release);
+}
+
+double engine::audio_clock::get(std::chrono::steady_clock::time_point now) const {
+    return get(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+}
+
+double engine::audio_clock::get(std::int64_t now_ns) const {
+    while (true) {
+        std::uint32_t current_sequence = sequence.load(std::memory_order_acquire);
+        if (current_sequence % 2 != 0)
+            continue;
+            
+        double time = anchor_time.load(std::memory_order_relaxed);
+        std::int64_t time_ns = anchor_ns.load(std::memory_order_relaxed);
+        double current_rate = rate.load(std::memory_order_relaxed);
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) == current_sequence)
+            return time + current_rate * static_cast<double>(std::max<std::int64_t>(now_ns - time_ns, 0)) / 1e9;
+    }
+}
+
+//--- ENGINE::MUSIC_STREAM ---//
+
+engine::music_stream::music_stream() :
+    mapping(nullptr),
+    mapping_size(0),
+    mapped_data(nullptr),
+    is_mapping_owned(false),
+    data_start(0),
+    block_size(0),
+    ring_head(0),
+    ring_count(0),
+    is_head_in_use(false),
+    decode_offset(0),
+    decode_end(0),
+    decode_frame_size(0),
+    seek_generation(0),
+    is_seek_pending(false),
+    should_decode_close(false),
+    next_offset(0)
+{
+#ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+    stall_end.store(std::numeric_limits<std::chrono::steady_clock::rep>::min(), std::memory_order_relaxed);
+#endif
+}
+
+engine::music_stream::~music_stream() {
+    close();
+}
+
+void engine::music_stream::open(const std::string& full_path, const music_t& music, std::size_t _block_size) {
+    close();
+    next_offset = 0;
+    block_size = _block_size;
+    
+    if (music.codec != music_codec::wav) {
+        decoder.open(full_path, music.codec, music.archived_data);
+        for (decoded_block& block : decode_ring)
+            block.data.resize(block_size);
+            
+        ring_head = 0;
+        ring_count = 0;
+        is_head_in_use = false;
+        decode_offset = 0;
+        decode_end = music.data_size;
+        decode_frame_size = music.frame_size;
+        is_seek_pending = false;
+        should_decode_close = false;
+        decode_thread = std::thread(&music_stream::decode_worker, this);
+        return;
+    }
+    
+#ifdef KEE_AUDIO_USE_MMAP
+    std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    if (!music.archived_data.empty()) {
+        // the archive is already mapped, the stream only borrows the pages around its blob
+        std::uintptr_t data_address = reinterpret_cast<std::uintptr_t>(music.archived_data.data());
+        mapping = reinterpret_cast<void*>(data_address - data_address % page_size);
+        mapping_size = data_address % page_size + music.archived_data.size();
+        mapped_data = music.archived_data.data();
+        is_mapping_owned = false;
+        return;
+    }
+    
+#ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+    bool should_map = !is_mapping_disabled.load(std::memory_order_relaxed);
+#else
+    constexpr bool should_map = true;
+#endif
+    int fd = should_map ? ::open(full_path.c_str(), O_RDONLY) : -1;
+    if (fd != -1) {
+        struct stat file_stat;
+        std::size_t map_start = music.data_start - music.data_start % page_size;
+        std::size_t map_size = music.data_start + music.data_size - map_start;
+        
+        void* map = MAP_FAILED;
+        if (fstat(fd, &file_stat) == 0 && static_cast<std::size_t>(file_stat.st_size) >= music.data_start + music.data_size)
+            map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(map_start));
+        ::close(fd);
+        
+        if (map != MAP_FAILED) {
+            madvise(map, map_size, MADV_SEQUENTIAL);
+            mapping = map;
+            mapping_size = map_size;
+            mapped_data = static_cast<const byte*>(map) + (music.data_start - map_start);
+            is_mapping_owned = true;
+            return;
+        }
+    }
+#endif
+
+    file = std::ifstream(full_path, std::ios::binary);
+    if (!file.is_open())
+        throw std::filesystem::filesystem_error("audio::engine::music_stream::open: Could not open music file at " + full_path, std::error_code());
+    
+    file_buffer.resize(block_size);
+    data_start = music.data_start;
+    file.seekg(data_start);
+}
+
+void engine::music_stream::close() {
+    if (decode_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(decode_lock);
+            should_decode_close = true;
+        }
+        decode_cv.notify_all();
+        decode_thread.join();
+        decoder.close();
+    }
+    
+#ifdef KEE_AUDIO_USE_MMAP
+    if (mapping != nullptr && is_mapping_owned)
+        munmap(mapping, mapping_size);
+#endif
+    mapping = nullptr;
+    mapping_size = 0;
+    mapped_data = nullptr;
+    is_mapping_owned = false;
+    
+    file = std::ifstream();
+}
+
+const engine::byte* engine::music_stream::read(std::size_t offset, std::size_t size) {
+    if (decode_thread.joinable())
+        return read_decoded(offset, size);
+
+    bool is_seek = offset != next_offset;
+    next_offset = offset + size;
+    
+#ifdef KEE_AUDIO_USE_MMAP
+    if (mapped_data != nullptr) {
+        if (is_seek)
+            advise_willneed(offset);
+        return mapped_data + offset;
+    }
+#endif
+
+    if (is_seek)
+        file.seekg(data_start + offset);
+    
+    if (!file.read(file_buffer.data(), size)) {
+        // a short read plays out as silence, the next read seeks from a clean stream
+        std::fill(file_buffer.begin() + file.gcount(), file_buffer.begin() + size, 0);
+        file.clear();
+        next_offset = std::numeric_limits<std::size_t>::max();
+    }
+    return file_buffer.data();
+}
+
+const engine::byte* engine::music_stream::read_decoded(std::size_t offset, std::size_t size) {
+    std::unique_lock<std::mutex> lock(decode_lock);
+    is_head_in_use = false;
+    
+    // only a seek waits on the decoder, sequential reads are served from blocks decoded ahead
+    bool is_seek = offset != next_offset || (ring_count > 0 && decode_ring[ring_head].offset != offset);
+    if (is_seek)
+        seek_decoder(offset);
+    
+    decode_cv.notify_all();
+    decode_cv.wait(lock, [this]() { return ring_count > 0; });
+    
+    decoded_block& block = decode_ring[ring_head];
+    ring_head = (ring_head + 1) % DECODE_RING_SIZE;
+    ring_count--;
+    is_head_in_use = true;
+    next_offset = offset + size;
+    
+    decode_cv.notify_all();
+    return block.data.data();
+}
+
+void engine::music_stream::prefetch(std::size_t offset) {
+    if (decode_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(decode_lock);
+            if (offset != next_offset || ring_count == 0 || decode_ring[ring_head].offset != offset)
+                seek_decoder(offset);
+            next_offset = offset;
+        }
+        decode_cv.notify_all();
+        return;
+    }
+    
+#ifdef KEE_AUDIO_USE_MMAP
+    if (mapped_data != nullptr)
+        advise_willneed(offset);
+#endif
+}
+
+bool engine::music_stream::is_ready(std::size_t offset) {
+    if (decode_thread.joinable()) {
+        std::lock_guard<std::mutex> lock(decode_lock);
+        return offset >= decode_end || (ring_count > 0 && decode_ring[ring_head].offset == offset);
+    }
+    
+#ifdef KEE_AUDIO_USE_MMAP
+    if (mapped_data != nullptr) {
+        // resident pages won't fault, the others are still being read in after advise_willneed
+    #ifdef __APPLE__
+        using residency_t = char;
+    #else
+        using residency_t = unsigned char;
+    #endif
+        static constexpr std::size_t CHECKED_PAGE_COUNT = 16;
+        std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        std::size_t mapping_offset = static_cast<std::size_t>(mapped_data - static_cast<const byte*>(mapping)) + offset;
+        std::size_t check_start = std::min(mapping_offset - mapping_offset % page_size, mapping_size);
+        std::size_t check_size = std::min({ mapping_size - check_start, mapping_offset - check_start + block_size, CHECKED_PAGE_COUNT * page_size });
+        
+        std::array<residency_t, CHECKED_PAGE_COUNT> residency;
+        if (check_size == 0 || mincore(static_cast<byte*>(mapping) + check_start, check_size, residency.data()) != 0)
+            return true;
+        return std::all_of(residency.begin(), residency.begin() + (check_size + page_size - 1) / page_size, [](residency_t page) -> bool {
+            return (page & 1) != 0;
+        });
+    }
+#endif
+
+    return true;
+}
+
+bool engine::music_stream::is_stalled([[maybe_unused]] std::chrono::steady_clock::time_point now) const {
+#ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+    return now.time_since_epoch().count() < stall_end.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+#ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+std::atomic_bool engine::music_stream::is_mapping_disabled = false;
+
+void engine::music_stream::stall_reads(std::chrono::steady_clock::time_point until) {
+    stall_end.store(until.time_since_epoch().count(), std::memory_order_relaxed);
+}
+#endif
+
+void engine::music_stream::seek_decoder(std::size_t offset) {
+    ring_count = 0;
+    decode_offset = offset;
+    seek_generation++;
+    is_seek_pending = true;
+}
+
+void engine::music_stream::advise_willneed([[maybe_unused]] std::size_t offset) {
+#ifdef KEE_AUDIO_USE_MMAP
+    // MADV_SEQUENTIAL only reads ahead of the old position, warm the pages after a seek
+    std::size_t willneed_size = 4 * block_size;
+    std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::size_t mapping_offset = static_cast<std::size_t>(mapped_data - static_cast<const byte*>(mapping)) + offset;
+    std::size_t advise_start = std::min(mapping_offset - mapping_offset % page_size, mapping_size);
+    std::size_t advise_size = std::min(mapping_size - advise_start, mapping_offset - advise_start + willneed_size);
+    madvise(static_cast<byte*>(mapping) + advise_start, advise_size, MADV_WILLNEED);
+#endif
+}
+
+void engine::music_stream::decode_worker() {
+    bool is_decoder_valid = true;
+    std::unique_lock<std::mutex> lock(decode_lock);
+    while (true) {
+        decode_cv.wait(lock, [this]() {
+            bool has_free_block = ring_count + (is_head_in_use ? 1 : 0) < DECODE_RING_SIZE;
+            return should_decode_close || is_seek_pending || (has_free_block && decode_offset < decode_end);
+        });
+        
+        if (should_decode_close)
+            return;
+            
+        if (is_seek_pending) {
+            is_seek_pending = false;
+            std::size_t seek_frame = decode_offset / decode_frame_size;
+            lock.unlock();
+            is_decoder_valid = decoder.seek(seek_frame);
+            lock.lock();
+            continue;
+        }
+        
+        // the block after the last ready one is never handed out, so it is decoded into unlocked
+        std::uint64_t generation = seek_generation;
+        std::size_t block_offset = decode_offset;
+        std::size_t decoded_size = std::min(block_size, decode_end - block_offset);
+        decoded_block& block = decode_ring[(ring_head + ring_count) % DECODE_RING_SIZE];
+        lock.unlock();
+        
+        std::size_t frames_read = 0;
+        if (is_decoder_valid)
+            frames_read = decoder.read(reinterpret_cast<std::int16_t*>(block.data.data()), decoded_size / decode_frame_size);
+        // a failed seek or a truncated stream plays out as silence
+        std::fill(block.data.begin() + frames_read * decode_frame_size, block.data.begin() + decoded_size, 0);
+        
+        lock.lock();
+        if (generation != seek_generation)
+            continue;
+            
+        block.offset = block_offset;
+        block.size = decoded_size;
+        decode_offset = block_offset + decoded_size;
+        ring_count++;
+        decode_cv.notify_all();
+    }
+}
+
+//--- ENGINE::MUSIC_DECODER ---//
+
+engine::music_decoder::music_decoder() :
+    codec(music_codec::wav),
+    handle(nullptr),
+    channels(0)
+{ }
+
+engine::music_decoder::~music_decoder() {
+    close();
+}
+
+engine::music_codec engine::music_decoder::get_codec(const std::filesystem::path& full_path) {
+    if (full_path.extension() == ".ogg")
+        return music_codec::vorbis;
+    if (full_path.extension() == ".flac")
+        return music_codec::flac;
+        
+    return music_codec::wav;
+}
+
+bool engine::music_decoder::is_supported(music_codec codec) {
+    switch (codec) {
+    case music_codec::wav:
+        return true;
+    case music_codec::vorbis:
+#ifdef KEE_AUDIO_ENABLE_VORBIS
+        return true;
+#else
+        return false;
+#endif
+    case music_codec::flac:
+#ifdef KEE_AUDIO_ENABLE_FLAC
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+engine::wav engine::music_decoder::load_header(const std::filesystem::path& full_path, music_codec codec) {
+    if (codec == music_codec::wav) {
+        std::ifstream wav_file = open_wav(full_path);
+        return load_wav(wav_file);
+    }
+    
+    music_decoder decoder;
+    decoder.open(full_path, codec, std::span<const byte>());
+    
+    int sample_rate = 0;
+    std::size_t frame_count = 0;
+#ifdef KEE_AUDIO_ENABLE_VORBIS
+    if (codec == music_codec::vorbis) {
+        stb_vorbis* vorbis = static_cast<stb_vorbis*>(decoder.handle);
+        sample_rate = static_cast<int>(stb_vorbis_get_info(vorbis).sample_rate);
+        frame_count = stb_vorbis_stream_length_in_samples(vorbis);
+    }
+#endif
+#ifdef KEE_AUDIO_ENABLE_FLAC
+    if (codec == music_codec::flac) {
+        drflac* flac = static_cast<drflac*>(decoder.handle);
+        sample_rate = static_cast<int>(flac->sampleRate);
+        frame_count = static_cast<std::size_t>(flac->totalPCMFrameCount);
+    }
+#endif
+
+    if (sample_rate <= 0 || frame_count == 0)
+        throw std::filesystem::filesystem_error("audio::engine::music_decoder::load_header: Could not read the length of " + full_path.string(), std::error_code());
+        
+    ALenum format = decoder.channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+    std::size_t data_size = frame_count * get_frame_size(format);
+    float duration = static_cast<float>(frame_count) / sample_rate;
+    return std::make_tuple(sample_rate, format, std::size_t(0), data_size, duration);
+}
+
+void engine::music_decoder::open(const std::filesystem::path& full_path, music_codec _codec, [[maybe_unused]] std::span<const byte> archived_data) {
+    close();
+    codec = _codec;
+    
+    switch (codec) {
+    case music_codec::wav:
+        throw std::logic_error("audio::engine::music_decoder::open: wav music is streamed as is, not decoded");
+    case music_codec::vorbis: {
+#ifdef KEE_AUDIO_ENABLE_VORBIS
+        int error = 0;
+        stb_vorbis* vorbis = archived_data.empty()
+            ? stb_vorbis_open_filename(full_path.string().c_str(), &error, nullptr)
+            : stb_vorbis_open_memory(reinterpret_cast<const unsigned char*>(archived_data.data()), static_cast<int>(archived_data.size()), &error, nullptr);
+        if (vorbis != nullptr) {
+            handle = vorbis;
+            channels = static_cast<std::size_t>(stb_vorbis_get_info(vorbis).channels);
+        }
+        break;
+#else
+        throw std::logic_error("audio::engine::music_decoder::open: .ogg music needs stb_vorbis.c and KEE_AUDIO_ENABLE_VORBIS");
+#endif
+    }
+    case music_codec::flac: {
+#ifdef KEE_AUDIO_ENABLE_FLAC
+        drflac* flac = archived_data.empty()
+            ? drflac_open_file(full_path.string().c_str(), nullptr)
+            : drflac_open_memory(archived_data.data(), archived_data.size(), nullptr);
+        if (flac != nullptr) {
+            handle = flac;
+            channels = flac->channels;
+        }
+        break;
+#else
+        throw std::logic_error("audio::engine::music_decoder::open: .flac music needs dr_flac.h and KEE_AUDIO_ENABLE_FLAC");
+#endif
+    }
+    }
+    
+    if (handle == nullptr)
+        throw std::filesystem::filesystem_error("audio::engine::music_decoder::open: Could not open music file at " + full_path.string(), std::error_code());
+    if (channels != 1 && channels != 2) {
+        close();
+        throw std::filesystem::filesystem_error("audio::engine::music_decoder::open: Only mono and stereo music is supported", std::error_code());
+    }
+}
+
+void engine::music_decoder::close() {
+#ifdef KEE_AUDIO_ENABLE_VORBIS
+    if (handle != nullptr && codec == music_codec::vorbis)
+        stb_vorbis_close(static_cast<stb_vorbis*>(handle));
+#endif
+#ifdef KEE_AUDIO_ENABLE_FLAC
+    if (handle != nullptr && codec == music_codec::flac)
+        drflac_close(static_cast<drflac*>(handle));
+#endif
+    handle = nullptr;
+    channels = 0;
+}
+
+std::size_t engine::music_decoder::read([[maybe_unused]] std::int16_t* out, [[maybe_unused]] std::size_t frames) {
+    std::size_t frames_read = 0;
+#ifdef KEE_AUDIO_ENABLE_VORBIS
+    if (codec == music_codec::vorbis) {
+        // stb_vorbis stops at packet boundaries, keep pulling until the block is full
+        while (frames_read < frames) {
+            int samples_left = static_cast<int>((frames - frames_read) * channels);
+            int decoded = stb_vorbis_get_samples_short_interleaved(static_cast<stb_vorbis*>(handle), static_cast<int>(channels), out + frames_read * channels, samples_left);
+            if (decoded <= 0)
+                break;
+            frames_read += decoded;
+        }
+    }
+#endif
+#ifdef KEE_AUDIO_ENABLE_FLAC
+    if (codec == music_codec::flac)
+        frames_read = static_cast<std::size_t>(drflac_read_pcm_frames_s16(static_cast<drflac*>(handle), frames, out));
+#endif
+    return frames_read;
+}
+
+bool engine::music_decoder::seek([[maybe_unused]] std::size_t frame) {
+#ifdef KEE_AUDIO_ENABLE_VORBIS
+    if (codec == music_codec::vorbis)
+        return stb_vorbis_seek(static_cast<stb_vorbis*>(handle), static_cast<unsigned int>(frame)) != 0;
+#endif
+#ifdef KEE_AUDIO_ENABLE_FLAC
+    if (codec == music_codec::flac)
+        return drflac_seek_to_pcm_frame(static_cast<drflac*>(handle), frame) == DRFLAC_TRUE;
+#endif
+    return false;
+}
+
+//----------------------------//
+
+std::size_t engine::get_frame_size(ALenum format) {
+    switch (format) {
+    case AL_FORMAT_MONO8:
+        return 1;
+    case AL_FORMAT_MONO16:
+    case AL_FORMAT_STEREO8:
+        return 2;
+    case AL_FORMAT_STEREO16:
+        return 4;
+    default:
+        throw std::logic_error("audio::engine::get_frame_size: Invalid format");
+    }
+}
+
+std::chrono::microseconds engine::frames_to_duration(std::size_t frames, int sample_rate) {
+    return std::chrono::microseconds(static_cast<std::int64_t>(frames) * 1000000 / sample_rate);
+}
+
+std::chrono::steady_clock::time_point engine::get_engine_time() const {
+    if (!is_loopback)
+        return std::chrono::steady_clock::now();
+        
+    std::uint64_t frames = loopback_frames.load(std::memory_order_acquire);
+    std::chrono::duration<double> rendered_time(static_cast<double>(frames) / mix_sample_rate);
+    return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(rendered_time));
+}
+
+void engine::fetch_al_errors(const char* file, int line) {
+    // checks run from nested classes without an engine at hand, OpenAL's one context means they're the live engine's
+    KEE_AUDIO_METRIC(engine* checked_engine = live_engine.load(std::memory_order_relaxed));
+    KEE_AUDIO_METRIC(std::optional<metric_timer> check_timer);
+    KEE_AUDIO_METRIC(if (checked_engine != nullptr) check_timer.emplace(checked_engine->metrics.al_error_check_time));
+    ALenum error_flag = alGetError();
+    if (error_flag == AL_NO_ERROR)
+        return;
+        
+    // the message is only built for a failed check, a passing one doesn't allocate
+    bool error_found = false;
+    std::stringstream err_msg_stream;
+    while (error_flag != AL_NO_ERROR) {
+        if (!error_found) {
+            error_found = true;
+            err_msg_stream << "OpenAL Flags: ";
+        }
+        
+        switch (error_flag) {
+        case AL_INVALID_NAME:
+            err_msg_stream << "\"AL_INVALID_NAME\" ";
+            break;
+        case AL_INVALID_ENUM:
+            err_msg_stream << "\"AL_INVALID_ENUM\" ";
+            break;
+        case AL_INVALID_VALUE:
+            err_msg_stream << "\"AL_INVALID_VALUE\" ";
+            break;
+        case AL_INVALID_OPERATION:
+            err_msg_stream << "\"AL_INVALID_OPERATION\" ";
+            break;
+        case AL_OUT_OF_MEMORY:
+            err_msg_stream << "\"AL_OUT_OF_MEMORY\" ";
+            break;
+        default:
+            err_msg_stream << "\"Flag not deducable\" ";
+            break;
+        }
+        
+        error_flag = alGetError();
+    }
+    
+    if (error_found) {
+        err_msg_stream << "File " << std::filesystem::path(file) << " @ Line " << line;
+        throw std::runtime_error(err_msg_stream.str());
+    }
+}
+
+void engine::fetch_alc_errors(ALCdevice* device, const char* file, int line) {
+    ALCenum error_flag = alcGetError(device);
+    if (error_flag == ALC_NO_ERROR)
+        return;
+        
+    bool error_found = false;
+    std::stringstream err_msg_stream;
+    while (error_flag != ALC_NO_ERROR) {
+        if (!error_found) {
+            error_found = true;
+            err_msg_stream << "OpenAL Flags: ";
+        }
+        
+        switch (error_flag) {
+        case ALC_INVALID_DEVICE:
+            err_msg_stream << "\"ALC_INVALID_DEVICE\" ";
+            break;
+        case ALC_INVALID_CONTEXT:
+            err_msg_stream << "\"ALC_INVALID_CONTEXT\" ";
+            break;
+        case ALC_INVALID_ENUM:
+            err_msg_stream << "\"ALC_INVALID_ENUM\" ";
+            break;
+        case ALC_INVALID_VALUE:
+            err_msg_stream << "\"ALC_INVALID_VALUE\" ";
+            break;
+        case ALC_OUT_OF_MEMORY:
+            err_msg_stream << "\"ALC_OUT_OF_MEMORY\" ";
+            break;
+        default:
+            err_msg_stream << "\"Flag not deducable\" ";
+            break;
+        }
+        
+        error_flag = alcGetError(device);
+    }
+    
+    if (error_found) {
+        err_msg_stream << "File " << std::filesystem::path(file) << " @ Line " << line;
+        throw std::runtime_error(err_msg_stream.str());
+    }
+}
+
+std::ifstream engine::open_wav(const std::filesystem::path& full_path) {
+    if (full_path.extension() != ".wav")
+        throw std::logic_error("audio::engine::open_wav: attempted opening a non .wav file");
+
+    std::ifstream wav_file(full_path, std::ios::binary);
+    if (!wav_file.is_open())
+        throw std::filesystem::filesystem_error("audio::engine::open_wav: Could not open wav file at " + full_path.string(), std::error_code());
+        
+    return wav_file;
+}
+
+engine::wav engine::load_wav(std::ifstream& wav_file, wav_encoding* encoding) {
+    static const auto buffer_to_number = [](byte* buffer, std::size_t len) -> std::int32_t {
+        if (len > 4)
+            throw std::logic_error("audio::engine::buffer_to_number: Buffer can only contain up at 4 bytes");
+        
+        if constexpr (std::endian::native == std::endian::big)
+            std::reverse(buffer, buffer + len);
+        
+        std::int32_t res = 0;
+        std::memcpy(&res, buffer, len);
+        return res;
+    };
+    
+    // chunks are read whole (ID + size, then the fmt body) instead of one field at a time
+    std::array<byte, 12> riff_header;
+    if (!wav_file.read(riff_header.data(), riff_header.size()))
+        throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read RIFF header", std::error_code());
+    if (std::strncmp(riff_header.data(), "RIFF", 4) != 0)
+        throw std::filesystem::filesystem_error("audio::engine::load_wav: wav header does not contain RIFF", std::error_code());
+    if (std::strncmp(riff_header.data() + 8, "WAVE", 4) != 0)
+        throw std::filesystem::filesystem_error("audio::engine::load_wav: wav header does not contain WAVE", std::error_code());
+    
+    int num_channels = 0;
+    int sample_rate = 0;
+    int bits_per_sample = 0;
+    bool is_float = false;
+    bool is_fmt_read = false;
+    ALenum format = AL_NONE;
+    
+    std::array<byte, 8> chunk_header;
+    while (wav_file.read(chunk_header.data(), chunk_header.size())) {
+        std::size_t chunk_size = static_cast<std::uint32_t>(buffer_to_number(chunk_header.data() + 4, 4));
+    
+        if (std::strncmp(chunk_header.data(), "fmt ", 4) == 0) {
+            // 40 bytes covers WAVE_FORMAT_EXTENSIBLE, whose sub format starts with the actual format tag
+            std::array<byte, 40> fmt_chunk;
+            std::size_t fmt_size = std::min(chunk_size, fmt_chunk.size());
+            if (chunk_size < 16 || !wav_file.read(fmt_chunk.data(), fmt_size))
+                throw std::filesystem::filesystem_error("audio::engine::load_wav: Could not read fmt chunk", std::error_code());
+            wav_file.ignore(chunk_size - fmt_size + chunk_size % 2);
+            
+            int format_tag = buffer_to_number(fmt_chunk.data(), 2);
+            num_channels = buffer_to_number(fmt_chunk.data() + 2, 2);
+            sample_rate = buffer_to_number(fmt_chunk.data() + 4, 4);
+            bits_per_sample = buffer_to_number(fmt_chunk.data() + 14, 2);
+            if (format_tag == 0xFFFE && fmt_size >= 26)
+                format_tag = buffer_to_number(fmt_chunk.data() + 24, 2);
+                
+            is_float = format_tag == 3;
+            bool is_pcm = format_tag == 1 && (bits_per_sample == 8 || bits_per_sample == 16 || bits_per_sample == 24 || bits_per_sample == 32);
+            if ((!is_pcm && !(is_float && bits_per_sample == 32)) || (num_channels != 1 && num_channels != 2) || sample_rate <= 0)
+                throw std::filesystem::filesystem_error("audio::engine::load_wav: Invalid filesystem format", std::error_code());
+            is_fmt_read = true;
+            
+            if (is_pcm && num_channels == 1 && bits_per_sample == 8)
+                format = AL_FORMAT_MONO8;
+            else if (is_pcm && num_channels == 1 && bits_per_sample == 16)
+                format = AL_FORMAT_MONO16;
+            else if (is_pcm && num_channels == 2 && bits_per_sample == 8)
+                format = AL_FORMAT_STEREO8;
+            else if (is_pcm && num_channels == 2 && bits_per_sample == 16)
+                format = AL_FORMAT_STEREO16;
+        }
+        else if (std::strncmp(chunk_header.data(), "data", 4) == 0) {
+            if (!is_fmt_read)
+                throw std::filesystem::filesystem_error("audio::engine::load_wav: data chunk precedes fmt chunk", std::error_code());
+                
+            std::size_t data_start = wav_file.tellg();
+            std::size_t data_size = chunk_size;
+            
+            float num_samples = data_size / (num_channels * bits_per_sample / 8);
+            float duration = num_samples / sample_rate;
+            if (encoding != nullptr)
+                *encoding = { num_channels, bits_per_sample, is_float };
+            return std::make_tuple(sample_rate, format, data_start, data_size, duration);
+        }
+        else
+            wav_file.ignore(chunk_size + chunk_size % 2);
+    }
+    
+    throw std::filesystem::filesystem_error("audio::engine::load_wav: wav file stream went bad or could not find data chunk", std::error_code());
+}
+
+void engine::write_wav(const std::filesystem::path& wav_path, const std::vector<std::int16_t>& samples, int channels, int sample_rate) {
+    std::ofstream wav_file(wav_path, std::ios::binary | std::ios::trunc);
+    if (!wav_file.is_open())
+        throw std::filesystem::filesystem_error("audio::engine::write_wav: Unable to open wav file", wav_path, std::error_code());
+        
+    std::vector<byte> header;
+    const auto push_number = [&header](std::uint32_t number, std::size_t len) {
+        for (std::size_t i = 0; i < len; i++)
+            header.push_back(static_cast<byte>(number >> (8 * i) & 0xFF));
+    };
+    const auto push_id = [&header](const char* id) {
+        header.insert(header.end(), id, id + 4);
+    };
+    
+    std::uint32_t data_size = static_cast<std::uint32_t>(samples.size() * sizeof(std::int16_t));
+    std::uint32_t frame_size = static_cast<std::uint32_t>(channels) * sizeof(std::int16_t);
+    push_id("RIFF");
+    push_number(36 + data_size, 4);
+    push_id("WAVE");
+    push_id("fmt ");
+    push_number(16, 4);
+    push_number(1, 2);
+    push_number(static_cast<std::uint32_t>(channels), 2);
+    push_number(static_cast<std::uint32_t>(sample_rate), 4);
+    push_number(static_cast<std::uint32_t>(sample_rate) * frame_size, 4);
+    push_number(frame_size, 2);
+    push_number(16, 2);
+    push_id("data");
+    push_number(data_size, 4);
+    wav_file.write(header.data(), static_cast<std::streamsize>(header.size()));
+    
+    if constexpr (std::endian::native == std::endian::big) {
+        std::vector<std::int16_t> swapped(samples);
+        for (std::int16_t& sample : swapped)
+            sample = static_cast<std::int16_t>(static_cast<std::uint16_t>(sample) >> 8 | static_cast<std::uint16_t>(sample) << 8);
+        wav_file.write(reinterpret_cast<const byte*>(swapped.data()), static_cast<std::streamsize>(data_size));
+    }
+    else
+        wav_file.write(reinterpret_cast<const byte*>(samples.data()), static_cast<std::streamsize>(data_size));
+    
+    wav_file.close();
+    if (!wav_file)
+        throw std::filesystem::filesystem_error("audio::engine::write_wav: Could not write wav file", wav_path, std::error_code());
+}
+
+void engine::load_assets() {
+    if (load_archived_assets())
+        return;
+        
+    class asset_file {
+    public:
+        std::filesystem::path full_path;
+        bool is_sfx;
+        std::uintmax_t file_size;
+        std::int64_t modified_time;
+        wav header;
+        std::string normalized_path;
+        bool is_parsed;
+    };
+    
+    std::vector<asset_file> asset_files;
+    for (const auto& [directory, is_sfx] : { std::make_pair(SFX_DIRECTORY, true), std::make_pair(MUSIC_DIRECTORY, false) }) {
+        for (const std::filesystem::directory_entry& full_path : std::filesystem::directory_iterator(directory)) {
+            if (full_path.path().filename() == ".DS_Store")
+                continue;
+            // music this build can't decode is left out, looking it up fails like any missing asset
+            if (!is_sfx && !music_decoder::is_supported(music_decoder::get_codec(full_path.path())))
+                continue;
+                
+            std::int64_t modified_time = full_path.last_write_time().time_since_epoch().count();
+            asset_files.push_back({ full_path.path(), is_sfx, full_path.file_size(), modified_time, wav(), std::string(), false });
+        }
+    }
+    
+    asset_index cached_index;
+    cached_index.load(ASSET_INDEX_PATH);
+    
+    parallel_for(asset_files.size(), [this, &asset_files, &cached_index](std::size_t i) {
+        asset_file& file = asset_files[i];
+        bool is_wav = file.is_sfx || music_decoder::get_codec(file.full_path) == music_codec::wav;
+        auto cached = cached_index.entries.find(file.full_path.string());
+        // a wav cached at another device rate is normalized again, compressed music keeps its own rate
+        bool is_cached = cached != cached_index.entries.end()
+            && cached->second.file_size == file.file_size
+            && cached->second.modified_time == file.modified_time
+            && (!is_wav || std::get<0>(cached->second.header) == mix_sample_rate)
+            && (cached->second.normalized_path.empty() || std::filesystem::exists(cached->second.normalized_path))
+            && !is_resampling_disabled();
+        
+        if (is_cached) {
+            file.header = cached->second.header;
+            file.normalized_path = cached->second.normalized_path;
+            return;
+        }
+        
+        if (is_wav) {
+            wav_encoding encoding;
+            std::ifstream wav_file = open_wav(file.full_path);
+            file.header = load_wav(wav_file, &encoding);
+            bool is_resampled = std::get<0>(file.header) != mix_sample_rate && !is_resampling_disabled();
+            if (encoding.bits_per_sample != 16 || encoding.is_float || is_resampled) {
+                file.normalized_path = normalize_wav(file.full_path, file.header, encoding).string();
+                std::ifstream normalized_file = open_wav(file.normalized_path);
+                file.header = load_wav(normalized_file);
+            }
+        }
+        else
+            file.header = music_decoder::load_header(file.full_path, music_decoder::get_codec(file.full_path));
+        file.is_parsed = true;
+    });
+    
+    asset_index new_index;
+    bool is_index_stale = cached_index.entries.size() != asset_files.size();
+    for (asset_file& file : asset_files) {
+        std::string file_name = file.full_path.filename().string();
+        const auto [sample_rate, format, data_start, data_size, duration] = file.header;
+        new_index.entries.try_emplace(file.full_path.string(), asset_index::entry{ file.file_size, file.modified_time, file.header, file.normalized_path });
+        is_index_stale |= file.is_parsed;
+        
+        // assets are named after their original file, but read from their normalized copy when they have one
+        std::filesystem::path data_path = file.normalized_path.empty() ? file.full_path : std::filesystem::path(file.normalized_path);
+        if (file.is_sfx) {
+            if (sfx_map.find(file_name) != sfx_map.end())
+                throw std::logic_error("audio::engine::load_wav: sfx file name already exists");
+                
+            sfx_map.try_emplace(file_name, data_path, sample_rate, format, data_start, data_size, std::span<const byte>());
+        }
+        else {
+            if (music_map.find(file_name) != music_map.end())
+                throw std::logic_error("audio::engine::load_wav: music file name already exists");
+                
+            music_map.try_emplace(file_name, data_path, music_decoder::get_codec(data_path), sample_rate, format, data_start, data_size, duration, std::span<const byte>());
+        }
+    }
+    
+    if (is_index_stale)
+        new_index.save(ASSET_INDEX_PATH);
+}
+
+bool engine::load_archived_assets() {
+    if (!archive.open(ARCHIVE_PATH))
+        return false;
+        
+    for (const asset_archive::entry& asset : archive.entries) {
+        if (!asset.is_sfx && !music_decoder::is_supported(asset.codec))
+            continue;
+            
+        const auto [sample_rate, format, data_start, data_size, duration] = asset.header;
+        std::span<const byte> blob = archive.get_blob(asset);
+        if (asset.is_sfx) {
+            if (!sfx_map.try_emplace(asset.name, archive.archive_path, sample_rate, format, data_start, data_size, blob).second)
+                throw std::logic_error("audio::engine::load_archived_assets: sfx file name already exists");
+        }
+        else {
+            if (!music_map.try_emplace(asset.name, archive.archive_path, asset.codec, sample_rate, format, data_start, data_size, duration, blob).second)
+                throw std::logic_error("audio::engine::load_archived_assets: music file name already exists");
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<const engine::waveform> engine::load_waveform(music_id id) {
+    const music_entry& music = *music_ids.at(id.index);
+    {
+        std::lock_guard<std::mutex> lock(waveform_lock);
+        if (waveforms[id.index] != nullptr)
+            return waveforms[id.index];
+    }
+    
+    // built outside the lock, two threads racing on one music only cost a duplicate pass
+    std::error_code error;
+    std::uintmax_t source_size = std::filesystem::file_size(music.second.full_path, error);
+    std::int64_t source_time = std::filesystem::last_write_time(music.second.full_path, error).time_since_epoch().count();
+    std::ostringstream cache_name;
+    cache_name << std::hex << asset_key(music.first).hash << ".keew";
+    std::filesystem::path cache_path = std::filesystem::path(WAVEFORM_DIRECTORY) / cache_name.str();
+    
+    std::shared_ptr<waveform> shape = std::make_shared<waveform>();
+    if (!shape->load(cache_path, source_size, source_time, music.second)) {
+        shape->build(music.second, kernels);
+        shape->save(cache_path, source_size, source_time, music.second);
+    }
+    
+    std::lock_guard<std::mutex> lock(waveform_lock);
+    if (waveforms[id.index] == nullptr)
+        waveforms[id.index] = std::move(shape);
+    return waveforms[id.index];
+}
+
+void engine::index_assets() {
+    sfx_ids.reserve(sfx_map.size());
+    for (sfx_entry& sfx : sfx_map) {
+        if (!sfx_keys.try_emplace(asset_key(sfx.first).hash, static_cast<std::uint32_t>(sfx_ids.size())).second)
+            throw std::logic_error("audio::engine::index_assets: two sfx file names share an asset key, rename one");
+        sfx_ids.push_back(&sfx);
+    }
+    
+    music_ids.reserve(music_map.size());
+    for (const music_entry& music : music_map) {
+        if (!music_keys.try_emplace(asset_key(music.first).hash, static_cast<std::uint32_t>(music_ids.size())).second)
+            throw std::logic_error("audio::engine::index_assets: two music file names share an asset key, rename one");
+        music_ids.push_back(&music);
+    }
+}
+
+void engine::pack_assets(const std::filesystem::path& archive_path, int sample_rate) {
+    if (sample_rate <= 0)
+        throw std::out_of_range("audio::engine::pack_assets: sample rate must be positive");
+    if constexpr (std::endian::native != std::endian::little)
+        throw std::logic_error("audio::engine::pack_assets: archives are little endian, they can only be packed on a little endian host");
+        
+    class packed_asset {
+    public:
+        asset_archive::entry entry;
+        std::vector<byte> blob;
+    };
+    
+    // packing never touches OpenAL, the kernels are only there for the resampler
+    mix_kernels pack_kernels = mix_kernels::select(simd_level::avx2);
+    std::vector<packed_asset> assets;
+    for (const auto& [directory, is_sfx] : { std::make_pair(SFX_DIRECTORY, true), std::make_pair(MUSIC_DIRECTORY, false) }) {
+        for (const std::filesystem::directory_entry& full_path : std::filesystem::directory_iterator(directory)) {
+            if (full_path.path().filename() == ".DS_Store")
+                continue;
+            if (!is_sfx && !music_decoder::is_supported(music_decoder::get_codec(full_path.path())))
+                continue;
+                
+            packed_asset asset = { { full_path.path().filename().string(), is_sfx, music_codec::wav, wav(), 0 }, std::vector<byte>() };
+            asset.entry.codec = is_sfx ? music_codec::wav : music_decoder::get_codec(full_path.path());
+            if (asset.entry.codec == music_codec::wav) {
+                wav_encoding encoding;
+                std::ifstream wav_file = open_wav(full_path.path());
+                wav header = load_wav(wav_file, &encoding);
+                const auto [wav_sample_rate, format, data_start, data_size, duration] = header;
+                
+                asset.blob.resize(data_size);
+                wav_file.seekg(data_start);
+                if (!wav_file.read(asset.blob.data(), data_size))
+                    throw std::filesystem::filesystem_error("audio::engine::pack_assets: Could not read wav data of " + full_path.path().string(), std::error_code());
+                    
+                ALenum packed_format = format;
+                if (encoding.bits_per_sample != 16 || encoding.is_float || wav_sample_rate != sample_rate) {
+                    std::vector<std::int16_t> samples = normalize_samples(asset.blob, header, encoding, sample_rate, pack_kernels);
+                    asset.blob.resize(samples.size() * sizeof(std::int16_t));
+                    std::memcpy(asset.blob.data(), samples.data(), asset.blob.size());
+                    packed_format = encoding.channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+                }
+                
+                float packed_duration = static_cast<float>(asset.blob.size() / get_frame_size(packed_format)) / sample_rate;
+                asset.entry.header = std::make_tuple(sample_rate, packed_format, std::size_t(0), asset.blob.size(), packed_duration);
+            }
+            else {
+                // compressed music is packed whole and decoded from the archive
+                asset.entry.header = music_decoder::load_header(full_path.path(), asset.entry.codec);
+                std::ifstream music_file(full_path.path(), std::ios::binary);
+                asset.blob.resize(full_path.file_size());
+                if (!music_file.read(asset.blob.data(), asset.blob.size()))
+                    throw std::filesystem::filesystem_error("audio::engine::pack_assets: Could not read " + full_path.path().string(), std::error_code());
+            }
+            asset.entry.blob_size = asset.blob.size();
+            assets.push_back(std::move(asset));
+        }
+    }
+    
+    std::size_t index_size = 4 + sizeof(std::uint32_t) + sizeof(std::uint64_t);
+    for (const packed_asset& asset : assets)
+        index_size += 2 + sizeof(std::uint32_t) + asset.entry.name.size() + 2 * sizeof(std::int32_t) + 3 * sizeof(std::uint64_t) + sizeof(float);
+        
+    std::size_t blob_offset = index_size;
+    for (packed_asset& asset : assets) {
+        blob_offset = (blob_offset + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT;
+        std::get<2>(asset.entry.header) = blob_offset;
+        blob_offset += asset.blob.size();
+    }
+    
+    std::ofstream archive_file(archive_path, std::ios::binary | std::ios::trunc);
+    if (!archive_file.is_open())
+        throw std::filesystem::filesystem_error("audio::engine::pack_assets: Unable to open archive", archive_path, std::error_code());
+        
+    const auto write_value = [&archive_file](const auto& value) {
+        archive_file.write(reinterpret_cast<const byte*>(&value), sizeof(value));
+    };
+    
+    archive_file.write("KEEA", 4);
+    write_value(ARCHIVE_VERSION);
+    write_value(static_cast<std::uint64_t>(assets.size()));
+    for (const packed_asset& asset : assets) {
+        const auto [asset_sample_rate, format, data_start, data_size, duration] = asset.entry.header;
+        write_value(static_cast<std::uint8_t>(asset.entry.is_sfx));
+        write_value(static_cast<std::uint8_t>(asset.entry.codec));
+        write_value(static_cast<std::uint32_t>(asset.entry.name.size()));
+        archive_file.write(asset.entry.name.data(), asset.entry.name.size());
+        write_value(static_cast<std::int32_t>(asset_sample_rate));
+        write_value(static_cast<std::int32_t>(format));
+        write_value(static_cast<std::uint64_t>(data_start));
+        write_value(static_cast<std::uint64_t>(data_size));
+        write_value(static_cast<std::uint64_t>(asset.entry.blob_size));
+        write_value(duration);
+    }
+    
+    for (const packed_asset& asset : assets) {
+        std::size_t padding = std::get<2>(asset.entry.header) - static_cast<std::size_t>(archive_file.tellp());
+        std::array<byte, ARCHIVE_ALIGNMENT> zeros = {};
+        archive_file.write(zeros.data(), static_cast<std::streamsize>(padding));
+        archive_file.write(asset.blob.data(), static_cast<std::streamsize>(asset.blob.size()));
+    }
+    
+    archive_file.close();
+    if (!archive_file)
+        throw std::filesystem::filesystem_error("audio::engine::pack_assets: Could not write archive", archive_path, std::error_code());
+}
+
+std::uint64_t engine::hash_file(const std::filesystem::path& full_path) {
+    std::ifstream file(full_path, std::ios::binary);
+    if (!file.is_open())
+        throw std::filesystem::filesystem_error("audio::engine::hash_file: Could not open " + full_path.string(), std::error_code());
+        
+    // 64 bit FNV-1a, only has to tell asset versions apart
+    std::uint64_t hash = 0xCBF29CE484222325;
+    std::vector<byte> buffer(65536);
+    while (file.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || file.gcount() > 0) {
+        for (std::streamsize i = 0; i < file.gcount(); i++) {
+            hash ^= static_cast<std::uint8_t>(buffer[i]);
+            hash *= 0x100000001B3;
+        }
+    }
+    return hash;
+}
+
+#ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+std::atomic_bool engine::resampling_disabled = false;
+
+void engine::digest_upload(const void* data, std::size_t size) {
+    // the same FNV-1a as hash_file, carried on over every upload
+    const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+    for (std::size_t i = 0; i < size; i++) {
+        upload_digest ^= bytes[i];
+        upload_digest *= 0x100000001B3;
+    }
+}
+#endif
+
+bool engine::is_resampling_disabled() {
+#ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+    return resampling_disabled.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+std::filesystem::path engine::normalize_wav(const std::filesystem::path& full_path, const wav& header, const wav_encoding& encoding) const {
+    std::ostringstream normalized_name;
+    normalized_name << std::hex << hash_file(full_path) << std::dec << "_" << mix_sample_rate << ".wav";
+    std::filesystem::path normalized_path = std::filesystem::path(NORMALIZED_DIRECTORY) / normalized_name.str();
+    if (std::filesystem::exists(normalized_path))
+        return normalized_path;
+        
+    const auto [sample_rate, format, data_start, data_size, duration] = header;
+    std::ifstream wav_file = open_wav(full_path);
+    std::vector<byte> data(data_size);
+    wav_file.seekg(data_start);
+    if (!wav_file.read(data.data(), data_size))
+        throw std::filesystem::filesystem_error("audio::engine::normalize_wav: Could not read wav data of " + full_path.string(), std::error_code());
+    std::vector<std::int16_t> normalized_samples = normalize_samples(data, header, encoding, mix_sample_rate, kernels);
+    
+    // written under a temporary name, so a worker normalizing the same content can't be read half written
+    std::filesystem::create_directories(NORMALIZED_DIRECTORY);
+    std::filesystem::path temp_path = normalized_path;
+    temp_path += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    write_wav(temp_path, normalized_samples, encoding.channels, mix_sample_rate);
+    std::filesystem::rename(temp_path, normalized_path);
+    return normalized_path;
+}
+
+std::vector<std::int16_t> engine::normalize_samples(const std::vector<byte>& data, const wav& header, const wav_encoding& encoding, int target_sample_rate, const mix_kernels& target_kernels) {
+    // samples are decoded to float on the int16 scale, which is what to_s16 expects back
+    std::size_t sample_size = encoding.bits_per_sample / 8;
+    std::vector<float> samples(data.size() / sample_size);
+    for (std::size_t i = 0; i < samples.size(); i++) {
+        const std::uint8_t* sample = reinterpret_cast<const std::uint8_t*>(data.data()) + i * sample_size;
+        if (encoding.is_float) {
+            std::uint32_t bits = sample[0] | sample[1] << 8 | sample[2] << 16 | static_cast<std::uint32_t>(sample[3]) << 24;
+            samples[i] = std::bit_cast<float>(bits) * 32768.0f;
+        }
+        else if (sample_size == 1)
+            samples[i] = (sample[0] - 128) * 256.0f;
+        else {
+            // sign extended from the top byte, then scaled down to 16 bits
+            std::int32_t value = static_cast<std::int8_t>(sample[sample_size - 1]);
+            for (std::size_t byte_index = sample_size - 1; byte_index-- > 0;)
+                value = value * 256 + sample[byte_index];
+            samples[i] = static_cast<float>(value) / static_cast<float>(1 << (8 * (sample_size - 2)));
+        }
+    }
+    
+    int sample_rate = std::get<0>(header);
+    if (sample_rate != target_sample_rate)
+        samples = resample(samples, encoding.channels, sample_rate, target_sample_rate, target_kernels);
+        
+    std::vector<std::int16_t> normalized_samples(samples.size());
+    target_kernels.to_s16(samples.data(), normalized_samples.data(), samples.size());
+    return normalized_samples;
+}
+
+static constexpr std::size_t RESAMPLER_TAPS = 32;
+static constexpr std::size_t RESAMPLER_PHASES = 256;
+
+std::vector<float> engine::resample(const std::vector<float>& samples, std::size_t channels, int sample_rate, int target_sample_rate, const mix_kernels& target_kernels) {
+    /* Blackman windowed sinc, RESAMPLER_TAPS taps over RESAMPLER_PHASES + 1 phases of the fraction between two
+     * input frames, interpolated between neighbouring phases. The cutoff follows the lower of the two rates.
+     */
+    double cutoff = std::min(1.0, static_cast<double>(target_sample_rate) / sample_rate) * 0.95;
+    std::vector<float> filters((RESAMPLER_PHASES + 1) * RESAMPLER_TAPS);
+    for (std::size_t phase = 0; phase <= RESAMPLER_PHASES; phase++) {
+        float* filter = filters.data() + phase * RESAMPLER_TAPS;
+        double filter_sum = 0.0;
+        for (std::size_t tap = 0; tap < RESAMPLER_TAPS; tap++) {
+            double distance = static_cast<double>(tap) - RESAMPLER_TAPS / 2 + 1 - static_cast<double>(phase) / RESAMPLER_PHASES;
+            double x = std::numbers::pi * cutoff * distance;
+            double sinc = x == 0.0 ? 1.0 : std::sin(x) / x;
+            double window_angle = 2.0 * std::numbers::pi * (distance / RESAMPLER_TAPS + 0.5);
+            double window = 0.42 - 0.5 * std::cos(window_angle) + 0.08 * std::cos(2.0 * window_angle);
+            filter[tap] = static_cast<float>(sinc * window);
+            filter_sum += filter[tap];
+        }
+        
+        // every phase passes dc at unity gain
+        for (std::size_t tap = 0; tap < RESAMPLER_TAPS; tap++)
+            filter[tap] = static_cast<float>(filter[tap] / filter_sum);
+    }
+    
+    std::size_t frames = samples.size() / channels;
+    std::size_t resampled_frames = static_cast<std::size_t>(static_cast<std::uint64_t>(frames) * target_sample_rate / sample_rate);
+    std::vector<float> resampled(resampled_frames * channels);
+    std::vector<float> channel_samples(frames + RESAMPLER_TAPS * 2, 0.0f);
+    for (std::size_t channel = 0; channel < channels; channel++) {
+        // deinterleaved and padded with silence on both ends, so every filter reads whole taps
+        for (std::size_t frame = 0; frame < frames; frame++)
+            channel_samples[RESAMPLER_TAPS / 2 + frame] = samples[frame * channels + channel];
+            
+        for (std::size_t resampled_frame = 0; resampled_frame < resampled_frames; resampled_frame++) {
+            std::uint64_t position = static_cast<std::uint64_t>(resampled_frame) * sample_rate;
+            std::size_t frame = static_cast<std::size_t>(position / target_sample_rate);
+            double phase_position = static_cast<double>(position % target_sample_rate) * RESAMPLER_PHASES / target_sample_rate;
+            std::size_t phase = static_cast<std::size_t>(phase_position);
+            float fraction = static_cast<float>(phase_position - phase);
+            
+            const float* in = channel_samples.data() + frame + 1;
+            float sample = target_kernels.dot(filters.data() + phase * RESAMPLER_TAPS, in, RESAMPLER_TAPS);
+            float next_sample = target_kernels.dot(filters.data() + (phase + 1) * RESAMPLER_TAPS, in, RESAMPLER_TAPS);
+            resampled[resampled_frame * channels + channel] = sample + (next_sample - sample) * fraction;
+        }
+    }
+    return resampled;
+}
+
+void engine::load_sfx(sfx_t& sfx, bool should_pin) {
+    // disk reads happen outside sfx_cache_lock, a racing load of the same sfx just wastes its read
+    std::vector<byte> sfx_data;
+    bool is_data_read = false;
+    
+    std::vector<std::int16_t> mix_data;
+    
+    // archived sfx are read straight from the mapping, and mixed from it when already 16 bit at the mix rate
+    bool is_archived = !sfx.archived_data.empty();
+    bool is_mixed_from_archive = is_software_mixing && is_archived && sfx.sample_rate == mix_sample_rate
+        && (sfx.format == AL_FORMAT_MONO16 || sfx.format == AL_FORMAT_STEREO16);
+    
+    std::unique_lock<std::mutex> lock(sfx_cache_lock);
+    if (sfx.is_resident)
+        sfx_cache.hits++;
+    else
+        sfx_cache.misses++;
+        
+    while (!sfx.is_resident && !is_data_read) {
+        lock.unlock();
+        if (!is_archived)
+            sfx_data = sfx.read_data();
+        if (is_software_mixing && !is_mixed_from_archive)
+            mix_data = convert_sfx_for_mixer(is_archived ? sfx.archived_data : std::span<const byte>(sfx_data), sfx.format, sfx.sample_rate, mix_sample_rate);
+        is_data_read = true;
+        lock.lock();
+    }
+    
+    if (!sfx.is_resident) {
+        if (is_mixed_from_archive) {
+            // mapped pages belong to the page cache, not to the budget
+            sfx.mix_samples = std::span<const std::int16_t>(reinterpret_cast<const std::int16_t*>(sfx.archived_data.data()), sfx.archived_data.size() / sizeof(std::int16_t));
+            sfx.resident_bytes = 0;
+        }
+        else if (is_software_mixing) {
+            sfx.mix_data = std::move(mix_data);
+            sfx.mix_samples = sfx.mix_data;
+            sfx.resident_bytes = sfx.mix_data.size() * sizeof(std::int16_t);
+        }
+        else {
+            std::span<const byte> data = is_archived ? sfx.archived_data : std::span<const byte>(sfx_data);
+            alGenBuffers(1, &sfx.buffer_id); CHECK_AL_ERRORS();
+            alBufferData(sfx.buffer_id, sfx.format, data.data(), static_cast<ALsizei>(data.size()), sfx.sample_rate); CHECK_AL_ERRORS();
+            sfx.resident_bytes = sfx.data_size;
+        }
+        sfx.is_resident = true;
+        sfx_cache.resident_bytes += sfx.resident_bytes;
+        sfx_cache.resident_count++;
+    }
+    else if (sfx.playing_voices == 0)
+        unlink_sfx_lru(sfx);
+        
+    if (should_pin)
+        sfx.playing_voices++;
+    else if (sfx.playing_voices == 0)
+        push_sfx_lru(sfx);
+        
+    evict_sfx();
+}
+
+void engine::release_sfx(sfx_t& sfx) {
+    std::lock_guard<std::mutex> lock(sfx_cache_lock);
+    sfx.playing_voices--;
+    if (sfx.playing_voices == 0) {
+        push_sfx_lru(sfx);
+        evict_sfx();
+    }
+}
+
+void engine::evict_sfx() {
+    while (sfx_cache.resident_bytes > sfx_cache.budget_bytes && sfx_lru_head != nullptr) {
+        sfx_t& sfx = *sfx_lru_head;
+        unlink_sfx_lru(sfx);
+        
+        if (sfx.buffer_id != 0) {
+            alDeleteBuffers(1, &sfx.buffer_id); CHECK_AL_ERRORS();
+            sfx.buffer_id = 0;
+        }
+        sfx.mix_data = std::vector<std::int16_t>();
+        sfx.mix_samples = std::span<const std::int16_t>();
+        sfx.is_resident = false;
+        sfx_cache.resident_bytes -= sfx.resident_bytes;
+        sfx_cache.resident_count--;
+        sfx_cache.evictions++;
+    }
+}
+
+void engine::unlink_sfx_lru(sfx_t& sfx) {
+    (sfx.lru_prev != nullptr ? sfx.lru_prev->lru_next : sfx_lru_head) = sfx.lru_next;
+    (sfx.lru_next != nullptr ? sfx.lru_next->lru_prev : sfx_lru_tail) = sfx.lru_prev;
+    sfx.lru_prev = nullptr;
+    sfx.lru_next = nullptr;
+}
+
+void engine::push_sfx_lru(sfx_t& sfx) {
+    sfx.lru_prev = sfx_lru_tail;
+    sfx.lru_next = nullptr;
+    (sfx_lru_tail != nullptr ? sfx_lru_tail->lru_next : sfx_lru_head) = &sfx;
+    sfx_lru_tail = &sfx;
+}
+
+std::vector<std::int16_t> engine::convert_sfx_for_mixer(std::span<const byte> sfx_data, ALenum format, int sample_rate, int mix_sample_rate) {
+    std::size_t channels = format == AL_FORMAT_STEREO8 || format == AL_FORMAT_STEREO16 ? 2 : 1;
+    bool is_duo_byte_sampled = format == AL_FORMAT_MONO16 || format == AL_FORMAT_STEREO16;
+    
+    std::vector<std::int16_t> samples(sfx_data.size() / (is_duo_byte_sampled ? 2 : 1));
+    if (is_duo_byte_sampled)
+        std::memcpy(samples.data(), sfx_data.data(), samples.size() * sizeof(std::int16_t));
+    else {
+        for (std::size_t i = 0; i < samples.size(); i++)
+            samples[i] = static_cast<std::int16_t>((static_cast<std::uint8_t>(sfx_data[i]) - 128) * 256);
+    }
+    
+    if (sample_rate == mix_sample_rate)
+        return samples;
+        
+    // linear interpolation, enough for short hit sounds
+    std::size_t frames = samples.size() / channels;
+    std::size_t mix_frames = frames * mix_sample_rate / sample_rate;
+    std::vector<std::int16_t> mix_samples(mix_frames * channels);
+    for (std::size_t mix_frame = 0; mix_frame < mix_frames; mix_frame++) {
+        double position = static_cast<double>(mix_frame) * sample_rate / mix_sample_rate;
+        std::size_t frame = static_cast<std::size_t>(position);
+        std::size_t next_frame = std::min(frame + 1, frames - 1);
+        double fraction = position - frame;
+        
+        for (std::size_t channel = 0; channel < channels; channel++) {
+            double sample = samples[frame * channels + channel];
+            double next_sample = samples[next_frame * channels + channel];
+            mix_samples[mix_frame * channels + channel] = static_cast<std::int16_t>(std::lround(sample + (next_sample - sample) * fraction));
+        }
+    }
+    return mix_samples;
+}
+
+void engine::defer_al_updates() {
+    if (al_defer_updates_soft != nullptr)
+        al_defer_updates_soft();
+    else
+        alcSuspendContext(alc_context);
+}
+
+void engine::process_al_updates() {
+    if (al_process_updates_soft != nullptr)
+        al_process_updates_soft();
+    else
+        alcProcessContext(alc_context);
+}
+
+std::optional<std::size_t> engine::acquire_sfx_voice(sfx_t& sfx, float gain, float pan, std::size_t bus) {
+    if (sfx_free_list.empty()) {
+        if (sfx_policy != sfx_pool_policy::steal_oldest || sfx_active_head == NO_SFX_VOICE) {
+            sfx_stats.refusals++;
+            release_sfx(sfx);
+            return std::nullopt;
+        }
+        
+        std::size_t stolen_index = sfx_active_head;
+        unlink_sfx_active(stolen_index);
+        if (!is_software_mixing) {
+            alSourceStop(sfx_mixer[stolen_index].source_id); CHECK_AL_ERRORS_DEBUG();
+        }
+        free_sfx_voice(stolen_index);
+        sfx_stats.steals++;
+    }
+    
+    std::size_t voice_index = sfx_free_list.back();
+    sfx_free_list.pop_back();
+    
+    // the voice's old handles went stale when it was freed, nothing else touches it until its handle is returned
+    sfx_voice& voice = sfx_mixer[voice_index];
+    voice.sfx = &sfx;
+    voice.bus = bus;
+    voice.is_stop_requested.store(false, std::memory_order_relaxed);
+    voice.gain = gain;
+    voice.pan = pan;
+    voice.pitch.store(1.0f, std::memory_order_relaxed);
+    voice.trigger_time = std::chrono::steady_clock::time_point();
+    voice.frame_position = 0;
+    voice.frame_fraction = 0.0;
+    voice.start_delay = 0;
+    if (!is_software_mixing) {
+        alSourcei(voice.source_id, AL_BUFFER, static_cast<ALint>(sfx.buffer_id)); CHECK_AL_ERRORS_DEBUG();
+    }
+    update_sfx_voice_mix(voice);
+    return voice_index;
+}
+
+void engine::free_sfx_voice(std::size_t voice_index) {
+    sfx_voice& voice = sfx_mixer[voice_index];
+    {
+        std::lock_guard<std::mutex> voice_lock(voice.control_lock);
+        voice.generation.fetch_add(1, std::memory_order_release);
+    }
+    
+    // detached before its sfx is released, an evicted sfx can't delete a buffer still attached
+    if (!is_software_mixing) {
+        alSourcei(voice.source_id, AL_BUFFER, 0); CHECK_AL_ERRORS_DEBUG();
+    }
+    release_sfx(*voice.sfx);
+    voice.sfx = nullptr;
+    sfx_free_list.push_back(voice_index);
+}
+
+bool engine::free_stopped_sfx_voice(std::size_t voice_index) {
+    if (!sfx_mixer[voice_index].is_stop_requested.load(std::memory_order_acquire))
+        return false;
+        
+    if (!is_software_mixing) {
+        alSourceStop(sfx_mixer[voice_index].source_id); CHECK_AL_ERRORS_DEBUG();
+    }
+    free_sfx_voice(voice_index);
+    return true;
+}
+
+void engine::push_sfx_active(std::size_t voice_index) {
+    sfx_voice& voice = sfx_mixer[voice_index];
+    voice.active_prev = sfx_active_tail;
+    voice.active_next = NO_SFX_VOICE;
+    if (sfx_active_tail != NO_SFX_VOICE)
+        sfx_mixer[sfx_active_tail].active_next = voice_index;
+    else
+        sfx_active_head = voice_index;
+    sfx_active_tail = voice_index;
+    
+    // the software mixer records the start once it mixes the voice's first block
+    KEE_AUDIO_METRIC(if (!is_software_mixing) record_sfx_start(voice));
+    sfx_stats.active++;
+    sfx_stats.peak_active = std::max(sfx_stats.peak_active, sfx_stats.active);
+    KEE_AUDIO_METRIC(metrics.record_voices(sfx_stats.active));
+}
+
+void engine::unlink_sfx_active(std::size_t voice_index) {
+    sfx_voice& voice = sfx_mixer[voice_index];
+    if (voice.active_prev != NO_SFX_VOICE)
+        sfx_mixer[voice.active_prev].active_next = voice.active_next;
+    else
+        sfx_active_head = voice.active_next;
+    if (voice.active_next != NO_SFX_VOICE)
+        sfx_mixer[voice.active_next].active_prev = voice.active_prev;
+    else
+        sfx_active_tail = voice.active_prev;
+    voice.active_prev = NO_SFX_VOICE;
+    voice.active_next = NO_SFX_VOICE;
+    
+    sfx_stats.active--;
+    KEE_AUDIO_METRIC(metrics.record_voices(sfx_stats.active));
+}
+
+engine::sfx_handle engine::get_sfx_handle(std::size_t voice_index) const {
+    return { static_cast<std::uint32_t>(voice_index), sfx_mixer[voice_index].generation.load(std::memory_order_relaxed) };
+}
+
+engine::sfx_voice* engine::lock_sfx_voice(sfx_handle handle, std::unique_lock<std::mutex>& voice_lock) {
+    if (handle.index >= sfx_mixer.size())
+        return nullptr;
+        
+    sfx_voice& voice = sfx_mixer[handle.index];
+    voice_lock = std::unique_lock<std::mutex>(voice.control_lock);
+    if (voice.generation.load(std::memory_order_relaxed) != handle.generation) {
+        voice_lock.unlock();
+        return nullptr;
+    }
+    return &voice;
+}
+
+bool engine::is_sfx_bus_paused(const sfx_voice& voice) const {
+    return buses[voice.bus].is_paused.load(std::memory_order_relaxed);
+}
+
+void engine::update_bus_voices(std::size_t bus) {
+    // set_sfx_* calls hold only the voice's lock, so it's taken here too to keep them from interleaving
+    defer_al_updates();
+    for (std::size_t voice_index = 0; voice_index < sfx_mixer.size(); voice_index++) {
+        sfx_voice& voice = sfx_mixer[voice_index];
+        if (voice.sfx == nullptr || voice.bus != bus)
+            continue;
+            
+        std::lock_guard<std::mutex> voice_lock(voice.control_lock);
+        update_sfx_voice_mix(voice);
+    }
+    process_al_updates();
+}
+
+void engine::update_sfx_voice_mix(sfx_voice& voice) const {
+    // the software mixer applies the bus's gain itself, so a bus change doesn't have to visit its voices
+    if (!is_software_mixing) {
+        alSourcef(voice.source_id, AL_GAIN, voice.gain * buses[voice.bus].gain.load(std::memory_order_relaxed)); CHECK_AL_ERRORS_DEBUG();
+        alSourcef(voice.source_id, AL_PITCH, voice.pitch.load(std::memory_order_relaxed)); CHECK_AL_ERRORS_DEBUG();
+        alSource3f(voice.source_id, AL_POSITION, voice.pan, 0.0f, -std::sqrt(1.0f - voice.pan * voice.pan)); CHECK_AL_ERRORS_DEBUG();
+        return;
+    }
+    
+    // constant power pan for mono, balance for stereo so a centered stereo sfx keeps full gain
+    float pan_angle = (voice.pan + 1.0f) * std::numbers::pi_v<float> / 4.0f;
+    bool is_mono = voice.sfx->mix_channels == 1;
+    voice.left_gain.store(voice.gain * (is_mono ? std::cos(pan_angle) : std::min(1.0f, 1.0f - voice.pan)), std::memory_order_relaxed);
+    voice.right_gain.store(voice.gain * (is_mono ? std::sin(pan_angle) : std::min(1.0f, 1.0f + voice.pan)), std::memory_order_relaxed);
+}
+
+std::int64_t engine::get_device_clock() const {
+    if (alc_get_integer64v_soft == nullptr)
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(get_engine_time().time_since_epoch()).count();
+        
+    ALCint64SOFT clock_ns = 0;
+    alc_get_integer64v_soft(alc_device, ALC_DEVICE_CLOCK_SOFT, 1, &clock_ns); CHECK_ALC_ERRORS(alc_device);
+    return clock_ns;
+}
+
+double engine::measure_source_offset(ALuint source_id, std::int64_t& clock_ns) const {
+    if (alc_get_integer64v_soft == nullptr) {
+        ALint sample_offset = 0;
+        alGetSourcei(source_id, AL_SAMPLE_OFFSET, &sample_offset); CHECK_AL_ERRORS();
+        clock_ns = get_device_clock();
+        return sample_offset;
+    }
+    
+    // offset is 32.32 fixed point sample frames, taken together with the device clock in one go
+    std::array<ALint64SOFT, 2> offset_clock = { 0, 0 };
+    al_get_source_i64v_soft(source_id, AL_SAMPLE_OFFSET_CLOCK_SOFT, offset_clock.data()); CHECK_AL_ERRORS();
+    clock_ns = offset_clock[1];
+    return static_cast<double>(offset_clock[0]) / 4294967296.0;
+}
+
+std::optional<std::chrono::microseconds> engine::update_sfx_schedule() {
+    /* Music and sfx sources go through the same device latency, so starting an sfx when the device's mixer
+     * reaches audio_time in the music is what lines them up where they're heard.
+     */
+    std::optional<std::chrono::microseconds> next_update;
+    const auto schedule_update = [&next_update](double delay) {
+        std::chrono::microseconds update(static_cast<std::int64_t>(std::max(delay, 0.0) * 1e6));
+        if (!next_update.has_value() || update < next_update.value())
+            next_update = update;
+    };
+    
+    if (is_sfx_paused)
+        return std::nullopt;
+        
+    static constexpr double SCHEDULE_LEAD = std::chrono::duration<double>(SFX_SCHEDULE_LEAD).count();
+    std::erase_if(sfx_schedule, [this, &schedule_update](const scheduled_sfx& entry) -> bool {
+        if (free_stopped_sfx_voice(entry.voice_index))
+            return true;
+            
+        // a paused bus holds its sfx back, unpausing it wakes this thread again
+        std::int64_t clock_ns = 0;
+        std::optional<double> music_time = music_mixer[entry.player_index].measure_mix_time(clock_ns);
+        if (!music_time.has_value() || is_sfx_bus_paused(sfx_mixer[entry.voice_index]))
+            return false;
+            
+        // music time runs at the player's tempo, the device's at 1
+        double remaining = (entry.audio_time - music_time.value()) / music_mixer[entry.player_index].get_heard_tempo();
+        const sfx_voice& voice = sfx_mixer[entry.voice_index];
+        if (al_source_play_at_time_soft != nullptr && remaining < SCHEDULE_LEAD) {
+            al_source_play_at_time_soft(voice.source_id, clock_ns + static_cast<std::int64_t>(std::max(remaining, 0.0) * 1e9)); CHECK_AL_ERRORS();
+        }
+        else if (al_source_play_at_time_soft == nullptr && remaining <= 0.0) {
+            alSourcePlay(voice.source_id); CHECK_AL_ERRORS();
+        }
+        else {
+            schedule_update(al_source_play_at_time_soft != nullptr ? remaining - SCHEDULE_LEAD : remaining);
+            return false;
+        }
+        
+        push_sfx_active(entry.voice_index);
+        return true;
+    });
+    return next_update;
+}
+
+std::optional<std::chrono::microseconds> engine::measure_sfx_onsets() {
+    if (sfx_schedule.empty())
+        return std::nullopt;
+        
+    // the next block is reached by the device's mixer once everything queued before it has played
+    std::size_t queued_frames = MIX_BLOCK_FRAMES * (mix_buffer_ids.size() - mix_free_buffers.size());
+    std::int64_t mix_clock_ns = 0;
+    double frames_ahead = 0.0;
+    if (queued_frames == 0)
+        mix_clock_ns = get_device_clock();
+    else
+        frames_ahead = static_cast<double>(queued_frames) - measure_source_offset(mix_source_id, mix_clock_ns);
+    
+    std::optional<std::chrono::microseconds> next_update;
+    static constexpr double MIX_QUEUE_FRAMES = MIX_BLOCK_FRAMES * MIX_BUFFER_COUNT;
+    for (scheduled_sfx& entry : sfx_schedule) {
+        std::int64_t clock_ns = 0;
+        std::optional<double> music_time = music_mixer[entry.player_index].measure_mix_time(clock_ns);
+        if (!music_time.has_value()) {
+            entry.onset_frames = std::numeric_limits<double>::infinity();
+            continue;
+        }
+        
+        // both positions are carried to the same device clock before comparing them, music time runs at the player's tempo
+        double tempo = music_mixer[entry.player_index].get_heard_tempo();
+        double music_time_at_mix = music_time.value() + static_cast<double>(mix_clock_ns - clock_ns) / 1e9 * tempo;
+        entry.onset_frames = (entry.audio_time - music_time_at_mix) / tempo * mix_sample_rate - frames_ahead;
+        if (entry.onset_frames < MIX_QUEUE_FRAMES)
+            continue;
+            
+        std::chrono::microseconds update = frames_to_duration(static_cast<std::size_t>(entry.onset_frames + frames_ahead - MIX_QUEUE_FRAMES), mix_sample_rate);
+        if (!next_update.has_value() || update < next_update.value())
+            next_update = update;
+    }
+    return next_update;
+}
+
+void engine::start_scheduled_sfx(std::size_t block_start) {
+    std::erase_if(sfx_schedule, [this, block_start](const scheduled_sfx& entry) -> bool {
+        if (free_stopped_sfx_voice(entry.voice_index))
+            return true;
+        if (entry.onset_frames >= static_cast<double>(block_start + MIX_BLOCK_FRAMES))
+            return false;
+            
+        // an onset that already passed starts at the top of the block
+        double start_delay = std::max(std::round(entry.onset_frames - static_cast<double>(block_start)), 0.0);
+        sfx_mixer[entry.voice_index].start_delay = std::min(static_cast<std::size_t>(start_delay), MIX_BLOCK_FRAMES - 1);
+        push_sfx_active(entry.voice_index);
+        return true;
+    });
+}
+
+std::optional<std::chrono::microseconds> engine::update_software_mixer() {
+    ALint buffers_processed = 0;
+    alGetSourcei(mix_source_id, AL_BUFFERS_PROCESSED, &buffers_processed); CHECK_AL_ERRORS();
+    while (buffers_processed > 0) {
+        buffers_processed--;
+        
+        ALuint buffer_id;
+        alSourceUnqueueBuffers(mix_source_id, 1, &buffer_id); CHECK_AL_ERRORS();
+        mix_free_buffers.push_back(buffer_id);
+    }
+    
+    if (is_sfx_paused)
+        return std::nullopt;
+        
+    /* Onsets are only placed into a stream that is already running, the position of a block queued to an
+     * idle source isn't known until the device picks it up. Silence keeps it running up to a near onset,
+     * and an idle stream spins up on whole blocks of silence that end before the onset, so the block holding it
+     * is queued once the stream runs. An onset less than a block away can't wait for that and starts late.
+     */
+    ALint source_state = AL_NONE;
+    alGetSourcei(mix_source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+    bool is_stream_running = source_state == AL_PLAYING && mix_free_buffers.size() < mix_buffer_ids.size();
+    std::optional<std::chrono::microseconds> schedule_delay = measure_sfx_onsets();
+    const auto is_onset_near = [this, is_stream_running](std::size_t block_start) -> bool {
+        double next_onset = std::numeric_limits<double>::infinity();
+        for (const scheduled_sfx& entry : sfx_schedule)
+            next_onset = std::min(next_onset, entry.onset_frames);
+        if (next_onset >= static_cast<double>(block_start + MIX_BLOCK_FRAMES * MIX_BUFFER_COUNT))
+            return false;
+        return is_stream_running || block_start == 0 || next_onset >= static_cast<double>(block_start + MIX_BLOCK_FRAMES);
+    };
+    
+    std::size_t block_start = 0;
+    while (!mix_free_buffers.empty() && (sfx_active_head != NO_SFX_VOICE || effect_tail_frames > 0 || is_onset_near(block_start))) {
+        if (is_stream_running)
+            start_scheduled_sfx(block_start);
+        mix_sfx_block();
+        block_start += MIX_BLOCK_FRAMES;
+        
+        ALuint buffer_id = mix_free_buffers.back();
+        mix_free_buffers.pop_back();
+        ALsizei block_size = static_cast<ALsizei>(mix_output.size() * sizeof(std::int16_t));
+        alBufferData(buffer_id, AL_FORMAT_STEREO16, mix_output.data(), block_size, mix_sample_rate); CHECK_AL_ERRORS();
+        alSourceQueueBuffers(mix_source_id, 1, &buffer_id); CHECK_AL_ERRORS();
+        KEE_AUDIO_TEST_HOOK(digest_upload(mix_output.data(), block_size));
+    }
+    
+    if (mix_free_buffers.size() == mix_buffer_ids.size())
+        return schedule_delay;
+        
+    // also restarts the source if it ran dry while voices were still playing
+    if (source_state != AL_PLAYING) {
+        alSourcePlay(mix_source_id); CHECK_AL_ERRORS();
+    }
+    
+    ALint sample_offset = 0;
+    alGetSourcei(mix_source_id, AL_SAMPLE_OFFSET, &sample_offset); CHECK_AL_ERRORS();
+    std::chrono::microseconds block_delay = frames_to_duration(MIX_BLOCK_FRAMES - static_cast<std::size_t>(sample_offset) % MIX_BLOCK_FRAMES, mix_sample_rate);
+    return schedule_delay.has_value() ? std::min(block_delay, schedule_delay.value()) : block_delay;
+}
+
+std::size_t engine::pitch_sfx_voice(sfx_voice& voice, float pitch, std::size_t frames) {
+    const sfx_t& sfx = *voice.sfx;
+    std::size_t channels = sfx.mix_channels;
+    std::size_t sfx_frames = sfx.mix_samples.size() / channels;
+    
+    std::size_t out_frame = 0;
+    for (; out_frame < frames && voice.frame_position < sfx_frames; out_frame++) {
+        std::size_t next_frame = std::min(voice.frame_position + 1, sfx_frames - 1);
+        for (std::size_t channel = 0; channel < channels; channel++) {
+            float sample = sfx.mix_samples[voice.frame_position * channels + channel];
+            float next_sample = sfx.mix_samples[next_frame * channels + channel];
+            mix_pitched[out_frame * channels + channel] = static_cast<std::int16_t>(std::lround(sample + (next_sample - sample) * static_cast<float>(voice.frame_fraction)));
+        }
+        
+        voice.frame_fraction += pitch;
+        double whole_frames = std::floor(voice.frame_fraction);
+        voice.frame_position += static_cast<std::size_t>(whole_frames);
+        voice.frame_fraction -= whole_frames;
+    }
+    return out_frame;
+}
+
+void engine::mix_sfx_block() {
+    std::fill(mix_accumulator.begin(), mix_accumulator.end(), 0.0f);
+    
+    // buses with effects mix apart, so their chain runs over their voices only
+    std::array<float*, MAX_BUSES> bus_outputs;
+    for (std::size_t bus_index = 0; bus_index < buses.size(); bus_index++) {
+        bus_outputs[bus_index] = mix_accumulator.data();
+        if (buses[bus_index].effects.is_active()) {
+            bus_outputs[bus_index] = bus_accumulators.data() + bus_index * MIX_BLOCK_FRAMES * 2;
+            std::fill_n(bus_outputs[bus_index], MIX_BLOCK_FRAMES * 2, 0.0f);
+        }
+    }
+    
+    std::size_t voice_index = sfx_active_head;
+    while (voice_index != NO_SFX_VOICE) {
+        sfx_voice& voice = sfx_mixer[voice_index];
+        std::size_t next_index = voice.active_next;
+        const sfx_t& sfx = *voice.sfx;
+        
+        // voices on a paused bus hold their place without being mixed
+        std::size_t sfx_frames = sfx.mix_samples.size() / sfx.mix_channels;
+        const mix_bus& bus = buses[voice.bus];
+        if (!voice.is_stop_requested.load(std::memory_order_acquire) && !bus.is_paused.load(std::memory_order_relaxed)) {
+            // pitched voices are interpolated into mix_pitched first, and stay on that path once off a whole frame
+            float pitch = voice.pitch.load(std::memory_order_relaxed);
+            const std::int16_t* in = sfx.mix_samples.data() + voice.frame_position * sfx.mix_channels;
+            std::size_t frames = MIX_BLOCK_FRAMES - voice.start_delay;
+            if (pitch == 1.0f && voice.frame_fraction == 0.0) {
+                frames = std::min(frames, sfx_frames - voice.frame_position);
+                voice.frame_position += frames;
+            }
+            else {
+                frames = pitch_sfx_voice(voice, pitch, frames);
+                in = mix_pitched.data();
+            }
+            
+            KEE_AUDIO_METRIC(record_sfx_start(voice));
+            float* out = bus_outputs[voice.bus] + voice.start_delay * 2;
+            if (bus_outputs[voice.bus] != mix_accumulator.data())
+                effect_tail_frames = static_cast<std::size_t>(EFFECT_TAIL_DURATION.count()) * mix_sample_rate;
+            float bus_gain = bus.gain.load(std::memory_order_relaxed);
+            float left_gain = voice.left_gain.load(std::memory_order_relaxed) * bus_gain;
+            float right_gain = voice.right_gain.load(std::memory_order_relaxed) * bus_gain;
+            if (sfx.mix_channels == 1)
+                kernels.mix_mono(in, out, frames, left_gain, right_gain);
+            else
+                kernels.mix_stereo(in, out, frames, left_gain, right_gain);
+            voice.start_delay = 0;
+        }
+        
+        if (voice.is_stop_requested.load(std::memory_order_acquire) || voice.frame_position >= sfx_frames) {
+            unlink_sfx_active(voice_index);
+            free_sfx_voice(voice_index);
+        }
+        voice_index = next_index;
+    }
+    
+    for (std::size_t bus_index = 0; bus_index < buses.size(); bus_index++) {
+        float* bus_output = bus_outputs[bus_index];
+        if (bus_output == mix_accumulator.data())
+            continue;
+            
+        buses[bus_index].effects.process(bus_output, MIX_BLOCK_FRAMES, 2, mix_sample_rate, kernels, metrics);
+        kernels.accumulate(bus_output, mix_accumulator.data(), mix_accumulator.size());
+    }
+    effect_tail_frames -= std::min(effect_tail_frames, MIX_BLOCK_FRAMES);
+    
+    kernels.to_s16(mix_accumulator.data(), mix_output.data(), mix_output.size());
+}
+
+engine::engine(const config& engine_config) :
+    init_config(validate_config(engine_config)),
+    alc_device(nullptr),
+    alc_context(nullptr),
+    buses(init_config.bus_names.size()),
+    music_mixer(init_config.music_player_count),
+    is_player_music_set(init_config.music_player_count)
+{
+    engine* no_engine = nullptr;
+    if (!live_engine.compare_exchange_strong(no_engine, this))
+        throw std::logic_error("audio::engine::engine: another engine is alive, OpenAL has one current context per process");
+        
+    try {
+        open();
+    }
+    catch (...) {
+        // the context takes its sources along, the device its buffers
+        if (alc_context != nullptr) {
+            alcMakeContextCurrent(nullptr);
+            alcDestroyContext(alc_context);
+        }
+        if (alc_device != nullptr)
+            alcCloseDevice(alc_device);
+        live_engine.store(nullptr);
+        throw;
+    }
+}
+
+void engine::open() {
+    KEE_AUDIO_METRIC(std::chrono::steady_clock::time_point init_start = std::chrono::steady_clock::now());
+    
+    is_loopback = init_config.use_loopback;
+    loopback_frames = 0;
+    alc_render_samples_soft = nullptr;
+    if (is_loopback) {
+        if (!alcIsExtensionPresent(nullptr, "ALC_SOFT_loopback"))
+            throw std::ios_base::failure("alcIsExtensionPresent: ALC_SOFT_loopback is unavailable, the engine can't render offline");
+            
+        LPALCLOOPBACKOPENDEVICESOFT loopback_open_device = reinterpret_cast<LPALCLOOPBACKOPENDEVICESOFT>(alcGetProcAddress(nullptr, "alcLoopbackOpenDeviceSOFT"));
+        alc_render_samples_soft = reinterpret_cast<LPALCRENDERSAMPLESSOFT>(alcGetProcAddress(nullptr, "alcRenderSamplesSOFT"));
+        alc_device = loopback_open_device(nullptr); CHECK_ALC_ERRORS(alc_device);
+        if (alc_device == nullptr)
+            throw std::ios_base::failure("alcLoopbackOpenDeviceSOFT: Unable to create OpenAL loopback device");
+            
+        LPALCISRENDERFORMATSUPPORTEDSOFT is_render_format_supported = reinterpret_cast<LPALCISRENDERFORMATSUPPORTEDSOFT>(alcGetProcAddress(alc_device, "alcIsRenderFormatSupportedSOFT"));
+        if (!is_render_format_supported(alc_device, init_config.loopback_sample_rate, ALC_STEREO_SOFT, ALC_SHORT_SOFT))
+            throw std::ios_base::failure("alcIsRenderFormatSupportedSOFT: loopback device can't render 16 bit stereo at the loopback sample rate");
+    }
+    else {
+        alc_device = alcOpenDevice(nullptr); CHECK_ALC_ERRORS(alc_device);
+        if (alc_device == nullptr)
+            throw std::ios_base::failure("alcOpenDevice: Unable to create OpenAL device");
+    }
+    
+    // a loopback device renders in the format its context asks for
+    std::array<ALCint, 7> loopback_attributes = { ALC_FORMAT_CHANNELS_SOFT, ALC_STEREO_SOFT, ALC_FORMAT_TYPE_SOFT, ALC_SHORT_SOFT, ALC_FREQUENCY, init_config.loopback_sample_rate, 0 };
+    alc_context = alcCreateContext(alc_device, is_loopback ? loopback_attributes.data() : nullptr); CHECK_ALC_ERRORS(alc_device);
+    if (alc_context == nullptr)
+        throw std::ios_base::failure("alcCreateContext: Unable to create OpenAL context");
+        
+    if (!alcMakeContextCurrent(alc_context))
+        throw std::ios_base::failure("alcMakeCurrentContext: Could not set OpenAL context to current context");
+    CHECK_ALC_ERRORS(alc_device);
+    
+    al_get_source_i64v_soft = nullptr;
+    if (alIsExtensionPresent("AL_SOFT_source_latency"))
+        al_get_source_i64v_soft = reinterpret_cast<LPALGETSOURCEI64VSOFT>(alGetProcAddress("alGetSourcei64vSOFT"));
+        
+    al_defer_updates_soft = nullptr;
+    al_process_updates_soft = nullptr;
+    if (alIsExtensionPresent("AL_SOFT_deferred_updates")) {
+        al_defer_updates_soft = reinterpret_cast<LPALDEFERUPDATESSOFT>(alGetProcAddress("alDeferUpdatesSOFT"));
+        al_process_updates_soft = reinterpret_cast<LPALPROCESSUPDATESSOFT>(alGetProcAddress("alProcessUpdatesSOFT"));
+    }
+    
+    // start times are on the device clock, so starting at one is only usable alongside it
+    alc_get_integer64v_soft = nullptr;
+    al_source_play_at_time_soft = nullptr;
+    if (al_get_source_i64v_soft != nullptr && alcIsExtensionPresent(alc_device, "ALC_SOFT_device_clock")) {
+        alc_get_integer64v_soft = reinterpret_cast<LPALCGETINTEGER64VSOFT>(alcGetProcAddress(alc_device, "alcGetInteger64vSOFT"));
+        if (alIsExtensionPresent("AL_SOFT_source_start_delay"))
+            al_source_play_at_time_soft = reinterpret_cast<play_at_time_function>(alGetProcAddress("alSourcePlayAtTimeSOFT"));
+    }
+    
+    alListenerf(AL_GAIN, 0.25f); CHECK_AL_ERRORS();
+    alListener3f(AL_POSITION, 0.0f, 0.0f, 0.0f); CHECK_AL_ERRORS();
+    
+    // assets are normalized to the device's rate with the mixer's kernels, both have to be known first
+    kernels = mix_kernels::select(init_config.max_simd_level);
+    alcGetIntegerv(alc_device, ALC_FREQUENCY, 1, &mix_sample_rate); CHECK_ALC_ERRORS(alc_device);
+    
+    sfx_lru_head = nullptr;
+    sfx_lru_tail = nullptr;
+    sfx_cache = { DEFAULT_SFX_MEMORY_BUDGET, 0, 0, 0, 0, 0 };
+    load_assets();
+    index_assets();
+    waveforms.resize(music_ids.size());
+    
+    is_software_mixing = init_config.use_software_mixer;
+    is_sfx_paused = false;
+    for (std::size_t bus_index = 0; bus_index < buses.size(); bus_index++)
+        buses[bus_index].name = init_config.bus_names[bus_index];
+    is_bus_gain_changed = false;
+    
+    // voices hold their own locks and atomics, so the slot array is built once at its final size
+    sfx_mixer = std::vector<sfx_voice>(is_software_mixing ? SOFTWARE_SFX_VOICE_COUNT : SFX_SOURCE_COUNT);
+    for (std::size_t voice_index = 0; voice_index < sfx_mixer.size(); voice_index++) {
+        sfx_free_list.push_back(sfx_mixer.size() - 1 - voice_index);
+        if (is_software_mixing)
+            continue;
+        
+        sfx_voice& voice = sfx_mixer[voice_index];
+        alGenSources(1, &voice.source_id); CHECK_AL_ERRORS();
+        alSourcef(voice.source_id, AL_PITCH, 1); CHECK_AL_ERRORS();
+        alSourcef(voice.source_id, AL_GAIN, 1.0f); CHECK_AL_ERRORS();
+        alSourcei(voice.source_id, AL_SOURCE_RELATIVE, AL_TRUE); CHECK_AL_ERRORS();
+        alSource3f(voice.source_id, AL_POSITION, 0.0f, 0.0f, 0.0f); CHECK_AL_ERRORS();
+        alSourcei(voice.source_id, AL_LOOPING, AL_FALSE); CHECK_AL_ERRORS();
+    }
+    
+    mix_source_id = 0;
+    mix_buffer_ids.fill(0);
+    if (is_software_mixing) {
+        alGenSources(1, &mix_source_id); CHECK_AL_ERRORS();
+        alSourcef(mix_source_id, AL_PITCH, 1); CHECK_AL_ERRORS();
+        alSourcef(mix_source_id, AL_GAIN, 1.0f); CHECK_AL_ERRORS();
+        alSource3f(mix_source_id, AL_POSITION, 0.0f, 0.0f, 0.0f); CHECK_AL_ERRORS();
+        alSourcei(mix_source_id, AL_LOOPING, AL_FALSE); CHECK_AL_ERRORS();
+        
+        alGenBuffers(static_cast<ALsizei>(mix_buffer_ids.size()), mix_buffer_ids.data()); CHECK_AL_ERRORS();
+        mix_free_buffers.assign(mix_buffer_ids.begin(), mix_buffer_ids.end());
+        mix_accumulator.resize(MIX_BLOCK_FRAMES * 2);
+        mix_output.resize(MIX_BLOCK_FRAMES * 2);
+        mix_pitched.resize(MIX_BLOCK_FRAMES * 2);
+        bus_accumulators.resize(buses.size() * MIX_BLOCK_FRAMES * 2);
+    }
+    effect_tail_frames = 0;
+    sfx_active_head = NO_SFX_VOICE;
+    sfx_active_tail = NO_SFX_VOICE;
+    sfx_policy = sfx_pool_policy::steal_oldest;
+    is_sfx_batching = false;
+    sfx_batch.reserve(sfx_mixer.size());
+    sfx_schedule.reserve(sfx_mixer.size());
+    sfx_source_batch.reserve(sfx_mixer.size());
+    sfx_stats = { sfx_mixer.size(), 0, 0, 0, 0 };
+    
+    music_command_batch.reserve(MUSIC_COMMAND_QUEUE_SIZE);
+    for (music_player& player : music_mixer) {
+        player.owner = this;
+        alGenSources(1, &player.source_id); CHECK_AL_ERRORS();
+        alSourcef(player.source_id, AL_PITCH, 1); CHECK_AL_ERRORS();
+        alSourcef(player.source_id, AL_GAIN, 1.0f); CHECK_AL_ERRORS();
+        alSource3f(player.source_id, AL_POSITION, 0.0f, 0.0f, 0.0f); CHECK_AL_ERRORS();
+        alSourcei(player.source_id, AL_LOOPING, AL_FALSE); CHECK_AL_ERRORS();
+        
+        player.buffer_size = init_config.music_buffer_size;
+        player.buffer_ids.resize(init_config.music_buffer_count);
+        alGenBuffers(static_cast<ALsizei>(player.buffer_ids.size()), player.buffer_ids.data()); CHECK_AL_ERRORS();
+        player.free_buffers = player.buffer_ids;
+        player.effect_pcm.resize(player.buffer_size / sizeof(std::int16_t));
+        player.effect_samples.resize(player.buffer_size / sizeof(std::int16_t));
+        KEE_AUDIO_METRIC(metrics.music_buffer_counts[&player - music_mixer.data()] = player.buffer_ids.size());
+    }
+    
+    should_thread_close = false;
+    is_polling_thread_woken = false;
+    should_loader_close = false;
+    is_music_command_spilled = false;
+    if (!is_loopback)
+        polling_thread = std::thread(&engine::engine_polling_thread, this);
+        
+    KEE_AUDIO_METRIC(metrics.startup_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - init_start).count());
+    KEE_AUDIO_METRIC(metrics.asset_count = sfx_map.size() + music_map.size());
+}
+
+engine::~engine() {
+    // a running job finishes first, it may be loading into sfx_map
+    {
+        std::lock_guard<std::mutex> lock(loader_lock);
+        should_loader_close = true;
+        loader_jobs.clear();
+    }
+    loader_cv.notify_one();
+    if (loader_thread.joinable())
+        loader_thread.join();
+        
+    {
+        std::lock_guard<std::mutex> lock(polling_thread_lock);
+        should_thread_close = true;
+    }
+    polling_thread_cv.notify_one();
+    if (polling_thread.joinable())
+        polling_thread.join();
+    
+    if (is_software_mixing) {
+        alSourceStop(mix_source_id); CHECK_AL_ERRORS();
+        alSourcei(mix_source_id, AL_BUFFER, 0); CHECK_AL_ERRORS();
+        alDeleteSources(1, &mix_source_id); CHECK_AL_ERRORS();
+        alDeleteBuffers(static_cast<ALsizei>(mix_buffer_ids.size()), mix_buffer_ids.data()); CHECK_AL_ERRORS();
+    }
+    else {
+        for (sfx_voice& voice : sfx_mixer) {
+            alSourceStop(voice.source_id); CHECK_AL_ERRORS();
+            alSourcei(voice.source_id, AL_BUFFER, 0); CHECK_AL_ERRORS();
+            alDeleteSources(1, &voice.source_id); CHECK_AL_ERRORS();
+        }
+    }
+    
+    for (auto& [file_name, sfx] : sfx_map) {
+        if (sfx.buffer_id != 0) {
+            alDeleteBuffers(1, &sfx.buffer_id); CHECK_AL_ERRORS();
+        }
+    }
+    
+    for (music_player& player : music_mixer) {
+        alSourceStop(player.source_id); CHECK_AL_ERRORS();
+        alSourcei(player.source_id, AL_BUFFER, 0); CHECK_AL_ERRORS();
+        alDeleteSources(1, &player.source_id); CHECK_AL_ERRORS();
+        alDeleteBuffers(static_cast<ALsizei>(player.buffer_ids.size()), player.buffer_ids.data()); CHECK_AL_ERRORS();
+    }
+    
+    alcMakeContextCurrent(nullptr); CHECK_ALC_ERRORS(alc_device);
+    alcDestroyContext(alc_context); CHECK_ALC_ERRORS(alc_device);
+    alcCloseDevice(alc_device); CHECK_ALC_ERRORS(alc_device);
+    live_engine.store(nullptr);
+}
+
+void engine::post_music_command(const music_command& command) {
+    // once a command spilled, later ones follow it there until the polling thread drains both, so each thread's stay in order
+    if (is_music_command_spilled.load(std::memory_order_acquire) || !music_commands.try_push(command)) {
+        std::lock_guard<std::mutex> lock(music_command_spill_lock);
+        music_command_spill.push_back(command);
+        is_music_command_spilled.store(true, std::memory_order_release);
+        KEE_AUDIO_METRIC(metrics.music_command_spills++);
+    }
+        
+    wake_polling_thread();
+}
+
+void engine::post_set_player_music(music_id id, std::size_t index, std::shared_ptr<std::promise<void>> completion) {
+    std::atomic_bool& is_music_set = is_player_music_set.at(index);
+    const music_entry* music = music_ids.at(id.index);
+    
+    post_music_command({ music_command::type::set_music, index, music, 0.0f, 0, 0.0, std::move(completion) });
+    is_music_set.store(true, std::memory_order_relaxed);
+}
+
+void engine::post_set_playback_time(float time, std::size_t index, std::shared_ptr<std::promise<void>> completion) {
+    if (!is_player_music_set.at(index).load(std::memory_order_relaxed))
+        throw std::logic_error("audio::engine::set_playback_time: music player has no music set (use audio::engine::set_player_music)");
+        
+    post_music_command({ music_command::type::set_playback_time, index, nullptr, time, 0, 0.0, std::move(completion) });
+}
+
+void engine::wake_polling_thread() {
+    {
+        std::lock_guard<std::mutex> lock(polling_thread_lock);
+        is_polling_thread_woken = true;
+    }
+    polling_thread_cv.notify_one();
+}
+
+void engine::process_music_commands() {
+    music_command_batch.clear();
+    music_command popped_command;
+    while (music_commands.try_pop(popped_command))
+        music_command_batch.push_back(std::move(popped_command));
+    if (is_music_command_spilled.load(std::memory_order_acquire)) {
+        // what reached the queue before the spill comes first, nothing spills while the lock is held
+        std::lock_guard<std::mutex> lock(music_command_spill_lock);
+        while (music_commands.try_pop(popped_command))
+            music_command_batch.push_back(std::move(popped_command));
+        music_command_batch.insert(music_command_batch.end(), std::make_move_iterator(music_command_spill.begin()), std::make_move_iterator(music_command_spill.end()));
+        music_command_spill.clear();
+        is_music_command_spilled.store(false, std::memory_order_release);
+    }
+        
+    const auto is_music_replacement = [](const music_command& command) -> bool {
+        return command.command_type == music_command::type::set_music
+            || command.command_type == music_command::type::unset_music;
+    };
+    const auto is_music_change = [&is_music_replacement](const music_command& command) -> bool {
+        return is_music_replacement(command) || command.command_type == music_command::type::set_playback_time;
+    };
+    
+    for (auto command_it = music_command_batch.begin(); command_it != music_command_batch.end(); command_it++) {
+        music_command& command = *command_it;
+        const auto is_followed_by = [this, &command_it](const auto& is_match) -> bool {
+            return std::any_of(command_it + 1, music_command_batch.end(), [&command_it, &is_match](const music_command& later_command) -> bool {
+                return later_command.index == command_it->index && is_match(later_command);
+            });
+        };
+        
+        // a later music change on the same player makes this one's I/O pointless,
+        // and a later set or unset makes setting this music pointless at all
+        bool is_superseded = is_music_change(command) && is_followed_by(is_music_change);
+        bool is_replaced = command.command_type == music_command::type::set_music && is_followed_by(is_music_replacement);
+        if (is_replaced || (is_superseded && command.command_type == music_command::type::set_playback_time)) {
+            if (command.completion != nullptr)
+                command.completion->set_value();
+            continue;
+        }
+    
+        /* the public api checks for music before posting, but another thread's unset can land in between.
+         * A seek or queued music for a player left without music is dropped here, on the only thread that knows.
+         */
+        const music_player& target_player = music_mixer[command.index];
+        bool is_music_needed = command.command_type == music_command::type::set_playback_time || command.command_type == music_command::type::queue_music;
+        if (is_music_needed && (target_player.heard_music == nullptr || (target_player.buffer_queue.empty() && target_player.stream_music == nullptr))) {
+            if (command.completion != nullptr)
+                command.completion->set_value();
+            continue;
+        }
+        
+        // requeueing a ramped player publishes it on its own, before this command's update begins
+        if (command.command_type == music_command::type::unset_music || command.command_type == music_command::type::crossfade)
+            stop_crossfades(command.index);
+        if (command.command_type == music_command::type::crossfade)
+            stop_crossfades(command.target_index);
+    
+        music_player& player = music_mixer[command.index];
+        player.begin_update();
+        
+        bool is_discontinuous = is_music_change(command);
+        switch (command.command_type) {
+        case music_command::type::set_music:
+            // a fade still running goes on without its ramp, which was made for the old music
+            player.ramp.reset();
+            player.finish_seek();
+            player.is_play_deferred = false;
+            player.upcoming_music.clear();
+            player.set_stream(command.music);
+            player.heard_music = command.music;
+            if (is_superseded)
+                player.clear_buffer_queue();
+            else {
+                player.update_buffer_queue();
+                KEE_AUDIO_METRIC(metrics.bytes_streamed[command.index] += player.queued_bytes);
+            }
+            
+            if (command.completion != nullptr)
+                command.completion->set_value();
+            break;
+        case music_command::type::unset_music:
+            player.finish_seek();
+            player.is_play_deferred = false;
+            player.clear_buffer_queue();
+            player.heard_music = nullptr;
+            player.upcoming_music.clear();
+            player.set_stream(nullptr);
+            break;
+        case music_command::type::queue_music:
+            // a playing source picks it up on its next refill, a drained one in the polling pass
+            player.upcoming_music.push_back(command.music);
+            break;
+        case music_command::type::play:
+            // set_music followed by a seek in the same batch queues nothing, a source played empty just stops
+            player.is_play_deferred = player.buffer_queue.empty();
+            alSourcePlay(player.source_id); CHECK_AL_ERRORS();
+            break;
+        case music_command::type::pause:
+            player.is_play_deferred = false;
+            alSourcePause(player.source_id); CHECK_AL_ERRORS();
+            break;
+        case music_command::type::set_playback_time: {
+            player.finish_seek();
+            ALint source_state = AL_NONE;
+            alGetSourcei(player.source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+            
+            const music_entry* heard_music = player.buffer_queue.empty() ? player.stream_music : player.buffer_queue.front().music;
+            bool is_stream_moved = player.get_heard_segment() != player.stream_segment;
+            if (is_stream_moved) {
+                player.rewind_upcoming_music();
+                player.set_stream(heard_music);
+            }
+            
+            const music_t& music = heard_music->second;
+            std::size_t seek_cursor = 0;
+            if (command.time >= music.duration)
+                seek_cursor = music.data_size;
+            else if (command.time > 0.0f) {
+                float playback_percent = command.time / music.duration;
+                seek_cursor = playback_percent * music.data_size;
+                seek_cursor -= seek_cursor % music.frame_size;
+            }
+            
+            player.is_seek_pending = true;
+            player.pending_seek_cursor = seek_cursor;
+            player.pending_seek_completion = std::move(command.completion);
+            if (source_state != AL_PLAYING || is_stream_moved)
+                apply_seek(player, source_state == AL_PLAYING || player.is_play_deferred);
+            else {
+                // keep playing the old queue until the polling pass finds the new cursor prefetched
+                player.music_file.prefetch(seek_cursor);
+                is_discontinuous = false;
+            }
+            break;
+        }
+        case music_command::type::crossfade:
+            start_crossfade(command.index, command.target_index, command.start_time, command.time);
+            break;
+        case music_command::type::set_bus:
+            player.bus = command.target_index;
+            player.set_fade_gain(player.fade_gain);
+            break;
+        case music_command::type::set_tempo: {
+            player.tempo = command.time;
+            ALint source_state = AL_NONE;
+            alGetSourcei(player.source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+            
+            // a seek still waiting rebuilds the queue anyway, at the new tempo
+            if (player.is_seek_pending) {
+                apply_seek(player, source_state == AL_PLAYING || player.is_play_deferred);
+                is_discontinuous = true;
+                break;
+            }
+            
+            if (player.buffer_queue.empty() && player.stream_music == nullptr)
+                break;
+                
+            // the queued buffers were made at the old tempo, they're rebuilt from where the player is heard
+            player.rewind_to_heard_position();
+            player.update_buffer_queue();
+            KEE_AUDIO_METRIC(metrics.bytes_streamed[command.index] += player.queued_bytes);
+            if (source_state == AL_PLAYING) {
+                alSourcePlay(player.source_id); CHECK_AL_ERRORS();
+            }
+            break;
+        }
+        }
+        
+        player.publish_snapshot(is_discontinuous);
+    }
+    
+    for (music_player& player : music_mixer)
+        player.is_play_deferred = false;
+}
+
+void engine::apply_seek(music_player& player, bool should_play) {
+    player.cursor = player.pending_seek_cursor;
+    player.update_buffer_queue();
+    if (should_play) {
+        alSourcePlay(player.source_id); CHECK_AL_ERRORS();
+    }
+    KEE_AUDIO_METRIC(metrics.bytes_streamed[&player - music_mixer.data()] += player.queued_bytes);
+    player.finish_seek();
+}
+
+void engine::start_crossfade(std::size_t from_index, std::size_t to_index, double start_time, double duration) {
+    // called within from_index's update, to_index is published here
+    music_player& from_player = music_mixer[from_index];
+    music_player& to_player = music_mixer[to_index];
+    music_crossfade fade = { from_index, to_index, start_time, duration, false, 0, false, false };
+    
+    /* from_index's buffers are ramped as they're queued, which covers a fade starting past its queue. One that
+     * isn't playing is requeued from where it's heard, one already playing the start steps its gain instead.
+     */
+    ALint source_state = AL_NONE;
+    alGetSourcei(from_player.source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+    if (from_player.heard_music != nullptr) {
+        const music_t& music = from_player.heard_music->second;
+        std::size_t queue_start = 0;
+        std::size_t queue_end = 0;
+        from_player.get_heard_queue(queue_start, queue_end);
+        double start_frame = start_time * music.sample_rate;
+        bool is_past_queue = from_player.get_heard_segment() == from_player.stream_segment && start_frame >= static_cast<double>(queue_end / music.frame_size);
+        if (source_state != AL_PLAYING) {
+            start_frame = std::max(start_frame, static_cast<double>(from_player.rewind_to_heard_position() / music.frame_size));
+            from_player.ramp = music_player::fade_ramp{ from_player.stream_segment, start_frame, duration * music.sample_rate, false };
+            from_player.update_buffer_queue();
+            KEE_AUDIO_METRIC(metrics.bytes_streamed[from_index] += from_player.queued_bytes);
+            fade.is_from_ramped = true;
+        }
+        else if (is_past_queue) {
+            from_player.ramp = music_player::fade_ramp{ from_player.stream_segment, start_frame, duration * music.sample_rate, false };
+            fade.is_from_ramped = true;
+        }
+    }
+    
+    // to_index fades in from where it's heard, which is where it starts
+    alGetSourcei(to_player.source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+    if (source_state != AL_PLAYING && to_player.heard_music != nullptr) {
+        to_player.begin_update();
+        std::size_t heard_cursor = to_player.rewind_to_heard_position();
+        const music_t& music = to_player.stream_music->second;
+        to_player.ramp = music_player::fade_ramp{ to_player.stream_segment, static_cast<double>(heard_cursor / music.frame_size), duration * music.sample_rate, true };
+        to_player.update_buffer_queue();
+        KEE_AUDIO_METRIC(metrics.bytes_streamed[to_index] += to_player.queued_bytes);
+        to_player.set_fade_gain(1.0f);
+        to_player.publish_snapshot(false);
+        fade.is_to_ramped = true;
+    }
+    music_crossfades.push_back(fade);
+}
+
+std::optional<std::chrono::microseconds> engine::update_crossfades() {
+    static constexpr double CROSSFADE_UPDATE_INTERVAL = 0.005;
+    static constexpr double SCHEDULE_LEAD = std::chrono::duration<double>(SFX_SCHEDULE_LEAD).count();
+    
+    std::optional<std::chrono::microseconds> next_update;
+    const auto schedule_update = [&next_update](double delay) {
+        std::chrono::microseconds update(static_cast<std::int64_t>(std::max(delay, 0.0) * 1e6));
+        if (!next_update.has_value() || update < next_update.value())
+            next_update = update;
+    };
+    
+    std::int64_t now_ns = get_device_clock();
+    std::erase_if(music_crossfades, [this, now_ns, &schedule_update](music_crossfade& fade) -> bool {
+        music_player& from_player = music_mixer[fade.from_index];
+        music_player& to_player = music_mixer[fade.to_index];
+        if (!fade.is_started) {
+            // the start is found where the device's mixer is in from_index's music, the way scheduled sfx are
+            std::int64_t clock_ns = now_ns;
+            double remaining = 0.0;
+            if (fade.start_time >= 0.0) {
+                std::optional<double> music_time = from_player.measure_mix_time(clock_ns);
+                if (music_time.has_value())
+                    remaining = (fade.start_time - music_time.value()) / from_player.get_heard_tempo();
+                else if (fade.start_time > from_player.clock.get(get_engine_time()))
+                    // a paused clock doesn't move, the next command that plays it wakes this thread again
+                    return false;
+            }
+            
+            double lead = al_source_play_at_time_soft != nullptr ? SCHEDULE_LEAD : 0.0;
+            if (remaining > lead) {
+                schedule_update(remaining - lead);
+                return false;
+            }
+            
+            fade.is_started = true;
+            fade.start_clock_ns = clock_ns + static_cast<std::int64_t>(std::max(remaining, 0.0) * 1e9);
+            to_player.begin_update();
+            if (!fade.is_to_ramped)
+                to_player.set_fade_gain(0.0f);
+            if (al_source_play_at_time_soft != nullptr) {
+                al_source_play_at_time_soft(to_player.source_id, fade.start_clock_ns); CHECK_AL_ERRORS();
+            }
+            else {
+                alSourcePlay(to_player.source_id); CHECK_AL_ERRORS();
+            }
+            to_player.publish_snapshot(false);
+        }
+        
+        // equal power, so the two players together stay as loud as either alone
+        double elapsed = static_cast<double>(now_ns - fade.start_clock_ns) / 1e9;
+        double progress = fade.duration > 0.0 ? std::clamp(elapsed / fade.duration, 0.0, 1.0) : (elapsed >= 0.0 ? 1.0 : 0.0);
+        double fade_angle = progress * std::numbers::pi / 2.0;
+        if (!fade.is_from_ramped)
+            from_player.set_fade_gain(static_cast<float>(std::cos(fade_angle)));
+        if (!fade.is_to_ramped)
+            to_player.set_fade_gain(static_cast<float>(std::sin(fade_angle)));
+        if (progress < 1.0) {
+            // ramped players only need waking for the end
+            schedule_update(fade.is_from_ramped && fade.is_to_ramped ? fade.duration - elapsed : CROSSFADE_UPDATE_INTERVAL);
+            return false;
+        }
+        
+        from_player.begin_update();
+        alSourcePause(from_player.source_id); CHECK_AL_ERRORS();
+        from_player.set_fade_gain(1.0f);
+        from_player.publish_snapshot(false);
+        // from_index's queue is silent past its ramp, to_index has played into gain 1
+        requeue_ramped_player(from_player);
+        to_player.ramp.reset();
+        return true;
+    });
+    return next_update;
+}
+
+void engine::stop_crossfades(std::size_t index) {
+    std::erase_if(music_crossfades, [this, index](const music_crossfade& fade) -> bool {
+        if (fade.from_index != index && fade.to_index != index)
+            return false;
+            
+        for (std::size_t player_index : { fade.from_index, fade.to_index }) {
+            music_mixer[player_index].set_fade_gain(1.0f);
+            requeue_ramped_player(music_mixer[player_index]);
+        }
+        return true;
+    });
+}
+
+void engine::requeue_ramped_player(music_player& player) {
+    if (!player.ramp.has_value())
+        return;
+        
+    // the ramp is in the buffers already queued, they're rebuilt without it from where the player is heard
+    ALint source_state = AL_NONE;
+    alGetSourcei(player.source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+    player.begin_update();
+    player.ramp.reset();
+    player.rewind_to_heard_position();
+    player.update_buffer_queue();
+    KEE_AUDIO_METRIC(metrics.bytes_streamed[&player - music_mixer.data()] += player.queued_bytes);
+    if (source_state == AL_PLAYING) {
+        alSourcePlay(player.source_id); CHECK_AL_ERRORS();
+    }
+    player.publish_snapshot(false);
+}
+
+std::optional<std::chrono::steady_clock::time_point> engine::update_engine() {
+    KEE_AUDIO_METRIC(metric_timer loop_timer(metrics.polling_loop_time));
+    process_music_commands();
+    if (is_bus_gain_changed.exchange(false, std::memory_order_acquire)) {
+        for (music_player& player : music_mixer)
+            player.set_fade_gain(player.fade_gain);
+    }
+    
+    std::optional<std::chrono::steady_clock::time_point> next_wakeup;
+    const auto schedule_wakeup = [&next_wakeup](std::chrono::microseconds delay) {
+        std::chrono::steady_clock::time_point wakeup = std::chrono::steady_clock::now() + delay;
+        if (!next_wakeup.has_value() || wakeup < next_wakeup.value())
+            next_wakeup = wakeup;
+    };
+
+    KEE_AUDIO_METRIC(metric_timer lock_wait_timer(metrics.sfx_mixer_lock_wait));
+    std::unique_lock<std::mutex> lock(sfx_mixer_lock);
+    KEE_AUDIO_METRIC(lock_wait_timer.stop());
+    if (is_software_mixing) {
+        std::optional<std::chrono::microseconds> mix_delay = update_software_mixer();
+        if (mix_delay.has_value())
+            schedule_wakeup(mix_delay.value());
+    }
+    else {
+        std::optional<std::chrono::microseconds> schedule_delay = update_sfx_schedule();
+        if (schedule_delay.has_value())
+            schedule_wakeup(schedule_delay.value());
+            
+        std::size_t voice_index = sfx_active_head;
+        while (voice_index != NO_SFX_VOICE) {
+            sfx_voice& voice = sfx_mixer[voice_index];
+            std::size_t next_index = voice.active_next;
+            ALint source_state = AL_STOPPED;
+            if (voice.is_stop_requested.load(std::memory_order_acquire)) {
+                alSourceStop(voice.source_id); CHECK_AL_ERRORS();
+            }
+            else {
+                alGetSourcei(voice.source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+            }
+            if (source_state == AL_PLAYING) {
+                ALint sample_offset = 0;
+                alGetSourcei(voice.source_id, AL_SAMPLE_OFFSET, &sample_offset); CHECK_AL_ERRORS();
+                
+                std::size_t sfx_frames = voice.sfx->data_size / get_frame_size(voice.sfx->format);
+                std::size_t played_frames = std::min(static_cast<std::size_t>(sample_offset), sfx_frames);
+                schedule_wakeup(frames_to_duration(sfx_frames - played_frames, voice.sfx->sample_rate));
+            }
+            if (source_state == AL_STOPPED) {
+                unlink_sfx_active(voice_index);
+                free_sfx_voice(voice_index);
+            }
+            voice_index = next_index;
+        }
+    }
+    lock.unlock();
+    
+    std::optional<std::chrono::microseconds> crossfade_delay = update_crossfades();
+    if (crossfade_delay.has_value())
+        schedule_wakeup(crossfade_delay.value());
+    
+    for (std::size_t player_index = 0; player_index < music_mixer.size(); player_index++) {
+        music_player& player = music_mixer[player_index];
+        player.begin_update();
+        ALint source_state = AL_NONE;
+        alGetSourcei(player.source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+        
+        bool is_discontinuous = false;
+        if (player.is_seek_pending) {
+            // refilling the old queue would read from the wrong place, it plays out what it has
+            // offline nothing is gained by waiting, the read blocks until the data is there
+            bool is_seek_ready = is_loopback || player.music_file.is_ready(player.pending_seek_cursor);
+            if (!is_seek_ready || player.music_file.is_stalled(get_engine_time())) {
+                static constexpr std::chrono::milliseconds SEEK_POLL_INTERVAL(1);
+                player.publish_snapshot(false);
+                schedule_wakeup(SEEK_POLL_INTERVAL);
+                continue;
+            }
+            
+            apply_seek(player, source_state != AL_PAUSED);
+            alGetSourcei(player.source_id, AL_SOURCE_STATE, &source_state); CHECK_AL_ERRORS();
+            is_discontinuous = true;
+        }
+        
+        // a stopped source is only ever one that ran out of queued buffers
+        bool is_starved = source_state == AL_STOPPED && player.has_stream_data();
+        KEE_AUDIO_METRIC(if (is_starved && !player.is_starved) metrics.starvations[player_index]++);
+        player.is_starved = is_starved;
+        
+        // the stream is still at the data after the last buffer heard, so the music carries on where it went silent
+        // a stalled stream stays stopped with its played buffers, the next pass finds it starved again
+        if (is_starved && !player.music_file.is_stalled(get_engine_time())) {
+            player.grow_buffers();
+            player.update_buffer_queue();
+            KEE_AUDIO_METRIC(metrics.bytes_streamed[player_index] += player.queued_bytes);
+            KEE_AUDIO_METRIC(metrics.music_buffer_counts[player_index] = player.buffer_ids.size());
+            if (!player.buffer_queue.empty()) {
+                alSourcePlay(player.source_id); CHECK_AL_ERRORS();
+                source_state = AL_PLAYING;
+            }
+            is_discontinuous = true;
+        }
+        
+        // upcoming music that couldn't follow gaplessly starts once the old music drained
+        if (source_state == AL_STOPPED && !is_starved && !player.upcoming_music.empty()) {
+            player.set_stream(player.upcoming_music.front());
+            player.upcoming_music.pop_front();
+            player.update_buffer_queue();
+            alSourcePlay(player.source_id); CHECK_AL_ERRORS();
+            KEE_AUDIO_METRIC(metrics.bytes_streamed[player_index] += player.queued_bytes);
+            source_state = AL_PLAYING;
+            is_discontinuous = true;
+        }
+        
+        if (source_state != AL_PLAYING) {
+            player.publish_snapshot(is_discontinuous);
+            continue;
+        }
+          
+        std::uint64_t heard_segment = player.get_heard_segment();
+        ALint buffers_processed;
+        alGetSourcei(player.source_id, AL_BUFFERS_PROCESSED, &buffers_processed); CHECK_AL_ERRORS();
+        KEE_AUDIO_METRIC(metric_timer refill_timer(metrics.music_refill_time));
+        std::size_t spare_buffers = player.buffer_queue.size() - static_cast<std::size_t>(buffers_processed);
+        while (buffers_processed > 0) {
+            buffers_processed--;
+            player.free_buffers.push_back(player.unqueue_buffer());
+        }
+        [[maybe_unused]] bool is_near_miss = player.update_buffer_depth(spare_buffers);
+        KEE_AUDIO_METRIC(if (is_near_miss) metrics.near_starvations[player_index]++);
+        KEE_AUDIO_METRIC(metrics.music_buffer_counts[player_index] = player.buffer_ids.size());
+        KEE_AUDIO_METRIC(std::size_t bytes_before_refill = player.queued_bytes);
+        player.fill_free_buffers();
+        KEE_AUDIO_METRIC(metrics.bytes_streamed[player_index] += player.queued_bytes - bytes_before_refill);
+        KEE_AUDIO_METRIC(refill_timer.stop());
+        
+        // crossing into the next queued music is the one jump of a playing clock
+        player.publish_snapshot(is_discontinuous || player.get_heard_segment() != heard_segment);
+        schedule_wakeup(AUDIO_CLOCK_UPDATE_INTERVAL);
+        if (player.buffer_queue.empty())
+            continue;
+        
+        // every pass unqueues processed buffers, so the offset is into the head buffer
+        ALint sample_offset = 0;
+        alGetSourcei(player.source_id, AL_SAMPLE_OFFSET, &sample_offset); CHECK_AL_ERRORS();
+        const music_t& head_music = player.buffer_queue.front().music->second;
+        std::size_t head_frames = player.buffer_queue.front().size / head_music.frame_size;
+        schedule_wakeup(frames_to_duration(head_frames - std::min(static_cast<std::size_t>(sample_offset), head_frames), head_music.sample_rate));
+    }
+    
+    KEE_AUDIO_METRIC(loop_timer.stop());
+    return next_wakeup;
+}
 
-engine::sfx_t::sfx_t(int _sample_rate, ALenum _format, const std::vector<byte>& _data) :
-    sample_rate(_sample_rate),
-    format(_format),
-    data(_data)
+void engine::engine_polling_thread() {
+    while (!should_thread_close) {
+        std::optional<std::chrono::steady_clock::time_point> next_wakeup = update_engine();
+        
+        static constexpr std::chrono::milliseconds MIN_WAKEUP_INTERVAL(1);
+        std::unique_lock<std::mutex> lock(polling_thread_lock);
+        const auto is_woken = [this]() -> bool {
+            return is_polling_thread_woken || should_thread_close;
+        };
+        
+        if (next_wakeup.has_value())
+            polling_thread_cv.wait_until(lock, std::max(next_wakeup.value(), std::chrono::steady_clock::now() + MIN_WAKEUP_INTERVAL), is_woken);
+        else
+            polling_thread_cv.wait(lock, is_woken);
+        is_polling_thread_woken = false;
+    }
+}
+
+// ------------------------------------------------------------------- //
+// ENGINE::METRICS
+
+#ifdef KEE_AUDIO_ENABLE_METRICS
+void engine::metric_histogram::record(std::chrono::steady_clock::duration duration) {
+    std::uint64_t duration_ns = static_cast<std::uint64_t>(std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 0));
+    std::size_t bucket = std::min<std::size_t>(std::bit_width(duration_ns >> 10), METRIC_BUCKET_COUNT - 1);
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(duration_ns, std::memory_order_relaxed);
+    
+    std::uint64_t current_max = max_ns.load(std::memory_order_relaxed);
+    while (duration_ns > current_max && !max_ns.compare_exchange_weak(current_max, duration_ns, std::memory_order_relaxed));
+}
+
+void engine::metric_histogram::read(latency_histogram& histogram) const {
+    for (std::size_t i = 0; i < METRIC_BUCKET_COUNT; i++)
+        histogram.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+    histogram.count = count.load(std::memory_order_relaxed);
+    histogram.total_ns = total_ns.load(std::memory_order_relaxed);
+    histogram.max_ns = max_ns.load(std::memory_order_relaxed);
+}
+
+void engine::metric_histogram::reset() {
+    for (std::atomic<std::uint64_t>& bucket : buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    total_ns.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+}
+
+engine::metric_timer::metric_timer(metric_histogram& _histogram) :
+    histogram(&_histogram),
+    start(std::chrono::steady_clock::now())
+{ }
+
+engine::metric_timer::~metric_timer() {
+    stop();
+}
+
+void engine::metric_timer::stop() {
+    if (histogram == nullptr)
+        return;
+        
+    histogram->record(std::chrono::steady_clock::now() - start);
+    histogram = nullptr;
+}
+
+void engine::record_sfx_start(sfx_voice& voice) {
+    if (voice.trigger_time == std::chrono::steady_clock::time_point())
+        return;
+        
+    metrics.sfx_start_latency.record(std::chrono::steady_clock::now() - voice.trigger_time);
+    voice.trigger_time = std::chrono::steady_clock::time_point();
+}
+
+void engine::engine_metrics::record_voices(std::size_t _live_voices) {
+    live_voices.store(_live_voices, std::memory_order_relaxed);
+    std::uint64_t current_peak = peak_voices.load(std::memory_order_relaxed);
+    while (_live_voices > current_peak && !peak_voices.compare_exchange_weak(current_peak, _live_voices, std::memory_order_relaxed));
+}
+#endif
+
+// ------------------------------------------------------------------- //
+// ENGINE::MIX_KERNELS
+
+static void mix_mono_scalar(const std::int16_t* in, float* out, std::size_t frames, float left_gain, float right_gain) {
+    for (std::size_t i = 0; i < frames; i++) {
+        float sample = static_cast<float>(in[i]);
+        out[2 * i] += sample * left_gain;
+        out[2 * i + 1] += sample * right_gain;
+    }
+}
+
+static void mix_stereo_scalar(const std::int16_t* in, float* out, std::size_t frames, float left_gain, float right_gain) {
+    for (std::size_t i = 0; i < frames; i++) {
+        out[2 * i] += static_cast<float>(in[2 * i]) * left_gain;
+        out[2 * i + 1] += static_cast<float>(in[2 * i + 1]) * right_gain;
+    }
+}
+
+static void to_s16_scalar(const float* in, std::int16_t* out, std::size_t samples) {
+    for (std::size_t i = 0; i < samples; i++)
+        out[i] = static_cast<std::int16_t>(std::nearbyint(std::clamp(in[i], -32768.0f, 32767.0f)));
+}
+
+static void s16_to_f32_scalar(const std::int16_t* in, float* out, std::size_t samples) {
+    for (std::size_t i = 0; i < samples; i++)
+        out[i] = static_cast<float>(in[i]);
+}
+
+static void accumulate_scalar(const float* in, float* out, std::size_t samples) {
+    for (std::size_t i = 0; i < samples; i++)
+        out[i] += in[i];
+}
+
+// every level keeps 8 running sums and folds them in this order, which keeps them bit exact
+static float fold_dot_lanes(const float* lanes) {
+    float quarters[4] = { lanes[0] + lanes[4], lanes[1] + lanes[5], lanes[2] + lanes[6], lanes[3] + lanes[7] };
+    return (quarters[0] + quarters[2]) + (quarters[1] + quarters[3]);
+}
+
+static float dot_scalar(const float* a, const float* b, std::size_t n) {
+    float lanes[8] = {};
+    for (std::size_t i = 0; i < n; i += 8)
+        for (std::size_t lane = 0; lane < 8; lane++)
+            lanes[lane] += a[i + lane] * b[i + lane];
+    return fold_dot_lanes(lanes);
+}
+
+static void biquad_scalar(float* samples, std::size_t frames, std::size_t channels, const float* coefficients, float* state, float mix) {
+    for (std::size_t channel = 0; channel < channels; channel++) {
+        float z1 = state[channel];
+        float z2 = state[2 + channel];
+        for (std::size_t i = 0; i < frames; i++) {
+            float x = samples[i * channels + channel];
+            float y = coefficients[0] * x + z1;
+            z1 = coefficients[1] * x - coefficients[3] * y + z2;
+            z2 = coefficients[2] * x - coefficients[4] * y;
+            samples[i * channels + channel] = x + mix * (y - x);
+        }
+        state[channel] = z1;
+        state[2 + channel] = z2;
+    }
+}
+
+static float peak_scalar(const std::int16_t* in, std::size_t samples, std::int16_t& min, std::int16_t& max) {
+    float lanes[8] = {};
+    for (std::size_t i = 0; i < samples; i++) {
+        min = std::min(min, in[i]);
+        max = std::max(max, in[i]);
+        float sample = static_cast<float>(in[i]);
+        lanes[i % 8] += sample * sample;
+    }
+    return fold_dot_lanes(lanes);
+}
+
+// one lane per line of engine::REVERB_LINE_COUNT, left input feeds lanes 0-3 and right 4-7,
+// even lanes make the left output and odd ones the right
+static constexpr std::size_t REVERB_LANES = 8;
+static constexpr float REVERB_INPUT_GAIN = 0.125f;
+
+static std::size_t reverb_scalar(float* samples, std::size_t frames, std::size_t channels, float* lines, std::size_t mask, std::size_t position,
+                                 const std::size_t* delays, float* lowpass, float feedback, float damping, float wet) {
+    for (std::size_t i = 0; i < frames; i++) {
+        float in_left = samples[i * channels];
+        float in_right = samples[i * channels + channels - 1];
+        for (std::size_t lane = 0; lane < REVERB_LANES; lane++) {
+            float delayed = lines[((position - delays[lane]) & mask) * REVERB_LANES + lane];
+            lowpass[lane] = delayed + (lowpass[lane] - delayed) * damping;
+        }
+        
+        // householder feedback, every line minus a quarter of their sum
+        float reflection = fold_dot_lanes(lowpass) * 0.25f;
+        float* row = lines + position * REVERB_LANES;
+        for (std::size_t lane = 0; lane < REVERB_LANES; lane++)
+            row[lane] = (lowpass[lane] - reflection) * feedback + (lane < REVERB_LANES / 2 ? in_left : in_right) * REVERB_INPUT_GAIN;
+            
+        float out_left = ((lowpass[0] + lowpass[2]) + (lowpass[4] + lowpass[6])) * 0.25f;
+        float out_right = ((lowpass[1] + lowpass[3]) + (lowpass[5] + lowpass[7])) * 0.25f;
+        if (channels == 1)
+            samples[i] = in_left + wet * ((out_left + out_right) * 0.5f);
+        else {
+            samples[2 * i] = in_left + wet * out_left;
+            samples[2 * i + 1] = in_right + wet * out_right;
+        }
+        position = (position + 1) & mask;
+    }
+    return position;
+}
+
+#ifdef KEE_AUDIO_HAS_SSE2
+static void mix_mono_sse2(const std::int16_t* in, float* out, std::size_t frames, float left_gain, float right_gain) {
+    const __m128 left = _mm_set1_ps(left_gain);
+    const __m128 right = _mm_set1_ps(right_gain);
+    
+    std::size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128i samples_s16 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i));
+        __m128 samples = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples_s16, samples_s16), 16));
+        __m128 left_samples = _mm_mul_ps(samples, left);
+        __m128 right_samples = _mm_mul_ps(samples, right);
+        
+        _mm_storeu_ps(out + 2 * i, _mm_add_ps(_mm_loadu_ps(out + 2 * i), _mm_unpacklo_ps(left_samples, right_samples)));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(out + 2 * i + 4), _mm_unpackhi_ps(left_samples, right_samples)));
+    }
+    mix_mono_scalar(in + i, out + 2 * i, frames - i, left_gain, right_gain);
+}
+
+static void mix_stereo_sse2(const std::int16_t* in, float* out, std::size_t frames, float left_gain, float right_gain) {
+    const __m128 gains = _mm_setr_ps(left_gain, right_gain, left_gain, right_gain);
+    
+    std::size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128i samples_s16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i));
+        __m128 low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples_s16, samples_s16), 16));
+        __m128 high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(samples_s16, samples_s16), 16));
+        
+        _mm_storeu_ps(out + 2 * i, _mm_add_ps(_mm_loadu_ps(out + 2 * i), _mm_mul_ps(low, gains)));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(out + 2 * i + 4), _mm_mul_ps(high, gains)));
+    }
+    mix_stereo_scalar(in + 2 * i, out + 2 * i, frames - i, left_gain, right_gain);
+}
+
+static void to_s16_sse2(const float* in, std::int16_t* out, std::size_t samples) {
+    const __m128 min = _mm_set1_ps(-32768.0f);
+    const __m128 max = _mm_set1_ps(32767.0f);
+    
+    std::size_t i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        __m128i low = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), min), max));
+        __m128i high = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), min), max));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(low, high));
+    }
+    to_s16_scalar(in + i, out + i, samples - i);
+}
+
+static void s16_to_f32_sse2(const std::int16_t* in, float* out, std::size_t samples) {
+    std::size_t i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        __m128i samples_s16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples_s16, samples_s16), 16)));
+        _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(samples_s16, samples_s16), 16)));
+    }
+    s16_to_f32_scalar(in + i, out + i, samples - i);
+}
+
+static void accumulate_sse2(const float* in, float* out, std::size_t samples) {
+    std::size_t i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_loadu_ps(in + i)));
+        _mm_storeu_ps(out + i + 4, _mm_add_ps(_mm_loadu_ps(out + i + 4), _mm_loadu_ps(in + i + 4)));
+    }
+    accumulate_scalar(in + i, out + i, samples - i);
+}
+
+static float dot_sse2(const float* a, const float* b, std::size_t n) {
+    __m128 low = _mm_setzero_ps();
+    __m128 high = _mm_setzero_ps();
+    for (std::size_t i = 0; i < n; i += 8) {
+        low = _mm_add_ps(low, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        high = _mm_add_ps(high, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    
+    float lanes[8];
+    _mm_storeu_ps(lanes, low);
+    _mm_storeu_ps(lanes + 4, high);
+    return fold_dot_lanes(lanes);
+}
+
+static void biquad_sse2(float* samples, std::size_t frames, std::size_t channels, const float* coefficients, float* state, float mix) {
+    if (channels != 2) {
+        biquad_scalar(samples, frames, channels, coefficients, state, mix);
+        return;
+    }
+    
+    // the recursion runs frame by frame, both channels side by side in the low two lanes
+    const __m128 b0 = _mm_set1_ps(coefficients[0]);
+    const __m128 b1 = _mm_set1_ps(coefficients[1]);
+    const __m128 b2 = _mm_set1_ps(coefficients[2]);
+    const __m128 a1 = _mm_set1_ps(coefficients[3]);
+    const __m128 a2 = _mm_set1_ps(coefficients[4]);
+    const __m128 mix_factor = _mm_set1_ps(mix);
+    __m128 z1 = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(state));
+    __m128 z2 = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(state + 2));
+    for (std::size_t i = 0; i < frames; i++) {
+        __m128 x = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(samples + 2 * i));
+        __m128 y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+        z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+        z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+        _mm_storel_pi(reinterpret_cast<__m64*>(samples + 2 * i), _mm_add_ps(x, _mm_mul_ps(mix_factor, _mm_sub_ps(y, x))));
+    }
+    _mm_storel_pi(reinterpret_cast<__m64*>(state), z1);
+    _mm_storel_pi(reinterpret_cast<__m64*>(state + 2), z2);
+}
+
+static float peak_sse2(const std::int16_t* in, std::size_t samples, std::int16_t& min, std::int16_t& max) {
+    __m128i low = _mm_set1_epi16(min);
+    __m128i high = _mm_set1_epi16(max);
+    __m128 low_sums = _mm_setzero_ps();
+    __m128 high_sums = _mm_setzero_ps();
+    
+    std::size_t i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        __m128i samples_s16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        low = _mm_min_epi16(low, samples_s16);
+        high = _mm_max_epi16(high, samples_s16);
+        __m128 first = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples_s16, samples_s16), 16));
+        __m128 second = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(samples_s16, samples_s16), 16));
+        low_sums = _mm_add_ps(low_sums, _mm_mul_ps(first, first));
+        high_sums = _mm_add_ps(high_sums, _mm_mul_ps(second, second));
+    }
+    
+    std::int16_t lows[8];
+    std::int16_t highs[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lows), low);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(highs), high);
+    min = *std::min_element(lows, lows + 8);
+    max = *std::max_element(highs, highs + 8);
+    
+    // the tail keeps adding into the lanes its samples would have landed in
+    float lanes[8];
+    _mm_storeu_ps(lanes, low_sums);
+    _mm_storeu_ps(lanes + 4, high_sums);
+    for (; i < samples; i++) {
+        min = std::min(min, in[i]);
+        max = std::max(max, in[i]);
+        float sample = static_cast<float>(in[i]);
+        lanes[i % 8] += sample * sample;
+    }
+    return fold_dot_lanes(lanes);
+}
+
+static std::size_t reverb_sse2(float* samples, std::size_t frames, std::size_t channels, float* lines, std::size_t mask, std::size_t position,
+                               const std::size_t* delays, float* lowpass, float feedback, float damping, float wet) {
+    const __m128 feedback_factor = _mm_set1_ps(feedback);
+    const __m128 damping_factor = _mm_set1_ps(damping);
+    const __m128 input_gain = _mm_set1_ps(REVERB_INPUT_GAIN);
+    __m128 low = _mm_loadu_ps(lowpass);
+    __m128 high = _mm_loadu_ps(lowpass + 4);
+    
+    float lanes[8];
+    for (std::size_t i = 0; i < frames; i++) {
+        float in_left = samples[i * channels];
+        float in_right = samples[i * channels + channels - 1];
+        const auto delayed = [&](std::size_t lane) { return lines[((position - delays[lane]) & mask) * REVERB_LANES + lane]; };
+        __m128 delayed_low = _mm_setr_ps(delayed(0), delayed(1), delayed(2), delayed(3));
+        __m128 delayed_high = _mm_setr_ps(delayed(4), delayed(5), delayed(6), delayed(7));
+        low = _mm_add_ps(delayed_low, _mm_mul_ps(_mm_sub_ps(low, delayed_low), damping_factor));
+        high = _mm_add_ps(delayed_high, _mm_mul_ps(_mm_sub_ps(high, delayed_high), damping_factor));
+        
+        _mm_storeu_ps(lanes, low);
+        _mm_storeu_ps(lanes + 4, high);
+        __m128 reflection = _mm_set1_ps(fold_dot_lanes(lanes) * 0.25f);
+        float* row = lines + position * REVERB_LANES;
+        _mm_storeu_ps(row, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(low, reflection), feedback_factor), _mm_mul_ps(_mm_set1_ps(in_left), input_gain)));
+        _mm_storeu_ps(row + 4, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(high, reflection), feedback_factor), _mm_mul_ps(_mm_set1_ps(in_right), input_gain)));
+        
+        float out_left = ((lanes[0] + lanes[2]) + (lanes[4] + lanes[6])) * 0.25f;
+        float out_right = ((lanes[1] + lanes[3]) + (lanes[5] + lanes[7])) * 0.25f;
+        if (channels == 1)
+            samples[i] = in_left + wet * ((out_left + out_right) * 0.5f);
+        else {
+            samples[2 * i] = in_left + wet * out_left;
+            samples[2 * i + 1] = in_right + wet * out_right;
+        }
+        position = (position + 1) & mask;
+    }
+    
+    _mm_storeu_ps(lowpass, low);
+    _mm_storeu_ps(lowpass + 4, high);
+    return position;
+}
+#endif
+
+#ifdef KEE_AUDIO_HAS_AVX2
+__attribute__((target("avx2")))
+static void mix_mono_avx2(const std::int16_t* in, float* out, std::size_t frames, float left_gain, float right_gain) {
+    const __m256 left = _mm256_set1_ps(left_gain);
+    const __m256 right = _mm256_set1_ps(right_gain);
+    
+    std::size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 samples = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))));
+        __m256 left_samples = _mm256_mul_ps(samples, left);
+        __m256 right_samples = _mm256_mul_ps(samples, right);
+        
+        // unpack interleaves within 128 bit lanes, frames 0-1 4-5 and 2-3 6-7, permute puts them back in order
+        __m256 low = _mm256_unpacklo_ps(left_samples, right_samples);
+        __m256 high = _mm256_unpackhi_ps(left_samples, right_samples);
+        __m256 first = _mm256_permute2f128_ps(low, high, 0x20);
+        __m256 second = _mm256_permute2f128_ps(low, high, 0x31);
+        
+        _mm256_storeu_ps(out + 2 * i, _mm256_add_ps(_mm256_loadu_ps(out + 2 * i), first));
+        _mm256_storeu_ps(out + 2 * i + 8, _mm256_add_ps(_mm256_loadu_ps(out + 2 * i + 8), second));
+    }
+    mix_mono_scalar(in + i, out + 2 * i, frames - i, left_gain, right_gain);
+}
+
+__attribute__((target("avx2")))
+static void mix_stereo_avx2(const std::int16_t* in, float* out, std::size_t frames, float left_gain, float right_gain) {
+    const __m256 gains = _mm256_setr_ps(left_gain, right_gain, left_gain, right_gain, left_gain, right_gain, left_gain, right_gain);
+    
+    std::size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 low = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i))));
+        __m256 high = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i + 8))));
+        
+        _mm256_storeu_ps(out + 2 * i, _mm256_add_ps(_mm256_loadu_ps(out + 2 * i), _mm256_mul_ps(low, gains)));
+        _mm256_storeu_ps(out + 2 * i + 8, _mm256_add_ps(_mm256_loadu_ps(out + 2 * i + 8), _mm256_mul_ps(high, gains)));
+    }
+    mix_stereo_scalar(in + 2 * i, out + 2 * i, frames - i, left_gain, right_gain);
+}
+
+__attribute__((target("avx2")))
+static void to_s16_avx2(const float* in, std::int16_t* out, std::size_t samples) {
+    const __m256 min = _mm256_set1_ps(-32768.0f);
+    const __m256 max = _mm256_set1_ps(32767.0f);
+    
+    std::size_t i = 0;
+    for (; i + 16 <= samples; i += 16) {
+        __m256i low = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), min), max));
+        __m256i high = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i + 8), min), max));
+        // packs works within 128 bit lanes, permute restores sample order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+    to_s16_scalar(in + i, out + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void s16_to_f32_avx2(const std::int16_t* in, float* out, std::size_t samples) {
+    std::size_t i = 0;
+    for (; i + 16 <= samples; i += 16) {
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)))));
+        _mm256_storeu_ps(out + i + 8, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8)))));
+    }
+    s16_to_f32_scalar(in + i, out + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(const float* in, float* out, std::size_t samples) {
+    std::size_t i = 0;
+    for (; i + 16 <= samples; i += 16) {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_loadu_ps(in + i)));
+        _mm256_storeu_ps(out + i + 8, _mm256_add_ps(_mm256_loadu_ps(out + i + 8), _mm256_loadu_ps(in + i + 8)));
+    }
+    accumulate_scalar(in + i, out + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static float dot_avx2(const float* a, const float* b, std::size_t n) {
+    __m256 sums = _mm256_setzero_ps();
+    for (std::size_t i = 0; i < n; i += 8)
+        sums = _mm256_add_ps(sums, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        
+    float lanes[8];
+    _mm256_storeu_ps(lanes, sums);
+    return fold_dot_lanes(lanes);
+}
+
+__attribute__((target("avx2")))
+static float peak_avx2(const std::int16_t* in, std::size_t samples, std::int16_t& min, std::int16_t& max) {
+    __m256i low = _mm256_set1_epi16(min);
+    __m256i high = _mm256_set1_epi16(max);
+    __m256 sums = _mm256_setzero_ps();
+    
+    // 16 samples a step, the second 8 added after the first so every lane sums in the scalar order
+    std::size_t i = 0;
+    for (; i + 16 <= samples; i += 16) {
+        __m256i samples_s16 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        low = _mm256_min_epi16(low, samples_s16);
+        high = _mm256_max_epi16(high, samples_s16);
+        __m256 first = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(samples_s16)));
+        __m256 second = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(samples_s16, 1)));
+        sums = _mm256_add_ps(sums, _mm256_mul_ps(first, first));
+        sums = _mm256_add_ps(sums, _mm256_mul_ps(second, second));
+    }
+    
+    std::int16_t lows[16];
+    std::int16_t highs[16];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lows), low);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(highs), high);
+    min = *std::min_element(lows, lows + 16);
+    max = *std::max_element(highs, highs + 16);
+    
+    float lanes[8];
+    _mm256_storeu_ps(lanes, sums);
+    for (; i < samples; i++) {
+        min = std::min(min, in[i]);
+        max = std::max(max, in[i]);
+        float sample = static_cast<float>(in[i]);
+        lanes[i % 8] += sample * sample;
+    }
+    return fold_dot_lanes(lanes);
+}
+
+__attribute__((target("avx2")))
+static std::size_t reverb_avx2(float* samples, std::size_t frames, std::size_t channels, float* lines, std::size_t mask, std::size_t position,
+                               const std::size_t* delays, float* lowpass, float feedback, float damping, float wet) {
+    const __m256 feedback_factor = _mm256_set1_ps(feedback);
+    const __m256 damping_factor = _mm256_set1_ps(damping);
+    const __m256 input_gain = _mm256_set1_ps(REVERB_INPUT_GAIN);
+    __m256 filtered = _mm256_loadu_ps(lowpass);
+    
+    float lanes[8];
+    for (std::size_t i = 0; i < frames; i++) {
+        float in_left = samples[i * channels];
+        float in_right = samples[i * channels + channels - 1];
+        const auto delayed = [&](std::size_t lane) { return lines[((position - delays[lane]) & mask) * REVERB_LANES + lane]; };
+        __m256 delayed_lines = _mm256_setr_ps(delayed(0), delayed(1), delayed(2), delayed(3), delayed(4), delayed(5), delayed(6), delayed(7));
+        filtered = _mm256_add_ps(delayed_lines, _mm256_mul_ps(_mm256_sub_ps(filtered, delayed_lines), damping_factor));
+        
+        _mm256_storeu_ps(lanes, filtered);
+        __m256 reflection = _mm256_set1_ps(fold_dot_lanes(lanes) * 0.25f);
+        __m256 input = _mm256_setr_ps(in_left, in_left, in_left, in_left, in_right, in_right, in_right, in_right);
+        _mm256_storeu_ps(lines + position * REVERB_LANES,
+                         _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(filtered, reflection), feedback_factor), _mm256_mul_ps(input, input_gain)));
+                         
+        float out_left = ((lanes[0] + lanes[2]) + (lanes[4] + lanes[6])) * 0.25f;
+        float out_right = ((lanes[1] + lanes[3]) + (lanes[5] + lanes[7])) * 0.25f;
+        if (channels == 1)
+            samples[i] = in_left + wet * ((out_left + out_right) * 0.5f);
+        else {
+            samples[2 * i] = in_left + wet * out_left;
+            samples[2 * i + 1] = in_right + wet * out_right;
+        }
+        position = (position + 1) & mask;
+    }
+    
+    _mm256_storeu_ps(lowpass, filtered);
+    return position;
+}
+#endif
+
+engine::mix_kernels engine::mix_kernels::select(simd_level max_level) {
+    static_assert(REVERB_LINE_COUNT == REVERB_LANES);
+    mix_kernels res = { simd_level::scalar, mix_mono_scalar, mix_stereo_scalar, to_s16_scalar, dot_scalar, biquad_scalar, reverb_scalar, peak_scalar,
+                       s16_to_f32_scalar, accumulate_scalar };
+    
+#ifdef KEE_AUDIO_HAS_SSE2
+    if (max_level >= simd_level::sse2)
+        res = { simd_level::sse2, mix_mono_sse2, mix_stereo_sse2, to_s16_sse2, dot_sse2, biquad_sse2, reverb_sse2, peak_sse2,
+               s16_to_f32_sse2, accumulate_sse2 };
+#endif
+
+#ifdef KEE_AUDIO_HAS_AVX2
+    if (max_level >= simd_level::avx2 && __builtin_cpu_supports("avx2"))
+        // the biquad's recursion leaves nothing for wider registers
+        res = { simd_level::avx2, mix_mono_avx2, mix_stereo_avx2, to_s16_avx2, dot_avx2, biquad_sse2, reverb_avx2, peak_avx2,
+               s16_to_f32_avx2, accumulate_avx2 };
+#endif
+
+    return res;
+}
+
+// ------------------------------------------------------------------- //
+// ENGINE::ASSET_INDEX
+
+/* Layout: "KEEI", u32 version, u64 entry count, then per entry
+ * u32 path length, path, u64 file size, i64 modified time,
+ * i32 sample rate, i32 format, u64 data start, u64 data size, f32 duration,
+ * u32 normalized path length, normalized path.
+ * Native endianness, the index is a local cache and is never shipped.
+ */
+static constexpr std::uint32_t ASSET_INDEX_VERSION = 2;
+
+void engine::asset_index::load(const std::filesystem::path& index_path) {
+    entries.clear();
+    std::ifstream index_file(index_path, std::ios::binary);
+    if (!index_file.is_open())
+        return;
+    
+    const auto read_value = [&index_file](auto& value) -> bool {
+        return static_cast<bool>(index_file.read(reinterpret_cast<byte*>(&value), sizeof(value)));
+    };
+    
+    std::array<byte, 4> magic;
+    std::uint32_t version = 0;
+    std::uint64_t entry_count = 0;
+    if (!index_file.read(magic.data(), magic.size()) || std::strncmp(magic.data(), "KEEI", 4) != 0)
+        return;
+    if (!read_value(version) || version != ASSET_INDEX_VERSION || !read_value(entry_count))
+        return;
+        
+    for (std::uint64_t i = 0; i < entry_count; i++) {
+        std::uint32_t path_size = 0;
+        std::string path;
+        std::uint64_t file_size = 0;
+        std::int64_t modified_time = 0;
+        std::int32_t sample_rate = 0;
+        std::int32_t format = 0;
+        std::uint64_t data_start = 0;
+        std::uint64_t data_size = 0;
+        float duration = 0.0f;
+        std::uint32_t normalized_path_size = 0;
+        std::string normalized_path;
+        
+        if (!read_value(path_size))
+            break;
+        path.resize(path_size);
+        if (!index_file.read(path.data(), path_size))
+            break;
+        if (!read_value(file_size) || !read_value(modified_time) || !read_value(sample_rate) || !read_value(format)
+            || !read_value(data_start) || !read_value(data_size) || !read_value(duration) || !read_value(normalized_path_size))
+            break;
+        normalized_path.resize(normalized_path_size);
+        if (!index_file.read(normalized_path.data(), normalized_path_size))
+            break;
+            
+        entries.try_emplace(path, entry{ file_size, modified_time, std::make_tuple(sample_rate, format, data_start, data_size, duration), normalized_path });
+    }
+}
+
+void engine::asset_index::save(const std::filesystem::path& index_path) const {
+    // written to a temporary first so a crash never leaves a torn index, failures only cost the next startup
+    std::filesystem::path temp_path = index_path;
+    temp_path += ".tmp";
+    std::ofstream index_file(temp_path, std::ios::binary | std::ios::trunc);
+    if (!index_file.is_open())
+        return;
+        
+    const auto write_value = [&index_file](const auto& value) {
+        index_file.write(reinterpret_cast<const byte*>(&value), sizeof(value));
+    };
+    
+    index_file.write("KEEI", 4);
+    write_value(ASSET_INDEX_VERSION);
+    write_value(static_cast<std::uint64_t>(entries.size()));
+    for (const auto& [path, asset] : entries) {
+        const auto [sample_rate, format, data_start, data_size, duration] = asset.header;
+        write_value(static_cast<std::uint32_t>(path.size()));
+        index_file.write(path.data(), path.size());
+        write_value(static_cast<std::uint64_t>(asset.file_size));
+        write_value(asset.modified_time);
+        write_value(static_cast<std::int32_t>(sample_rate));
+        write_value(static_cast<std::int32_t>(format));
+        write_value(static_cast<std::uint64_t>(data_start));
+        write_value(static_cast<std::uint64_t>(data_size));
+        write_value(duration);
+        write_value(static_cast<std::uint32_t>(asset.normalized_path.size()));
+        index_file.write(asset.normalized_path.data(), asset.normalized_path.size());
+    }
+    
+    index_file.close();
+    if (!index_file)
+        return;
+        
+    std::error_code error;
+    std::filesystem::rename(temp_path, index_path, error);
+}
+
+// ------------------------------------------------------------------- //
+// ENGINE::WAVEFORM
+
+/* Layout: "KEEW", u32 version, u64 source file size, i64 source modified time, u64 data start, u64 data size,
+ * i32 sample rate, u64 frame count, u32 level count, then per level u64 bin count and its bins as i16 min, max, rms.
+ * Native endianness, a local cache like the asset index.
+ */
+static constexpr std::uint32_t WAVEFORM_CACHE_VERSION = 1;
+
+engine::waveform::waveform() :
+    sample_rate(0),
+    frame_count(0)
 { }
 
+bool engine::waveform::load(const std::filesystem::path& cache_path, std::uintmax_t source_size, std::int64_t source_time, const music_t& music) {
+    std::ifstream cache_file(cache_path, std::ios::binary);
+    if (!cache_file.is_open())
+        return false;
+        
+    const auto read_value = [&cache_file](auto& value) -> bool {
+        return static_cast<bool>(cache_file.read(reinterpret_cast<byte*>(&value), sizeof(value)));
+    };
+    
+    std::array<byte, 4> magic;
+    std::uint32_t version = 0;
+    std::uint64_t cached_size = 0;
+    std::int64_t cached_time = 0;
+    std::uint64_t data_start = 0;
+    std::uint64_t data_size = 0;
+    std::int32_t cached_sample_rate = 0;
+    std::uint64_t cached_frame_count = 0;
+    std::uint32_t level_count = 0;
+    if (!cache_file.read(magic.data(), magic.size()) || std::strncmp(magic.data(), "KEEW", 4) != 0)
+        return false;
+    if (!read_value(version) || version != WAVEFORM_CACHE_VERSION || !read_value(cached_size) || !read_value(cached_time)
+        || !read_value(data_start) || !read_value(data_size) || !read_value(cached_sample_rate) || !read_value(cached_frame_count) || !read_value(level_count))
+        return false;
+    if (cached_size != source_size || cached_time != source_time || data_start != music.data_start || data_size != music.data_size || level_count > 64)
+        return false;
+        
+    // a bin count past what the music could fill means a torn or foreign file
+    std::uint64_t max_bins = cached_frame_count / WAVEFORM_BIN_FRAMES + 1;
+    levels.resize(level_count);
+    for (std::vector<peak_bin>& bins : levels) {
+        std::uint64_t bin_count = 0;
+        if (!read_value(bin_count) || bin_count > max_bins)
+            return false;
+        bins.resize(bin_count);
+        if (!cache_file.read(reinterpret_cast<byte*>(bins.data()), static_cast<std::streamsize>(bin_count * sizeof(peak_bin))))
+            return false;
+    }
+    
+    sample_rate = cached_sample_rate;
+    frame_count = cached_frame_count;
+    return !levels.empty();
+}
+
+void engine::waveform::save(const std::filesystem::path& cache_path, std::uintmax_t source_size, std::int64_t source_time, const music_t& music) const {
+    // like the asset index, written to a temporary first and failures only cost a rebuild
+    std::error_code error;
+    std::filesystem::create_directories(cache_path.parent_path(), error);
+    std::filesystem::path temp_path = cache_path;
+    temp_path += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    std::ofstream cache_file(temp_path, std::ios::binary | std::ios::trunc);
+    if (!cache_file.is_open())
+        return;
+        
+    const auto write_value = [&cache_file](const auto& value) {
+        cache_file.write(reinterpret_cast<const byte*>(&value), sizeof(value));
+    };
+    
+    cache_file.write("KEEW", 4);
+    write_value(WAVEFORM_CACHE_VERSION);
+    write_value(static_cast<std::uint64_t>(source_size));
+    write_value(source_time);
+    write_value(static_cast<std::uint64_t>(music.data_start));
+    write_value(static_cast<std::uint64_t>(music.data_size));
+    write_value(static_cast<std::int32_t>(sample_rate));
+    write_value(static_cast<std::uint64_t>(frame_count));
+    write_value(static_cast<std::uint32_t>(levels.size()));
+    for (const std::vector<peak_bin>& bins : levels) {
+        write_value(static_cast<std::uint64_t>(bins.size()));
+        cache_file.write(reinterpret_cast<const byte*>(bins.data()), static_cast<std::streamsize>(bins.size() * sizeof(peak_bin)));
+    }
+    
+    cache_file.close();
+    if (!cache_file)
+        return;
+        
+    std::filesystem::rename(temp_path, cache_path, error);
+}
+
+void engine::waveform::build(const music_t& music, const mix_kernels& kernels) {
+    std::size_t sample_size = music.is_duo_byte_sampled ? sizeof(std::int16_t) : 1;
+    std::size_t channels = music.frame_size / sample_size;
+    sample_rate = music.sample_rate;
+    frame_count = music.data_size / music.frame_size;
+    levels.assign(1, std::vector<peak_bin>());
+    levels[0].reserve(frame_count / WAVEFORM_BIN_FRAMES + 1);
+    
+    // compressed music is decoded, wav pcm is read as is from its file or the archive's mapping
+    music_decoder decoder;
+    std::ifstream wav_file;
+    if (music.codec != music_codec::wav)
+        decoder.open(music.full_path, music.codec, music.archived_data);
+    else if (music.archived_data.empty()) {
+        wav_file.open(music.full_path, std::ios::binary);
+        if (!wav_file.is_open())
+            throw std::filesystem::filesystem_error("audio::engine::waveform::build: Could not open " + music.full_path.string(), std::error_code());
+        wav_file.seekg(static_cast<std::streamoff>(music.data_start));
+    }
+    
+    std::vector<std::int16_t> samples(WAVEFORM_READ_BINS * WAVEFORM_BIN_FRAMES * channels);
+    std::vector<byte> data(music.archived_data.empty() ? samples.size() * sample_size : 0);
+    std::size_t frame = 0;
+    while (frame < frame_count) {
+        std::size_t frames = std::min(samples.size() / channels, frame_count - frame);
+        if (music.codec != music_codec::wav)
+            frames = decoder.read(samples.data(), frames);
+        else {
+            const byte* block = music.archived_data.data() + frame * music.frame_size;
+            if (music.archived_data.empty()) {
+                wav_file.read(data.data(), static_cast<std::streamsize>(frames * music.frame_size));
+                frames = static_cast<std::size_t>(wav_file.gcount()) / music.frame_size;
+                block = data.data();
+            }
+            
+            // 8 bit pcm is unsigned
+            if (music.is_duo_byte_sampled)
+                std::memcpy(samples.data(), block, frames * music.frame_size);
+            else {
+                for (std::size_t i = 0; i < frames * channels; i++)
+                    samples[i] = static_cast<std::int16_t>((static_cast<int>(static_cast<std::uint8_t>(block[i])) - 128) * 256);
+            }
+        }
+        if (frames == 0)
+            break;
+            
+        for (std::size_t bin_start = 0; bin_start < frames; bin_start += WAVEFORM_BIN_FRAMES) {
+            std::size_t bin_samples = std::min(WAVEFORM_BIN_FRAMES, frames - bin_start) * channels;
+            std::int16_t min = std::numeric_limits<std::int16_t>::max();
+            std::int16_t max = std::numeric_limits<std::int16_t>::min();
+            float sum_squares = kernels.peak(samples.data() + bin_start * channels, bin_samples, min, max);
+            float rms = std::min(std::sqrt(sum_squares / static_cast<float>(bin_samples)), 32767.0f);
+            levels[0].push_back({ min, max, static_cast<std::int16_t>(std::lround(rms)) });
+        }
+        frame += frames;
+    }
+    // a decoder can end short of the length its header promised
+    frame_count = frame;
+    
+    // every level above halves the one below, up to a single bin
+    while (levels.back().size() > 1) {
+        std::vector<peak_bin> upper((levels.back().size() + 1) / 2);
+        std::span<const peak_bin> lower = levels.back();
+        for (std::size_t i = 0; i < upper.size(); i++)
+            upper[i] = merge(lower.subspan(2 * i, std::min<std::size_t>(2, lower.size() - 2 * i)));
+        levels.push_back(std::move(upper));
+    }
+}
+
+std::size_t engine::waveform::read(double start_time, double end_time, std::span<waveform_peak> peaks) const {
+    if (peaks.empty())
+        return 0;
+        
+    // the coarsest level whose bins are no wider than a peak, so a peak merges at most 3 bins
+    double frames_per_peak = (end_time - start_time) * sample_rate / static_cast<double>(peaks.size());
+    std::size_t level = 0;
+    while (level + 1 < levels.size() && static_cast<double>(WAVEFORM_BIN_FRAMES << (level + 1)) <= frames_per_peak)
+        level++;
+        
+    const std::vector<peak_bin>& bins = levels[level];
+    double bin_frames = static_cast<double>(WAVEFORM_BIN_FRAMES << level);
+    double start_frame = start_time * sample_rate;
+    std::size_t merged_bins = 0;
+    for (std::size_t i = 0; i < peaks.size(); i++) {
+        // the bins the slice overlaps, at least the one it starts in when it's narrower than a bin
+        double slice_start = (start_frame + static_cast<double>(i) * frames_per_peak) / bin_frames;
+        double slice_end = (start_frame + static_cast<double>(i + 1) * frames_per_peak) / bin_frames;
+        std::int64_t first_bin = static_cast<std::int64_t>(std::floor(slice_start));
+        std::int64_t last_bin = std::max(first_bin, static_cast<std::int64_t>(std::ceil(slice_end)) - 1);
+        first_bin = std::max<std::int64_t>(first_bin, 0);
+        last_bin = std::min<std::int64_t>(last_bin, static_cast<std::int64_t>(bins.size()) - 1);
+        if (first_bin > last_bin) {
+            peaks[i] = { 0.0f, 0.0f, 0.0f };
+            continue;
+        }
+        
+        peak_bin merged = merge(std::span<const peak_bin>(bins).subspan(first_bin, last_bin - first_bin + 1));
+        peaks[i] = { merged.min / 32768.0f, merged.max / 32768.0f, merged.rms / 32768.0f };
+        merged_bins += static_cast<std::size_t>(last_bin - first_bin + 1);
+    }
+    return merged_bins;
+}
+
+engine::peak_bin engine::waveform::merge(std::span<const peak_bin> bins) {
+    peak_bin merged = bins[0];
+    float sum_squares = 0.0f;
+    for (const peak_bin& bin : bins) {
+        merged.min = std::min(merged.min, bin.min);
+        merged.max = std::max(merged.max, bin.max);
+        sum_squares += static_cast<float>(bin.rms) * static_cast<float>(bin.rms);
+    }
+    merged.rms = static_cast<std::int16_t>(std::lround(std::sqrt(sum_squares / static_cast<float>(bins.size()))));
+    return merged;
+}
+
 // ------------------------------------------------------------------- //
-// ENGINE::SFX_BUFFERS
+// ENGINE::ASSET_ARCHIVE
 
-engine::sfx_buffers::sfx_buffers(ALuint _source_id, ALuint _buffer_id) :
-    source_id(_source_id),
-    buffer_id(_buffer_id)
+/* Layout: "KEEA", u32 version, u64 entry count, then per entry
+ * u8 is sfx, u8 codec, u32 name length, name, i32 sample rate, i32 format,
+ * u64 blob offset, u64 data size, u64 blob size, f32 duration.
+ * Blobs follow, each aligned to ARCHIVE_ALIGNMENT: 16 bit pcm for wav assets, the whole file for compressed music.
+ * Little endian throughout, so pcm is used straight from the mapping.
+ */
+
+engine::asset_archive::asset_archive() :
+    mapping(nullptr),
+    mapping_size(0)
 { }
 
-ALuint engine::sfx_buffers::get_source_id() const {
-    return source_id;
+engine::asset_archive::~asset_archive() {
+#ifdef KEE_AUDIO_USE_MMAP
+    if (mapping != nullptr)
+        munmap(mapping, mapping_size);
+#endif
+}
+
+bool engine::asset_archive::open(const std::filesystem::path& _archive_path) {
+    if constexpr (std::endian::native != std::endian::little)
+        return false;
+        
+    archive_path = _archive_path;
+    std::error_code error;
+    std::size_t archive_size = static_cast<std::size_t>(std::filesystem::file_size(archive_path, error));
+    if (error)
+        return false;
+        
+    const byte* data = nullptr;
+#ifdef KEE_AUDIO_USE_MMAP
+    int fd = ::open(archive_path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+        
+    void* map = mmap(nullptr, archive_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+        
+    mapping = map;
+    mapping_size = archive_size;
+    data = static_cast<const byte*>(map);
+#else
+    std::ifstream archive_file(archive_path, std::ios::binary);
+    archive_data.resize(archive_size);
+    if (!archive_file.read(archive_data.data(), archive_size))
+        return false;
+    data = archive_data.data();
+#endif
+
+    std::size_t position = 0;
+    const auto read_value = [data, archive_size, &position](auto& value) -> bool {
+        if (archive_size - position < sizeof(value))
+            return false;
+        std::memcpy(&value, data + position, sizeof(value));
+        position += sizeof(value);
+        return true;
+    };
+    
+    std::uint32_t version = 0;
+    std::uint64_t entry_count = 0;
+    if (archive_size < 4 || std::strncmp(data, "KEEA", 4) != 0)
+        throw std::filesystem::filesystem_error("audio::engine::asset_archive::open: Not an asset archive", archive_path, std::error_code());
+    position = 4;
+    if (!read_value(version) || version != ARCHIVE_VERSION || !read_value(entry_count))
+        throw std::filesystem::filesystem_error("audio::engine::asset_archive::open: Unsupported archive version, repack the assets", archive_path, std::error_code());
+        
+    entries.clear();
+    for (std::uint64_t i = 0; i < entry_count; i++) {
+        std::uint8_t is_sfx = 0;
+        std::uint8_t codec = 0;
+        std::uint32_t name_size = 0;
+        std::int32_t sample_rate = 0;
+        std::int32_t format = 0;
+        std::uint64_t blob_offset = 0;
+        std::uint64_t data_size = 0;
+        std::uint64_t blob_size = 0;
+        float duration = 0.0f;
+        
+        bool is_read = read_value(is_sfx) && read_value(codec) && read_value(name_size) && archive_size - position >= name_size;
+        std::string name = is_read ? std::string(data + position, name_size) : std::string();
+        position += is_read ? name_size : 0;
+        is_read = is_read && read_value(sample_rate) && read_value(format) && read_value(blob_offset)
+            && read_value(data_size) && read_value(blob_size) && read_value(duration);
+        if (!is_read || blob_offset > archive_size || blob_size > archive_size - blob_offset)
+            throw std::filesystem::filesystem_error("audio::engine::asset_archive::open: Archive is truncated", archive_path, std::error_code());
+            
+        wav header = std::make_tuple(sample_rate, format, static_cast<std::size_t>(blob_offset), static_cast<std::size_t>(data_size), duration);
+        entries.push_back({ std::move(name), is_sfx != 0, static_cast<music_codec>(codec), header, static_cast<std::size_t>(blob_size) });
+    }
+    return true;
 }
 
-const ALuint* engine::sfx_buffers::get_source_id_addr() const {
-    return &source_id;
+std::span<const engine::byte> engine::asset_archive::get_blob(const entry& asset) const {
+    const byte* data = mapping != nullptr ? static_cast<const byte*>(mapping) : archive_data.data();
+    return std::span<const byte>(data + std::get<2>(asset.header), asset.blob_size);
 }
 
-const ALuint* engine::sfx_buffers::get_buffer_id_addr() const {
-    return &buffer_id;
+// ------------------------------------------------------------------- //
+// ENGINE::SFX_T
+
+engine::sfx_t::sfx_t(const std::filesystem::path& _full_path, int _sample_rate, ALenum _format, std::size_t _data_start, std::size_t _data_size, std::span<const byte> _archived_data) :
+    full_path(_full_path),
+    sample_rate(_sample_rate),
+    format(_format),
+    data_start(_data_start),
+    data_size(_data_size),
+    archived_data(_archived_data),
+    is_resident(false),
+    resident_bytes(0),
+    buffer_id(0),
+    mix_channels(format == AL_FORMAT_STEREO8 || format == AL_FORMAT_STEREO16 ? 2 : 1),
+    playing_voices(0),
+    lru_prev(nullptr),
+    lru_next(nullptr)
+{ }
+
+std::vector<engine::byte> engine::sfx_t::read_data() const {
+    std::ifstream sfx_file = open_wav(full_path);
+    std::vector<byte> sfx_data(data_size);
+    sfx_file.seekg(data_start);
+    if (!sfx_file.read(sfx_data.data(), data_size))
+        throw std::filesystem::filesystem_error("audio::engine::sfx_t::read_data: Could not read sfx data", std::error_code());
+        
+    return sfx_data;
 }
 
 // ------------------------------------------------------------------- //
 // ENGINE::MUSIC_T
 
-engine::music_t::music_t(int _sample_rate, ALenum _format, std::size_t _data_start, std::size_t _data_size, float _duration) :
+engine::music_t::music_t(const std::filesystem::path& _full_path, music_codec _codec, int _sample_rate, ALenum _format, std::size_t _data_start, std::size_t _data_size, float _duration, std::span<const byte> _archived_data) :
+    full_path(_full_path),
+    codec(_codec),
     sample_rate(_sample_rate),
     format(_format),
     data_start(_data_start),
     data_size(_data_size),
     duration(_duration),
-    is_duo_byte_sampled(format == AL_FORMAT_MONO16 || format == AL_FORMAT_STEREO16)
+    is_duo_byte_sampled(format == AL_FORMAT_MONO16 || format == AL_FORMAT_STEREO16),
+    frame_size(get_frame_size(format)),
+    archived_data(_archived_data)
 { }
 
 } // namespace audio
@@ -1,43 +1,377 @@
 #pragma once
 #include <array>
+#include <vector>
+#include <filesystem>
 #include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <optional>
+#include <future>
+#include <memory>
+#include <bit>
+#include <deque>
+#include <span>
+#include <string_view>
+#include <limits>
 #include <AL/al.h>
 #include <AL/alc.h>
+#include <AL/alext.h>
 
 namespace audio {
 
 class engine {
 public:
-    static void init();
-    /* Engine automatically deinits via destructor.
-     * w/o this, engine only inits on the first static call of this engine.
-     * use this function to init whenever you'd like
+    enum class simd_level {
+        scalar,
+        sse2,
+        avx2
+    };
+
+    static constexpr std::size_t MAX_MUSIC_PLAYERS = 16;
+    static constexpr std::size_t MAX_BUSES = 16;
+
+    struct config {
+        bool use_software_mixer = false;
+        simd_level max_simd_level = simd_level::avx2;
+        std::size_t music_player_count = 4;
+        std::size_t music_buffer_count = 4;
+        std::size_t music_max_buffer_count = 16;
+        std::size_t music_buffer_size = 65536;
+        bool use_loopback = false;
+        int loopback_sample_rate = 48000;
+        std::vector<std::string> bus_names = { "default" };
+    };
+    /* use_software_mixer - sfx are mixed by the engine into one streamed source instead of
+     *                      taking an OpenAL source each, allowing hundreds of voices
+     * max_simd_level     - caps the mixer kernels, the best level the cpu supports is used up to it
+     * music_player_count - 1 to MAX_MUSIC_PLAYERS
+     * music_buffer_count - buffers queued per music player, at least 2
+     * music_max_buffer_count - how many buffers a player may grow to when refills come close to missing, at least
+     *                      music_buffer_count. It bounds the memory of each player and the time a seek spends refilling.
+     *                      Players shrink back towards music_buffer_count while their queue stays comfortably ahead
+     * music_buffer_size  - bytes per music buffer, a multiple of 8 of at least 4096.
+     *                      more or bigger buffers ride out longer stalls at the cost of memory
+     * use_loopback       - renders offline through ALC_SOFT_loopback instead of opening an output device, see render
+     * bus_names          - 1 to MAX_BUSES distinct names, sfx and music players start on the first bus
      */
 
-    static float get_volume();
-    static void set_volume(float new_volume);
+    engine();
+    explicit engine(const config& engine_config);
+    ~engine();
+    engine(const engine&) = delete;
+    engine& operator=(const engine&) = delete;
+    /* Opens the output device (or a loopback device) and loads the assets, the destructor stops everything and closes it.
+     * OpenAL has one current context per process, so one engine can be alive at a time, constructing another throws std::logic_error.
+     * Handles, futures and calls from other threads must not outlive the engine.
+     */
+    
+    static void pack_assets(const std::filesystem::path& archive_path, int sample_rate = 48000);
+    /* Packs assets/sfx/ and assets/music/ into one archive, wav assets normalized to 16 bit at sample_rate.
+     * Doesn't need an engine. An engine that finds an archive at assets/assets.keea loads every asset
+     * from it instead of the directories: the archive is mapped once, sfx are uploaded or mixed straight
+     * from the mapping and music streams from it. Without mmap the archive is read into memory at init.
+     */
+
+    void render(std::int16_t* out, std::size_t frames);
+    void render_wav(const std::filesystem::path& wav_path, double duration);
+    /* Loopback only. The engine has no output device and no thread of its own, render runs the engine's updates
+     * and renders frames of interleaved 16 bit stereo at loopback_sample_rate into out, as fast as the cpu allows.
+     * Time in the engine (audio clocks, crossfades, scheduled sfx) only moves with rendered frames,
+     * so the same calls render the same output. render_wav renders duration seconds into a wav file.
+     * render takes the place of the engine's thread, call it from one thread at a time.
+     */
+
+    float get_volume() const;
+    void set_volume(float new_volume);
+    
+    struct sfx_id {
+        std::uint32_t index;
+    };
+    
+    struct music_id {
+        std::uint32_t index;
+    };
+    
+    struct asset_key {
+        std::uint64_t hash;
+        
+        constexpr explicit asset_key(std::string_view file_name) :
+            hash(0xCBF29CE484222325)
+        {
+            for (char c : file_name) {
+                hash ^= static_cast<std::uint8_t>(c);
+                hash *= 0x100000001B3;
+            }
+        }
+    };
+    
+    struct bus_id {
+        std::uint32_t index;
+    };
+    
+    bus_id lookup_bus(std::string_view bus_name) const;
+    void set_bus_gain(bus_id bus, float gain);
+    float get_bus_gain(bus_id bus) const;
+    void pause_bus(bus_id bus);
+    void unpause_bus(bus_id bus);
+    bool is_bus_paused(bus_id bus) const;
+    void set_player_bus(bus_id bus, std::size_t index = 0);
+    /* Every sfx plays on a bus, given when it's played, and scales its gain by the bus's gain.
+     * With the software mixer a bus change is one atomic store, picked up by the next mixed block.
+     * Sfx on a paused bus keep their place (and their voice) until it's unpaused.
+     * OpenAL sources on the bus take one deferred batch of gain updates, or one vector pause/play call.
+     * Music players follow their bus's gain, but pause with pause_music_player.
+     */
+    
+    sfx_id lookup_sfx(std::string_view sfx_file_name) const;
+    sfx_id lookup_sfx(asset_key key) const;
+    music_id lookup_music(std::string_view music_file_name) const;
+    music_id lookup_music(asset_key key) const;
+    /* Resolves a file name once, for the calls that take an id instead: they index an array rather than hash the name.
+     * asset_key hashes a name at compile time (64 bit FNV-1a), so static constexpr asset_key HIT("hit.wav")
+     * can be looked up without keeping the string around. Ids stay valid while the engine runs.
+     * Both throw std::out_of_range for names that aren't assets.
+     */
+    
+    enum class sfx_pool_policy {
+        steal_oldest,
+        refuse
+    };
+    /* steal_oldest - an exhausted pool stops its longest playing sfx and reuses its source
+     * refuse       - an exhausted pool drops the new sfx, play_sfx returns an empty handle
+     */
+    
+    struct sfx_pool_stats {
+        std::size_t capacity;
+        std::size_t active;
+        std::size_t peak_active;
+        std::size_t steals;
+        std::size_t refusals;
+    };
     
-    static void play_sfx(const std::string& sfx_file_name);
-    static void pause_sfx_mixer();
-    static void unpause_sfx_mixer();
-    static void stop_sfx_mixer();
+    struct sfx_handle {
+        std::uint32_t index = std::numeric_limits<std::uint32_t>::max();
+        std::uint32_t generation = 0;
+        
+        explicit operator bool() const { return index != std::numeric_limits<std::uint32_t>::max(); }
+    };
+    /* Names one play of an sfx. Its voice is reused once the sfx ends, is stopped or is stolen,
+     * the voice's generation moves on then and calls with the old handle do nothing. An empty handle is false.
+     */
+    
+    sfx_handle play_sfx(sfx_id id, float gain = 1.0f, float pan = 0.0f, bus_id bus = { 0 });
+    sfx_handle play_sfx(std::string_view sfx_file_name, float gain = 1.0f, float pan = 0.0f, bus_id bus = { 0 });
+    // pan ranges from -1.0 (left) to 1.0 (right)
+    sfx_handle schedule_sfx(sfx_id id, double audio_time, std::size_t player_index = 0, float gain = 1.0f, float pan = 0.0f, bus_id bus = { 0 });
+    sfx_handle schedule_sfx(std::string_view sfx_file_name, double audio_time, std::size_t player_index = 0, float gain = 1.0f, float pan = 0.0f, bus_id bus = { 0 });
+    /* Starts the sfx once player_index's music reaches audio_time, in the seconds of get_playback_time.
+     * The software mixer places it on the exact sample, and so do OpenAL sources with AL_SOFT_source_start_delay.
+     * Without it the start is as accurate as the engine's thread wakes up, about a millisecond.
+     * Scheduled sfx wait while their player is paused, and start right away once their time has passed.
+     * The voice is taken when scheduling, so it returns an empty handle like play_sfx when the pool refuses it.
+     */
+    void set_sfx_gain(sfx_handle handle, float gain);
+    void set_sfx_pan(sfx_handle handle, float pan);
+    void set_sfx_pitch(sfx_handle handle, float pitch);
+    void stop_sfx(sfx_handle handle);
+    bool is_sfx_playing(sfx_handle handle) const;
+    /* Handle calls go straight to the handle's voice, without a map lookup or the engine's sfx lock,
+     * so they can be made from any thread. They apply to batched and scheduled sfx before they start too.
+     * pitch scales the playback rate (1.0 is unchanged), the software mixer interpolates pitched voices linearly.
+     * is_sfx_playing is true from play_sfx until the sfx ends, is stopped or is stolen.
+     */
+    void begin_sfx_batch();
+    void end_sfx_batch();
+    /* play_sfx calls between these are started together by end_sfx_batch, in one submission that takes
+     * effect atomically. Wrap a frame's worth of play_sfx with them. Batches don't nest.
+     */
+    void pause_sfx_mixer();
+    void unpause_sfx_mixer();
+    void stop_sfx_mixer();
+    
+    void set_sfx_pool_policy(sfx_pool_policy policy);
+    sfx_pool_stats get_sfx_pool_stats();
+    
+    struct sfx_cache_stats {
+        std::size_t budget_bytes;
+        std::size_t resident_bytes;
+        std::size_t resident_count;
+        std::size_t hits;
+        std::size_t misses;
+        std::size_t evictions;
+    };
+    
+    void preload_sfx(const std::vector<std::string>& sfx_file_names);
+    std::future<void> prefetch_sfx(std::vector<std::string> sfx_file_names);
+    void set_sfx_memory_budget(std::size_t budget_bytes);
+    sfx_cache_stats get_sfx_cache_stats();
+    
+    simd_level get_mixer_simd_level() const;
+    /* sfx are read from disk on first play, or ahead of time with preload_sfx/prefetch_sfx.
+     * prefetch_sfx loads them on the engine's loader thread, behind the prefetches posted before it.
+     * Once resident sfx exceed the budget, the least recently used sfx that aren't playing are evicted.
+     * Playing sfx are never evicted, so the budget can be exceeded while they play.
+     */
+    
+    std::size_t get_music_player_count() const;
+    
+    void set_player_music(music_id id, std::size_t index = 0);
+    void set_player_music(std::string_view music_file_name, std::size_t index = 0);
+    std::future<void> set_player_music_async(music_id id, std::size_t index = 0);
+    std::future<void> set_player_music_async(std::string_view music_file_name, std::size_t index = 0);
+    void unset_player_music(std::size_t index = 0);
+    void queue_player_music(music_id id, std::size_t index = 0);
+    void queue_player_music(std::string_view music_file_name, std::size_t index = 0);
+    /* queued music plays after the player's current music (and whatever was queued before it).
+     * Music with the same format and sample rate follows without a gap, other music starts once the player runs dry.
+     * set_player_music and unset_player_music clear the queue.
+     */
+    
+    void play_music_player(std::size_t index = 0);
+    void pause_music_player(std::size_t index = 0);
+    bool is_music_playing(std::size_t index = 0) const;
+    
+    void crossfade_music_players(std::size_t from_index, std::size_t to_index, float fade_duration, double start_time = -1.0);
+    /* Starts to_index once from_index's audio clock reaches start_time (right away when negative),
+     * then fades from_index out and to_index in over fade_duration seconds, and pauses from_index.
+     * to_index starts on the sample where OpenAL has AL_SOFT_source_start_delay, and both fades are applied to the
+     * music as it is buffered. A player already playing the audio its fade covers (to_index playing, or start_time
+     * within what from_index has queued) has its gain stepped every 5 ms of the device clock instead.
+     */
     
-    static void set_player_music(const std::string& music_file_name, std::size_t index = 0);
-    static void unset_player_music(std::size_t index = 0);
+    float get_music_duration(music_id id) const;
+    float get_music_duration(std::string_view music_file_name) const;
+    
+    struct waveform_peak {
+        float min;
+        float max;
+        float rms;
+    };
+    
+    void preload_waveforms(const std::vector<std::string>& music_file_names = {});
+    std::future<void> prefetch_waveforms(std::vector<std::string> music_file_names = {});
+    void get_waveform(music_id id, double start_time, double end_time, std::span<waveform_peak> peaks);
+    void get_waveform(std::string_view music_file_name, double start_time, double end_time, std::span<waveform_peak> peaks);
+    void release_waveforms();
+    /* A music's waveform is a pyramid of min/max/rms peaks (-1.0 to 1.0, over all channels) made in one pass over
+     * its pcm, cached in WAVEFORM_DIRECTORY and kept in memory once loaded. preload_waveforms loads or builds the
+     * named music's (all music when empty) in parallel, prefetch_waveforms does the same from the engine's loader
+     * thread, behind the prefetches posted before it. get_waveform loads a missing one first.
+     * get_waveform fills every peak with an equal slice of start_time to end_time (seconds) from the pyramid level
+     * closest to that slice, so it costs the same at any zoom and never reads the pcm once the waveform is loaded.
+     * Slices past the end of the music are silent. release_waveforms drops the loaded waveforms, not their cache.
+     */
+    void set_playback_time(float time, std::size_t index = 0);
+    std::future<void> set_playback_time_async(float time, std::size_t index = 0);
+    /* Both setters only post to the engine's thread. The async versions also return a future that is ready
+     * once the new music or position is buffered.
+     * A playing player keeps playing from where it was until the new position is buffered, then carries on from it.
+     * Seeks and music changes on one player that pile up faster than the engine's thread drains them are coalesced:
+     * only the last does any I/O, the futures of the superseded ones are ready right away.
+     */
+    
+    double get_playback_time(std::size_t index = 0) const;
+    double get_audio_clock(std::size_t index = 0) const;
+    /* Both return seconds into the player's music, 0 when no music is set.
+     * get_playback_time asks OpenAL where the player is. It is sample accurate, and compensates
+     * for device latency when AL_SOFT_source_latency is available.
+     * get_audio_clock touches neither OpenAL nor a lock, so it is cheap to poll every frame.
+     * It extrapolates from the position last published by the engine's thread, never runs
+     * backwards while the player plays, and only jumps on set_player_music/set_playback_time.
+     */
+    
+    enum class filter_type {
+        none,
+        low_pass,
+        high_pass,
+        band_pass
+    };
+    
+    void set_player_filter(filter_type type, float cutoff, float q = 0.7071f, std::size_t index = 0);
+    void set_player_reverb(float wet, float room_size = 0.5f, float damping = 0.5f, std::size_t index = 0);
+    void set_player_tempo(float tempo, std::size_t index = 0);
+    void set_bus_filter(bus_id bus, filter_type type, float cutoff, float q = 0.7071f);
+    void set_bus_reverb(bus_id bus, float wet, float room_size = 0.5f, float damping = 0.5f);
+    /* Every music player and bus has an effect chain, a biquad filter into a reverb, both off to begin with.
+     * cutoff is in Hz. wet, room_size and damping range from 0.0 to 1.0, a wet of 0.0 turns the reverb off.
+     * The setters only store the new values, the chain glides to them over about 20 ms.
+     * A player's chain runs as its buffers are filled, so a change is heard once the buffers queued before it played.
+     * A bus's chain runs on its sfx as they're mixed, which needs the software mixer (std::logic_error otherwise). Music players skip it.
+     * set_player_tempo (0.5 to 2.0) changes speed without changing pitch. The queue is rebuilt from where the player
+     * is heard, like a seek. Playback time and the audio clock stay in seconds of the music and run at the tempo.
+     * 8 bit music plays as is.
+     */
     
-    static void play_music_player(std::size_t index = 0);
-    static void pause_music_player(std::size_t index = 0);
-    static bool is_music_playing(std::size_t index = 0);
+    static constexpr std::size_t METRIC_BUCKET_COUNT = 16;
     
-    static float get_music_duration(const std::string& music_file_name);
-    static void set_playback_time(float time, std::size_t index = 0);
+    struct latency_histogram {
+        std::array<std::uint64_t, METRIC_BUCKET_COUNT> buckets;
+        std::uint64_t count;
+        std::uint64_t total_ns;
+        std::uint64_t max_ns;
+    };
+    // bucket i counts durations under 2^(10 + i) ns (1 us, 2 us, ... 16 ms), the last bucket everything longer
+    
+    struct metrics_snapshot {
+        latency_histogram play_sfx_latency;
+        latency_histogram sfx_start_latency;
+        latency_histogram polling_loop_time;
+        latency_histogram music_refill_time;
+        latency_histogram music_buffer_fill_time;
+        latency_histogram sfx_mixer_lock_wait;
+        latency_histogram al_error_check_time;
+        latency_histogram render_time;
+        latency_histogram filter_block_time;
+        latency_histogram reverb_block_time;
+        latency_histogram tempo_block_time;
+        std::uint64_t rendered_frames;
+        std::array<std::uint64_t, MAX_MUSIC_PLAYERS> bytes_streamed;
+        std::array<std::uint64_t, MAX_MUSIC_PLAYERS> starvations;
+        std::array<std::uint64_t, MAX_MUSIC_PLAYERS> near_starvations;
+        std::array<std::uint64_t, MAX_MUSIC_PLAYERS> music_buffer_counts;
+        std::uint64_t music_command_spills;
+        std::uint64_t live_voices;
+        std::uint64_t peak_voices;
+        std::uint64_t startup_ns;
+        std::uint64_t asset_count;
+    };
+    /* play_sfx_latency       - whole play_sfx calls
+     * sfx_start_latency      - from a play_sfx call to its source starting, or to its first mixed block with the software mixer.
+     *                          batched sfx count their wait for end_sfx_batch, scheduled sfx aren't counted
+     * polling_loop_time      - one pass of the engine's thread, not counting its sleep
+     * music_refill_time      - refilling the processed buffers of one music player
+     * music_buffer_fill_time - reading (or decoding) and uploading one music buffer of music_buffer_size bytes
+     * sfx_mixer_lock_wait    - time spent waiting on the sfx lock by play_sfx and the engine's thread
+     * al_error_check_time    - every OpenAL error check
+     * render_time            - whole render calls, over rendered_frames it gives the loopback render speed
+     * filter_block_time      - one block (a music buffer or a mixer block) through a chain's filter,
+     * reverb_block_time        through its reverb, and one music buffer through the time stretch
+     * tempo_block_time
+     * starvations            - times a music player ran dry before the end of its music, it's refilled and played again
+     * near_starvations       - refills that found only the playing buffer left, each one grows the player's queue
+     * music_buffer_counts    - the buffers each music player has right now. reset_metrics keeps it
+     * music_command_spills   - music player calls posted while the command queue was full, they wait under a lock instead
+     * startup_ns             - the engine's init, asset_count assets loaded during it. reset_metrics keeps both
+     */
+    
+    bool get_metrics(metrics_snapshot& snapshot) const;
+    void reset_metrics();
+    static std::string metrics_to_json(const metrics_snapshot& snapshot);
+    /* Metrics are compiled in with KEE_AUDIO_ENABLE_METRICS, get_metrics returns false and a
+     * zeroed snapshot without it. Counters are relaxed atomics, so get_metrics neither locks nor
+     * allocates and can be polled every frame, but fields of one snapshot may be a few events apart.
+     * metrics_to_json writes a snapshot as one JSON object with the field names above, to keep across runs or releases.
+     */
 
 private:
+    friend class test_access;
+    // the tests reach the engine's internals through it, see KEE_AUDIO_ENABLE_TEST_HOOKS
+    
     using byte = char;
     using wav = std::tuple<int, ALenum, std::size_t, std::size_t, float>;
     /* int          - sample rate
@@ -46,82 +380,1040 @@ private:
      * std::size_t  - data size
      * float        - wav duration in seconds
      */
+    
+    enum class music_codec {
+        wav,
+        vorbis,
+        flac
+    };
+    /* Compressed music reuses the wav tuple with a data start of 0 and the size of the decoded
+     * 16 bit pcm as data size, so cursors and buffer math are the same for every codec.
+     */
+    
+    class wav_encoding {
+    public:
+        int channels;
+        int bits_per_sample;
+        bool is_float;
+    };
+    // what load_wav found in the fmt chunk, the wav tuple of an encoding OpenAL can't take has AL_NONE as format
 
     class sfx_t;
-    class sfx_buffers;
     class music_t;
+    class engine_metrics;
+    using sfx_entry = std::pair<const std::string, sfx_t>;
+    using music_entry = std::pair<const std::string, music_t>;
+    class asset_index {
+    public:
+        class entry {
+        public:
+            std::uintmax_t file_size;
+            std::int64_t modified_time;
+            wav header;
+            std::string normalized_path;
+        };
+        
+        void load(const std::filesystem::path& index_path);
+        void save(const std::filesystem::path& index_path) const;
+        
+        std::unordered_map<std::string, entry> entries;
+        /* keyed by asset path, an entry is only trusted while its file size and modified time match.
+         * normalized_path is the asset's converted copy (and header the copy's), empty when the asset is used as is.
+         */
+    };
+    
+    class asset_archive {
+    public:
+        class entry {
+        public:
+            std::string name;
+            bool is_sfx;
+            music_codec codec;
+            wav header;
+            std::size_t blob_size;
+        };
+        // header's data start is the blob's offset in the archive, blob_size differs from its data size only for compressed music
+        
+        asset_archive();
+        ~asset_archive();
+        asset_archive(const asset_archive&) = delete;
+        asset_archive& operator=(const asset_archive&) = delete;
+        
+        bool open(const std::filesystem::path& _archive_path);
+        // false when there is no (readable) archive at archive_path
+        std::span<const byte> get_blob(const entry& asset) const;
+        
+        std::filesystem::path archive_path;
+        std::vector<entry> entries;
+        
+    private:
+        void* mapping;
+        std::size_t mapping_size;
+        std::vector<byte> archive_data;
+        // archive_data holds the whole archive where it can't be mapped
+    };
+    
+    class sfx_voice {
+    public:
+        sfx_voice();
+        
+        ALuint source_id;
+        sfx_t* sfx;
+        std::size_t bus;
+        std::size_t active_prev;
+        std::size_t active_next;
+        /* null sfx means this voice is in the free list.
+         * active_prev and active_next link the active list, NO_SFX_VOICE at either end.
+         */
+        
+        std::mutex control_lock;
+        std::atomic<std::uint32_t> generation;
+        std::atomic_bool is_stop_requested;
+        float gain;
+        float pan;
+        std::atomic<float> pitch;
+        /* Handle calls take control_lock and check generation, which only moves (under control_lock) when the voice is freed.
+         * gain and pan are guarded by control_lock. is_stop_requested is carried out by the engine's thread.
+         */
+        
+        std::chrono::steady_clock::time_point trigger_time;
+        // when play_sfx was called for the voice's sfx, for sfx_start_latency. the epoch once recorded, or for scheduled sfx
+        
+        std::size_t frame_position;
+        double frame_fraction;
+        std::size_t start_delay;
+        std::atomic<float> left_gain;
+        std::atomic<float> right_gain;
+        /* software mixer only, source_id is 0 when mixing in software.
+         * frame_fraction is the position between frames of a pitched voice.
+         * start_delay is the frames of silence before the voice within the next mixed block.
+         */
+    };
+    
+    class scheduled_sfx {
+    public:
+        std::size_t voice_index;
+        std::size_t player_index;
+        double audio_time;
+        double onset_frames;
+        // onset_frames is scratch for the software mixer, infinite while the player isn't playing
+    };
+    
+    static constexpr std::size_t REVERB_LINE_COUNT = 8;
+    
+    class reverb_state {
+    public:
+        reverb_state();
+        
+        void resize(int _sample_rate);
+        void clear();
+        
+        std::vector<float> lines;
+        std::size_t mask;
+        std::size_t position;
+        std::array<std::size_t, REVERB_LINE_COUNT> delays;
+        std::array<float, REVERB_LINE_COUNT> lowpass;
+        int sample_rate;
+        /* A feedback delay network of REVERB_LINE_COUNT damped lines mixed through a householder matrix.
+         * lines holds one row of REVERB_LINE_COUNT samples per frame, so a frame's feedback is written at once,
+         * mask + 1 rows. Empty until the reverb is first used.
+         */
+    };
+    
+    class mix_kernels {
+    public:
+        using mix_function = void (*)(const std::int16_t* in, float* out, std::size_t frames, float left_gain, float right_gain);
+        using convert_function = void (*)(const float* in, std::int16_t* out, std::size_t samples);
+        using widen_function = void (*)(const std::int16_t* in, float* out, std::size_t samples);
+        using accumulate_function = void (*)(const float* in, float* out, std::size_t samples);
+        using dot_function = float (*)(const float* a, const float* b, std::size_t n);
+        using peak_function = float (*)(const std::int16_t* in, std::size_t samples, std::int16_t& min, std::int16_t& max);
+        using biquad_function = void (*)(float* samples, std::size_t frames, std::size_t channels, const float* coefficients, float* state, float mix);
+        using reverb_function = std::size_t (*)(float* samples, std::size_t frames, std::size_t channels, float* lines, std::size_t mask, std::size_t position,
+                                                const std::size_t* delays, float* lowpass, float feedback, float damping, float wet);
+        
+        static mix_kernels select(simd_level max_level);
+        
+        simd_level level;
+        mix_function mix_mono;
+        mix_function mix_stereo;
+        convert_function to_s16;
+        dot_function dot;
+        biquad_function biquad;
+        reverb_function reverb;
+        peak_function peak;
+        widen_function s16_to_f32;
+        accumulate_function accumulate;
+        /* mix_mono/mix_stereo convert int16 frames to float, apply per channel gain and add them
+         * into an interleaved stereo float accumulator.
+         * to_s16 converts the accumulator back, rounding to nearest and saturating.
+         * dot sums the products of n floats (a multiple of 8) in 8 lanes, for the resampler that normalizes assets
+         * and the time stretch's search.
+         * biquad filters 1 or 2 interleaved channels in place (transposed direct form II), coefficients are
+         * b0 b1 b2 a1 a2 over a0 and state is z1 of channels 0 and 1, then z2 of both. mix fades from the dry signal to the filtered one.
+         * reverb runs a reverb_state's network (passed apart) and adds wet times its output to 1 or 2 interleaved channels
+         * in place, it returns the position after the block.
+         * peak widens min and max to cover n int16 samples and returns the sum of their squares, summed in 8 lanes like dot.
+         * s16_to_f32 converts int16 samples to float as they are, for the music effects and the time stretch.
+         * accumulate adds samples into out, a bus mixed apart into the accumulator.
+         * Every level is bit exact with the scalar one (as long as the compiler doesn't contract into fma).
+         */
+    };
+    
+    class effect_chain {
+    public:
+        effect_chain();
+        
+        void set_filter(filter_type type, float cutoff, float q);
+        void set_reverb(float wet, float room_size, float damping);
+        bool is_active() const;
+        void process(float* samples, std::size_t frames, std::size_t channels, int sample_rate, const mix_kernels& kernels, engine_metrics& metrics);
+        void reset();
+        /* process runs the chain in place, in blocks of EFFECT_SMOOTHING_FRAMES while its values glide
+         * and in one block once they've settled, timing them into metrics. reset clears the filter's and reverb's memory after a jump.
+         */
+        
+        std::atomic<filter_type> filter;
+        std::atomic<float> filter_cutoff;
+        std::atomic<float> filter_q;
+        std::atomic<float> reverb_wet;
+        std::atomic<float> reverb_room_size;
+        std::atomic<float> reverb_damping;
+        // the values set by the public api, from any thread
+        
+        filter_type current_filter;
+        float filter_mix;
+        float current_cutoff;
+        float current_q;
+        std::array<float, 4> filter_state;
+        float current_wet;
+        float current_feedback;
+        float current_damping;
+        reverb_state reverb;
+        /* Only touched by whoever processes the chain, the engine's thread for a player or the mixer for a bus.
+         * A change of filter type fades filter_mix out, switches, and fades it back in.
+         */
+    };
+    
+    struct peak_bin {
+        std::int16_t min;
+        std::int16_t max;
+        std::int16_t rms;
+    };
+    
+    class waveform {
+    public:
+        waveform();
+        
+        bool load(const std::filesystem::path& cache_path, std::uintmax_t source_size, std::int64_t source_time, const music_t& music);
+        void save(const std::filesystem::path& cache_path, std::uintmax_t source_size, std::int64_t source_time, const music_t& music) const;
+        void build(const music_t& music, const mix_kernels& kernels);
+        std::size_t read(double start_time, double end_time, std::span<waveform_peak> peaks) const;
+        static peak_bin merge(std::span<const peak_bin> bins);
+        /* load only accepts a cache made from the same source file (size and modified time) and pcm range.
+         * build streams the pcm once in blocks of whole bins, decoding compressed music.
+         * read returns the number of bins it merged, at most 3 per peak whatever the range.
+         */
+        
+        int sample_rate;
+        std::size_t frame_count;
+        std::vector<std::vector<peak_bin>> levels;
+        // a bin of level i covers WAVEFORM_BIN_FRAMES << i frames, the last level is a single bin
+    };
+    
+    class music_decoder {
+    public:
+        music_decoder();
+        ~music_decoder();
+        music_decoder(const music_decoder&) = delete;
+        music_decoder& operator=(const music_decoder&) = delete;
+        
+        static music_codec get_codec(const std::filesystem::path& full_path);
+        static bool is_supported(music_codec codec);
+        static wav load_header(const std::filesystem::path& full_path, music_codec codec);
+        // is_supported is false for a codec compiled out, the engine leaves its music out of the assets
+        
+        void open(const std::filesystem::path& full_path, music_codec codec, std::span<const byte> archived_data);
+        void close();
+        std::size_t read(std::int16_t* out, std::size_t frames);
+        bool seek(std::size_t frame);
+        /* open decodes archived_data in memory when it isn't empty, full_path is only used for errors then.
+         * read returns the number of interleaved frames decoded, fewer than asked only at the end.
+         * seek goes through the codec's own seeking (page bisection for vorbis, the seek table
+         * for flac), so it lands on the exact frame.
+         */
+        
+    private:
+        music_codec codec;
+        void* handle;
+        std::size_t channels;
+    };
+    
+    class metric_histogram {
+    public:
+        void record(std::chrono::steady_clock::duration duration);
+        void read(latency_histogram& histogram) const;
+        void reset();
+    
+    private:
+        std::array<std::atomic<std::uint64_t>, METRIC_BUCKET_COUNT> buckets;
+        std::atomic<std::uint64_t> count;
+        std::atomic<std::uint64_t> total_ns;
+        std::atomic<std::uint64_t> max_ns;
+    };
+    
+    class metric_timer {
+    public:
+        metric_timer(metric_histogram& _histogram);
+        ~metric_timer();
+        
+        void stop();
+        // records the time since construction once, the destructor records it if stop wasn't called
+        
+    private:
+        metric_histogram* histogram;
+        std::chrono::steady_clock::time_point start;
+    };
+    
+    class engine_metrics {
+    public:
+        void record_voices(std::size_t live_voices);
+    
+        metric_histogram play_sfx_latency;
+        metric_histogram sfx_start_latency;
+        metric_histogram polling_loop_time;
+        metric_histogram music_refill_time;
+        metric_histogram music_buffer_fill_time;
+        metric_histogram sfx_mixer_lock_wait;
+        metric_histogram al_error_check_time;
+        metric_histogram render_time;
+        metric_histogram filter_block_time;
+        metric_histogram reverb_block_time;
+        metric_histogram tempo_block_time;
+        std::atomic<std::uint64_t> rendered_frames;
+        std::array<std::atomic<std::uint64_t>, MAX_MUSIC_PLAYERS> bytes_streamed;
+        std::array<std::atomic<std::uint64_t>, MAX_MUSIC_PLAYERS> starvations;
+        std::array<std::atomic<std::uint64_t>, MAX_MUSIC_PLAYERS> near_starvations;
+        std::array<std::atomic<std::uint64_t>, MAX_MUSIC_PLAYERS> music_buffer_counts;
+        std::atomic<std::uint64_t> music_command_spills;
+        std::atomic<std::uint64_t> live_voices;
+        std::atomic<std::uint64_t> peak_voices;
+        std::atomic<std::uint64_t> startup_ns;
+        std::atomic<std::uint64_t> asset_count;
+    };
+    
+    class music_stream {
+    public:
+        music_stream();
+        ~music_stream();
+        music_stream(const music_stream&) = delete;
+        music_stream& operator=(const music_stream&) = delete;
+        
+        void open(const std::string& full_path, const music_t& music, std::size_t _block_size);
+        void close();
+        const byte* read(std::size_t offset, std::size_t size);
+        void prefetch(std::size_t offset);
+        bool is_ready(std::size_t offset);
+        // prefetch starts bringing in data at offset without waiting, is_ready tells if a read there won't wait
+        /* offset is relative to the start of the wav data chunk (or the decoded pcm).
+         * The returned pointer is valid until the next read or close.
+         * Reads are at most block_size bytes.
+         */
+        
+        bool is_stalled(std::chrono::steady_clock::time_point now) const;
+    #ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+        void stall_reads(std::chrono::steady_clock::time_point until);
+        
+        static std::atomic_bool is_mapping_disabled;
+    #endif
+        /* Test hooks. Reads act as if the disk didn't answer until the engine's clock reaches until,
+         * refills are skipped meanwhile. is_stalled is always false without KEE_AUDIO_ENABLE_TEST_HOOKS.
+         * Loose files opened while is_mapping_disabled is set are read through ifstream, as without mmap.
+         */
+        
+    private:
+        static constexpr std::size_t DECODE_RING_SIZE = 8;
+    
+        class decoded_block {
+        public:
+            std::vector<byte> data;
+            std::size_t offset;
+            std::size_t size;
+        };
+        
+        const byte* read_decoded(std::size_t offset, std::size_t size);
+        void seek_decoder(std::size_t offset);
+        void advise_willneed(std::size_t offset);
+        void decode_worker();
+        
+        void* mapping;
+        std::size_t mapping_size;
+        const byte* mapped_data;
+        bool is_mapping_owned;
+        /* mapped_data points at the wav data chunk inside the mapping, null when not mapped.
+         * Archived music streams from the archive's mapping, which the stream doesn't own.
+         */
+        
+        std::ifstream file;
+        std::vector<byte> file_buffer;
+        std::size_t data_start;
+        // ifstream fallback for when the file cannot be mapped
+        
+        std::size_t block_size;
+        music_decoder decoder;
+        std::thread decode_thread;
+        std::mutex decode_lock;
+        std::condition_variable decode_cv;
+        std::array<decoded_block, DECODE_RING_SIZE> decode_ring;
+        std::size_t ring_head;
+        std::size_t ring_count;
+        bool is_head_in_use;
+        std::size_t decode_offset;
+        std::size_t decode_end;
+        std::size_t decode_frame_size;
+        std::uint64_t seek_generation;
+        bool is_seek_pending;
+        bool should_decode_close;
+        /* Compressed music is decoded by decode_thread into decode_ring ahead of the reader,
+         * block_size bytes per block. A read only takes a ready block, it never decodes.
+         * The block last returned by read stays out of the ring until the next read.
+         * seek_generation drops blocks the worker finished after a seek was requested.
+         */
+        
+        std::size_t next_offset;
+    #ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+        std::atomic<std::chrono::steady_clock::rep> stall_end;
+    #endif
+    };
+    
+    class audio_clock {
+    public:
+        audio_clock();
+        
+        void update(std::chrono::steady_clock::time_point now, double measured_time, double tempo, bool is_running, bool is_discontinuous);
+        // runs at tempo seconds of music per second
+        double get(std::chrono::steady_clock::time_point now) const;
+        // now is the engine's time, see get_engine_time
+        
+    private:
+        double get(std::int64_t now_ns) const;
+    
+        std::atomic<std::uint32_t> sequence;
+        std::atomic<double> anchor_time;
+        std::atomic<std::int64_t> anchor_ns;
+        std::atomic<double> rate;
+        /* Seqlock over a (time, steady_clock, rate) anchor, written by the polling thread only.
+         * A measured time close to the prediction is slewed into by adjusting rate instead of
+         * snapping to it, which keeps the clock monotonic.
+         */
+    };
+    
+    class time_stretch {
+    public:
+        time_stretch();
+        
+        void reset(std::size_t _channels, std::size_t start_frame);
+        std::size_t get_required_input_end() const;
+        void push_input(const std::int16_t* in, std::size_t frames, const mix_kernels& kernels);
+        void push_silence(std::size_t frames);
+        bool is_drained(std::size_t music_frames) const;
+        void stretch(float tempo, const mix_kernels& kernels);
+        std::size_t take_output(float* out, std::size_t frames, float tempo, double& nominal_start);
+        /* Waveform similarity overlap-add: every hop outputs STRETCH_WINDOW_FRAMES / 2 frames from a hann windowed
+         * segment picked within STRETCH_SEARCH_FRAMES of its nominal position, the one that best continues the previous.
+         * stretch needs input up to get_required_input_end, past the music's end it's padded with silence.
+         * take_output hands out up to frames pending frames and the nominal input frame of the first one,
+         * the rest follow tempo input frames per output frame.
+         */
+        
+        std::size_t channels;
+        std::vector<float> window;
+        std::vector<float> input;
+        std::size_t input_start;
+        std::vector<float> overlap;
+        std::vector<float> output;
+        double nominal;
+        double output_nominal;
+        std::size_t previous;
+        bool is_first_hop;
+        /* input holds frames from input_start on, trimmed behind the next search.
+         * nominal is where the next segment would start at an exact tempo, previous where the last one did start.
+         */
+    };
+    
+    class mix_bus {
+    public:
+        mix_bus();
+        
+        std::string name;
+        std::atomic<float> gain;
+        std::atomic_bool is_paused;
+        effect_chain effects;
+        // name is set at init, gain and is_paused are read by the mixer without a lock
+    };
+    
     class music_player {
     public:
+        class queued_buffer {
+        public:
+            ALuint buffer_id;
+            const music_entry* music;
+            std::uint64_t segment;
+            std::size_t offset;
+            ALsizei size;
+            std::size_t input_size;
+            float tempo;
+            // offset and input_size are in the music's data chunk, size is what the buffer holds after the time stretch
+        };
+    
         music_player();
         
-        void update_buffer_queue(const music_t& music);
+        void set_stream(const music_entry* music);
+        bool advance_stream();
+        void rewind_upcoming_music();
+        /* set_stream starts reading music from its beginning (null closes the stream).
+         * advance_stream moves the stream on to the next upcoming music if it can follow without a gap.
+         * rewind_upcoming_music puts music the stream already moved on to back in front of upcoming_music,
+         * before the queue is rebuilt from the heard music.
+         */
+        
+        void update_buffer_queue();
+        void clear_buffer_queue();
+        void fill_free_buffers();
+        ALsizei queue_buffer(ALuint buffer_id);
+        // returns the number of bytes queued, 0 when the stream is at its end and can't advance
+        ALsizei queue_stretched_buffer(ALuint buffer_id);
+        const byte* process_effects(const byte* data, std::size_t frames, std::size_t music_frame);
+        /* queue_stretched_buffer reads ahead of the stretch as far as its next hop needs.
+         * process_effects runs the player's chain and fade ramp over 16 bit pcm starting at music_frame,
+         * returning data untouched while neither changes it.
+         */
+        bool is_stretching() const;
+        bool has_stream_data() const;
+        float get_heard_tempo() const;
+        void get_heard_queue(std::size_t& queue_start, std::size_t& queue_end) const;
+        ALuint unqueue_buffer();
+        std::uint64_t get_heard_segment() const;
+        std::size_t rewind_to_heard_position();
+        // moves the stream back to where a source that isn't playing resumes, and returns that cursor
+        
+        bool update_buffer_depth(std::size_t spare_buffers);
+        bool grow_buffers();
+        void shrink_buffers();
+        /* update_buffer_depth is given how many buffers were still queued past the processed ones before a refill,
+         * and returns true for a near miss (only the playing buffer left), after which the player grows one buffer.
+         * Once spare_buffers stayed at 3 or more for MUSIC_BUFFER_SHRINK_INTERVAL, one free buffer is deleted.
+         * Depth stays between config::music_buffer_count and config::music_max_buffer_count.
+         */
+        
+        void begin_update();
+        void publish_snapshot(bool is_discontinuous);
+        double measure_playback_time(const music_t& music, std::size_t queue_start, std::size_t queue_end, float tempo) const;
+        // queue_start and queue_end are the data chunk offsets of the first and past the last queued byte of the heard music
+        std::optional<double> measure_mix_time(std::int64_t& clock_ns) const;
+        /* where the device's mixer is in the heard music (no latency compensation) and the device clock it was there at.
+         * nullopt unless the player is playing. Polling thread only.
+         */
 
+        void set_fade_gain(float gain);
+        // sets the source's gain to gain (the crossfade's) times its bus's gain
+        
+        class fade_ramp {
+        public:
+            std::uint64_t segment;
+            double start_frame;
+            double frames;
+            bool is_fade_in;
+            // start_frame is in segment's music, frames is the ramp's length in frames heard
+        };
+        
+        float get_ramp_gain(std::uint64_t segment, double music_frame, float frame_tempo) const;
+        bool is_ramped(double music_frame, std::size_t frames, float frame_tempo) const;
+        void apply_ramp(float* samples, std::size_t frames, std::size_t channels, double music_frame, float frame_tempo) const;
+        /* get_ramp_gain is the equal power gain of ramp at music_frame of segment, 1 without a ramp.
+         * Segments after the ramp's are past it. is_ramped and apply_ramp take frames of the stream from music_frame,
+         * frame_tempo music frames apart. is_ramped is false when the ramp's gain over all of them is 1.
+         */
+        
+        engine* owner;
         ALuint source_id;
-        std::string wav_key;
-        std::ifstream music_file;
+        std::size_t bus;
+        float fade_gain;
+        std::optional<fade_ramp> ramp;
+        float tempo;
+        effect_chain effects;
+        time_stretch stretch;
+        std::vector<std::int16_t> effect_pcm;
+        std::vector<float> effect_samples;
+        // effect_pcm and effect_samples are scratch for one buffer on its way through the stretch and the chain
+        std::size_t buffer_size;
+        std::vector<ALuint> buffer_ids;
+        std::vector<ALuint> free_buffers;
+        std::deque<queued_buffer> buffer_queue;
+        std::size_t queued_bytes;
+        // buffer_queue mirrors the source's queue, oldest buffer first
+        
+        const music_entry* heard_music;
+        const music_entry* stream_music;
+        std::uint64_t stream_segment;
+        music_stream music_file;
         std::size_t cursor;
-        std::array<ALuint, 4> buffer_ids;
-        // empty wav_key means no music file is set to this player
+        std::deque<const music_entry*> upcoming_music;
+        /* heard_music is the music heard right now, the one at the head of the queue. null means no music is set.
+         * stream_music is read into buffers at cursor, up to a queue ahead of heard_music.
+         * stream_segment changes whenever the stream moves on, which keeps the same music queued twice apart.
+         */
+        
+        std::atomic<std::uint32_t> update_sequence;
+        std::atomic<const music_t*> published_music;
+        std::atomic_bool published_is_playing;
+        std::atomic<std::size_t> published_queue_start;
+        std::atomic<std::size_t> published_cursor;
+        std::atomic<float> published_tempo;
+        audio_clock clock;
+        bool is_starved;
+        std::size_t low_spare_buffers;
+        std::chrono::steady_clock::time_point depth_window_start;
+        // the fewest spare buffers seen since depth_window_start, when the depth last changed or was checked
+        /* written by the polling thread only, read by the public api without locking.
+         * update_sequence is odd while the polling thread changes the source's queue.
+         * is_starved keeps one underrun from being counted on every pass, or a failed refill from retrying the count.
+         */
+        
+        bool is_seek_pending;
+        std::size_t pending_seek_cursor;
+        std::shared_ptr<std::promise<void>> pending_seek_completion;
+        bool is_play_deferred;
+        void finish_seek();
+        /* A seek on a playing player waits here for the stream to prefetch the new cursor,
+         * while the old queue keeps playing. finish_seek fulfils the completion and clears the seek.
+         * is_play_deferred is a play that found nothing queued within a batch of commands, a seek later in it starts the player.
+         */
     };
     
-    static constexpr std::size_t MUSIC_BUFFER_SIZE = 65536;
+    class music_crossfade {
+    public:
+        std::size_t from_index;
+        std::size_t to_index;
+        double start_time;
+        double duration;
+        bool is_started;
+        std::int64_t start_clock_ns;
+        bool is_from_ramped;
+        bool is_to_ramped;
+        /* start_time is on from_index's audio clock, start_clock_ns is the device clock the fade starts at.
+         * A ramped player has its fade in the buffers it queues, the others follow the device clock with their gain.
+         */
+    };
     
-    static void fetch_al_errors(const std::filesystem::path& file, int line);
-    static void fetch_alc_errors(ALCdevice* device, const std::filesystem::path& file, int line);
+    class music_command {
+    public:
+        enum class type {
+            set_music,
+            unset_music,
+            queue_music,
+            play,
+            pause,
+            set_playback_time,
+            crossfade,
+            set_bus,
+            set_tempo
+        };
+    
+        type command_type;
+        std::size_t index;
+        const music_entry* music;
+        float time;
+        std::size_t target_index = 0;
+        double start_time = 0.0;
+        std::shared_ptr<std::promise<void>> completion = nullptr;
+        /* music points into music_map, which never changes after init.
+         * crossfade fades index into target_index over time seconds, from start_time. set_bus moves index onto bus target_index, set_tempo sets index's tempo to time.
+         * completion, when set, is fulfilled once set_music or set_playback_time is buffered (or superseded).
+         */
+    };
+    
+    template <typename T, std::size_t CAPACITY>
+    class mpsc_queue {
+    public:
+        mpsc_queue();
+        
+        bool try_push(const T& item);
+        bool try_pop(T& item);
+        
+    private:
+        static_assert(std::has_single_bit(CAPACITY), "audio::engine::mpsc_queue: capacity must be a power of 2");
+        
+        class slot {
+        public:
+            std::atomic<std::size_t> sequence;
+            T item;
+        };
+        
+        std::array<slot, CAPACITY> slots;
+        alignas(64) std::atomic<std::size_t> head;
+        alignas(64) std::atomic<std::size_t> tail;
+        /* A slot's sequence is the position a producer may claim it at, that position + 1 once its item is published.
+         * Producers claim tail with a compare exchange, head is only written by the consumer.
+         */
+    };
+    
+    static constexpr const char* SFX_DIRECTORY = "assets/sfx/";
+    static constexpr const char* MUSIC_DIRECTORY = "assets/music/";
+    static constexpr const char* ASSET_INDEX_PATH = "assets/asset_index.kee";
+    static constexpr const char* NORMALIZED_DIRECTORY = "assets/normalized/";
+    static constexpr const char* ARCHIVE_PATH = "assets/assets.keea";
+    static constexpr const char* WAVEFORM_DIRECTORY = "assets/waveforms/";
+    static constexpr std::uint32_t ARCHIVE_VERSION = 1;
+    static constexpr std::size_t ARCHIVE_ALIGNMENT = 64;
+    static constexpr std::size_t SFX_SOURCE_COUNT = 64;
+    static constexpr std::size_t SOFTWARE_SFX_VOICE_COUNT = 512;
+    static constexpr std::size_t NO_SFX_VOICE = std::numeric_limits<std::size_t>::max();
+    static constexpr std::size_t MIX_BLOCK_FRAMES = 512;
+    static constexpr std::size_t MIX_BUFFER_COUNT = 4;
+    static constexpr std::size_t DEFAULT_SFX_MEMORY_BUDGET = 64 * 1024 * 1024;
+    static constexpr std::size_t MUSIC_COMMAND_QUEUE_SIZE = 256;
+    static constexpr std::size_t RENDER_UPDATE_FRAMES = 256;
+    static constexpr std::chrono::milliseconds SFX_SCHEDULE_LEAD{50};
+    // scheduled sfx are handed to AL_SOFT_source_start_delay this far ahead of their start
+    
+    static std::size_t get_frame_size(ALenum format);
+    static std::chrono::microseconds frames_to_duration(std::size_t frames, int sample_rate);
+    std::chrono::steady_clock::time_point get_engine_time() const;
+    // steady_clock, or the time rendered so far in loopback
+    static constexpr std::chrono::milliseconds AUDIO_CLOCK_UPDATE_INTERVAL{100};
+    static constexpr std::chrono::seconds MUSIC_BUFFER_SHRINK_INTERVAL{30};
+    static constexpr std::size_t EFFECT_SMOOTHING_FRAMES = 64;
+    static constexpr float EFFECT_SMOOTHING_TIME = 0.02f;
+    static constexpr std::size_t STRETCH_WINDOW_FRAMES = 1024;
+    static constexpr std::size_t STRETCH_SEARCH_FRAMES = 256;
+    static constexpr std::chrono::seconds EFFECT_TAIL_DURATION{3};
+    static constexpr std::size_t WAVEFORM_BIN_FRAMES = 256;
+    static constexpr std::size_t WAVEFORM_READ_BINS = 64;
+    
+    static void fetch_al_errors(const char* file, int line);
+    static void fetch_alc_errors(ALCdevice* device, const char* file, int line);
 
-    static engine& singleton();
-    engine();
-    ~engine();
+    static std::ifstream open_wav(const std::filesystem::path& full_path);
+    static wav load_wav(std::ifstream& wav_file, wav_encoding* encoding = nullptr);
+    static void write_wav(const std::filesystem::path& wav_path, const std::vector<std::int16_t>& samples, int channels, int sample_rate);
+    void load_assets();
+    /* Headers (and sfx data) are parsed on every core, then cached in ASSET_INDEX_PATH
+     * so an unchanged file is never parsed again.
+     */
+    template <typename F>
+    static void parallel_for(std::size_t count, const F& function);
+    /* calls function(i) for every i below count, one i per core at a time, the calling thread included.
+     * The first exception stops the indices not yet taken and is rethrown once every worker is done.
+     */
+    
+    static std::uint64_t hash_file(const std::filesystem::path& full_path);
+    std::filesystem::path normalize_wav(const std::filesystem::path& full_path, const wav& header, const wav_encoding& encoding) const;
+    static std::vector<std::int16_t> normalize_samples(const std::vector<byte>& data, const wav& header, const wav_encoding& encoding, int target_sample_rate, const mix_kernels& target_kernels);
+    static std::vector<float> resample(const std::vector<float>& samples, std::size_t channels, int sample_rate, int target_sample_rate, const mix_kernels& target_kernels);
+    /* Wav assets that aren't 16 bit pcm at the device's rate are converted once, through a windowed sinc resampler,
+     * into NORMALIZED_DIRECTORY under the hash of their content and that rate, so OpenAL never resamples them.
+     * resample works on interleaved float samples.
+     */
+    static bool is_resampling_disabled();
+#ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+    static std::atomic_bool resampling_disabled;
+#endif
+    // test hook, 16 bit wavs at another rate load as they are and OpenAL resamples them. Always false without hooks
+#ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+    std::uint64_t upload_digest = 0xCBF29CE484222325;
+    void digest_upload(const void* data, std::size_t size);
+#endif
+    /* test hook, a hash of every music buffer and mix block the engine handed OpenAL, in the order they were queued.
+     * It pins the engine's own output, whatever OpenAL implementation then mixes it. Only the polling thread (or render) touches it
+     */
+    bool load_archived_assets();
+    // true when the assets came from ARCHIVE_PATH
+    std::shared_ptr<const waveform> load_waveform(music_id id);
+    // from memory, WAVEFORM_DIRECTORY or a new pass over the music, in that order
+    
+    void load_sfx(sfx_t& sfx, bool should_pin);
+    void release_sfx(sfx_t& sfx);
+    void evict_sfx();
+    void unlink_sfx_lru(sfx_t& sfx);
+    void push_sfx_lru(sfx_t& sfx);
     
+    static std::vector<std::int16_t> convert_sfx_for_mixer(std::span<const byte> sfx_data, ALenum format, int sample_rate, int mix_sample_rate);
+    std::optional<std::size_t> acquire_sfx_voice(sfx_t& sfx, float gain, float pan, std::size_t bus);
+    void free_sfx_voice(std::size_t voice_index);
+    bool free_stopped_sfx_voice(std::size_t voice_index);
+    void push_sfx_active(std::size_t voice_index);
+    void unlink_sfx_active(std::size_t voice_index);
+    sfx_handle get_sfx_handle(std::size_t voice_index) const;
+    /* acquire_sfx_voice takes a free (or stolen) voice for an sfx already loaded and pinned, its source set up but not started,
+     * nullopt (and the sfx released) when the pool refuses. free_sfx_voice needs a voice out of the active list with its source stopped.
+     * free_stopped_sfx_voice frees a voice that isn't active yet if stop_sfx was called on it. All of these need sfx_mixer_lock.
+     */
+    sfx_voice* lock_sfx_voice(sfx_handle handle, std::unique_lock<std::mutex>& voice_lock);
+    void update_sfx_voice_mix(sfx_voice& voice) const;
+    /* lock_sfx_voice takes the voice's control_lock into voice_lock, nullptr (and nothing held) when the handle is stale.
+     * update_sfx_voice_mix applies the voice's gain, pan and pitch, it needs control_lock.
+     */
+    std::int64_t get_device_clock() const;
+    double measure_source_offset(ALuint source_id, std::int64_t& clock_ns) const;
+    // sample frames into the source's queue and the device clock they were taken at, steady_clock stands in without ALC_SOFT_device_clock
+    std::optional<std::chrono::microseconds> update_sfx_schedule();
+    std::optional<std::chrono::microseconds> measure_sfx_onsets();
+    void start_scheduled_sfx(std::size_t block_start);
+    /* update_sfx_schedule starts scheduled sfx on OpenAL sources, and returns when the next one is due.
+     * measure_sfx_onsets sets every onset_frames relative to the next block the software mixer queues,
+     * and returns when an onset too far to be reached by the mix queue comes into reach.
+     * start_scheduled_sfx starts the voices with onsets in the block block_start frames after that one.
+     */
+    void defer_al_updates();
+    void process_al_updates();
+    bool is_sfx_bus_paused(const sfx_voice& voice) const;
+    void update_bus_voices(std::size_t bus);
+    /* Sources of voices on a paused bus aren't started or resumed, they stay in the active list until the bus is unpaused.
+     * update_bus_voices reapplies the gain of every voice on the bus to its source, in one deferred update. Needs sfx_mixer_lock.
+     */
+    std::optional<std::chrono::microseconds> update_software_mixer();
+    void mix_sfx_block();
+    // update_software_mixer returns when it next needs the polling thread, nullopt once the mix has drained
+    std::size_t pitch_sfx_voice(sfx_voice& voice, float pitch, std::size_t frames);
+    // pitch_sfx_voice interpolates up to frames of a pitched voice into mix_pitched, and returns the frames it wrote
+
+    static config validate_config(const config& engine_config);
+    void open();
+    static std::atomic<engine*> live_engine;
+    /* open is the constructor's work past claiming live_engine, it releases the device and context if open throws.
+     * live_engine is the engine alive right now, null without one.
+     */
+    
+    const config init_config;
+    engine_metrics metrics;
+    void record_sfx_start(sfx_voice& voice);
+    // metrics only records and record_sfx_start is only defined with KEE_AUDIO_ENABLE_METRICS, touch them through KEE_AUDIO_METRIC
+    
+    void post_music_command(const music_command& command);
+    void post_set_player_music(music_id id, std::size_t index, std::shared_ptr<std::promise<void>> completion);
+    void post_set_playback_time(float time, std::size_t index, std::shared_ptr<std::promise<void>> completion);
+    void wake_polling_thread();
+    void process_music_commands();
+    void apply_seek(music_player& player, bool should_play);
+    void start_crossfade(std::size_t from_index, std::size_t to_index, double start_time, double duration);
+    std::optional<std::chrono::microseconds> update_crossfades();
+    void stop_crossfades(std::size_t index);
+    void requeue_ramped_player(music_player& player);
+    /* start_crossfade ramps the players whose queued audio doesn't reach the fade yet.
+     * update_crossfades returns when the next fade needs updating, stop_crossfades drops the fades of a player.
+     * requeue_ramped_player drops a ramp, rebuilding the queue of a player that isn't playing from where it's heard.
+     */
+    std::optional<std::chrono::steady_clock::time_point> update_engine();
     void engine_polling_thread();
+    // update_engine is one pass of the polling thread (or of render), it returns when the next one is needed
     std::atomic_bool should_thread_close;
     std::thread polling_thread;
+    std::condition_variable polling_thread_cv;
+    std::mutex polling_thread_lock;
+    bool is_polling_thread_woken;
+    /* The polling thread sleeps until the earliest sfx ends or music buffer drains,
+     * and parks with no timeout when nothing is playing.
+     * Anything that starts or moves playback has to call wake_polling_thread().
+     */
     
     ALCdevice* alc_device;
     ALCcontext* alc_context;
+    bool is_loopback;
+    std::atomic<std::uint64_t> loopback_frames;
+    LPALCRENDERSAMPLESSOFT alc_render_samples_soft;
+    // loopback_frames is every frame rendered so far, null alc_render_samples_soft unless rendering to a loopback device
+    LPALGETSOURCEI64VSOFT al_get_source_i64v_soft;
+    // null when AL_SOFT_source_latency is unavailable
+    LPALDEFERUPDATESSOFT al_defer_updates_soft;
+    LPALPROCESSUPDATESSOFT al_process_updates_soft;
+    // null when AL_SOFT_deferred_updates is unavailable, alcSuspendContext/alcProcessContext stand in for them
+    LPALCGETINTEGER64VSOFT alc_get_integer64v_soft;
+    // null when ALC_SOFT_device_clock (or AL_SOFT_source_latency) is unavailable
+    using play_at_time_function = void (AL_APIENTRY*)(ALuint source, ALint64SOFT start_time);
+    play_at_time_function al_source_play_at_time_soft;
+    // null when AL_SOFT_source_start_delay is unavailable, declared here since older alext.h headers lack it
     
+    asset_archive archive;
     std::unordered_map<std::string, sfx_t> sfx_map;
     std::unordered_map<std::string, music_t> music_map;
+    // archived sfx and music point into archive, declared first so it outlives them
+    
+    std::vector<sfx_entry*> sfx_ids;
+    std::vector<const music_entry*> music_ids;
+    std::unordered_map<std::uint64_t, std::uint32_t> sfx_keys;
+    std::unordered_map<std::uint64_t, std::uint32_t> music_keys;
+    void index_assets();
+    /* sfx_ids and music_ids are what sfx_id and music_id index, sfx_keys and music_keys map an asset_key to them.
+     * Built once after load_assets, the maps never change afterwards.
+     */
+    
+    std::vector<std::shared_ptr<const waveform>> waveforms;
+    std::mutex waveform_lock;
+    // indexed like music_ids, null until loaded
+    
+    sfx_t* sfx_lru_head;
+    sfx_t* sfx_lru_tail;
+    sfx_cache_stats sfx_cache;
+    std::mutex sfx_cache_lock;
+    /* The lru holds every resident sfx without playing voices, least recently used at the head.
+     * Lock order is sfx_mixer_lock before sfx_cache_lock.
+     */
+    
+    std::future<void> post_loader_job(std::packaged_task<void()> job);
+    void engine_loader_thread();
+    std::thread loader_thread;
+    std::mutex loader_lock;
+    std::condition_variable loader_cv;
+    std::deque<std::packaged_task<void()>> loader_jobs;
+    bool should_loader_close;
+    /* prefetch_sfx and prefetch_waveforms run on loader_thread one after another, in the order they were posted.
+     * It starts with the first one and lives as long as the engine. Jobs still waiting when the engine closes are
+     * dropped, their futures break.
+     */
     
-    std::vector<sfx_buffers> sfx_mixer;
+    std::vector<mix_bus> buses;
+    std::atomic_bool is_bus_gain_changed;
+    std::vector<float> bus_accumulators;
+    std::size_t effect_tail_frames;
+    /* is_bus_gain_changed has the engine's thread reapply the music players' gains.
+     * bus_accumulators holds a mixed block for each bus, so buses with effects can be processed apart. Software mixer only.
+     * effect_tail_frames keeps blocks being mixed after the last voice on a processed bus, so its reverb rings out.
+     */
+    
+    std::vector<sfx_voice> sfx_mixer;
+    std::vector<std::size_t> sfx_free_list;
+    std::size_t sfx_active_head;
+    std::size_t sfx_active_tail;
+    // the active voices are linked through sfx_mixer in start order, oldest voice at the head
+    sfx_pool_policy sfx_policy;
+    sfx_pool_stats sfx_stats;
     std::mutex sfx_mixer_lock;
     
-    std::array<music_player, 4> music_mixer;
-    std::mutex music_mixer_lock;
+    bool is_sfx_batching;
+    std::vector<std::size_t> sfx_batch;
+    std::vector<ALuint> sfx_source_batch;
+    std::vector<scheduled_sfx> sfx_schedule;
+    /* batched and scheduled voices hold their sfx but stay out of the active list until they start.
+     * sfx_source_batch is scratch for the vector forms of source calls. Guarded by sfx_mixer_lock.
+     */
+    
+    bool is_software_mixing;
+    bool is_sfx_paused;
+    int mix_sample_rate;
+    mix_kernels kernels;
+    ALuint mix_source_id;
+    std::array<ALuint, MIX_BUFFER_COUNT> mix_buffer_ids;
+    std::vector<ALuint> mix_free_buffers;
+    std::vector<float> mix_accumulator;
+    std::vector<std::int16_t> mix_output;
+    std::vector<std::int16_t> mix_pitched;
+    // software mixer state, guarded by sfx_mixer_lock
+    
+    std::vector<music_player> music_mixer;
+    std::vector<music_crossfade> music_crossfades;
+    mpsc_queue<music_command, MUSIC_COMMAND_QUEUE_SIZE> music_commands;
+    std::mutex music_command_spill_lock;
+    std::vector<music_command> music_command_spill;
+    std::atomic_bool is_music_command_spilled;
+    std::vector<music_command> music_command_batch;
+    std::vector<std::atomic_bool> is_player_music_set;
+    /* music_mixer and music_crossfades are only touched by the polling thread, the public api posts to music_commands
+     * from any number of threads. Commands posted while it's full spill into music_command_spill, under its lock,
+     * and later ones follow them there until the polling thread has drained both, so posting never fails.
+     * is_player_music_set is the callers' view of the players, used to validate commands up front.
+     * music_command_batch holds one drain of music_commands, so superseded seeks can be spotted before doing I/O.
+     */
 };
 
 class engine::sfx_t {
 public:
-    sfx_t(int _sample_rate, ALenum _format, const std::vector<byte>& _data);
+    sfx_t(const std::filesystem::path& _full_path, int _sample_rate, ALenum _format, std::size_t _data_start, std::size_t _data_size, std::span<const byte> _archived_data);
+
+    std::vector<byte> read_data() const;
 
+    const std::filesystem::path full_path;
     const int sample_rate;
     const ALenum format;
-    const std::vector<byte> data;
-};
-
-class engine::sfx_buffers {
-public:
-    sfx_buffers(ALuint _source_id, ALuint _buffer_id);
-
-    ALuint get_source_id() const;
-    const ALuint* get_source_id_addr() const;
-    const ALuint* get_buffer_id_addr() const;
-
-private:
-    ALuint source_id;
+    const std::size_t data_start;
+    const std::size_t data_size;
+    const std::span<const byte> archived_data;
+    // archived_data is the sfx's pcm inside the archive's mapping, empty for a loose file
+    
+    bool is_resident;
+    std::size_t resident_bytes;
     ALuint buffer_id;
+    std::vector<std::int16_t> mix_data;
+    std::span<const std::int16_t> mix_samples;
+    std::size_t mix_channels;
+    std::size_t playing_voices;
+    sfx_t* lru_prev;
+    sfx_t* lru_next;
+    /* A resident sfx is either uploaded to buffer_id, or converted to int16 at the mix rate when mixing in software.
+     * mix_samples is what the mixer reads, mix_data when converted or the archive when it already was at the mix rate.
+     * Every playing voice shares it.
+     * Guarded by sfx_cache_lock.
+     */
 };
 
 class engine::music_t {
 public:
-    music_t(int _sample_rate, ALenum _format, std::size_t _data_start, std::size_t _data_size, float _duration);
+    music_t(const std::filesystem::path& _full_path, music_codec _codec, int _sample_rate, ALenum _format, std::size_t _data_start, std::size_t _data_size, float _duration, std::span<const byte> _archived_data);
 
+    const std::filesystem::path full_path;
+    const music_codec codec;
     const int sample_rate;
     const ALenum format;
     const std::size_t data_start;
     const std::size_t data_size;
     const float duration;
     const bool is_duo_byte_sampled;
+    const std::size_t frame_size;
+    const std::span<const byte> archived_data;
+    // archived_data is the pcm (or the whole compressed file) inside the archive's mapping, empty for a loose file
 };
 
+template <typename T, std::size_t CAPACITY>
+engine::mpsc_queue<T, CAPACITY>::mpsc_queue() :
+    head(0),
+    tail(0)
+{
+    for (std::size_t position = 0; position < CAPACITY; position++)
+        slots[position].sequence.store(position, std::memory_order_relaxed);
+}
+
+template <typename T, std::size_t CAPACITY>
+bool engine::mpsc_queue<T, CAPACITY>::try_push(const T& item) {
+    std::size_t position = tail.load(std::memory_order_relaxed);
+    while (true) {
+        slot& claimed_slot = slots[position % CAPACITY];
+        std::size_t sequence = claimed_slot.sequence.load(std::memory_order_acquire);
+        std::ptrdiff_t lag = static_cast<std::ptrdiff_t>(sequence - position);
+        if (lag < 0)
+            return false;
+            
+        // another producer took this position first when lag is positive or the exchange fails
+        if (lag == 0 && tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+            claimed_slot.item = item;
+            claimed_slot.sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+        if (lag > 0)
+            position = tail.load(std::memory_order_relaxed);
+    }
+}
+
+template <typename T, std::size_t CAPACITY>
+bool engine::mpsc_queue<T, CAPACITY>::try_pop(T& item) {
+    std::size_t position = head.load(std::memory_order_relaxed);
+    slot& popped_slot = slots[position % CAPACITY];
+    if (popped_slot.sequence.load(std::memory_order_acquire) != position + 1)
+        return false;
+        
+    item = std::move(popped_slot.item);
+    popped_slot.sequence.store(position + CAPACITY, std::memory_order_release);
+    head.store(position + 1, std::memory_order_relaxed);
+    return true;
+}
+
 } // namespace audio
@@ -0,0 +1,71 @@
+#include "test_support.hpp"
+
+/* Streams the same song as FLAC and as wav through the same offline script of plays, pauses and seeks, and
+ * compares the renders sample for sample: decoding ahead and seeking in the decoder land on the exact sample a wav
+ * stream would. The FLAC file is written verbatim (see write_flac), so it holds the wav's samples exactly.
+ * Vorbis is lossy and there's no encoder to write it here, it shares the decode ring and seeks the FLAC path runs.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+using kee_test::FRAME_FRAMES;
+constexpr std::size_t SONG_FRAMES = SAMPLE_RATE * 12;
+
+std::vector<std::int16_t> render_script(const char* music_name) {
+    audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+    std::vector<std::int16_t> samples;
+    const auto render_frames = [&](std::size_t frame_count) {
+        for (std::size_t rendered_frames = 0; rendered_frames < frame_count; rendered_frames += FRAME_FRAMES) {
+            samples.resize(samples.size() + FRAME_FRAMES * 2);
+            engine.render(samples.data() + samples.size() - FRAME_FRAMES * 2, FRAME_FRAMES);
+        }
+    };
+
+    engine.set_player_music(music_name);
+    engine.play_music_player();
+    render_frames(SAMPLE_RATE / 2);
+
+    // seeks while playing, forward, back, onto a frame that isn't on a block boundary, and close to the end
+    for (float time : { 7.5f, 1.25f, 3.00002f, 11.8f }) {
+        engine.set_playback_time(time);
+        render_frames(SAMPLE_RATE / 2);
+    }
+
+    // piled up seeks while paused, only the last one is heard
+    engine.pause_music_player();
+    engine.set_playback_time(9.0f);
+    engine.set_playback_time(2.0f);
+    std::future<void> seeked = engine.set_playback_time_async(4.5f);
+    render_frames(FRAME_FRAMES);
+    KEE_CHECK(seeked.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    engine.play_music_player();
+    render_frames(SAMPLE_RATE);
+    return samples;
+}
+
+} // namespace
+
+int main() {
+    if (!audio::test_access::is_codec_supported("song.flac")) {
+        std::printf("compressed_seek_test: FLAC is compiled out, skipped\n");
+        return kee_test::finish("compressed_seek_test");
+    }
+
+    kee_test::asset_directory assets("compressed_seek");
+    std::vector<std::int16_t> song = kee_test::make_noise(SONG_FRAMES, 2, 1);
+    assets.add_music("song.wav", song);
+    assets.add_music("song.flac", song);
+
+    std::vector<std::int16_t> wav_samples = render_script("song.wav");
+    std::vector<std::int16_t> flac_samples = render_script("song.flac");
+    KEE_CHECK(std::any_of(wav_samples.begin(), wav_samples.end(), [](std::int16_t sample) { return sample != 0; }));
+    KEE_CHECK(flac_samples.size() == wav_samples.size());
+
+    std::size_t mismatched_frames = 0;
+    for (std::size_t i = 0; i < std::min(wav_samples.size(), flac_samples.size()); i += 2)
+        mismatched_frames += wav_samples[i] != flac_samples[i] || wav_samples[i + 1] != flac_samples[i + 1] ? 1 : 0;
+    std::printf("flac renders %zu of %zu frames differently from wav\n", mismatched_frames, wav_samples.size() / 2);
+    KEE_CHECK(mismatched_frames == 0);
+    return kee_test::finish("compressed_seek_test");
+}
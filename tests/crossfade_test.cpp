@@ -0,0 +1,76 @@
+#include "test_support.hpp"
+
+/* Crossfades one song into another at a time on the first song's clock and renders them offline. The songs sit
+ * on opposite channels, so each one's fade can be read off the output. The incoming song has to reach half power
+ * within a few samples of the frame the fade's midpoint falls on, and so does the outgoing one where its fade
+ * starts past what it had queued.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+using kee_test::FRAME_FRAMES;
+constexpr std::size_t SONG_FRAMES = SAMPLE_RATE * 8;
+constexpr std::size_t RENDER_FRAMES = SAMPLE_RATE * 5;
+constexpr float FADE_DURATION = 0.5f;
+constexpr std::int64_t MAX_FADE_ERROR = 4;
+
+std::vector<std::int16_t> make_channel_song(std::size_t channel) {
+    std::vector<std::int16_t> samples(SONG_FRAMES * 2, 0);
+    for (std::size_t frame = 0; frame < SONG_FRAMES; frame++)
+        samples[frame * 2 + channel] = 30000;
+    return samples;
+}
+
+std::int64_t find_crossing(const std::vector<std::int16_t>& samples, std::size_t channel, std::size_t from_frame, double level, bool is_rising) {
+    for (std::size_t frame = from_frame; frame < samples.size() / 2; frame++)
+        if (is_rising ? samples[frame * 2 + channel] >= level : samples[frame * 2 + channel] <= level)
+            return static_cast<std::int64_t>(frame);
+    return -1;
+}
+
+void check_crossfade(double start_time, bool is_from_checked) {
+    audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+    engine.set_player_music("left.wav", 0);
+    engine.set_player_music("right.wav", 1);
+    engine.play_music_player(0);
+
+    std::vector<std::int16_t> samples(RENDER_FRAMES * 2);
+    engine.render(samples.data(), FRAME_FRAMES);
+    engine.crossfade_music_players(0, 1, FADE_DURATION, start_time);
+    for (std::size_t rendered_frames = FRAME_FRAMES; rendered_frames < RENDER_FRAMES; rendered_frames += FRAME_FRAMES)
+        engine.render(samples.data() + rendered_frames * 2, FRAME_FRAMES);
+
+    // the songs are constant, so the outgoing one's level before the fade is the incoming one's after it
+    std::int64_t song_start = find_crossing(samples, 0, 0, 1.0, true);
+    KEE_CHECK(song_start >= 0);
+    double full_level = samples[song_start * 2];
+    std::int64_t midpoint = song_start + std::llround((start_time + FADE_DURATION / 2.0) * SAMPLE_RATE);
+    double half_power = full_level * std::sqrt(0.5);
+
+    std::int64_t fade_in_error = std::abs(find_crossing(samples, 1, 0, half_power, true) - midpoint);
+    std::printf("start %.2f s: fade in off by %lld samples", start_time, static_cast<long long>(fade_in_error));
+    KEE_CHECK(fade_in_error <= MAX_FADE_ERROR);
+    KEE_CHECK(find_crossing(samples, 1, 0, 1.0, true) >= midpoint - SAMPLE_RATE * FADE_DURATION / 2.0);
+    KEE_CHECK(samples[samples.size() - 1] == full_level);
+    if (is_from_checked) {
+        std::int64_t fade_out_error = std::abs(find_crossing(samples, 0, song_start, half_power, false) - midpoint);
+        std::printf(", fade out off by %lld samples", static_cast<long long>(fade_out_error));
+        KEE_CHECK(fade_out_error <= MAX_FADE_ERROR);
+    }
+    std::printf("\n");
+    KEE_CHECK(samples[samples.size() - 2] == 0);
+}
+
+} // namespace
+
+int main() {
+    kee_test::asset_directory assets("crossfade");
+    assets.add_music("left.wav", make_channel_song(0));
+    assets.add_music("right.wav", make_channel_song(1));
+
+    // the later fade starts past the outgoing song's queue, the earlier one within it
+    check_crossfade(3.0, true);
+    check_crossfade(0.25, false);
+    return kee_test::finish("crossfade_test");
+}
@@ -0,0 +1,91 @@
+#include "test_support.hpp"
+#include <numeric>
+
+/* Renders the same short scene offline at every simd level and compares it sample for sample with the render
+ * through the scalar kernels, the golden one. The scene goes through every kernel: panned mono and stereo sfx,
+ * a pitched voice, a scheduled one, bus and player filters and reverbs and a tempo change on the music.
+ * The scalar render is itself pinned by GOLDEN_UPLOAD_DIGEST, the hash of every buffer the engine handed OpenAL
+ * (see test_access::get_upload_digest), so a change to the scalar kernels shows up too. OpenAL's own mix isn't
+ * part of it, the hash holds with any OpenAL implementation.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+using kee_test::FRAME_FRAMES;
+constexpr std::size_t RENDER_FRAMES = SAMPLE_RATE * 2;
+constexpr std::uint64_t GOLDEN_UPLOAD_DIGEST = 0x527FBE155A452A99;
+// an intended change to the engine's output prints the new digest, to be pasted here
+
+std::vector<std::int16_t> render_scene(audio::engine::simd_level max_simd_level, audio::engine::simd_level& level, std::uint64_t& upload_digest) {
+    audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+    config.use_software_mixer = true;
+    config.max_simd_level = max_simd_level;
+    config.bus_names = { "music", "hits" };
+    audio::engine engine(config);
+    level = engine.get_mixer_simd_level();
+    audio::engine::bus_id hits = engine.lookup_bus("hits");
+    engine.set_bus_filter(hits, audio::engine::filter_type::low_pass, 2000.0f);
+    engine.set_bus_reverb(hits, 0.4f);
+    engine.set_player_music("song.wav");
+    engine.set_player_tempo(1.25f);
+    engine.set_player_filter(audio::engine::filter_type::high_pass, 300.0f);
+    engine.set_player_reverb(0.2f);
+    engine.schedule_sfx("tone.wav", 0.75, 0, 0.7f, 0.3f, hits);
+    engine.play_music_player();
+
+    std::vector<std::int16_t> samples(RENDER_FRAMES * 2);
+    for (std::size_t frame = 0; frame < RENDER_FRAMES; frame += FRAME_FRAMES) {
+        if (frame % (SAMPLE_RATE / 4) == 0) {
+            engine.play_sfx("click.wav", 0.8f, static_cast<float>(frame % 3) - 1.0f);
+            engine.play_sfx("stereo.wav", 0.5f, -0.25f, hits);
+            audio::engine::sfx_handle pitched = engine.play_sfx("tone.wav", 0.6f, 0.5f);
+            engine.set_sfx_pitch(pitched, 1.37f);
+        }
+        engine.render(samples.data() + frame * 2, FRAME_FRAMES);
+    }
+    upload_digest = audio::test_access::get_upload_digest(engine);
+    return samples;
+}
+
+} // namespace
+
+int main() {
+    kee_test::asset_directory assets("golden_render");
+    assets.add_sfx("click.wav", kee_test::make_noise(960, 1, 1));
+    assets.add_sfx("tone.wav", kee_test::make_tone(SAMPLE_RATE / 4, 1, SAMPLE_RATE, 660.0));
+    assets.add_sfx("stereo.wav", kee_test::make_noise(SAMPLE_RATE / 8, 2, 2), 2);
+    assets.add_music("song.wav", kee_test::make_tone(SAMPLE_RATE * 4, 2, SAMPLE_RATE, 220.0));
+
+    audio::engine::simd_level level = audio::engine::simd_level::scalar;
+    std::uint64_t golden_digest = 0;
+    std::vector<std::int16_t> golden = render_scene(audio::engine::simd_level::scalar, level, golden_digest);
+    KEE_CHECK(level == audio::engine::simd_level::scalar);
+    KEE_CHECK(std::any_of(golden.begin(), golden.end(), [](std::int16_t sample) -> bool { return std::abs(sample) > 1000; }));
+    if (golden_digest != GOLDEN_UPLOAD_DIGEST)
+        std::printf("scalar render uploads hash to 0x%016llX, GOLDEN_UPLOAD_DIGEST is 0x%016llX\n", static_cast<unsigned long long>(golden_digest), static_cast<unsigned long long>(GOLDEN_UPLOAD_DIGEST));
+    KEE_CHECK(golden_digest == GOLDEN_UPLOAD_DIGEST);
+    
+    // the scalar render repeats itself exactly, or the comparisons below would mean nothing
+    std::uint64_t digest = 0;
+    KEE_CHECK(render_scene(audio::engine::simd_level::scalar, level, digest) == golden);
+    KEE_CHECK(digest == golden_digest);
+
+    for (audio::engine::simd_level max_simd_level : { audio::engine::simd_level::sse2, audio::engine::simd_level::avx2 }) {
+        std::vector<std::int16_t> samples = render_scene(max_simd_level, level, digest);
+        if (level != max_simd_level) {
+            std::printf("level %d not available\n", static_cast<int>(max_simd_level));
+            continue;
+        }
+
+        auto mismatch = std::mismatch(samples.begin(), samples.end(), golden.begin());
+        std::size_t differing = std::inner_product(samples.begin(), samples.end(), golden.begin(), std::size_t(0), std::plus<>(), std::not_equal_to<>());
+        if (mismatch.first != samples.end())
+            std::printf("level %d: %zu samples differ, the first at frame %zu\n", static_cast<int>(level), differing, static_cast<std::size_t>(mismatch.first - samples.begin()) / 2);
+        else
+            std::printf("level %d: matches the scalar render\n", static_cast<int>(level));
+        KEE_CHECK(differing == 0);
+        KEE_CHECK(digest == golden_digest);
+    }
+    return kee_test::finish("golden_render_test");
+}
@@ -0,0 +1,171 @@
+#include "test_support.hpp"
+
+/* Runs every kernel of every simd level the cpu has against the scalar ones on random input, at every length
+ * up to a few vectors past the widest and at every misalignment of a float, so each tail loop runs too.
+ * Every level promises output bit exact with scalar, so the comparisons are exact.
+ */
+
+namespace {
+
+using kernels_t = audio::test_access::mix_kernels;
+constexpr std::size_t MAX_LENGTH = 67;
+constexpr std::size_t MAX_OFFSET = 4;
+constexpr std::size_t REVERB_MASK = 255;
+
+std::mt19937 random_engine(1);
+
+std::vector<std::int16_t> random_s16(std::size_t count) {
+    std::uniform_int_distribution<int> distribution(-32768, 32767);
+    std::vector<std::int16_t> samples(count);
+    for (std::int16_t& sample : samples)
+        sample = static_cast<std::int16_t>(distribution(random_engine));
+    return samples;
+}
+
+std::vector<float> random_f32(std::size_t count, float amplitude) {
+    std::uniform_real_distribution<float> distribution(-amplitude, amplitude);
+    std::vector<float> samples(count);
+    for (float& sample : samples)
+        sample = distribution(random_engine);
+    return samples;
+}
+
+template<typename T>
+bool is_equal(const std::vector<T>& a, const std::vector<T>& b) {
+    return std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+void check_mix(const kernels_t& scalar, const kernels_t& kernels, std::size_t frames, std::size_t offset) {
+    for (bool is_stereo : { false, true }) {
+        std::vector<std::int16_t> in = random_s16(offset + frames * 2);
+        std::vector<float> expected = random_f32(offset + frames * 2, 30000.0f);
+        std::vector<float> out = expected;
+        (is_stereo ? scalar.mix_stereo : scalar.mix_mono)(in.data() + offset, expected.data() + offset, frames, 0.37f, -1.21f);
+        (is_stereo ? kernels.mix_stereo : kernels.mix_mono)(in.data() + offset, out.data() + offset, frames, 0.37f, -1.21f);
+        KEE_CHECK(is_equal(out, expected));
+    }
+}
+
+void check_to_s16(const kernels_t& scalar, const kernels_t& kernels, std::size_t samples, std::size_t offset) {
+    // past both ends of int16 so saturation is covered, with halves to check rounding to even
+    std::vector<float> in = random_f32(offset + samples, 40000.0f);
+    for (std::size_t i = offset; i < in.size(); i += 3)
+        in[i] = std::round(in[i]) + 0.5f;
+    std::vector<std::int16_t> expected(offset + samples);
+    std::vector<std::int16_t> out(offset + samples);
+    scalar.to_s16(in.data() + offset, expected.data() + offset, samples);
+    kernels.to_s16(in.data() + offset, out.data() + offset, samples);
+    KEE_CHECK(is_equal(out, expected));
+}
+
+void check_s16_to_f32(const kernels_t& scalar, const kernels_t& kernels, std::size_t samples, std::size_t offset) {
+    std::vector<std::int16_t> in = random_s16(offset + samples);
+    // the one int16 without a positive twin
+    if (samples > 0)
+        in[offset] = -32768;
+    std::vector<float> expected = random_f32(offset + samples, 1.0f);
+    std::vector<float> out = expected;
+    scalar.s16_to_f32(in.data() + offset, expected.data() + offset, samples);
+    kernels.s16_to_f32(in.data() + offset, out.data() + offset, samples);
+    KEE_CHECK(is_equal(out, expected));
+}
+
+void check_accumulate(const kernels_t& scalar, const kernels_t& kernels, std::size_t samples, std::size_t offset) {
+    std::vector<float> in = random_f32(offset + samples, 30000.0f);
+    std::vector<float> expected = random_f32(offset + samples, 30000.0f);
+    std::vector<float> out = expected;
+    scalar.accumulate(in.data() + offset, expected.data() + offset, samples);
+    kernels.accumulate(in.data() + offset, out.data() + offset, samples);
+    KEE_CHECK(is_equal(out, expected));
+}
+
+void check_dot(const kernels_t& scalar, const kernels_t& kernels, std::size_t length, std::size_t offset) {
+    // dot takes multiples of 8 only
+    std::size_t n = length / 8 * 8;
+    std::vector<float> a = random_f32(offset + n, 1.0f);
+    std::vector<float> b = random_f32(offset + n, 1.0f);
+    float expected = scalar.dot(a.data() + offset, b.data() + offset, n);
+    float result = kernels.dot(a.data() + offset, b.data() + offset, n);
+    KEE_CHECK(std::memcmp(&expected, &result, sizeof(float)) == 0);
+}
+
+void check_peak(const kernels_t& scalar, const kernels_t& kernels, std::size_t samples, std::size_t offset) {
+    std::vector<std::int16_t> in = random_s16(offset + samples);
+    std::int16_t expected_min = 0;
+    std::int16_t expected_max = 0;
+    std::int16_t min = 0;
+    std::int16_t max = 0;
+    float expected = scalar.peak(in.data() + offset, samples, expected_min, expected_max);
+    float result = kernels.peak(in.data() + offset, samples, min, max);
+    KEE_CHECK(std::memcmp(&expected, &result, sizeof(float)) == 0);
+    KEE_CHECK(min == expected_min && max == expected_max);
+}
+
+void check_biquad(const kernels_t& scalar, const kernels_t& kernels, std::size_t frames, std::size_t offset) {
+    // a lowpass near 2 kHz at 48 kHz, faded halfway in
+    const float coefficients[5] = { 0.0133f, 0.0266f, 0.0133f, -1.6475f, 0.7008f };
+    for (std::size_t channels : { 1, 2 }) {
+        std::vector<float> expected = random_f32(offset + frames * channels, 20000.0f);
+        std::vector<float> out = expected;
+        std::vector<float> expected_state = random_f32(4, 100.0f);
+        std::vector<float> state = expected_state;
+        scalar.biquad(expected.data() + offset, frames, channels, coefficients, expected_state.data(), 0.5f);
+        kernels.biquad(out.data() + offset, frames, channels, coefficients, state.data(), 0.5f);
+        KEE_CHECK(is_equal(out, expected));
+        KEE_CHECK(is_equal(state, expected_state));
+    }
+}
+
+void check_reverb(const kernels_t& scalar, const kernels_t& kernels, std::size_t frames, std::size_t offset) {
+    constexpr std::size_t LINES = audio::test_access::REVERB_LINE_COUNT;
+    const std::size_t delays[LINES] = { 31, 37, 41, 43, 47, 53, 59, 61 };
+    for (std::size_t channels : { 1, 2 }) {
+        std::vector<float> expected = random_f32(offset + frames * channels, 20000.0f);
+        std::vector<float> out = expected;
+        std::vector<float> expected_lines = random_f32((REVERB_MASK + 1) * LINES, 5000.0f);
+        std::vector<float> lines = expected_lines;
+        std::vector<float> expected_lowpass = random_f32(LINES, 5000.0f);
+        std::vector<float> lowpass = expected_lowpass;
+        // a position near the end of the lines, so the block wraps around
+        std::size_t position = REVERB_MASK - 20;
+        std::size_t expected_end = scalar.reverb(expected.data() + offset, frames, channels, expected_lines.data(), REVERB_MASK, position,
+                                                 delays, expected_lowpass.data(), 0.8f, 0.3f, 0.4f);
+        std::size_t end = kernels.reverb(out.data() + offset, frames, channels, lines.data(), REVERB_MASK, position,
+                                         delays, lowpass.data(), 0.8f, 0.3f, 0.4f);
+        KEE_CHECK(end == expected_end);
+        KEE_CHECK(is_equal(out, expected));
+        KEE_CHECK(is_equal(lines, expected_lines));
+        KEE_CHECK(is_equal(lowpass, expected_lowpass));
+    }
+}
+
+} // namespace
+
+int main() {
+    const kernels_t scalar = kernels_t::select(audio::engine::simd_level::scalar);
+    KEE_CHECK(scalar.level == audio::engine::simd_level::scalar);
+    for (audio::engine::simd_level level : { audio::engine::simd_level::sse2, audio::engine::simd_level::avx2 }) {
+        const kernels_t kernels = kernels_t::select(level);
+        // a level the build or the cpu lacks falls back to one already checked
+        if (kernels.level != level) {
+            std::printf("level %d not available, checked level %d instead\n", static_cast<int>(level), static_cast<int>(kernels.level));
+            continue;
+        }
+
+        int failures_before = kee_test::failures;
+        for (std::size_t length = 0; length <= MAX_LENGTH; length++) {
+            for (std::size_t offset = 0; offset < MAX_OFFSET; offset++) {
+                check_mix(scalar, kernels, length, offset);
+                check_to_s16(scalar, kernels, length, offset);
+                check_s16_to_f32(scalar, kernels, length, offset);
+                check_accumulate(scalar, kernels, length, offset);
+                check_dot(scalar, kernels, length, offset);
+                check_peak(scalar, kernels, length, offset);
+                check_biquad(scalar, kernels, length, offset);
+                check_reverb(scalar, kernels, length, offset);
+            }
+        }
+        std::printf("level %d: %s\n", static_cast<int>(level), kee_test::failures == failures_before ? "matches scalar" : "differs from scalar");
+    }
+    return kee_test::finish("mix_kernels_test");
+}
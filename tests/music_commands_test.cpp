@@ -0,0 +1,82 @@
+#include "test_support.hpp"
+
+/* Music commands that reach the engine's thread after the player lost its music, the way a seek or a queued song
+ * from one thread lands behind another thread's unset_player_music. They're dropped, their completions fulfilled,
+ * and the player takes new music afterwards as if they never came. Then thousands of commands posted faster than
+ * the engine drains them, which spill past the queue and still land in order.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+using kee_test::FRAME_FRAMES;
+
+void check_commands_after_unset() {
+    audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+    audio::engine::music_id song = engine.lookup_music("song.wav");
+    std::vector<std::int16_t> samples(FRAME_FRAMES * 2);
+    engine.set_player_music(song);
+    engine.play_music_player();
+    engine.render(samples.data(), FRAME_FRAMES);
+
+    // posted in one batch behind the unset, and again in a batch of their own
+    std::shared_ptr<std::promise<void>> batched_seek = std::make_shared<std::promise<void>>();
+    std::future<void> batched_seek_done = batched_seek->get_future();
+    engine.unset_player_music();
+    audio::test_access::post_unchecked_seek(engine, 1.0f, 0, batched_seek);
+    audio::test_access::post_unchecked_queue(engine, song, 0);
+    engine.render(samples.data(), FRAME_FRAMES);
+
+    std::shared_ptr<std::promise<void>> lone_seek = std::make_shared<std::promise<void>>();
+    std::future<void> lone_seek_done = lone_seek->get_future();
+    audio::test_access::post_unchecked_seek(engine, 2.0f, 0, lone_seek);
+    audio::test_access::post_unchecked_queue(engine, song, 0);
+    engine.render(samples.data(), FRAME_FRAMES);
+    KEE_CHECK(batched_seek_done.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    KEE_CHECK(lone_seek_done.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    KEE_CHECK(!engine.is_music_playing());
+
+    // nothing was queued behind the new music, it plays from its start and ends where it does
+    engine.set_player_music(song);
+    engine.play_music_player();
+    engine.render(samples.data(), FRAME_FRAMES);
+    KEE_CHECK(engine.is_music_playing());
+    KEE_CHECK(engine.get_playback_time() < 0.1);
+}
+
+void check_command_flood() {
+    // nothing drains the queue between renders, so most of these spill past it and have to come back in order
+    audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+    std::vector<std::int16_t> samples(FRAME_FRAMES * 2);
+    engine.set_player_music("song.wav");
+    std::vector<std::future<void>> seeks;
+    for (std::size_t call = 0; call < 2000; call++) {
+        seeks.push_back(engine.set_playback_time_async(static_cast<float>(call % 200) / 100.0f));
+        engine.set_player_tempo(call % 2 == 0 ? 1.5f : 1.0f);
+        if (call % 2 == 0)
+            engine.play_music_player();
+        else
+            engine.pause_music_player();
+    }
+    engine.set_playback_time(2.5f);
+    engine.play_music_player();
+    engine.render(samples.data(), FRAME_FRAMES);
+
+    audio::engine::metrics_snapshot snapshot;
+    engine.get_metrics(snapshot);
+    KEE_CHECK(snapshot.music_command_spills > 0);
+    KEE_CHECK(std::all_of(seeks.begin(), seeks.end(), [](const std::future<void>& seek) { return seek.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }));
+    KEE_CHECK(engine.is_music_playing());
+    KEE_CHECK(std::abs(engine.get_playback_time() - 2.5) < 0.1);
+}
+
+} // namespace
+
+int main() {
+    kee_test::asset_directory assets("music_commands");
+    assets.add_music("song.wav", kee_test::make_noise(SAMPLE_RATE * 3, 2, 1));
+
+    check_commands_after_unset();
+    check_command_flood();
+    return kee_test::finish("music_commands_test");
+}
@@ -0,0 +1,56 @@
+#include "test_support.hpp"
+
+/* Renders a whole song offline a game frame at a time, polling the music clocks after every frame the way
+ * a rhythm game would. Against the frames rendered, neither clock may drift by a millisecond over the song.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+using kee_test::FRAME_FRAMES;
+constexpr std::size_t SONG_FRAMES = SAMPLE_RATE * 20;
+constexpr double MAX_DRIFT = 0.001;
+
+void check_drift(bool use_software_mixer) {
+    audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+    config.use_software_mixer = use_software_mixer;
+    audio::engine engine(config);
+    engine.set_player_music("song.wav");
+    engine.play_music_player();
+
+    // the clocks may start a fixed latency behind the render, drift is measured against the first frame's offset
+    std::vector<std::int16_t> samples(FRAME_FRAMES * 2);
+    std::size_t rendered_frames = 0;
+    double first_playback_offset = 0.0;
+    double first_clock_offset = 0.0;
+    double max_playback_drift = 0.0;
+    double max_clock_drift = 0.0;
+    for (; rendered_frames + FRAME_FRAMES < SONG_FRAMES; rendered_frames += FRAME_FRAMES) {
+        engine.render(samples.data(), FRAME_FRAMES);
+        double rendered_time = static_cast<double>(rendered_frames + FRAME_FRAMES) / SAMPLE_RATE;
+        double playback_offset = engine.get_playback_time() - rendered_time;
+        double clock_offset = engine.get_audio_clock() - rendered_time;
+        if (rendered_frames == 0) {
+            first_playback_offset = playback_offset;
+            first_clock_offset = clock_offset;
+        }
+        max_playback_drift = std::max(max_playback_drift, std::abs(playback_offset - first_playback_offset));
+        max_clock_drift = std::max(max_clock_drift, std::abs(clock_offset - first_clock_offset));
+    }
+    std::printf("%s mixer: max drift %.3f ms get_playback_time, %.3f ms get_audio_clock over %zu frames\n",
+        use_software_mixer ? "software" : "source", max_playback_drift * 1e3, max_clock_drift * 1e3, rendered_frames / FRAME_FRAMES);
+    KEE_CHECK(max_playback_drift < MAX_DRIFT);
+    KEE_CHECK(max_clock_drift < MAX_DRIFT);
+    KEE_CHECK(engine.is_music_playing());
+}
+
+} // namespace
+
+int main() {
+    kee_test::asset_directory assets("music_drift");
+    assets.add_music("song.wav", kee_test::make_tone(SONG_FRAMES, 2, SAMPLE_RATE, 330.0));
+
+    check_drift(false);
+    check_drift(true);
+    return kee_test::finish("music_drift_test");
+}
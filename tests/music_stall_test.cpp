@@ -0,0 +1,79 @@
+#include "test_support.hpp"
+
+/* Stalls a playing music player's reads for longer than its queue lasts and renders through it offline.
+ * The player has to starve, come back on its own once reads answer again and keep a deeper queue afterwards.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+constexpr std::size_t BUFFER_COUNT = 4;
+constexpr std::size_t CHECK_FRAMES = 48;
+
+bool is_silent(const std::int16_t* samples, std::size_t frames) {
+    return std::all_of(samples, samples + frames * 2, [](std::int16_t sample) -> bool {
+        return std::abs(sample) < 64;
+    });
+}
+
+} // namespace
+
+int main() {
+    kee_test::asset_directory assets("music_stall");
+    assets.add_music("tone.wav", kee_test::make_tone(SAMPLE_RATE * 5, 2, SAMPLE_RATE, 440.0));
+
+    audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+    config.music_buffer_count = BUFFER_COUNT;
+    config.music_max_buffer_count = 12;
+    config.music_buffer_size = 4096;
+    audio::engine engine(config);
+    engine.set_player_music("tone.wav");
+    engine.play_music_player();
+
+    std::vector<std::int16_t> samples(SAMPLE_RATE * 2);
+    engine.render(samples.data(), SAMPLE_RATE);
+    audio::engine::metrics_snapshot snapshot;
+    engine.get_metrics(snapshot);
+    KEE_CHECK(snapshot.starvations[0] == 0);
+    KEE_CHECK(snapshot.music_buffer_counts[0] == BUFFER_COUNT);
+    double time_before_stall = engine.get_playback_time();
+
+    // 4 buffers of 1024 frames last about 85 ms, the stall outlasts them
+    constexpr std::size_t STALL_FRAMES = SAMPLE_RATE * 150 / 1000;
+    constexpr std::size_t RECOVERY_FRAMES = SAMPLE_RATE * 20 / 1000;
+    audio::test_access::stall_music_reads(engine, 0, std::chrono::milliseconds(150));
+    std::size_t rendered_frames = SAMPLE_RATE / 2;
+    engine.render(samples.data(), rendered_frames);
+
+    std::size_t first_silent_frame = rendered_frames;
+    std::size_t last_silent_frame = 0;
+    for (std::size_t frame = 0; frame + CHECK_FRAMES <= rendered_frames; frame += CHECK_FRAMES) {
+        if (!is_silent(samples.data() + frame * 2, CHECK_FRAMES))
+            continue;
+        first_silent_frame = std::min(first_silent_frame, frame);
+        last_silent_frame = frame + CHECK_FRAMES;
+    }
+    std::printf("silent from %zu to %zu of a stall ending at %zu\n", first_silent_frame, last_silent_frame, STALL_FRAMES);
+    KEE_CHECK(first_silent_frame < STALL_FRAMES);
+    KEE_CHECK(last_silent_frame <= STALL_FRAMES + RECOVERY_FRAMES);
+    KEE_CHECK(!is_silent(samples.data() + (STALL_FRAMES + RECOVERY_FRAMES) * 2, rendered_frames - STALL_FRAMES - RECOVERY_FRAMES));
+
+    engine.get_metrics(snapshot);
+    KEE_CHECK(snapshot.starvations[0] == 1);
+    KEE_CHECK(snapshot.music_buffer_counts[0] > BUFFER_COUNT);
+    KEE_CHECK(engine.is_music_playing());
+
+    // the music carries on from where it went silent, the clock covers the playing part of the render only
+    double silent_time = static_cast<double>(last_silent_frame - first_silent_frame) / SAMPLE_RATE;
+    double expected_time = time_before_stall + 0.5 - silent_time;
+    double playback_time = engine.get_playback_time();
+    std::printf("playback time %.4f, expected %.4f\n", playback_time, expected_time);
+    KEE_CHECK(std::abs(playback_time - expected_time) < 0.01);
+
+    // once recovered it plays on without starving again
+    engine.render(samples.data(), SAMPLE_RATE);
+    engine.get_metrics(snapshot);
+    KEE_CHECK(snapshot.starvations[0] == 1);
+    KEE_CHECK(!is_silent(samples.data(), SAMPLE_RATE));
+    return kee_test::finish("music_stall_test");
+}
@@ -0,0 +1,128 @@
+#include "test_support.hpp"
+#include <thread>
+
+/* Floods a playing music player with seeks while it renders offline, after one seek that lands in the same batch
+ * as the player's music and play. Between two renders, bursts of seeks pile up and only the last one of each may
+ * read the music file. From a thread of its own, thousands of seeks a second are timed call by call, and every
+ * future they returned, superseded or not, has to be ready once they're drained.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+using kee_test::FRAME_FRAMES;
+constexpr std::size_t SONG_FRAMES = SAMPLE_RATE * 30;
+constexpr std::size_t BURST_SEEKS = 200;
+constexpr std::size_t FLOOD_FRAMES = SAMPLE_RATE * 3;
+constexpr double MIN_SEEKS_PER_SECOND = 1000.0;
+constexpr double MAX_P99_CALL_NS = 250000.0;
+
+std::uint64_t count_buffer_fills(const audio::engine& engine) {
+    audio::engine::metrics_snapshot snapshot;
+    engine.get_metrics(snapshot);
+    return snapshot.music_buffer_fill_time.count;
+}
+
+void check_seek_batched_with_play() {
+    // set_music is skipped for the seek behind it, so the play between them finds nothing queued
+    audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+    std::vector<std::int16_t> samples(FRAME_FRAMES * 2);
+    engine.set_player_music("song.wav");
+    engine.play_music_player();
+    engine.set_playback_time(5.0f);
+    engine.render(samples.data(), FRAME_FRAMES);
+    KEE_CHECK(engine.is_music_playing());
+    KEE_CHECK(std::abs(engine.get_playback_time() - 5.0) < 0.1);
+}
+
+void check_burst_io() {
+    audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+    std::vector<std::int16_t> samples(FRAME_FRAMES * 2);
+    engine.set_player_music("song.wav");
+    engine.play_music_player();
+    engine.render(samples.data(), FRAME_FRAMES);
+
+    // one seek's I/O is a refill of the whole queue, the frame rendered behind it may add a buffer of its own
+    std::uint64_t fills_before = count_buffer_fills(engine);
+    engine.set_playback_time(12.0f);
+    engine.render(samples.data(), FRAME_FRAMES);
+    std::uint64_t single_seek_fills = count_buffer_fills(engine) - fills_before;
+
+    std::uint64_t max_burst_fills = 0;
+    std::vector<std::future<void>> superseded;
+    for (std::size_t burst = 0; burst < 10; burst++) {
+        fills_before = count_buffer_fills(engine);
+        for (std::size_t seek = 0; seek < BURST_SEEKS; seek++) {
+            float time = static_cast<float>((burst * BURST_SEEKS + seek) % 2500) / 100.0f;
+            if (seek % 2 == 0)
+                engine.set_playback_time(time);
+            else
+                superseded.push_back(engine.set_playback_time_async(time));
+        }
+        std::future<void> last_seek = engine.set_playback_time_async(20.0f - burst);
+        engine.render(samples.data(), FRAME_FRAMES);
+        max_burst_fills = std::max(max_burst_fills, count_buffer_fills(engine) - fills_before);
+        KEE_CHECK(last_seek.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        KEE_CHECK(std::abs(engine.get_playback_time() - (20.0 - burst)) < 0.1);
+    }
+    std::printf("a burst of %zu seeks fills at most %llu buffers, a single seek %llu\n",
+        BURST_SEEKS + 1, static_cast<unsigned long long>(max_burst_fills), static_cast<unsigned long long>(single_seek_fills));
+    KEE_CHECK(max_burst_fills <= single_seek_fills + 1);
+    KEE_CHECK(std::all_of(superseded.begin(), superseded.end(), [](const std::future<void>& seek) { return seek.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }));
+}
+
+void check_seek_thread() {
+    audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+    std::vector<std::int16_t> samples(FRAME_FRAMES * 2);
+    engine.set_player_music("song.wav");
+    engine.play_music_player();
+
+    std::atomic_bool should_stop = false;
+    std::vector<double> call_ns;
+    std::vector<std::future<void>> seeks;
+    std::chrono::steady_clock::time_point seek_start = std::chrono::steady_clock::now();
+    std::thread seeker([&]() {
+        // a seek about every 50 us, every other one asks for a future
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> seek_time(0.0f, 25.0f);
+        while (!should_stop.load(std::memory_order_relaxed)) {
+            float time = seek_time(random);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (call_ns.size() % 2 == 0)
+                engine.set_playback_time(time);
+            else
+                seeks.push_back(engine.set_playback_time_async(time));
+            call_ns.push_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    });
+    for (std::size_t rendered_frames = 0; rendered_frames < FLOOD_FRAMES; rendered_frames += FRAME_FRAMES) {
+        engine.render(samples.data(), FRAME_FRAMES);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    should_stop.store(true, std::memory_order_relaxed);
+    seeker.join();
+    double seek_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - seek_start).count();
+    engine.render(samples.data(), FRAME_FRAMES);
+
+    std::sort(call_ns.begin(), call_ns.end());
+    double p99_ns = call_ns.empty() ? 0.0 : call_ns[std::min(call_ns.size() - 1, call_ns.size() * 99 / 100)];
+    double seeks_per_second = call_ns.size() / seek_seconds;
+    std::printf("%.0f seeks per second while rendering, p99 call %.1f us, max %.1f us\n", seeks_per_second, p99_ns / 1e3, call_ns.empty() ? 0.0 : call_ns.back() / 1e3);
+    KEE_CHECK(seeks_per_second >= MIN_SEEKS_PER_SECOND);
+    KEE_CHECK(p99_ns <= MAX_P99_CALL_NS);
+    KEE_CHECK(std::all_of(seeks.begin(), seeks.end(), [](const std::future<void>& seek) { return seek.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }));
+    KEE_CHECK(engine.is_music_playing());
+}
+
+} // namespace
+
+int main() {
+    kee_test::asset_directory assets("seek_flood");
+    assets.add_music("song.wav", kee_test::make_noise(SONG_FRAMES, 2, 1));
+
+    check_seek_batched_with_play();
+    check_burst_io();
+    check_seek_thread();
+    return kee_test::finish("seek_flood_test");
+}
@@ -0,0 +1,76 @@
+#include "test_support.hpp"
+
+/* Schedules clicks at known times on a silent song's clock and renders them offline. Every click has to start
+ * within a few samples of the frame its time falls on, whether it was scheduled before the song started or
+ * while it played.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+using kee_test::FRAME_FRAMES;
+constexpr std::size_t SONG_FRAMES = SAMPLE_RATE * 6;
+constexpr std::size_t CLICK_FRAMES = 64;
+constexpr std::int64_t MAX_ONSET_ERROR = 4;
+
+const std::array<double, 4> EARLY_TIMES = { 0.25, 0.5003, 1.1111, 1.75 };
+const std::array<double, 4> LATE_TIMES = { 3.0, 3.33337, 4.0001, 5.2 };
+
+std::vector<std::size_t> find_onsets(const std::vector<std::int16_t>& samples) {
+    // the song is silent, so an onset is the first loud frame after a quiet stretch longer than a click
+    std::vector<std::size_t> onsets;
+    std::size_t quiet_frames = CLICK_FRAMES;
+    for (std::size_t frame = 0; frame < samples.size() / 2; frame++) {
+        bool is_loud = std::abs(samples[frame * 2]) > 1000;
+        if (is_loud && quiet_frames >= CLICK_FRAMES)
+            onsets.push_back(frame);
+        quiet_frames = is_loud ? 0 : quiet_frames + 1;
+    }
+    return onsets;
+}
+
+void check_onsets(bool use_software_mixer) {
+    audio::engine::config config = kee_test::loopback_config(SAMPLE_RATE);
+    config.use_software_mixer = use_software_mixer;
+    audio::engine engine(config);
+    audio::engine::sfx_id click = engine.lookup_sfx("click.wav");
+    engine.set_player_music("silence.wav");
+    for (double time : EARLY_TIMES)
+        KEE_CHECK(static_cast<bool>(engine.schedule_sfx(click, time)));
+    engine.play_music_player();
+
+    std::vector<std::int16_t> samples(SONG_FRAMES * 2);
+    std::size_t rendered_frames = 0;
+    for (; rendered_frames + FRAME_FRAMES <= SONG_FRAMES; rendered_frames += FRAME_FRAMES) {
+        // the late clicks are scheduled a second ahead, the way a game schedules the notes coming up
+        for (double time : LATE_TIMES)
+            if (rendered_frames < (time - 1.0) * SAMPLE_RATE && rendered_frames + FRAME_FRAMES >= (time - 1.0) * SAMPLE_RATE)
+                KEE_CHECK(static_cast<bool>(engine.schedule_sfx(click, time)));
+        engine.render(samples.data() + rendered_frames * 2, FRAME_FRAMES);
+    }
+    samples.resize(rendered_frames * 2);
+
+    std::vector<double> times(EARLY_TIMES.begin(), EARLY_TIMES.end());
+    times.insert(times.end(), LATE_TIMES.begin(), LATE_TIMES.end());
+    std::vector<std::size_t> onsets = find_onsets(samples);
+    KEE_CHECK(onsets.size() == times.size());
+    std::int64_t max_error = 0;
+    for (std::size_t i = 0; i < std::min(onsets.size(), times.size()); i++) {
+        std::int64_t expected = std::llround(times[i] * SAMPLE_RATE);
+        max_error = std::max(max_error, std::abs(static_cast<std::int64_t>(onsets[i]) - expected));
+    }
+    std::printf("%s mixer: %zu onsets, off by at most %lld samples\n", use_software_mixer ? "software" : "source", onsets.size(), static_cast<long long>(max_error));
+    KEE_CHECK(max_error <= MAX_ONSET_ERROR);
+}
+
+} // namespace
+
+int main() {
+    kee_test::asset_directory assets("sfx_onset");
+    assets.add_sfx("click.wav", std::vector<std::int16_t>(CLICK_FRAMES, 20000));
+    assets.add_music("silence.wav", std::vector<std::int16_t>(SONG_FRAMES * 2 + SAMPLE_RATE * 2, 0));
+
+    check_onsets(false);
+    check_onsets(true);
+    return kee_test::finish("sfx_onset_test");
+}
@@ -0,0 +1,192 @@
+#include "test_support.hpp"
+#include <functional>
+
+/* Calls every public function of the engine from 8 threads at once, with and without the software mixer,
+ * against the engine's own thread. Built with ThreadSanitizer, any data race fails the run.
+ */
+
+namespace {
+
+constexpr int THREAD_COUNT = 8;
+constexpr std::chrono::milliseconds RUN_DURATION{1500};
+
+const std::array<const char*, 3> SFX_NAMES = { "click.wav", "tone.wav", "stereo.wav" };
+const std::array<const char*, 2> MUSIC_NAMES = { "first.wav", "second.wav" };
+
+// handles move between the threads the way a game would hand them over, published with release and acquire
+class shared_handles {
+public:
+    shared_handles() {
+        for (std::size_t slot = 0; slot < handles.size(); slot++)
+            store(slot, {});
+    }
+
+    void store(std::size_t slot, audio::engine::sfx_handle handle) {
+        handles[slot % handles.size()].store(static_cast<std::uint64_t>(handle.generation) << 32 | handle.index, std::memory_order_release);
+    }
+
+    audio::engine::sfx_handle load(std::size_t slot) const {
+        std::uint64_t packed = handles[slot % handles.size()].load(std::memory_order_acquire);
+        return { static_cast<std::uint32_t>(packed), static_cast<std::uint32_t>(packed >> 32) };
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, 64> handles {};
+};
+
+void hammer(audio::engine& engine, int thread_index, std::atomic_bool& should_stop, shared_handles& handles, std::atomic<std::size_t>& expected_rejections) {
+    std::mt19937 random(static_cast<std::uint32_t>(thread_index) * 7919u + 1);
+    const auto pick = [&random](std::size_t count) -> std::size_t {
+        return std::uniform_int_distribution<std::size_t>(0, count - 1)(random);
+    };
+    const auto unit = [&random]() -> float {
+        return std::uniform_real_distribution<float>(0.0f, 1.0f)(random);
+    };
+
+    const std::size_t player_count = engine.get_music_player_count();
+    const audio::engine::bus_id music_bus = engine.lookup_bus("music");
+    const audio::engine::bus_id hit_bus = engine.lookup_bus("hit");
+    const std::array<audio::engine::bus_id, 2> buses = { music_bus, hit_bus };
+    std::array<audio::engine::sfx_id, SFX_NAMES.size()> sfx_ids;
+    for (std::size_t i = 0; i < SFX_NAMES.size(); i++)
+        sfx_ids[i] = engine.lookup_sfx(SFX_NAMES[i]);
+    std::array<audio::engine::music_id, MUSIC_NAMES.size()> music_ids;
+    for (std::size_t i = 0; i < MUSIC_NAMES.size(); i++)
+        music_ids[i] = engine.lookup_music(audio::engine::asset_key(MUSIC_NAMES[i]));
+
+    std::vector<std::function<void()>> calls = {
+        [&]() { handles.store(pick(64), engine.play_sfx(sfx_ids[pick(sfx_ids.size())], unit(), unit() * 2.0f - 1.0f, buses[pick(2)])); },
+        [&]() { handles.store(pick(64), engine.play_sfx(SFX_NAMES[pick(SFX_NAMES.size())])); },
+        [&]() { handles.store(pick(64), engine.schedule_sfx(sfx_ids[pick(sfx_ids.size())], engine.get_audio_clock(0) + unit() * 0.2, pick(player_count))); },
+        [&]() { engine.set_sfx_gain(handles.load(pick(64)), unit()); },
+        [&]() { engine.set_sfx_pan(handles.load(pick(64)), unit() * 2.0f - 1.0f); },
+        [&]() { engine.set_sfx_pitch(handles.load(pick(64)), 0.5f + unit()); },
+        [&]() { engine.stop_sfx(handles.load(pick(64))); },
+        [&]() { engine.is_sfx_playing(handles.load(pick(64))); },
+        [&]() {
+            engine.begin_sfx_batch();
+            for (int i = 0; i < 4; i++)
+                handles.store(pick(64), engine.play_sfx(sfx_ids[pick(sfx_ids.size())]));
+            engine.end_sfx_batch();
+        },
+        [&]() { engine.pause_sfx_mixer(); engine.unpause_sfx_mixer(); },
+        [&]() { if (pick(16) == 0) engine.stop_sfx_mixer(); },
+        [&]() { engine.set_sfx_pool_policy(pick(2) == 0 ? audio::engine::sfx_pool_policy::steal_oldest : audio::engine::sfx_pool_policy::refuse); },
+        [&]() { engine.get_sfx_pool_stats(); },
+        [&]() { engine.preload_sfx({ SFX_NAMES[pick(SFX_NAMES.size())] }); },
+        [&]() { engine.prefetch_sfx({ SFX_NAMES[pick(SFX_NAMES.size())] }).wait(); },
+        [&]() { engine.set_sfx_memory_budget(pick(2) == 0 ? 4096 : 64 * 1024 * 1024); },
+        [&]() { engine.get_sfx_cache_stats(); },
+        [&]() { engine.set_player_music(music_ids[pick(music_ids.size())], pick(player_count)); },
+        [&]() { engine.set_player_music(MUSIC_NAMES[pick(MUSIC_NAMES.size())], pick(player_count)); },
+        [&]() { engine.set_player_music_async(music_ids[pick(music_ids.size())], pick(player_count)).wait(); },
+        [&]() { if (pick(4) == 0) engine.unset_player_music(pick(player_count)); },
+        [&]() { engine.queue_player_music(music_ids[pick(music_ids.size())], pick(player_count)); },
+        [&]() { engine.play_music_player(pick(player_count)); },
+        [&]() { engine.pause_music_player(pick(player_count)); },
+        [&]() {
+            std::size_t from_index = pick(player_count);
+            engine.crossfade_music_players(from_index, (from_index + 1) % player_count, 0.01f + unit() * 0.1f, pick(2) == 0 ? -1.0 : unit());
+        },
+        [&]() { engine.set_playback_time(unit() * 2.0f, pick(player_count)); },
+        [&]() { engine.set_playback_time_async(unit() * 2.0f, pick(player_count)).wait(); },
+        [&]() {
+            std::size_t index = pick(player_count);
+            engine.get_playback_time(index);
+            engine.get_audio_clock(index);
+            engine.is_music_playing(index);
+            engine.get_music_duration(music_ids[pick(music_ids.size())]);
+        },
+        [&]() { engine.set_player_tempo(0.5f + unit() * 1.5f, pick(player_count)); },
+        [&]() { engine.set_player_filter(static_cast<audio::engine::filter_type>(pick(4)), 200.0f + unit() * 8000.0f, 0.7f, pick(player_count)); },
+        [&]() { engine.set_player_reverb(unit(), unit(), unit(), pick(player_count)); },
+        [&]() { engine.set_bus_gain(buses[pick(2)], unit()); engine.get_bus_gain(buses[pick(2)]); },
+        [&]() { engine.pause_bus(buses[pick(2)]); engine.is_bus_paused(buses[pick(2)]); engine.unpause_bus(buses[pick(2)]); },
+        [&]() { engine.set_player_bus(buses[pick(2)], pick(player_count)); },
+        [&]() { engine.set_bus_filter(buses[pick(2)], static_cast<audio::engine::filter_type>(pick(4)), 200.0f + unit() * 8000.0f); },
+        [&]() { engine.set_bus_reverb(buses[pick(2)], unit(), unit(), unit()); },
+        [&]() {
+            std::array<audio::engine::waveform_peak, 32> peaks;
+            double start_time = unit();
+            engine.get_waveform(music_ids[pick(music_ids.size())], start_time, start_time + 0.5, peaks);
+        },
+        [&]() { engine.preload_waveforms({ MUSIC_NAMES[pick(MUSIC_NAMES.size())] }); },
+        [&]() { if (pick(8) == 0) engine.release_waveforms(); },
+        [&]() {
+            audio::engine::metrics_snapshot snapshot;
+            engine.get_metrics(snapshot);
+            audio::engine::metrics_to_json(snapshot);
+            if (pick(8) == 0)
+                engine.reset_metrics();
+        },
+        [&]() { engine.set_volume(0.1f + unit() * 0.2f); engine.get_volume(); },
+        [&]() { engine.lookup_sfx(SFX_NAMES[pick(SFX_NAMES.size())]); engine.lookup_music(MUSIC_NAMES[pick(MUSIC_NAMES.size())]); engine.get_mixer_simd_level(); }
+    };
+
+    while (!should_stop.load(std::memory_order_relaxed)) {
+        try {
+            calls[pick(calls.size())]();
+        }
+        catch (const std::out_of_range& exception) {
+            std::fprintf(stderr, "thread %d: unexpected std::out_of_range: %s\n", thread_index, exception.what());
+            KEE_CHECK(false);
+        }
+        catch (const std::logic_error&) {
+            // music calls on a player another thread just unset, bus effects without the software mixer
+            expected_rejections++;
+        }
+        catch (const std::exception& exception) {
+            std::fprintf(stderr, "thread %d: unexpected exception: %s\n", thread_index, exception.what());
+            KEE_CHECK(false);
+        }
+    }
+}
+
+void run(bool use_software_mixer) {
+    audio::engine::config config;
+    config.use_software_mixer = use_software_mixer;
+    config.music_buffer_size = 8192;
+    config.bus_names = { "music", "hit" };
+    audio::engine engine(config);
+    engine.set_player_music(MUSIC_NAMES[0], 0);
+    engine.play_music_player(0);
+
+    std::atomic_bool should_stop = false;
+    std::atomic<std::size_t> expected_rejections = 0;
+    shared_handles handles;
+    std::vector<std::thread> threads;
+    for (int thread_index = 0; thread_index < THREAD_COUNT; thread_index++)
+        threads.emplace_back(hammer, std::ref(engine), thread_index, std::ref(should_stop), std::ref(handles), std::ref(expected_rejections));
+    std::this_thread::sleep_for(RUN_DURATION);
+    should_stop = true;
+    for (std::thread& thread : threads)
+        thread.join();
+
+    // the engine still plays once the threads are done with it, unsetting drops crossfades still scheduled
+    for (std::size_t index = 0; index < engine.get_music_player_count(); index++)
+        engine.unset_player_music(index);
+    engine.unpause_sfx_mixer();
+    engine.set_sfx_pool_policy(audio::engine::sfx_pool_policy::steal_oldest);
+    engine.set_player_music_async(MUSIC_NAMES[1], 0).wait();
+    engine.set_player_tempo(1.0f, 0);
+    engine.play_music_player(0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    KEE_CHECK(engine.is_music_playing(0));
+    KEE_CHECK(static_cast<bool>(engine.play_sfx(SFX_NAMES[0])));
+    std::printf("%s mixer: %zu expected rejections\n", use_software_mixer ? "software" : "source", expected_rejections.load());
+}
+
+} // namespace
+
+int main() {
+    kee_test::asset_directory assets("stress");
+    assets.add_sfx("click.wav", kee_test::make_noise(480, 1, 1));
+    assets.add_sfx("tone.wav", kee_test::make_tone(9600, 1, kee_test::SAMPLE_RATE, 660.0));
+    assets.add_sfx("stereo.wav", kee_test::make_noise(4800, 2, 2), 2);
+    assets.add_music("first.wav", kee_test::make_tone(kee_test::SAMPLE_RATE * 3, 2, kee_test::SAMPLE_RATE, 220.0));
+    assets.add_music("second.wav", kee_test::make_noise(kee_test::SAMPLE_RATE * 3, 2, 3));
+
+    run(false);
+    run(true);
+    return kee_test::finish("stress_test");
+}
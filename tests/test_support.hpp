@@ -0,0 +1,243 @@
+#pragma once
+#include "kee_audio_engine.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <numbers>
+#include <random>
+
+namespace kee_test {
+
+inline int failures = 0;
+
+inline void check(bool condition, const char* expression, const char* file, int line) {
+    if (condition)
+        return;
+
+    std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    failures++;
+}
+
+#define KEE_CHECK(condition)\
+    kee_test::check((condition), #condition, __FILE__, __LINE__)
+
+inline int finish(const char* test_name) {
+    if (failures == 0)
+        std::printf("%s: passed\n", test_name);
+    else
+        std::printf("%s: %d checks failed\n", test_name, failures);
+    return failures == 0 ? 0 : 1;
+}
+
+inline void write_wav(const std::filesystem::path& wav_path, const std::vector<std::int16_t>& samples, int channels, int sample_rate) {
+    const auto write_u32 = [](std::ofstream& file, std::uint32_t value) {
+        file.write(reinterpret_cast<const char*>(&value), 4);
+    };
+    const auto write_u16 = [](std::ofstream& file, std::uint16_t value) {
+        file.write(reinterpret_cast<const char*>(&value), 2);
+    };
+
+    std::uint32_t data_size = static_cast<std::uint32_t>(samples.size() * sizeof(std::int16_t));
+    std::ofstream file(wav_path, std::ios::binary);
+    file.write("RIFF", 4);
+    write_u32(file, 36 + data_size);
+    file.write("WAVEfmt ", 8);
+    write_u32(file, 16);
+    write_u16(file, 1);
+    write_u16(file, static_cast<std::uint16_t>(channels));
+    write_u32(file, static_cast<std::uint32_t>(sample_rate));
+    write_u32(file, static_cast<std::uint32_t>(sample_rate * channels * 2));
+    write_u16(file, static_cast<std::uint16_t>(channels * 2));
+    write_u16(file, 16);
+    file.write("data", 4);
+    write_u32(file, data_size);
+    file.write(reinterpret_cast<const char*>(samples.data()), data_size);
+}
+
+inline void write_flac(const std::filesystem::path& flac_path, const std::vector<std::int16_t>& samples, int channels, int sample_rate) {
+    /* Every subframe is stored verbatim, so the file is bigger than the wav, but it's a valid FLAC stream any
+     * decoder reads back to the exact samples written, and the tests need no encoder.
+     */
+    constexpr std::size_t BLOCK_FRAMES = 4096;
+    const auto crc8 = [](const std::vector<std::uint8_t>& bytes) {
+        std::uint8_t crc = 0;
+        for (std::uint8_t byte : bytes) {
+            crc ^= byte;
+            for (int bit = 0; bit < 8; bit++)
+                crc = static_cast<std::uint8_t>((crc & 0x80) != 0 ? (crc << 1) ^ 0x07 : crc << 1);
+        }
+        return crc;
+    };
+    const auto crc16 = [](const std::vector<std::uint8_t>& bytes) {
+        std::uint16_t crc = 0;
+        for (std::uint8_t byte : bytes) {
+            crc ^= static_cast<std::uint16_t>(byte << 8);
+            for (int bit = 0; bit < 8; bit++)
+                crc = static_cast<std::uint16_t>((crc & 0x8000) != 0 ? (crc << 1) ^ 0x8005 : crc << 1);
+        }
+        return crc;
+    };
+    const auto put_be = [](std::vector<std::uint8_t>& bytes, std::uint64_t value, int byte_count) {
+        for (int i = byte_count - 1; i >= 0; i--)
+            bytes.push_back(static_cast<std::uint8_t>(value >> (i * 8)));
+    };
+
+    std::size_t frame_count = samples.size() / channels;
+    std::vector<std::uint8_t> bytes = { 'f', 'L', 'a', 'C', 0x80, 0, 0, 34 };
+    // STREAMINFO, the only metadata block: block sizes, unknown frame sizes, then rate, channels, bits and length packed in 64 bits
+    put_be(bytes, BLOCK_FRAMES, 2);
+    put_be(bytes, BLOCK_FRAMES, 2);
+    put_be(bytes, 0, 3);
+    put_be(bytes, 0, 3);
+    put_be(bytes, (static_cast<std::uint64_t>(sample_rate) << 44) | (static_cast<std::uint64_t>(channels - 1) << 41) | (15ull << 36) | frame_count, 8);
+    bytes.insert(bytes.end(), 16, 0);
+
+    for (std::size_t block = 0, start = 0; start < frame_count; block++, start += BLOCK_FRAMES) {
+        std::size_t block_frames = std::min(BLOCK_FRAMES, frame_count - start);
+        // the block size is in the header's 16 bit tail, the rate comes from STREAMINFO, 16 bit independent channels
+        std::vector<std::uint8_t> frame = { 0xFF, 0xF8, 0x70, static_cast<std::uint8_t>(((channels - 1) << 4) | 0x08) };
+        if (block < 0x80)
+            frame.push_back(static_cast<std::uint8_t>(block));
+        else if (block < 0x800) {
+            frame.push_back(static_cast<std::uint8_t>(0xC0 | (block >> 6)));
+            frame.push_back(static_cast<std::uint8_t>(0x80 | (block & 0x3F)));
+        }
+        else {
+            frame.push_back(static_cast<std::uint8_t>(0xE0 | (block >> 12)));
+            frame.push_back(static_cast<std::uint8_t>(0x80 | ((block >> 6) & 0x3F)));
+            frame.push_back(static_cast<std::uint8_t>(0x80 | (block & 0x3F)));
+        }
+        put_be(frame, block_frames - 1, 2);
+        frame.push_back(crc8(frame));
+        for (int channel = 0; channel < channels; channel++) {
+            frame.push_back(0x02);
+            for (std::size_t i = start; i < start + block_frames; i++)
+                put_be(frame, static_cast<std::uint16_t>(samples[i * channels + channel]), 2);
+        }
+        put_be(frame, crc16(frame), 2);
+        bytes.insert(bytes.end(), frame.begin(), frame.end());
+    }
+    std::ofstream(flac_path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+}
+
+inline std::vector<std::int16_t> make_tone(std::size_t frames, int channels, int sample_rate, double frequency, double amplitude = 8000.0) {
+    std::vector<std::int16_t> samples(frames * channels);
+    for (std::size_t frame = 0; frame < frames; frame++) {
+        double value = amplitude * std::sin(2.0 * std::numbers::pi * frequency * static_cast<double>(frame) / sample_rate);
+        for (int channel = 0; channel < channels; channel++)
+            samples[frame * channels + channel] = static_cast<std::int16_t>(std::lround(value));
+    }
+    return samples;
+}
+
+inline std::vector<std::int16_t> make_noise(std::size_t frames, int channels, std::uint32_t seed, std::int16_t amplitude = 12000) {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> distribution(-amplitude, amplitude);
+    std::vector<std::int16_t> samples(frames * channels);
+    for (std::int16_t& sample : samples)
+        sample = static_cast<std::int16_t>(distribution(random));
+    return samples;
+}
+
+constexpr int SAMPLE_RATE = 48000;
+constexpr std::size_t FRAME_FRAMES = 800;
+// one 60 fps game frame of audio, the block the tests render and poll at like a game would
+
+inline audio::engine::config loopback_config(int sample_rate = SAMPLE_RATE) {
+    audio::engine::config config;
+    config.use_loopback = true;
+    config.loopback_sample_rate = sample_rate;
+    return config;
+}
+
+class asset_directory {
+public:
+    explicit asset_directory(const std::string& test_name) :
+        root(std::filesystem::temp_directory_path() / ("kee_audio_" + test_name + "_" + std::to_string(std::random_device()()))),
+        previous_path(std::filesystem::current_path())
+    {
+        std::filesystem::create_directories(root / "assets" / "sfx");
+        std::filesystem::create_directories(root / "assets" / "music");
+        std::filesystem::current_path(root);
+    }
+
+    ~asset_directory() {
+        std::filesystem::current_path(previous_path);
+        std::error_code error;
+        std::filesystem::remove_all(root, error);
+    }
+
+    asset_directory(const asset_directory&) = delete;
+    asset_directory& operator=(const asset_directory&) = delete;
+
+    void add_sfx(const std::string& name, const std::vector<std::int16_t>& samples, int channels = 1, int sample_rate = SAMPLE_RATE) const {
+        write_wav(root / "assets" / "sfx" / name, samples, channels, sample_rate);
+    }
+
+    void add_music(const std::string& name, const std::vector<std::int16_t>& samples, int channels = 2, int sample_rate = SAMPLE_RATE) const {
+        // .flac names are written as FLAC, everything else as wav
+        if (std::filesystem::path(name).extension() == ".flac")
+            write_flac(root / "assets" / "music" / name, samples, channels, sample_rate);
+        else
+            write_wav(root / "assets" / "music" / name, samples, channels, sample_rate);
+    }
+
+    std::filesystem::path root;
+    std::filesystem::path previous_path;
+    // the engine finds its assets under the working directory, so the test runs inside root
+};
+
+} // namespace kee_test
+
+#ifdef KEE_AUDIO_ENABLE_TEST_HOOKS
+namespace audio {
+
+class test_access {
+public:
+    using mix_kernels = engine::mix_kernels;
+    using waveform = engine::waveform;
+    using music_t = engine::music_t;
+    static constexpr std::size_t REVERB_LINE_COUNT = engine::REVERB_LINE_COUNT;
+    static constexpr const char* WAVEFORM_DIRECTORY = engine::WAVEFORM_DIRECTORY;
+
+    static std::shared_ptr<const waveform> load_waveform(engine& audio_engine, engine::music_id id) {
+        return audio_engine.load_waveform(id);
+    }
+
+    static const music_t& get_music(const engine& audio_engine, engine::music_id id) {
+        return audio_engine.music_ids.at(id.index)->second;
+    }
+
+    static void post_unchecked_seek(engine& audio_engine, float time, std::size_t index, std::shared_ptr<std::promise<void>> completion) {
+        audio_engine.post_music_command({ engine::music_command::type::set_playback_time, index, nullptr, time, 0, 0.0, std::move(completion) });
+    }
+
+    static void post_unchecked_queue(engine& audio_engine, engine::music_id id, std::size_t index) {
+        audio_engine.post_music_command({ engine::music_command::type::queue_music, index, audio_engine.music_ids.at(id.index), 0.0f });
+    }
+    // post past the public api's check for music, the way a call racing another thread's unset_player_music lands
+
+    static bool is_codec_supported(const std::filesystem::path& music_path) {
+        return engine::music_decoder::is_supported(engine::music_decoder::get_codec(music_path));
+    }
+
+    static std::uint64_t get_upload_digest(const engine& audio_engine) {
+        return audio_engine.upload_digest;
+    }
+
+    static void stall_music_reads(engine& audio_engine, std::size_t index, std::chrono::steady_clock::duration duration) {
+        audio_engine.music_mixer[index].music_file.stall_reads(audio_engine.get_engine_time() + duration);
+    }
+
+    static void set_music_mapping_disabled(bool is_disabled) {
+        engine::music_stream::is_mapping_disabled.store(is_disabled, std::memory_order_relaxed);
+    }
+
+    static void set_resampling_disabled(bool is_disabled) {
+        engine::resampling_disabled.store(is_disabled, std::memory_order_relaxed);
+    }
+};
+
+} // namespace audio
+#endif
@@ -0,0 +1,118 @@
+#include "test_support.hpp"
+
+/* Builds the waveform of a minute of music and reads it at every zoom, then checks its cache: a waveform loaded
+ * back is the one saved, and a cache made from a file of another size or modified time is rebuilt.
+ */
+
+namespace {
+
+using kee_test::SAMPLE_RATE;
+constexpr std::size_t SONG_FRAMES = SAMPLE_RATE * 60;
+constexpr std::size_t MAX_BINS_PER_PEAK = 3;
+
+std::vector<std::int16_t> make_song(std::size_t frames) {
+    // noise swelling every second, so neighbouring bins differ
+    std::vector<std::int16_t> samples = kee_test::make_noise(frames, 2, 1);
+    for (std::size_t frame = 0; frame < frames; frame++) {
+        double swell = 0.25 + 0.75 * (frame % SAMPLE_RATE) / SAMPLE_RATE;
+        samples[frame * 2] = static_cast<std::int16_t>(samples[frame * 2] * swell);
+        samples[frame * 2 + 1] = static_cast<std::int16_t>(samples[frame * 2 + 1] * swell);
+    }
+    return samples;
+}
+
+bool is_equal(const audio::test_access::waveform& a, const audio::test_access::waveform& b) {
+    if (a.sample_rate != b.sample_rate || a.frame_count != b.frame_count || a.levels.size() != b.levels.size())
+        return false;
+    for (std::size_t level = 0; level < a.levels.size(); level++) {
+        if (a.levels[level].size() != b.levels[level].size())
+            return false;
+        if (std::memcmp(a.levels[level].data(), b.levels[level].data(), a.levels[level].size() * sizeof(a.levels[level][0])) != 0)
+            return false;
+    }
+    return true;
+}
+
+std::filesystem::path find_cache() {
+    std::vector<std::filesystem::path> caches;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(audio::test_access::WAVEFORM_DIRECTORY))
+        if (entry.path().extension() == ".keew")
+            caches.push_back(entry.path());
+    KEE_CHECK(caches.size() == 1);
+    return caches.empty() ? std::filesystem::path() : caches[0];
+}
+
+void check_range_queries(const audio::test_access::waveform& shape) {
+    // the bins merged follow the peaks asked for, not the length of the range
+    const std::array<std::pair<double, double>, 5> ranges = { { { 0.0, 60.0 }, { 0.0, 600.0 }, { 12.0, 13.0 }, { 30.0, 30.01 }, { 59.5, 61.0 } } };
+    std::size_t max_ratio_bins = 0;
+    for (std::size_t peak_count : { 1, 7, 100, 1000, 4096 }) {
+        std::vector<audio::engine::waveform_peak> peaks(peak_count);
+        for (const auto& [start_time, end_time] : ranges) {
+            std::size_t merged_bins = shape.read(start_time, end_time, peaks);
+            KEE_CHECK(merged_bins <= MAX_BINS_PER_PEAK * peak_count);
+            max_ratio_bins = std::max(max_ratio_bins, (merged_bins + peak_count - 1) / peak_count);
+        }
+    }
+    std::printf("range queries merge at most %zu bins per peak\n", max_ratio_bins);
+}
+
+void check_round_trip(audio::engine& engine, const audio::test_access::waveform& shape) {
+    audio::engine::music_id song = engine.lookup_music("song.wav");
+    const audio::test_access::music_t& music = audio::test_access::get_music(engine, song);
+    std::filesystem::path cache_path = find_cache();
+    std::uintmax_t source_size = std::filesystem::file_size(music.full_path);
+    std::int64_t source_time = std::filesystem::last_write_time(music.full_path).time_since_epoch().count();
+
+    audio::test_access::waveform loaded;
+    KEE_CHECK(loaded.load(cache_path, source_size, source_time, music));
+    KEE_CHECK(is_equal(loaded, shape));
+
+    // the cache only stands for the file it was made from
+    audio::test_access::waveform stale;
+    KEE_CHECK(!stale.load(cache_path, source_size + 2, source_time, music));
+    KEE_CHECK(!stale.load(cache_path, source_size, source_time + 1, music));
+}
+
+float read_max(audio::engine& engine, double start_time, double end_time) {
+    std::array<audio::engine::waveform_peak, 1> peak;
+    engine.get_waveform("song.wav", start_time, end_time, peak);
+    return peak[0].max;
+}
+
+} // namespace
+
+int main() {
+    kee_test::asset_directory assets("waveform");
+    assets.add_music("song.wav", make_song(SONG_FRAMES));
+    std::filesystem::path song_path = assets.root / "assets" / "music" / "song.wav";
+
+    {
+        audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+        std::shared_ptr<const audio::test_access::waveform> shape = audio::test_access::load_waveform(engine, engine.lookup_music("song.wav"));
+        KEE_CHECK(shape->frame_count == SONG_FRAMES);
+        check_range_queries(*shape);
+        check_round_trip(engine, *shape);
+        KEE_CHECK(read_max(engine, 10.0, 20.0) > 0.2f);
+    }
+
+    // silence of the same size, told apart from the cached song by its modified time alone
+    std::filesystem::file_time_type song_time = std::filesystem::last_write_time(song_path);
+    assets.add_music("song.wav", std::vector<std::int16_t>(SONG_FRAMES * 2, 0));
+    std::filesystem::last_write_time(song_path, song_time + std::chrono::seconds(2));
+    {
+        audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+        engine.prefetch_waveforms({ "song.wav" }).get();
+        KEE_CHECK(read_max(engine, 10.0, 20.0) == 0.0f);
+    }
+
+    // a shorter song changes the size, its waveform ends where it does
+    assets.add_music("song.wav", make_song(SONG_FRAMES / 2));
+    {
+        audio::engine engine(kee_test::loopback_config(SAMPLE_RATE));
+        KEE_CHECK(audio::test_access::load_waveform(engine, engine.lookup_music("song.wav"))->frame_count == SONG_FRAMES / 2);
+        KEE_CHECK(read_max(engine, 10.0, 20.0) > 0.2f);
+        KEE_CHECK(read_max(engine, 40.0, 50.0) == 0.0f);
+    }
+    return kee_test::finish("waveform_test");
+}